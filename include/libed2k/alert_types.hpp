@@ -7,11 +7,13 @@
 #include "libed2k/error_code.hpp"
 #include "libed2k/packet_struct.hpp"
 #include "libed2k/kademlia/kad_packet_struct.hpp"
+#include "libed2k/search_aggregator.hpp"
 #include "libed2k/transfer_handle.hpp"
 #include "libed2k/socket_io.hpp"
 #include "libed2k/entry.hpp"
 #include "libed2k/add_transfer_params.hpp"
 #include <boost/lexical_cast.hpp>
+#include <boost/shared_ptr.hpp>
 
 namespace libed2k
 {
@@ -182,13 +184,20 @@ namespace libed2k
     };
 
     /**
-      * this alert throws on server search results and on user shared files
+      * this alert throws on server search results and on user shared files.
+      * The list is shared by all copies of the alert and never changes
      */
     struct shared_files_alert : peer_alert
     {
         const static int static_category = alert::server_notification | alert::peer_notification;
+        typedef boost::shared_ptr<const shared_files_list> files_ptr;
 
         shared_files_alert(const net_identifier& np, const md4_hash& hash, const shared_files_list& files, bool more) :
+            peer_alert(np, hash),
+            m_files(new shared_files_list(files)),
+            m_more(more){}
+
+        shared_files_alert(const net_identifier& np, const md4_hash& hash, files_ptr files, bool more) :
             peer_alert(np, hash),
             m_files(files),
             m_more(more){}
@@ -202,7 +211,7 @@ namespace libed2k
             return (std::auto_ptr<alert>(new shared_files_alert(*this)));
         }
 
-        shared_files_list       m_files;
+        files_ptr               m_files;
         bool                    m_more;
     };
 
@@ -242,7 +251,7 @@ namespace libed2k
         shared_directory_files_alert(const net_identifier& np,
                 const md4_hash& hash,
                 const std::string& strDirectory,
-                const shared_files_list& files) :
+                files_ptr files) :
             shared_files_alert(np, hash, files, false), m_strDirectory(strDirectory)
         {
         }
@@ -267,7 +276,7 @@ namespace libed2k
         ismod_shared_directory_files_alert(const net_identifier& np,
                 const md4_hash& hash,
                 const md4_hash& dir_hash,
-                const shared_files_list& files) :
+                files_ptr files) :
             shared_files_alert(np, hash, files, false), m_dir_hash(dir_hash)
         {
         }
@@ -408,6 +417,32 @@ namespace libed2k
         transfer_handle m_handle;
     };
 
+    /**
+      * result of session::add_transfers(), handles and errors have the same
+      * order as parameters, handle is invalid when the error is set
+     */
+    struct added_transfers_alert : alert
+    {
+        const static int static_category = alert::status_notification;
+
+        added_transfers_alert(const std::vector<transfer_handle>& handles,
+                              const std::vector<error_code>& errors) :
+            m_handles(handles), m_errors(errors) {}
+
+        virtual int category() const { return static_category; }
+
+        virtual std::auto_ptr<alert> clone() const
+        {
+            return std::auto_ptr<alert>(new added_transfers_alert(*this));
+        }
+
+        virtual std::string message() const { return std::string("added transfers"); }
+        virtual char const* what() const { return "added transfers"; }
+
+        std::vector<transfer_handle> m_handles;
+        std::vector<error_code> m_errors;
+    };
+
     struct paused_transfer_alert : alert
     {
         const static int static_category = alert::status_notification;
@@ -446,6 +481,51 @@ namespace libed2k
         transfer_handle m_handle;
     };
 
+    /**
+      * idle seed was replaced by its compact dormant record, see
+      * session_settings::dormant_seed_timeout. The handle stays valid
+     */
+    struct dormant_transfer_alert : alert
+    {
+        const static int static_category = alert::status_notification;
+
+        dormant_transfer_alert(const transfer_handle& h) : m_handle(h) {}
+
+        virtual int category() const { return static_category; }
+
+        virtual std::auto_ptr<alert> clone() const
+        {
+            return std::auto_ptr<alert>(new dormant_transfer_alert(*this));
+        }
+
+        virtual std::string message() const { return std::string("dormant transfer"); }
+        virtual char const* what() const { return "dormant transfer"; }
+
+        transfer_handle m_handle;
+    };
+
+    /**
+      * dormant transfer was restored because a peer or a handle asked for it
+     */
+    struct woke_transfer_alert : alert
+    {
+        const static int static_category = alert::status_notification;
+
+        woke_transfer_alert(const transfer_handle& h) : m_handle(h) {}
+
+        virtual int category() const { return static_category; }
+
+        virtual std::auto_ptr<alert> clone() const
+        {
+            return std::auto_ptr<alert>(new woke_transfer_alert(*this));
+        }
+
+        virtual std::string message() const { return std::string("woke transfer"); }
+        virtual char const* what() const { return "woke transfer"; }
+
+        transfer_handle m_handle;
+    };
+
     struct deleted_transfer_alert : alert
     {
         const static int static_category = alert::status_notification;
@@ -796,6 +876,30 @@ namespace libed2k
         }
     };
 
+    /**
+      * block was received completely, latency is time from block request to last byte received
+     */
+    struct block_finished_alert: transfer_alert
+    {
+        block_finished_alert(transfer_handle const& h, int piece, int block, time_duration const& lat)
+            : transfer_alert(h), piece_index(piece), block_index(block), latency(lat)
+        {}
+
+        int piece_index;
+        int block_index;
+        time_duration latency;
+
+        virtual std::auto_ptr<alert> clone() const
+        { return std::auto_ptr<alert>(new block_finished_alert(*this)); }
+        virtual char const* what() const { return "block finished"; }
+        const static int static_category = alert::progress_notification;
+        virtual int category() const { return static_category; }
+        virtual std::string message() const
+        {
+            return transfer_alert::message() + " block finished";
+        }
+    };
+
     struct transfer_params_alert : alert
     {
         const static int static_category = alert::status_notification;
@@ -1030,9 +1134,10 @@ namespace libed2k
     };
 
     struct dht_keyword_search_result_alert : alert {
+        typedef boost::shared_ptr<const std::deque<kad_info_entry> > entries_ptr;
 
         dht_keyword_search_result_alert(const md4_hash& h, const std::deque<kad_info_entry>& entries)
-            : m_hash(h), m_entries(entries)
+            : m_hash(h), m_entries(new std::deque<kad_info_entry>(entries))
         {}
 
         virtual std::auto_ptr<alert> clone() const {
@@ -1050,7 +1155,43 @@ namespace libed2k
         }
 
         md4_hash    m_hash;
-        std::deque<kad_info_entry>  m_entries;
+        // shared by all copies of the alert
+        entries_ptr m_entries;
+    };
+
+    /**
+      * files of the current search which are new or changed since the previous
+      * alert, merged over the server and kad answers
+     */
+    struct search_result_alert : alert
+    {
+        const static int static_category = alert::server_notification;
+        typedef boost::shared_ptr<const std::vector<search_result_entry> > files_ptr;
+
+        search_result_alert(files_ptr files, bool more, int total)
+            : m_files(files), m_more(more), m_total(total)
+        {}
+
+        virtual std::auto_ptr<alert> clone() const
+        {
+            return std::auto_ptr<alert>(new search_result_alert(*this));
+        }
+
+        virtual char const* what() const { return "search result"; }
+        virtual int category() const { return static_category; }
+
+        virtual std::string message() const
+        {
+            return "search result: " + boost::lexical_cast<std::string>(m_files->size())
+                + " changed of " + boost::lexical_cast<std::string>(m_total);
+        }
+
+        // shared by all copies of the alert
+        files_ptr                           m_files;
+        // the server has more results, ask them with post_search_more_result_request
+        bool                                m_more;
+        // the number of different files found so far
+        int                                 m_total;
     };
 }
 
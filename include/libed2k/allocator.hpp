@@ -35,12 +35,55 @@ POSSIBILITY OF SUCH DAMAGE.
 
 #include <cstddef>
 #include <libed2k/config.hpp>
+#include <libed2k/size_type.hpp>
 
 namespace libed2k
 {
 
     LIBED2K_EXTRA_EXPORT int page_size();
 
+    // allocation statistics of a slab_allocator
+    struct slab_allocator_stats
+    {
+        slab_allocator_stats()
+            : slabs(0)
+            , huge_page_slabs(0)
+            , reserved_bytes(0)
+            , in_use(0)
+            , allocations(0)
+            , cache_hits(0)
+            , refills(0)
+        {}
+
+        slab_allocator_stats& operator+=(const slab_allocator_stats& s)
+        {
+            slabs += s.slabs;
+            huge_page_slabs += s.huge_page_slabs;
+            reserved_bytes += s.reserved_bytes;
+            in_use += s.in_use;
+            allocations += s.allocations;
+            cache_hits += s.cache_hits;
+            refills += s.refills;
+            return *this;
+        }
+
+        // slabs taken from the system and how many of them
+        // are backed by huge pages
+        int slabs;
+        int huge_page_slabs;
+        // the number of bytes in all slabs
+        size_type reserved_bytes;
+        // the number of objects handed out and not freed yet
+        int in_use;
+        // total allocations and allocations served by the
+        // thread local cache of the calling thread without locking
+        size_type allocations;
+        size_type cache_hits;
+        // the number of times thread local caches exchanged
+        // objects with the shared free list
+        size_type refills;
+    };
+
     struct LIBED2K_EXTRA_EXPORT page_aligned_allocator
     {
         typedef std::size_t size_type;
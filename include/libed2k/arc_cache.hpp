@@ -0,0 +1,76 @@
+#ifndef __LIBED2K_ARC_CACHE__
+#define __LIBED2K_ARC_CACHE__
+
+#include <list>
+#include <map>
+#include <utility>
+
+namespace libed2k
+{
+    /**
+      * adaptive replacement cache (Megiddo, Modha) bookkeeping for cached pieces.
+      * resident pieces are kept by the cache itself in two lists: recent (served
+      * once) and frequent (served again). This class remembers pieces recently
+      * evicted from each list (ghosts) and adapts the target size of the recent
+      * list on ghost hits. Sizes are in blocks, each ghost list is bounded by
+      * the cache capacity
+     */
+    class arc_policy
+    {
+    public:
+        typedef std::pair<void*, int> key_type;     //!< storage and piece
+        enum list_t { none, recent, frequent };
+
+        arc_policy();
+
+        /** cache size in blocks, ghost lists are trimmed to it */
+        void set_capacity(int blocks);
+        int capacity() const { return m_capacity; }
+
+        /** target size of the recent list in blocks */
+        int target() const { return m_target; }
+
+        /**
+          * piece which isn't cached was requested. Returns the ghost list it was
+          * found in, the piece is forgotten and the target adapted. When the result
+          * is not none the piece goes to the frequent list
+         */
+        list_t miss(const key_type& key);
+
+        /** piece of the given size was evicted from the resident list */
+        void evicted(const key_type& key, int blocks, list_t from);
+
+        /** resident list to evict from */
+        list_t replace(int recent_blocks, int frequent_blocks) const;
+
+        /** forget ghosts of the storage, it can be freed and the address reused */
+        void forget(void* storage);
+        void clear();
+
+        int ghost_size(list_t l) const;
+        size_t ghost_pieces(list_t l) const;
+
+    private:
+        struct ghost_list
+        {
+            typedef std::list<std::pair<key_type, int> > order_t;
+            typedef std::map<key_type, order_t::iterator> index_t;
+
+            ghost_list() : blocks(0) {}
+            void push(const key_type& key, int size);
+            void erase(index_t::iterator i);
+            void trim(int capacity);
+            void clear();
+
+            order_t order;      // oldest first
+            index_t index;
+            int blocks;
+        };
+
+        ghost_list m_ghosts[2];
+        int m_capacity;
+        int m_target;
+    };
+}
+
+#endif
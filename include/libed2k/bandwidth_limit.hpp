@@ -64,12 +64,11 @@ struct LIBED2K_EXTRA_EXPORT bandwidth_channel
     void return_quota(int amount);
     void use_quota(int amount);
 
-    // used as temporary storage while distributing
-    // bandwidth
-    int tmp;
-
-    // this is the number of bytes to distribute this round
-    int distribute_quota;
+    // the number of queued bandwidth requests limited by
+    // this channel, and its index in the bandwidth manager's
+    // list of channels to refill while there are any
+    int queued;
+    int queue_slot;
 
 private:
 
@@ -51,34 +51,40 @@ struct LIBED2K_EXTRA_EXPORT bandwidth_manager
     void close();
 
 #if defined LIBED2K_DEBUG || LIBED2K_RELEASE_ASSERTS
-    bool is_queued(const peer_connection* peer) const;
+    bool is_queued(const bandwidth_socket* peer) const;
 #endif
 
     int queue_size() const;
     int queued_bytes() const;
-    
-    // non prioritized means that, if there's a line for bandwidth,
-    // others will cut in front of the non-prioritized peers.
-    // this is used by web seeds
+
     // returns the number of bytes to assign to the peer, or 0
-    // if the peer's 'assign_bandwidth' callback will be called later
-    int request_bandwidth(const intrusive_ptr<peer_connection>& peer
+    // if the peer's 'assign_bandwidth' callback will be called later.
+    // The peer is limited by all throttled channels in chan, a higher
+    // priority gives it a larger share of them. Requests taking from
+    // the guarantee bucket while it has quota are served first. The
+    // guarantee is refilled every tick from then on, so it must live
+    // as long as the manager
+    int request_bandwidth(const intrusive_ptr<bandwidth_socket>& peer
         , int blk, int priority
-        , bandwidth_channel* chan1 = 0
-        , bandwidth_channel* chan2 = 0
-        , bandwidth_channel* chan3 = 0
-        , bandwidth_channel* chan4 = 0
-        , bandwidth_channel* chan5 = 0);
+        , bandwidth_channel** chan, int num_channels
+        , bandwidth_channel* guarantee = 0);
 
 #ifdef LIBED2K_DEBUG
     void check_invariant() const;
 #endif
 
+    // refills the channels with waiting requests and the guarantees,
+    // and serves the requests in order until the channels they wait
+    // for run out. A request blocked by a channel waits aside until
+    // that channel is refilled, so a round costs log(n) per request
+    // served or put aside, not per waiting request
     void update_quotas(time_duration const& dt);
 
-    // these are the consumers that want bandwidth
+    // these are the consumers that want bandwidth, a heap
+    // with the next request to serve in front
     typedef std::vector<bw_request> queue_t;
     queue_t m_queue;
+
     // the number of bytes all the requests in queue are for
     int m_queued_bytes;
 
@@ -87,6 +93,31 @@ struct LIBED2K_EXTRA_EXPORT bandwidth_manager
     int m_channel;
 
     bool m_abort;
+
+private:
+
+    void enqueue(bw_request& r);
+    void dequeue(bw_request& r);
+
+    void add_channel(bandwidth_channel* c);
+    void remove_channel(bandwidth_channel* c);
+
+    // the throttled channels of the queued requests, refilled
+    // every round. Their queue_slot is their index here
+    std::vector<bandwidth_channel*> m_channels;
+
+    // requests blocked by the channel of the same index, they go
+    // back to m_queue once the channel has quota again
+    std::vector<queue_t> m_blocked;
+    int m_num_blocked;
+
+    // every guarantee seen by request_bandwidth. They fill up while
+    // nothing is queued, so the minimum rate holds after idle periods
+    std::vector<bandwidth_channel*> m_guarantees;
+
+    // finish time of the last served request
+    double m_virtual_time;
+    boost::uint64_t m_sequence;
 };
 
 }
@@ -34,36 +34,48 @@ POSSIBILITY OF SUCH DAMAGE.
 #define LIBED2K_BANDWIDTH_QUEUE_ENTRY_HPP_INCLUDED
 
 #include <boost/intrusive_ptr.hpp>
+#include <boost/cstdint.hpp>
 #include "libed2k/bandwidth_limit.hpp"
+#include "libed2k/bandwidth_socket.hpp"
 
 namespace libed2k {
 
-class peer_connection;
-
 struct LIBED2K_EXTRA_EXPORT bw_request
 {
-    bw_request(boost::intrusive_ptr<peer_connection> const& pe
+    enum { max_channels = 10 };
+
+    bw_request(boost::intrusive_ptr<bandwidth_socket> const& pe
         , int blk, int prio);
 
-    boost::intrusive_ptr<peer_connection> peer;
-    // 1 is normal prio
+    boost::intrusive_ptr<bandwidth_socket> peer;
+    // 1 is normal prio, it includes the weight of the peer class
     int priority;
-    // the number of bytes assigned to this request so far
-    int assigned;
-    // once assigned reaches this, we dispatch the request function
+    // the number of bytes the peer asked for
     int request_size;
 
-    // the max number of rounds for this request to survive
-    // this ensures that requests gets responses at very low
-    // rate limits, when the requested size would take a long
-    // time to satisfy
-    int ttl;
+    // requests are served in order of their virtual finish time,
+    // the virtual time of the queue plus request_size / priority.
+    // Requests of the same finish time are served by arrival
+    double finish;
+    boost::uint64_t sequence;
+
+    // served before all other requests, the minimum rate
+    // of the peer class wasn't used up when it was queued
+    bool guaranteed;
+
+    // the number of bytes all limiting channels can hand out now,
+    // up to request_size. If it's 0 blocking is set to the channel
+    // without quota
+    int quota_left(bandwidth_channel*& blocking) const;
+
+    // takes the bytes from all channels and the guarantee
+    void use_quota(int amount);
 
-    // loops over the bandwidth channels and assigns bandwidth
-    // from the most limiting one
-    int assign_bandwidth();
+    bandwidth_channel* channel[max_channels];
+    int num_channels;
 
-    bandwidth_channel* channel[5];
+    // the minimum rate bucket of the peer class, it doesn't limit
+    bandwidth_channel* guarantee;
 };
 
 }
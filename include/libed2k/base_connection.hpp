@@ -24,6 +24,8 @@
 #include "libed2k/packet_struct.hpp"
 #include "libed2k/deadline_timer.hpp"
 #include "libed2k/bandwidth_limit.hpp"
+#include "libed2k/bandwidth_socket.hpp"
+#include "libed2k/inflater.hpp"
 
 namespace libed2k{
 
@@ -33,7 +35,7 @@ namespace libed2k{
 
 
 
-    class base_connection: public intrusive_ptr_base<base_connection>,
+    class base_connection: public bandwidth_socket,
                            public boost::noncopyable
     {
         friend class aux::session_impl;
@@ -78,9 +80,9 @@ namespace libed2k{
 
         void copy_send_buffer(const char* buf, int size);
 
-        template <class Destructor>
-        void append_send_buffer(char* buffer, int size, Destructor const& destructor)
-        { m_send_buffer.append_buffer(buffer, size, size, destructor); }
+        // appends the whole buffer, it's returned to the session pool
+        // of the given type (session_impl::buffer_pool_t) when sent
+        void append_send_buffer(char* buffer, int size, int pool);
 
         int send_buffer_size() const { return m_send_buffer.size(); }
         int send_buffer_capacity() const { return m_send_buffer.capacity(); }
@@ -120,7 +122,7 @@ namespace libed2k{
                 if (!m_in_container.empty())
                 {
                     boost::iostreams::stream_buffer<base_connection::Device> buffer(
-                        &m_in_container[0], m_in_header.m_size - 1);
+                        &m_in_container[0], m_in_container.size());
                     std::istream in_array_stream(&buffer);
                     archive::ed2k_iarchive ia(in_array_stream);
                     ia >> t;
@@ -135,6 +137,9 @@ namespace libed2k{
             return (true);
         }
 
+        boost::intrusive_ptr<base_connection> self()
+        { return boost::intrusive_ptr<base_connection>(this); }
+
         template <typename Self>
         boost::intrusive_ptr<Self> self_as()
         { return boost::intrusive_ptr<Self>((Self*)this); }
@@ -161,6 +166,7 @@ namespace libed2k{
         libed2k_header m_in_header;    //!< incoming message header
         socket_buffer m_in_container; //!< buffer for incoming messages
         socket_buffer m_in_gzip_container; //!< buffer for compressed data
+        inflater m_inflater; //!< decompressor of packed packets
         chained_buffer m_send_buffer;  //!< buffer for outgoing messages
         tcp::endpoint m_remote;
 
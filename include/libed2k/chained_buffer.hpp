@@ -35,14 +35,13 @@ POSSIBILITY OF SUCH DAMAGE.
 
 #include "libed2k/config.hpp"
 
-#include <boost/function/function1.hpp>
 #include <boost/version.hpp>
 #if BOOST_VERSION < 103500
 #include <asio/buffer.hpp>
 #else
 #include <boost/asio/buffer.hpp>
 #endif
-#include <list>
+#include <vector>
 #include <string.h> // for memcpy
 
 namespace libed2k
@@ -50,9 +49,19 @@ namespace libed2k
 #if BOOST_VERSION >= 103500
 	namespace asio = boost::asio;
 #endif
+
+	// returns buffers appended to a chained_buffer to the pool they
+	// were allocated from, once they are sent. type identifies the pool
+	struct LIBED2K_EXTRA_EXPORT buffer_releaser
+	{
+		virtual void release_buffer(int type, char* buf, int size) = 0;
+	protected:
+		~buffer_releaser() {}
+	};
+
 	struct LIBED2K_EXTRA_EXPORT chained_buffer
 	{
-		chained_buffer(): m_bytes(0), m_capacity(0)
+		chained_buffer(): m_head(0), m_count(0), m_bytes(0), m_capacity(0)
 		{
 #if defined LIBED2K_DEBUG || LIBED2K_RELEASE_ASSERTS
 			m_destructed = false;
@@ -61,7 +70,8 @@ namespace libed2k
 
 		struct buffer_t
 		{
-			boost::function<void(char*)> free; // destructs the buffer
+			buffer_releaser* releaser; // returns the buffer to its pool
+			int type; // the pool, passed to releaser
 			char* buf; // the first byte of the buffer
 			int size; // the total size of the buffer
 
@@ -69,6 +79,22 @@ namespace libed2k
 			int used_size; // this is the number of bytes to send/receive
 		};
 
+		// the buffers of one write, kept inline so building them
+		// doesn't allocate. Models the asio ConstBufferSequence
+		struct iovec_t
+		{
+			enum { max_buffers = 16 };
+			typedef asio::const_buffer value_type;
+			typedef asio::const_buffer const* const_iterator;
+
+			iovec_t(): num_buffers(0) {}
+			const_iterator begin() const { return bufs; }
+			const_iterator end() const { return bufs + num_buffers; }
+
+			asio::const_buffer bufs[max_buffers];
+			int num_buffers;
+		};
+
 		bool empty() const { return m_bytes == 0; }
 		int size() const { return m_bytes; }
 		int capacity() const { return m_capacity; }
@@ -76,7 +102,7 @@ namespace libed2k
 		void pop_front(int bytes_to_pop);
 
 		void append_buffer(char* buffer, int s, int used_size
-			, boost::function<void(char*)> const& destructor);
+			, buffer_releaser* releaser, int type);
 
 		// returns the number of bytes available at the
 		// end of the last chained buffer.
@@ -92,15 +118,23 @@ namespace libed2k
 		// enough room, returns 0
 		char* allocate_appendix(int s);
 
-		std::list<asio::const_buffer> const& build_iovec(int to_send);
+		// the first to_send bytes, or the bytes of the first
+		// iovec_t::max_buffers buffers if that's less
+		iovec_t const& build_iovec(int to_send);
 
 		~chained_buffer();
 
 	private:
 
-		// this is the list of all the buffers we want to
-		// send
-		std::list<buffer_t> m_vec;
+		buffer_t& at(int i) { return m_vec[(m_head + i) & (m_vec.size() - 1)]; }
+		void grow();
+
+		// ring of the buffers we want to send. The size is a power
+		// of two, it grows when full and never shrinks. m_count
+		// buffers starting at m_head are used
+		std::vector<buffer_t> m_vec;
+		int m_head;
+		int m_count;
 
 		// this is the number of bytes in the send buf.
 		// this will always be equal to the sum of the
@@ -113,7 +147,7 @@ namespace libed2k
 
 		// this is the vector of buffers used when
 		// invoking the async write call
-		std::list<asio::const_buffer> m_tmp_vec;
+		iovec_t m_tmp_vec;
 
 #if defined LIBED2K_DEBUG || LIBED2K_RELEASE_ASSERTS
 		bool m_destructed;
@@ -0,0 +1,101 @@
+#ifndef __LIBED2K_CLIENT_CREDITS__
+#define __LIBED2K_CLIENT_CREDITS__
+
+#include <map>
+#include <string>
+#include <vector>
+#include <ctime>
+#include <boost/cstdint.hpp>
+
+#include "libed2k/config.hpp"
+#include "libed2k/error_code.hpp"
+#include "libed2k/hasher.hpp"
+
+namespace libed2k
+{
+    /**
+      * what we exchanged with a peer over all sessions, the clients.met record
+     */
+    struct LIBED2K_EXPORT client_credit
+    {
+        enum { max_key_size = 80 };
+
+        client_credit() : m_uploaded(0), m_downloaded(0), m_last_seen(0) {}
+
+        /**
+          * eMule credit modifier of the peer's upload queue score, 1 - 10.
+          * Peers gave us less than 1MB are all at 1
+         */
+        float score_ratio() const;
+
+        // payload bytes we sent to the peer and got from it
+        boost::uint64_t m_uploaded;
+        boost::uint64_t m_downloaded;
+        boost::uint32_t m_last_seen;
+
+        // public key of the peer for the secure identification,
+        // empty until it is verified once
+        std::string m_secure_ident;
+    };
+
+    /**
+      * credits of all known peers keyed by user hash. The file is read on the
+      * first lookup, but records are only parsed when their peer shows up,
+      * until then they are kept as raw bytes behind the hash index
+     */
+    class LIBED2K_EXPORT client_credits
+    {
+    public:
+        // eMule drops peers which didn't show up for 150 days
+        enum { expire_seconds = 150 * 24 * 60 * 60 };
+        enum { record_size = 16 + 5 * 4 + 2 + 1 + client_credit::max_key_size };
+
+        /** empty path keeps the credits in memory only */
+        explicit client_credits(const std::string& path = std::string());
+
+        /** the credit of the peer or null when we never exchanged data */
+        client_credit* find(const md4_hash& hash);
+
+        /** creates the record on first contact and updates its last seen time */
+        client_credit& get(const md4_hash& hash);
+
+        void add_uploaded(client_credit& c, boost::uint64_t bytes);
+        void add_downloaded(client_credit& c, boost::uint64_t bytes);
+
+        /** writes all records when something changed since the last save */
+        void save(error_code& ec);
+
+        /**
+          * the file contents for a save on another thread, false when nothing
+          * changed. Call save_failed() when the write didn't succeed
+         */
+        bool save_buffer(std::vector<char>& buf);
+        void save_failed() { m_dirty = true; }
+
+        /** reads the header and builds the index, called by the first lookup */
+        void load(error_code& ec);
+
+        bool dirty() const { return m_dirty; }
+        const std::string& path() const { return m_path; }
+        size_t size() const { return m_entries.size() + m_index.size(); }
+
+    private:
+        void ensure_loaded();
+        void parse(const char* rec, client_credit& c) const;
+        void write(const md4_hash& hash, const client_credit& c, char* rec) const;
+
+        std::string m_path;
+
+        // parsed records, never erased so peers may keep pointers to them
+        std::map<md4_hash, client_credit> m_entries;
+
+        // offsets of not yet parsed records in m_raw
+        std::map<md4_hash, size_t> m_index;
+        std::vector<char> m_raw;
+
+        bool m_loaded;
+        bool m_dirty;
+    };
+}
+
+#endif
@@ -206,6 +206,10 @@ POSSIBILITY OF SUCH DAMAGE.
 
 #if !defined __ANDROID__
   #define LIBED2K_USE_IFADDRS 1
+  // recvmmsg() and sendmmsg()
+  #define LIBED2K_USE_MMSG 1
+  // sendfile() to sockets
+  #define LIBED2K_USE_SENDFILE 1
 #endif
 
 #define LIBED2K_USE_NETLINK 1
@@ -420,6 +424,14 @@ namespace libed2k
 #define LIBED2K_USE_IFADDRS 0
 #endif
 
+#ifndef LIBED2K_USE_MMSG
+#define LIBED2K_USE_MMSG 0
+#endif
+
+#ifndef LIBED2K_USE_SENDFILE
+#define LIBED2K_USE_SENDFILE 0
+#endif
+
 #ifndef LIBED2K_USE_IPV6
 #define LIBED2K_USE_IPV6 0
 #endif
@@ -51,6 +51,12 @@ POSSIBILITY OF SUCH DAMAGE.
 namespace libed2k
 {
 
+// connection attempts per second for the next second: ramp up while peers
+// answer and there are free half-open slots, back off when half-open queue
+// is full or most of the attempts time out
+LIBED2K_EXTRA_EXPORT int adapt_connect_rate(int rate, int successes, int failures
+	, int timeouts, int free_slots, int max_rate);
+
 class LIBED2K_EXTRA_EXPORT connection_queue : public boost::noncopyable
 {
 public:
@@ -39,8 +39,11 @@ POSSIBILITY OF SUCH DAMAGE.
 #include <libed2k/session_settings.hpp>
 #include <libed2k/allocator.hpp>
 
+#include <boost/noncopyable.hpp>
+#include <boost/detail/atomic_count.hpp>
+
 #ifndef LIBED2K_DISABLE_POOL_ALLOCATOR
-#include <boost/pool/pool.hpp>
+#include <libed2k/slab_allocator.hpp>
 #endif
 
 #ifdef LIBED2K_DISK_STATS
@@ -83,18 +86,23 @@ namespace libed2k
 
         void release_memory();
 
+        // back new disk buffer slabs by huge pages
+        void set_huge_pages(bool b);
+
         int in_use() const { return m_in_use; }
 
+        slab_allocator_stats buffer_stats() const;
+
     protected:
 
-        void free_buffer_impl(char* buf, mutex::scoped_lock& l);
+        void free_buffer_impl(char* buf);
 
         // number of bytes per block. The ED2K
         // protocol defines the block size to BLOCK_SIZE.
         const int m_block_size;
 
         // number of disk buffers currently allocated
-        int m_in_use;
+        boost::detail::atomic_count m_in_use;
 
         session_settings m_settings;
 
@@ -104,8 +112,9 @@ namespace libed2k
 
 #ifndef LIBED2K_DISABLE_POOL_ALLOCATOR
         // memory pool for read and write operations
-        // and disk cache
-        boost::pool<page_aligned_allocator> m_pool;
+        // and disk cache. Blocks are page aligned and
+        // are allocated without locking m_pool_mutex
+        slab_allocator m_pool;
 #endif
 
 #if defined LIBED2K_DISK_STATS || defined LIBED2K_STATS
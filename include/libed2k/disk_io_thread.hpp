@@ -45,11 +45,14 @@ POSSIBILITY OF SUCH DAMAGE.
 #include <boost/optional.hpp>
 #include <deque>
 #include <list>
+#include <vector>
 
 #include <libed2k/config.hpp>
 #include <libed2k/thread.hpp>
 #include <libed2k/disk_buffer_pool.hpp>
 #include <libed2k/constants.hpp>
+#include <libed2k/arc_cache.hpp>
+#include <libed2k/read_streams.hpp>
 
 #include <boost/multi_index_container.hpp>
 #include <boost/multi_index/member.hpp>
@@ -85,6 +88,7 @@ namespace libed2k
             , offset(0)
             , max_cache_line(0)
             , cache_min_time(0)
+            , requester(0)
         {}
 
         enum action_t
@@ -106,6 +110,8 @@ namespace libed2k
             , read_and_hash
             , cache_piece
             , finalize_file
+            , read_ahead
+            , write_file
         };
 
         action_t action;
@@ -125,15 +131,23 @@ namespace libed2k
 
         // if this is > 0, it specifies the max number of blocks to read
         // ahead in the read cache for this access. This is only valid
-        // for 'read' actions
+        // for 'read' actions. For 'read_ahead' it's the number of blocks
+        // to prefetch starting at offset
         int max_cache_line;
 
         // if this is > 0, it may increase the minimum time the cache
         // line caused by this operation stays in the cache
         int cache_min_time;
 
+        // id of the peer issuing a read, used to detect peers
+        // reading parts sequentially. May be 0
+        boost::uint32_t requester;
+
         boost::shared_ptr<entry> resume_data;
 
+        // contents for 'write_file', written to the path in str
+        boost::shared_ptr<std::vector<char> > file_data;
+
         // the error code from the file operation
         error_code error;
 
@@ -160,10 +174,17 @@ namespace libed2k
             , writes(0)
             , blocks_read(0)
             , blocks_read_hit(0)
+            , blocks_read_hit_recent(0)
+            , blocks_read_hit_frequent(0)
+            , ghost_hits_recent(0)
+            , ghost_hits_frequent(0)
             , reads(0)
             , queued_bytes(0)
             , cache_size(0)
             , read_cache_size(0)
+            , read_cache_recent_size(0)
+            , read_cache_frequent_size(0)
+            , arc_target(0)
             , total_used_buffers(0)
             , average_queue_time(0)
             , average_read_time(0)
@@ -179,6 +200,9 @@ namespace libed2k
             , cumulative_sort_time(0)
             , total_read_back(0)
             , read_queue_size(0)
+            , blocks_read_ahead(0)
+            , read_ahead_hits(0)
+            , read_ahead_size(0)
         {}
 
         // the number of blocks written
@@ -193,6 +217,14 @@ namespace libed2k
         size_type blocks_read;
         // the number of blocks that was just copied from the read cache
         size_type blocks_read_hit;
+        // blocks_read_hit split by the read cache list the piece was in:
+        // pieces served once and pieces served over and over
+        size_type blocks_read_hit_recent;
+        size_type blocks_read_hit_frequent;
+        // read cache misses of pieces which were evicted recently from
+        // the recent or frequent list (arc algorithm only)
+        size_type ghost_hits_recent;
+        size_type ghost_hits_frequent;
         // the number of read operations used
         size_type reads;
 
@@ -203,6 +235,11 @@ namespace libed2k
 
         // the number of blocks in the cache used for read cache
         int read_cache_size;
+        // read cache blocks in the recent and frequent lists
+        int read_cache_recent_size;
+        int read_cache_frequent_size;
+        // target size of the recent list in blocks (arc algorithm only)
+        int arc_target;
 
         // the total number of blocks that are currently in use
         // this includes send and receive buffers
@@ -224,6 +261,16 @@ namespace libed2k
         boost::uint32_t cumulative_sort_time;
         int total_read_back;
         int read_queue_size;
+
+        // blocks prefetched by the part read-ahead and how many
+        // of them were served to peers afterwards
+        size_type blocks_read_ahead;
+        size_type read_ahead_hits;
+        // prefetched blocks in the read cache not served yet
+        int read_ahead_size;
+
+        // allocation statistics of disk buffers
+        slab_allocator_stats buffers;
     };
 
     // this is a singleton consisting of the thread and a queue
@@ -267,11 +314,19 @@ namespace libed2k
 
         struct cached_block_entry
         {
-            cached_block_entry(): buf(0) {}
+            cached_block_entry(): buf(0), served(false), read_ahead(false) {}
             // the buffer pointer (this is a disk_pool buffer)
             // or 0
             char* buf;
 
+            // set when the block was copied to a read request
+            // from the read cache. Serving it once more moves
+            // the piece to the frequent list
+            bool served;
+
+            // the block was prefetched by the part read-ahead
+            bool read_ahead;
+
             // callback for when this block is flushed to disk
             boost::function<void(int, disk_io_job const&)> callback;
         };
@@ -296,9 +351,15 @@ namespace libed2k
             // is used to determine if flushing a range would force us
             // to read it back later when hashing
             int next_block_to_hash;
+            // read cache pieces with blocks served more than once
+            // are in the frequent list, the others in the recent one
+            bool frequent;
 
             std::pair<void*, int> storage_piece_pair() const
             { return std::pair<void*, int>(storage.get(), piece); }
+
+            std::pair<bool, libed2k::ptime> list_expire() const
+            { return std::pair<bool, libed2k::ptime>(frequent, expire); }
         };
 
         typedef multi_index_container<
@@ -307,11 +368,14 @@ namespace libed2k
                 , &cached_piece_entry::storage_piece_pair> >
                 , ordered_non_unique<member<cached_piece_entry, libed2k::ptime
                     , &cached_piece_entry::expire> >
+                , ordered_non_unique<const_mem_fun<cached_piece_entry, std::pair<bool, libed2k::ptime>
+                    , &cached_piece_entry::list_expire> >
                 >
             > cache_t;
 
         typedef cache_t::nth_index<0>::type cache_piece_index_t;
         typedef cache_t::nth_index<1>::type cache_lru_index_t;
+        typedef cache_t::nth_index<2>::type cache_list_index_t;
 
     private:
 
@@ -329,7 +393,7 @@ namespace libed2k
             , mutex::scoped_lock& l);
         bool is_cache_hit(cached_piece_entry& p
             , disk_io_job const& j, mutex::scoped_lock& l);
-        int copy_from_piece(cached_piece_entry& p, bool& hit
+        int copy_from_piece(cached_piece_entry& p, bool& hit, bool& served_again
             , disk_io_job const& j, mutex::scoped_lock& l);
 
         struct ignore_t
@@ -356,10 +420,16 @@ namespace libed2k
         // read cache operations
         int clear_oldest_read_piece(int num_blocks, ignore_t ignore
             , mutex::scoped_lock& l);
+        cache_list_index_t::iterator oldest_read_piece(bool frequent
+            , ignore_t const& ignore);
+        void read_cache_lists(int& recent, int& frequent) const;
+        bool read_cache_miss(disk_io_job const& j);
+        void count_read_hit(cached_piece_entry const& p, bool hit);
         int read_into_piece(cached_piece_entry& p, int start_block
             , int options, int num_blocks, mutex::scoped_lock& l);
         int cache_read_block(disk_io_job const& j, mutex::scoped_lock& l);
         int free_piece(cached_piece_entry& p, mutex::scoped_lock& l);
+        void drop_read_ahead(cached_block_entry& b);
         int drain_piece_bufs(cached_piece_entry& p, std::vector<char*>& buf
             , mutex::scoped_lock& l);
 
@@ -367,6 +437,8 @@ namespace libed2k
             cache_only = 1
         };
         int try_read_from_cache(disk_io_job const& j, bool& hit, int flags = 0);
+        void update_read_stream(disk_io_job const& j);
+        int read_ahead(disk_io_job const& j, mutex::scoped_lock& l);
         int read_piece_from_cache_and_hash(disk_io_job const& j, md4_hash& h);
         int cache_piece(disk_io_job const& j, cache_piece_index_t::iterator& p
             , bool& hit, int options, mutex::scoped_lock& l);
@@ -390,6 +462,17 @@ namespace libed2k
         // read cache
         cache_t m_read_pieces;
 
+        // ghost lists of the read cache when the arc algorithm is used
+        arc_policy m_arc;
+
+        // read cache blocks held by pieces in the frequent list, the
+        // rest of read_cache_size is the recent list
+        int m_frequent_read_blocks;
+
+        // peers reading parts, used by the part read-ahead.
+        // Only touched by the disk thread
+        read_streams m_read_streams;
+
         void flip_stats(libed2k::ptime now);
 
         // total number of blocks in use by both the read
@@ -0,0 +1,113 @@
+#ifndef __LIBED2K_DORMANT_TRANSFER__
+#define __LIBED2K_DORMANT_TRANSFER__
+
+#include <map>
+#include <string>
+#include <vector>
+#include <boost/shared_ptr.hpp>
+
+#include "libed2k/hasher.hpp"
+#include "libed2k/size_type.hpp"
+#include "libed2k/time.hpp"
+
+namespace libed2k
+{
+    class add_transfer_params;
+    namespace aux { class session_impl; }
+
+    /**
+      * lives as long as the transfer is in the session, running or dormant.
+      * Handles reach the session through it to wake the transfer up
+     */
+    struct transfer_link
+    {
+        transfer_link(aux::session_impl& s, const md4_hash& h) : ses(s), hash(h) {}
+
+        aux::session_impl&  ses;
+        md4_hash            hash;
+    };
+
+    /**
+      * compact state of complete seed without peers: enough to announce
+      * the file and to restore full transfer when some peer asks for it
+     */
+    struct dormant_transfer
+    {
+        std::string     file_path;
+        size_type       file_size;
+        boost::uint32_t hashes;         //!< first piece hash in the hashes arena
+        boost::uint32_t num_hashes;
+        boost::uint32_t accepted;
+        boost::uint32_t requested;
+        boost::uint64_t transferred;
+        boost::uint8_t  priority;
+        bool            announced;      //!< offered to current server already
+        ptime           next_dht_announce;
+        boost::shared_ptr<transfer_link> link;
+    };
+
+    /**
+      * dormant transfers of the session, piece hashes of all of them are kept
+      * in one arena instead of a vector per transfer
+     */
+    class dormant_transfers
+    {
+    public:
+        typedef std::map<md4_hash, dormant_transfer> container_type;
+        typedef container_type::iterator iterator;
+        typedef container_type::const_iterator const_iterator;
+
+        dormant_transfers();
+
+        /** next_dht_announce is kept from the time the transfer was running */
+        void add(const add_transfer_params& params, bool announced,
+                 const boost::shared_ptr<transfer_link>& link = boost::shared_ptr<transfer_link>(),
+                 const ptime& next_dht_announce = min_time());
+        /** fill transfer parameters, false when it is not dormant */
+        bool params(const md4_hash& hash, add_transfer_params& params) const;
+        /** fill transfer parameters and forget the transfer, false when it is not dormant */
+        bool take(const md4_hash& hash, add_transfer_params& params, bool& announced);
+        bool remove(const md4_hash& hash);
+        void clear();
+
+        bool contains(const md4_hash& hash) const { return m_transfers.count(hash) != 0; }
+        /** the link handles of the dormant transfer hold, empty when it isn't dormant */
+        boost::shared_ptr<transfer_link> link(const md4_hash& hash) const;
+        size_t size() const { return m_transfers.size(); }
+        bool empty() const { return m_transfers.empty(); }
+
+        iterator begin() { return m_transfers.begin(); }
+        iterator end() { return m_transfers.end(); }
+        const_iterator begin() const { return m_transfers.begin(); }
+        const_iterator end() const { return m_transfers.end(); }
+        const_iterator find(const md4_hash& hash) const { return m_transfers.find(hash); }
+
+        void piece_hashes(const dormant_transfer& t, std::vector<md4_hash>& hashes) const;
+
+        /** forget announces after server connection is closed */
+        void set_announced(bool announced);
+
+        /**
+          * round robin search of transfer which kad source publish is due,
+          * next publish time of the found transfer is set to now + interval
+         */
+        bool pop_dht_announce(const ptime& now, const time_duration& interval,
+                              md4_hash& hash, size_type& size);
+
+        /** hashes arena usage, for tests and statistics */
+        size_t arena_size() const { return m_hashes.size(); }
+
+    private:
+        void remove(iterator i);
+        void compact();
+
+        container_type m_transfers;
+        std::vector<md4_hash> m_hashes;
+        // hashes of removed transfers still kept in the arena
+        size_t m_free_hashes;
+        // the last transfer checked for kad source publish
+        md4_hash m_dht_cursor;
+    };
+}
+
+#endif
@@ -132,6 +132,7 @@ namespace libed2k
             failed_hash_check,
             invalid_escaped_string,
             file_params_making_was_cancelled,
+            inflated_packet_too_large,
             num_errors
         };
     }
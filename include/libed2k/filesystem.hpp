@@ -35,6 +35,7 @@ POSSIBILITY OF SUCH DAMAGE.
 
 #include <memory>
 #include <string>
+#include <vector>
 
 #ifdef _MSC_VER
 #pragma warning(push, 1)
@@ -128,6 +129,9 @@ namespace libed2k
         , std::string const& new_path, error_code& ec);
     LIBED2K_EXPORT void copy_file(std::string const& f
         , std::string const& newf, error_code& ec);
+    // replaces the file by the buffer through a temporary file
+    LIBED2K_EXPORT void save_file(std::string const& f
+        , std::vector<char> const& buf, error_code& ec);
 
     LIBED2K_EXPORT std::string split_path(std::string const& f);
     LIBED2K_EXPORT char const* next_path_element(char const* p);
@@ -224,6 +228,11 @@ namespace libed2k
         void close();
         bool set_size(size_type size, error_code& ec);
 
+        // reserve disk space for the first size bytes without writing
+        // them, sparse ranges stay sparse for sparse_end(). Only done
+        // when it's cheap (fallocate on linux), otherwise it's a no-op
+        bool preallocate(size_type size, error_code& ec);
+
         // called when we're done writing to the file.
         // On windows this will clear the sparse bit
         void finalize();
@@ -256,6 +265,13 @@ namespace libed2k
 
         size_type phys_offset(size_type offset);
 
+#if LIBED2K_USE_SENDFILE
+        // copies up to size bytes at file_offset to the socket in the
+        // kernel. Returns the number of bytes sent or -1 on errors, a full
+        // non-blocking socket fails with errc::resource_unavailable_try_again
+        size_type sendfile(int sock, size_type file_offset, size_type size, error_code& ec);
+#endif
+
 #ifdef LIBED2K_WINDOWS
         HANDLE native_handle() const { return m_file_handle; }
 #else
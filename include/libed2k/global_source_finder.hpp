@@ -0,0 +1,78 @@
+#ifndef __LIBED2K_GLOBAL_SOURCE_FINDER__
+#define __LIBED2K_GLOBAL_SOURCE_FINDER__
+
+#include <map>
+#include <vector>
+
+#include "libed2k/hasher.hpp"
+#include "libed2k/ptime.hpp"
+#include "libed2k/socket.hpp"
+#include "libed2k/packet_struct.hpp"
+
+namespace libed2k
+{
+    /**
+      * parse server UDP sources answer: one or more found sources blocks
+      * each but the first is prefixed with its own protocol and opcode
+     */
+    bool parse_global_sources(const char* buf, int len, std::vector<found_file_sources>& res);
+
+    /**
+      * servers asked for file sources over UDP (OP_GLOBGETSOURCES2)
+      * every server has own query budget and remembers files it was asked about,
+      * so one file is not asked from the same server again before reask time
+     */
+    class global_source_finder
+    {
+    public:
+        global_source_finder();
+
+        /**
+          * servers are given by TCP endpoints, UDP port is TCP port + 4
+          * servers which are already known keep their state
+         */
+        void set_servers(const std::vector<tcp::endpoint>& servers);
+        void clear();
+        size_t size() const { return m_servers.size(); }
+
+        // some server may be queried at now
+        bool ready(const ptime& now) const;
+
+        /**
+          * take the next server which budget allows query at now, except skip,
+          * and fill query with at most limit files in given priority order.
+          * Server will be queried again not earlier than now + interval,
+          * interval grows while server doesn't answer
+         */
+        bool next_query(const ptime& now, const std::vector<get_file_sources>& files
+            , size_t limit, const time_duration& interval, const time_duration& reask_time
+            , const udp::endpoint& skip, udp::endpoint& server, global_get_file_sources& query);
+
+        /**
+          * server answered our query
+          * returns false when endpoint doesn't belong to asked server
+         */
+        bool on_answer(const udp::endpoint& server);
+
+        int queries() const { return m_queries; }
+        int answers() const { return m_answers; }
+    private:
+        struct server_entry
+        {
+            server_entry(): next_query(min_time()), failures(0), awaiting(false) {}
+            ptime   next_query;     //!< query budget: time this server may be asked again
+            int     failures;       //!< queries in a row without answer
+            bool    awaiting;       //!< last query is not answered yet
+            std::map<md4_hash, ptime>   asked;  //!< files and times they were asked
+        };
+
+        typedef std::map<udp::endpoint, server_entry> servers_map;
+
+        servers_map             m_servers;
+        udp::endpoint           m_last;     //!< last queried server, round robin starts after it
+        int                     m_queries;
+        int                     m_answers;
+    };
+}
+
+#endif
@@ -0,0 +1,38 @@
+#ifndef __LIBED2K_INFLATER__
+#define __LIBED2K_INFLATER__
+
+#include <vector>
+#include <boost/noncopyable.hpp>
+
+#include "libed2k/error_code.hpp"
+
+namespace libed2k
+{
+    /**
+      * streaming decompressor of packed (OP_PACKEDPROT) packets
+      * output grows by chunks up to the size limit, so no worst case buffer
+      * is allocated for every packet and any compression ratio is accepted.
+      * Decompressor state with its window is allocated once per connection
+     */
+    class inflater : boost::noncopyable
+    {
+    public:
+        inflater();
+
+        /**
+          * decompress zlib stream src into dst, dst is resized to decompressed size
+          * returns errors::decode_packet_error on broken stream and
+          * errors::inflated_packet_too_large when data exceeds max_size
+         */
+        error_code unpack(const char* src, size_t len, std::vector<char>& dst, size_t max_size);
+
+    private:
+        static void* alloc_state(void* opaque, size_t items, size_t size);
+        static void free_state(void* opaque, void* address);
+
+        std::vector<char>   m_state;    //!< decompressor state and window
+        bool                m_state_used;
+    };
+}
+
+#endif
@@ -42,7 +42,9 @@ POSSIBILITY OF SUCH DAMAGE.
 
 #include <boost/limits.hpp>
 #include <boost/utility.hpp>
+#include <boost/next_prior.hpp>
 #include <boost/tuple/tuple.hpp>
+#include <boost/shared_ptr.hpp>
 
 #ifdef _MSC_VER
 #pragma warning(pop)
@@ -52,6 +54,7 @@ POSSIBILITY OF SUCH DAMAGE.
 #include "libed2k/config.hpp"
 #include "libed2k/address.hpp"
 #include "libed2k/assert.hpp"
+#include "libed2k/error_code.hpp"
 
 namespace libed2k
 {
@@ -307,6 +310,57 @@ private:
 
 };
 
+/**
+  * immutable form of ip_filter for lookups: start addresses of ranges are kept
+  * in flat sorted arrays and IPv4 lookup starts from /16 prefix index, so only
+  * a few ranges are compared. Filter is built outside of the session and is
+  * swapped in by pointer, see session::set_ip_filter()
+ */
+class LIBED2K_EXPORT compiled_ip_filter : boost::noncopyable
+{
+public:
+    /** nothing is blocked */
+    compiled_ip_filter();
+    explicit compiled_ip_filter(const ip_filter& f);
+    /** union of blocklist ranges, ranges without ip_filter::blocked flag are ignored */
+    explicit compiled_ip_filter(std::vector<ip_range<address_v4> > ranges);
+
+    int access(address const& addr) const;
+    int access(boost::uint32_t addr) const;
+
+    /** number of ranges with the same access, both blocked and allowed */
+    size_t size() const;
+
+    /** convert back to editable rules */
+    ip_filter rules() const;
+
+private:
+    void build_index();
+
+    std::vector<boost::uint32_t> m_start4;
+    std::vector<int> m_access4;
+    // for every /16 prefix - index of the range which contains the first prefix address
+    std::vector<boost::uint32_t> m_index4;
+#if LIBED2K_USE_IPV6
+    std::vector<std::pair<address_v6::bytes_type, int> > m_ranges6;
+#endif
+};
+
+/**
+  * parse blocklist in emule ipfilter.dat format
+  *     000.000.000.000 - 000.255.255.255 , 000 , description
+  * where ranges with access level below 127 are blocked, or in P2P format
+  *     description:0.0.0.0-0.255.255.255
+  * empty lines and lines started with # or // are skipped
+  * @return number of malformed lines
+ */
+LIBED2K_EXPORT int parse_ip_filter(const char* begin, const char* end,
+                                   std::vector<ip_range<address_v4> >& ranges);
+
+/** read and compile blocklist file, see parse_ip_filter */
+LIBED2K_EXPORT boost::shared_ptr<compiled_ip_filter> load_ip_filter(
+    const std::string& path, error_code& ec);
+
 }
 
 #endif
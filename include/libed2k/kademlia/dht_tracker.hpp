@@ -104,6 +104,18 @@ namespace libed2k { namespace dht
           , size_type size
           , boost::function<void(kad_id const&)> f);
 
+        void publish_source(const md4_hash& ih
+          , const md4_hash& source_id
+          , const tag_list<boost::uint8_t>& tags
+          , boost::function<void(kad_id const&)> f);
+
+        void publish_keyword(const md4_hash& keyword
+          , const std::deque<kad_info_entry>& files
+          , boost::function<void(kad_id const&)> f);
+
+        // true when routing table has live nodes to publish to
+        bool has_nodes() const { return m_dht.size().get<0>() > 0; }
+
 		void dht_status(session_status& s);
 		void network_stats(int& sent, int& received);
 
@@ -104,6 +104,7 @@ public:
     virtual void reply(const kad2_hello_res&, udp::endpoint ep);
     virtual void reply(const kad2_bootstrap_res&, udp::endpoint ep);
     virtual void reply(const kademlia2_res&, udp::endpoint ep);
+    virtual void reply(const kad2_publish_res&, udp::endpoint ep);
 };
 
 } } // namespace libed2k::dht
@@ -503,6 +503,28 @@ namespace libed2k {
         LIBED2K_SERIALIZATION_SPLIT_MEMBER()
     };
 
+    /**
+      * asks the Kad buddy of a firewalled client over UDP to make the client
+      * connect to our TCP port. Both ids go as Kad ids do
+     */
+    struct buddy_callback_request
+    {
+        kad_id          m_hBuddy;
+        kad_id          m_hFile;
+        boost::uint16_t m_nPort;
+
+        template<typename Archive>
+        void serialize(Archive& ar)
+        {
+            ar & m_hBuddy & m_hFile & m_nPort;
+        }
+    };
+
+    template<> struct packet_type<buddy_callback_request>{
+        static const proto_type value       = OP_REASKCALLBACKUDP;
+        static const proto_type protocol    = OP_EMULEPROT;
+    };//!< callback of a firewalled client through its Kad buddy
+
     template<> struct packet_type<sources_request>{
         static const proto_type value       = OP_REQUESTSOURCES;
         static const proto_type protocol    = OP_EMULEPROT;
@@ -590,6 +612,21 @@ namespace libed2k {
         static const proto_type protocol = OP_KADEMLIAHEADER;
     };
 
+    template<> struct packet_type<kad2_publish_key_req> {
+        static const proto_type value = KADEMLIA2_PUBLISH_KEY_REQ;
+        static const proto_type protocol = OP_KADEMLIAHEADER;
+    };
+
+    template<> struct packet_type<kad2_publish_source_req> {
+        static const proto_type value = KADEMLIA2_PUBLISH_SOURCE_REQ;
+        static const proto_type protocol = OP_KADEMLIAHEADER;
+    };
+
+    template<> struct packet_type<kad2_publish_res> {
+        static const proto_type value = KADEMLIA2_PUBLISH_RES;
+        static const proto_type protocol = OP_KADEMLIAHEADER;
+    };
+
     /**
     *   special transaction identifier on packet type
     */
@@ -623,6 +660,11 @@ namespace libed2k {
     // firewalled 
     template<> struct transaction_identifier<kad_firewalled_req> { static const uint16_t id = 'f';  };
     template<> struct transaction_identifier<kad_firewalled_res> { static const uint16_t id = 'f';  };
+
+    // publish keywords and sources, both answered with one publish response
+    template<> struct transaction_identifier<kad2_publish_key_req> { static const uint16_t id = 'u'; };
+    template<> struct transaction_identifier<kad2_publish_source_req> { static const uint16_t id = 'u'; };
+    template<> struct transaction_identifier<kad2_publish_res> { static const uint16_t id = 'u'; };
 }
 
 #endif //__KAD_PACKET_STRUCT__
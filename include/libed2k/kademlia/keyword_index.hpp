@@ -0,0 +1,74 @@
+#ifndef LIBED2K_DISABLE_DHT
+
+#ifndef __LIBED2K_KEYWORD_INDEX__
+#define __LIBED2K_KEYWORD_INDEX__
+
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+
+#include "libed2k/hasher.hpp"
+#include "libed2k/ptime.hpp"
+
+namespace libed2k { namespace dht
+{
+    /**
+      * split file name into kad keywords like eMule does:
+      * lower case words of at least 3 bytes without duplicates,
+      * last word of 3 characters is treated as file extension and dropped
+     */
+    void extract_keywords(const std::string& name, std::vector<std::string>& words);
+
+    /**
+      * files grouped by keyword hash for kad keyword publishing
+      * each keyword publishes all its files at once, so files sharing keywords
+      * cost one traversal per keyword instead of one per file
+     */
+    class keyword_index
+    {
+    public:
+        keyword_index();
+
+        void add_file(const md4_hash& file, const std::string& name);
+        /** drop the file from all keywords it was added with */
+        void remove_file(const md4_hash& file);
+
+        /**
+          * take the earliest keyword due at now and move it to now + interval
+          * returns at most limit files, next call continues where previous stopped
+         */
+        bool pop(const ptime& now, const time_duration& interval, size_t limit
+            , md4_hash& keyword, std::vector<md4_hash>& files);
+
+        void reschedule(const md4_hash& keyword, const ptime& when);
+
+        // keywords waiting for publish at now
+        int pending(const ptime& now) const;
+
+        size_t size() const { return m_keywords.size(); }
+        void clear();
+    private:
+        struct keyword_entry
+        {
+            keyword_entry() : offset(0) {}
+            std::set<md4_hash>  files;
+            ptime               next_publish;
+            size_t              offset;         //!< first file for next publish when files exceed limit
+        };
+
+        typedef std::map<md4_hash, keyword_entry> keywords_map;
+        typedef std::set<std::pair<ptime, md4_hash> > publish_queue;
+        typedef std::map<md4_hash, std::vector<md4_hash> > files_map;
+
+        void schedule(keywords_map::iterator i, const ptime& when);
+
+        keywords_map    m_keywords;
+        publish_queue   m_queue;
+        files_map       m_files;            //!< keywords of every file
+
+    };
+}}
+
+#endif
+#endif
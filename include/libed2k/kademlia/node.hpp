@@ -167,6 +167,7 @@ public:
   virtual void reply(const kad2_hello_res&, udp::endpoint ep) { flags |= flag_done; }
   virtual void reply(const kad2_bootstrap_res&, udp::endpoint ep) { flags |= flag_done; }
   virtual void reply(const kademlia2_res&, udp::endpoint ep) { flags |= flag_done; }
+  virtual void reply(const kad2_publish_res&, udp::endpoint ep) { flags |= flag_done; }
 };
 
 struct count_peers
@@ -241,6 +242,23 @@ public:
     , size_type size
     , boost::function<void(kad_id const&)> f);
 
+  // store our source for the file on the nodes closest to its hash
+  void publish_source(node_id const& file_hash
+    , kad_id const& source_id
+    , tag_list<uint8_t> const& tags
+    , boost::function<void(kad_id const&)> f);
+
+  // store files entries for the keyword on the nodes closest to keyword hash
+  // one traversal serves all files sharing the keyword
+  void publish_keyword(node_id const& keyword_hash
+    , std::deque<kad_info_entry> const& files
+    , boost::function<void(kad_id const&)> f);
+
+  // publish requests sent and publish responses received since start
+  int num_publish_requests() const { return m_publish_requests; }
+  int num_publish_replies() const { return m_publish_replies; }
+  void publish_request_sent() { ++m_publish_requests; }
+
 	// the returned time is the delay until connection_timeout()
 	// should be called again the next time
 	time_duration connection_timeout();
@@ -304,8 +322,15 @@ private:
 	bool (*m_send)(void*, const udp_message&, udp::endpoint const&, int);
 	void* m_userdata;
 	uint16_t m_port;
+
+	int m_publish_requests;
+	int m_publish_replies;
 };
 
+// counts publish responses before the usual rpc processing
+template<>
+void node_impl::incoming(const kad2_publish_res& t, udp::endpoint target);
+
 
 } } // namespace libed2k::dht
 
@@ -75,6 +75,7 @@ struct observer : boost::noncopyable
 		, m_id(id)
 		, m_port(0)
 		, m_transaction_id()
+		, m_send_seq(0)
 		, flags(0)
 	{
 		LIBED2K_ASSERT(a);
@@ -93,6 +94,7 @@ struct observer : boost::noncopyable
         virtual void reply(const kad2_hello_res&, udp::endpoint ep) = 0;
 	virtual void reply(const kad2_bootstrap_res&, udp::endpoint ep) = 0;
         virtual void reply(const kademlia2_res&, udp::endpoint ep) = 0;    
+        virtual void reply(const kad2_publish_res&, udp::endpoint ep) = 0;
 
 	// this is called if no response has been received after
 	// a few seconds, before the request has timed out
@@ -126,6 +128,10 @@ struct observer : boost::noncopyable
 	boost::uint16_t transaction_id() const
 	{ return m_transaction_id; }
 
+	// order of sending among the transactions of the rpc manager
+	void set_send_seq(boost::uint64_t seq) { m_send_seq = seq; }
+	boost::uint64_t send_seq() const { return m_send_seq; }
+
 	enum {
 		flag_queried = 1,
 		flag_initial = 2,
@@ -165,6 +171,8 @@ protected:
 
 	// the transaction ID for this call
 	boost::uint16_t m_transaction_id;
+
+	boost::uint64_t m_send_seq;
 public:
 	unsigned char flags;
 
@@ -38,6 +38,9 @@ POSSIBILITY OF SUCH DAMAGE.
 #include <boost/cstdint.hpp>
 #include <boost/pool/pool.hpp>
 #include <boost/function/function3.hpp>
+#include <boost/multi_index_container.hpp>
+#include <boost/multi_index/sequenced_index.hpp>
+#include <boost/multi_index/hashed_index.hpp>
 
 #include "libed2k/socket.hpp"
 #include "libed2k/entry.hpp"
@@ -65,6 +68,7 @@ struct null_observer : public observer
   virtual void reply(const kad2_hello_res&, udp::endpoint ep) { flags |= flag_done; }
   virtual void reply(const kad2_bootstrap_res&, udp::endpoint ep) { flags |= flag_done; }
   virtual void reply(const kademlia2_res&, udp::endpoint ep) { flags |= flag_done; }
+  virtual void reply(const kad2_publish_res&, udp::endpoint ep) { flags |= flag_done; }
 };
 
 class routing_table;
@@ -130,10 +134,68 @@ public:
 	int num_allocated_observers() const { return m_allocated_observers; }
 private:
 
+	// the reply a transaction waits for: transaction type, address
+	// of the node and packet kad identifier
+	struct reply_key
+	{
+		reply_key(boost::uint16_t tid, address const& a, kad_id const& pid)
+			: transaction_id(tid), addr(a), packet_id(pid) {}
+
+		bool operator==(reply_key const& k) const
+		{ return transaction_id == k.transaction_id && addr == k.addr && packet_id == k.packet_id; }
+
+		boost::uint16_t transaction_id;
+		address addr;
+		kad_id packet_id;
+	};
+
+	struct reply_key_of
+	{
+		typedef reply_key result_type;
+		result_type operator()(observer_ptr const& o) const
+		{ return reply_key(o->transaction_id(), o->target_addr(), o->packet_id()); }
+	};
+
+	struct endpoint_of
+	{
+		typedef udp::endpoint result_type;
+		result_type operator()(observer_ptr const& o) const { return o->target_ep(); }
+	};
+
+	struct reply_key_hash
+	{
+		std::size_t operator()(reply_key const& k) const;
+	};
+
+	struct endpoint_hash
+	{
+		std::size_t operator()(udp::endpoint const& ep) const;
+	};
+
+	// outstanding transactions in the order they were sent (and so in the
+	// order they time out), indexed by the reply they wait for and by
+	// the node endpoint
+	typedef boost::multi_index_container<
+		observer_ptr, boost::multi_index::indexed_by<
+			boost::multi_index::sequenced<>
+			, boost::multi_index::hashed_non_unique<reply_key_of, reply_key_hash>
+			, boost::multi_index::hashed_non_unique<endpoint_of, endpoint_hash>
+		>
+	> transactions_t;
+
+	void erase_transaction(transactions_t::iterator i);
+
 	mutable boost::pool<> m_pool_allocator;
 
-	typedef std::list<observer_ptr> transactions_t;
 	transactions_t m_transactions;
+
+	// the first transaction which wasn't checked for the short timeout
+	// yet, every one is checked once. end() when all were checked
+	transactions_t::iterator m_short_timeout;
+
+	// send sequence of the next transaction, tells the oldest one
+	// among transactions waiting for the same reply
+	boost::uint64_t m_next_send_seq;
 	
 	send_fun m_send;
 	void* m_userdata;
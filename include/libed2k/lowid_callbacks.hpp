@@ -0,0 +1,86 @@
+#ifndef __LIBED2K_LOWID_CALLBACKS__
+#define __LIBED2K_LOWID_CALLBACKS__
+
+#include <map>
+#include <vector>
+
+#include "libed2k/hasher.hpp"
+#include "libed2k/ptime.hpp"
+#include "libed2k/socket.hpp"
+#include "libed2k/packet_struct.hpp"
+
+namespace libed2k
+{
+    /**
+      * callbacks asked from LowID peers, which can't accept connections and have
+      * to connect to us. There is one callback per client id at a time, files of
+      * all transfers which want the peer wait for it together. A callback goes
+      * through the server we are connected to, or through the Kad buddy of the
+      * peer when we know it, and is sent again when the peer doesn't come in time
+     */
+    class lowid_callbacks
+    {
+    public:
+        lowid_callbacks();
+
+        /**
+          * file wants a callback of the peer. Returns true when a callback has
+          * to be sent, false when one is already on the way
+         */
+        bool request(client_id_type id, const md4_hash& file, const ptime& now);
+
+        /** the Kad buddy the peer is reachable through, used from now on */
+        void set_buddy(client_id_type id, const udp::endpoint& buddy, const md4_hash& buddy_hash);
+
+        /**
+          * the peer connected to us, takes the files waiting for it.
+          * False when we didn't ask it
+         */
+        bool answered(client_id_type id, const ptime& now, std::vector<md4_hash>& files);
+
+        /**
+          * callbacks not answered within timeout are sent again while they have
+          * attempts left, the rest are dropped. Ids to send again go to resend
+         */
+        void tick(const ptime& now, const time_duration& timeout, int max_attempts
+            , std::vector<client_id_type>& resend);
+
+        /** where to send the callback of the peer, false when it has no buddy */
+        bool buddy(client_id_type id, udp::endpoint& ep, md4_hash& buddy_hash, md4_hash& file) const;
+
+        void clear() { m_callbacks.clear(); }
+        size_t size() const { return m_callbacks.size(); }
+
+        // callbacks sent including retries, files joined a callback on the way,
+        // peers came back, callbacks given up and the average time peers took
+        // to connect in milliseconds
+        int sent() const { return m_sent; }
+        int coalesced() const { return m_coalesced; }
+        int succeeded() const { return m_succeeded; }
+        int timed_out() const { return m_timed_out; }
+        int average_latency() const;
+
+    private:
+        struct callback_entry
+        {
+            callback_entry(): attempts(1) {}
+            std::vector<md4_hash>   files;
+            ptime                   sent;       //!< the first attempt
+            ptime                   last;       //!< the last attempt
+            int                     attempts;
+            udp::endpoint           buddy;
+            md4_hash                buddy_hash;
+        };
+
+        typedef std::map<client_id_type, callback_entry> callbacks_map;
+
+        callbacks_map   m_callbacks;
+        int             m_sent;
+        int             m_coalesced;
+        int             m_succeeded;
+        int             m_timed_out;
+        boost::int64_t  m_total_latency;
+    };
+}
+
+#endif
@@ -347,6 +347,12 @@ namespace libed2k
             ++m_size;
         }
 
+        void swap(container_holder& c)
+        {
+            std::swap(m_size, c.m_size);
+            m_collection.swap(c.m_collection);
+        }
+
         void dump() const
         {
             DBG("container_holder::dump");
@@ -863,6 +869,22 @@ namespace libed2k
 
 
     // UDP client - server structures
+
+    /**
+      * request sources for several files from server over UDP
+      * entries have the same layout as TCP sources request
+     */
+    struct global_get_file_sources
+    {
+        std::vector<get_file_sources>   m_files;
+
+        template<typename Archive>
+        void serialize(Archive& ar){
+            for (std::vector<get_file_sources>::iterator i = m_files.begin(); i != m_files.end(); ++i)
+                ar & *i;
+        }
+    };
+
     struct global_server_state_req
     {
         boost::uint32_t m_nChallendge;
@@ -959,6 +981,11 @@ namespace libed2k
         static const proto_type protocol    = OP_EDONKEYPROT;
     };//!< file sources answer
 
+    template<> struct packet_type<global_get_file_sources>{
+        static const proto_type value = OP_GLOBGETSOURCES2;
+        static const proto_type protocol    = OP_EDONKEYPROT;
+    };//!< file sources request to server over UDP
+
     template<> struct packet_type<callback_request_out>{
         static const proto_type value = OP_CALLBACKREQUEST;
         static const proto_type protocol    = OP_EDONKEYPROT;
@@ -13,8 +13,8 @@ namespace libed2k {
     public:
         peer(const tcp::endpoint& ep, bool conn, int src):
             endpoint(ep), connection(NULL), last_connected(0), next_connect(0),
-            connectable(conn), seed(false), failcount(0), fast_reconnects(0),
-            trust_points(0), source(src)
+            connectable(conn), seed(false), transferred(false), last_transferred(0),
+            failcount(0), fast_reconnects(0), trust_points(0), source(src)
 #ifndef LIBED2K_DISABLE_DHT
             , added_to_dht(false)
 #endif
@@ -47,6 +47,13 @@ namespace libed2k {
         // this is true if the peer is a seed
         bool seed;
 
+        // we have downloaded payload from the peer on the last connection
+        bool transferred;
+
+        // posix time of the end of the last connection we downloaded
+        // payload on, 0 if never. Kept in the resume data
+        boost::uint32_t last_transferred;
+
         // the number of failed connection attempts this peer has
         unsigned failcount;
 
@@ -0,0 +1,113 @@
+#ifndef __LIBED2K_PEER_CLASS__
+#define __LIBED2K_PEER_CLASS__
+
+#include <string>
+#include <boost/cstdint.hpp>
+
+#include "libed2k/config.hpp"
+#include "libed2k/bandwidth_limit.hpp"
+
+namespace libed2k
+{
+    /**
+      * settings of a peer class. Peers are put in classes by the peer class filter
+      * (ip ranges), by the type of their connection and by the classes of their
+      * transfer. The bandwidth of a peer is limited by all of its classes, the
+      * global limit, its transfer and its own limit
+     */
+    struct LIBED2K_EXPORT peer_class_info
+    {
+        peer_class_info()
+            : upload_limit(0), download_limit(0)
+            , upload_min(0), download_min(0)
+            , upload_weight(1), download_weight(1)
+        {}
+
+        std::string label;
+
+        // bytes per second the class may use, 0 is unlimited
+        int upload_limit;
+        int download_limit;
+
+        // bytes per second the class is served ahead of the other peers.
+        // It still counts against the global limit, so the minimums of all
+        // classes should sum up below it
+        int upload_min;
+        int download_min;
+
+        // share of a limited channel relative to other peers, 1 - 255.
+        // A peer in several classes gets the largest weight
+        int upload_weight;
+        int download_weight;
+    };
+
+    /**
+      * the connection types the peer class type filter maps to classes
+     */
+    struct LIBED2K_EXPORT peer_class_type_filter
+    {
+        enum socket_type_t
+        {
+            tcp_incoming,
+            tcp_outgoing,
+            // incoming connection of a LowID peer we asked to call us back
+            lowid_callback,
+            num_socket_types
+        };
+
+        peer_class_type_filter();
+
+        void add(socket_type_t st, int peer_class);
+        void remove(socket_type_t st, int peer_class);
+
+        /** adds the classes of the connection type to the set */
+        boost::uint32_t apply(int st, boost::uint32_t peer_classes) const;
+
+        boost::uint32_t m_peer_classes[num_socket_types];
+    };
+
+    struct peer_class
+    {
+        peer_class();
+
+        void set_info(const peer_class_info& pci);
+        void get_info(peer_class_info& pci) const;
+
+        // the limits of the class, upload and download
+        bandwidth_channel channel[2];
+
+        // token buckets of the minimum rates
+        bandwidth_channel guarantee[2];
+
+        int weight[2];
+        std::string label;
+        bool in_use;
+    };
+
+    /**
+      * classes are referred to by their index, peers and transfers keep the set
+      * of their classes in a bit mask. Classes never move in memory, their
+      * bandwidth channels may be queued in the bandwidth managers
+     */
+    class peer_class_pool
+    {
+    public:
+        enum { max_classes = 32 };
+
+        /** @return the new class or -1 if all are in use */
+        int new_peer_class(const std::string& label);
+        void delete_peer_class(int c);
+
+        /** null if the class isn't in use */
+        peer_class* at(int c);
+        const peer_class* at(int c) const;
+
+        /** the classes in use out of the set */
+        boost::uint32_t valid(boost::uint32_t peer_classes) const;
+
+    private:
+        peer_class m_classes[max_classes];
+    };
+}
+
+#endif
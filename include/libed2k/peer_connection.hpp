@@ -12,6 +12,7 @@
 #include "libed2k/disk_buffer_holder.hpp"
 #include "libed2k/base_connection.hpp"
 #include "libed2k/error_code.hpp"
+#include "libed2k/filesystem.hpp"
 #include "libed2k/packet_struct.hpp"
 #include "libed2k/peer_request.hpp"
 #include "libed2k/piece_picker.hpp"
@@ -34,6 +35,7 @@ namespace libed2k
         class session_impl;
     }
     struct disk_io_job;
+    struct client_credit;
 
     struct pending_block
     {
@@ -58,6 +60,9 @@ namespace libed2k
         // busy request at a time in each peer's queue
         bool busy:1;
 
+        // the block belongs to a piece with deadline
+        bool time_critical:1;
+
         piece_block block;
         // data size, it is useful to store compressed block size
         size_type data_size;
@@ -67,6 +72,8 @@ namespace libed2k
         char* buffer;
         // time when this block has been created
         ptime create_time;
+        // time when the request of this block has been sent to the peer
+        ptime request_time;
 
         bool operator==(const pending_block& b)
         {
@@ -87,6 +94,12 @@ namespace libed2k
         { return pb.block == block; }
     };
 
+    /**
+      * number of blocks to keep requested from a peer sending rate bytes per second
+      * with request round trip rtt milliseconds: bandwidth-delay product plus one request packet
+     */
+    int desired_queue_size(int rate, int rtt, int min_queue, int max_queue);
+
     class peer_connection : public base_connection
     {
     public:
@@ -218,6 +231,15 @@ namespace libed2k
         void send_block_requests();
         void cancel_all_requests();
 
+        // requests blocks of the time critical piece ahead of other requests,
+        // blocks requested from other peers are duplicated when the piece is late.
+        // returns the number of blocks requested
+        int request_time_critical_piece(int piece, bool late);
+
+        // the block was received from another peer. Not sent request is dropped,
+        // sent one is forgotten and its data will be skipped
+        void cancel_request(const piece_block& block);
+
         void assign_bandwidth(int channel, int amount);
         int bandwidth_throttle(int channel) const
         { return m_bandwidth_channel[channel].throttle(); }
@@ -227,6 +249,11 @@ namespace libed2k
         int upload_limit() const { return m_upload_limit; }
         int download_limit() const { return m_download_limit; }
 
+        // set of peer classes (1 << class id), the classes of
+        // the transfer are added when bandwidth is requested
+        void set_peer_classes(boost::uint32_t classes) { m_peer_classes = classes; }
+        boost::uint32_t peer_classes() const { return m_peer_classes; }
+
         bool failed() const { return m_failed; }
 
     private:
@@ -239,12 +266,13 @@ namespace libed2k
         virtual void do_read();
         virtual void do_write(int quota = std::numeric_limits<int>::max());
 
-        int request_upload_bandwidth(
-            bandwidth_channel* bwc1, bandwidth_channel* bwc2 = 0,
-            bandwidth_channel* bwc3 = 0, bandwidth_channel* bwc4 = 0);
-        int request_download_bandwidth(
-            bandwidth_channel* bwc1, bandwidth_channel* bwc2 = 0,
-            bandwidth_channel* bwc3 = 0, bandwidth_channel* bwc4 = 0);
+        // the global, class, transfer and peer channels limiting the peer,
+        // the guarantee bucket of its class with a minimum rate and the
+        // largest weight of its classes
+        int bandwidth_channels(int channel, bandwidth_channel** chan,
+                               bandwidth_channel*& guarantee, int& weight);
+        int request_upload_bandwidth();
+        int request_download_bandwidth();
         bool has_upload_bandwidth();
         bool has_download_bandwidth();
 
@@ -255,14 +283,20 @@ namespace libed2k
         bool add_request(const piece_block& b, int flags = 0);
         void abort_all_requests();
         void abort_expired_requests();
+        // resize request pipeline by measured rate and round trip time
+        void update_desired_queue_size();
         bool requesting(const piece_block& b) const;
         size_t num_requesting_busy_blocks() const;
+        size_t num_requesting_time_critical_blocks() const;
         int outstanding_bytes() const;
 
         void send_deferred();
         void fill_send_buffer();
         void send_data(const peer_request& r);
         void on_disk_read_complete(int ret, disk_io_job const& j, peer_request r, peer_request left);
+        bool start_send_file(const peer_request& r);
+        void send_file();
+        void on_send_file(const error_code& error);
         void receive_data(const peer_request& r, bool compressed);
         void receive_data();
         void on_disk_write_complete(int ret, disk_io_job const& j,
@@ -379,6 +413,17 @@ namespace libed2k
         // from this peer
         std::vector<peer_request> m_requests;
 
+        // identifies our reads of the parts the peer requested to the disk
+        // thread, unlike the address it isn't reused by a later connection
+        boost::uint32_t m_read_stream_id;
+
+        // the part being sent with sendfile() after its header went out,
+        // m_upload_req is what is left of it and m_upload_offset
+        // where that starts in the file
+        boost::intrusive_ptr<file> m_upload_file;
+        peer_request m_upload_req;
+        size_type m_upload_offset;
+
         // the blocks we have reserved in the piece
         // picker and will request from this peer.
         std::vector<pending_block> m_request_queue;
@@ -391,14 +436,33 @@ namespace libed2k
         // at the remote end.
         size_t m_desired_queue_size;
 
+        // smoothed round trip time of block requests in milliseconds,
+        // measured from request sent to the first byte of the block
+        // when nothing else was requested from the peer
+        int m_rtt;
+
+        // the block which request round trip is measured
+        bool m_rtt_pending;
+        piece_block m_rtt_block;
+        ptime m_rtt_request_time;
+
         // the maximum number of busy blocks we can
         // request at a time
         size_t m_max_busy_blocks;
 
+        // set when the last blocks were picked in end-game mode
+        bool m_endgame_mode;
+
         // the bandwidth channels, upload and download
         // keeps track of the current quotas
         bandwidth_channel m_bandwidth_channel[num_channels];
 
+        boost::uint32_t m_peer_classes;
+
+        // the credit record of the user hash, set by the hello exchange.
+        // Records live as long as the session
+        client_credit* m_credit;
+
         // number of bytes this peer can send and receive
         int m_quota[2];
 
@@ -343,6 +343,10 @@ namespace libed2k
 		// the number of pieces we want and don't have
 		int num_want_left() const { return num_pieces() - m_num_have - m_num_filtered; }
 
+		// true when every block of the pieces we want and don't
+		// have is requested, downloaded or being written
+		bool all_requested() const;
+
 #ifdef LIBED2K_DEBUG
 		// used in debug mode
 		void verify_priority(int start, int end, int prio) const;
@@ -2,6 +2,7 @@
 #define __LIBED2K_POLICY__
 
 #include <deque>
+#include <string>
 #include <vector>
 
 #include "libed2k/peer.hpp"
@@ -45,6 +46,16 @@ namespace libed2k {
         void erase_peer(peer* p);
         void erase_peer(peers_t::iterator i);
 
+        /**
+          * the connectable peers most worth reconnecting after restart, at most
+          * max_peers of them, as 12 bytes each: ip, port, source flags,
+          * fail count and the last time we downloaded from the peer
+         */
+        void save_peers(std::string& out, int max_peers) const;
+
+        /** adds peers written by save_peers, returns the number added */
+        int load_peers(const char* buf, int len);
+
     private:
 
         struct peer_address_compare
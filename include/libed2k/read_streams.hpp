@@ -0,0 +1,63 @@
+#ifndef __LIBED2K_READ_STREAMS__
+#define __LIBED2K_READ_STREAMS__
+
+#include <list>
+#include <map>
+#include <utility>
+#include <boost/cstdint.hpp>
+
+#include "libed2k/config.hpp"
+
+namespace libed2k
+{
+    /**
+      * positions of peers reading parts, used by the disk thread to prefetch
+      * the blocks ahead of a peer. After two forward reads in a part the
+      * window of the next read_ahead_blocks is asked for, it is refilled when
+      * the peer has consumed half of it. Only the most recently used streams
+      * are kept
+     */
+    class LIBED2K_EXTRA_EXPORT read_streams
+    {
+    public:
+        typedef std::pair<boost::uint32_t, void const*> key_type;   //!< requester and storage
+        enum { max_streams = 256 };
+
+        /**
+          * the requester read size bytes at offset of the piece. Returns true
+          * when blocks [start, end) should be prefetched, hint is set once per
+          * piece when the rest of it may be hinted to the OS
+         */
+        bool update(const key_type& key, int piece, int offset, int size, int block_size
+            , int blocks_in_piece, int read_ahead_blocks, int& start, int& end, bool& hint);
+
+        /** forget streams of the storage, it can be freed and the address reused */
+        void forget(void const* storage);
+        void clear();
+
+        size_t size() const { return m_index.size(); }
+
+    private:
+        struct stream
+        {
+            key_type key;
+            int piece;
+            // end of the last read
+            int next_offset;
+            // forward reads in a row within the part
+            int sequential;
+            // the block the prefetched window ends at
+            int read_ahead_end;
+            // the rest of the part was hinted to the OS
+            bool hinted;
+        };
+
+        typedef std::list<stream> order_t;
+        typedef std::map<key_type, order_t::iterator> index_t;
+
+        order_t m_order;    // least recently used first
+        index_t m_index;
+    };
+}
+
+#endif
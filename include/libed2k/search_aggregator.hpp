@@ -0,0 +1,92 @@
+#ifndef __LIBED2K_SEARCH_AGGREGATOR__
+#define __LIBED2K_SEARCH_AGGREGATOR__
+
+#include <deque>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "libed2k/config.hpp"
+#include "libed2k/hasher.hpp"
+#include "libed2k/size_type.hpp"
+#include "libed2k/packet_struct.hpp"
+#include "libed2k/kademlia/kad_packet_struct.hpp"
+
+namespace libed2k
+{
+    /**
+      * a file found by a search, merged over the answers of the server and kad
+     */
+    struct LIBED2K_EXPORT search_result_entry
+    {
+        enum origin_flags
+        {
+            server = 0x1,
+            kad = 0x2
+        };
+
+        search_result_entry() : size(0), sources(0), complete_sources(0), names(0), origins(0) {}
+
+        md4_hash    hash;
+        size_type   size;
+        // the name most answers gave
+        std::string name;
+        int         sources;
+        int         complete_sources;
+        // the number of different names
+        int         names;
+        int         origins;
+    };
+
+    /**
+      * merges the results of one search by file hash. The server answers pages
+      * of files, a file it reports again replaces its previous numbers. Kad nodes
+      * index overlapping sources, so the largest numbers of kad count. Adding
+      * answers returns the files which are new or changed since the last answer
+     */
+    class LIBED2K_EXPORT search_aggregator
+    {
+    public:
+        search_aggregator();
+
+        /**
+          * starts a new search, results of the previous one are dropped.
+          * kad_target is the keyword kad searches for, invalid when kad isn't asked
+         */
+        void start(bool server, const md4_hash& kad_target);
+        void stop();
+
+        bool server_active() const { return m_server; }
+        bool kad_target(const md4_hash& target) const { return m_kad_target.defined() && m_kad_target == target; }
+
+        void add_server_results(const shared_files_list& files, bool more, std::vector<search_result_entry>& changed);
+        void add_kad_results(const std::deque<kad_info_entry>& entries, std::vector<search_result_entry>& changed);
+
+        /** the server has more results for search more results request */
+        bool more() const { return m_more; }
+        size_t size() const { return m_files.size(); }
+
+    private:
+        struct file_entry
+        {
+            file_entry() : server_sources(0), server_complete(0), kad_sources(0), kad_complete(0) {}
+
+            search_result_entry result;
+            std::map<std::string, int> names;
+            int server_sources;
+            int server_complete;
+            int kad_sources;
+            int kad_complete;
+        };
+
+        void add(const md4_hash& hash, size_type size, const std::string& name, int sources, int complete,
+                 int origin, std::vector<search_result_entry>& changed);
+
+        std::map<md4_hash, file_entry> m_files;
+        md4_hash m_kad_target;
+        bool m_server;
+        bool m_more;
+    };
+}
+
+#endif
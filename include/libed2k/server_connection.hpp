@@ -118,6 +118,7 @@ namespace libed2k
         libed2k_header                  m_in_header;            //!< incoming message header
         socket_buffer                   m_in_container;         //!< buffer for incoming messages
         socket_buffer                   m_in_gzip_container;    //!< special container for compressed data
+        inflater                        m_inflater;             //!< decompressor of packed packets
         tcp::endpoint                   m_target;
 
         std::deque<message>             m_write_order;  //!< outgoing messages order
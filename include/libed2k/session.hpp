@@ -17,6 +17,7 @@
 #include "libed2k/filesystem.hpp"
 #include "libed2k/session_settings.hpp"
 #include "libed2k/entry.hpp"
+#include "libed2k/peer_class.hpp"
 
 namespace libed2k {
 
@@ -24,9 +25,12 @@ namespace libed2k {
     struct transfer_handle;
     class add_transfer_params;
     struct ip_filter;
+    class compiled_ip_filter;
     class upnp;
     class natpmp;
     struct server_connection_parameters;
+    struct server_met;
+    struct cache_status;
 
     namespace aux
     {
@@ -56,9 +60,18 @@ namespace libed2k {
 
         session_status status() const;
 
+        // disk thread state: queues, cache and disk buffers usage
+        cache_status get_cache_status() const;
+
         // all transfer_handles must be destructed before the session is destructed!
+        // seed kept dormant (see session_settings::dormant_seed_timeout) wakes up
+        // on the first call through its handle
         transfer_handle add_transfer(const add_transfer_params& params);
         void post_transfer(const add_transfer_params& params);
+        // add transfers in one batch from the network thread, result is posted
+        // as added_transfers_alert. Resume data of the transfers is checked later
+        // by several at once, see session_settings::max_deferred_resume_checks
+        void add_transfers(const std::vector<add_transfer_params>& params);
         transfer_handle find_transfer(const md4_hash& hash) const;
         std::vector<transfer_handle> get_transfers() const;
         std::vector<transfer_handle> get_active_transfers() const;
@@ -76,6 +89,8 @@ namespace libed2k {
 
         /** execute search file on server */
         void post_search_request(search_request& sr);
+        /** search the server and kad for the keyword, results come in search_result_alert */
+        void post_search(search_request& sr, const std::string& keyword);
         void post_search_more_result_request();
         void post_cancel_search();
         void listen_on(int port, const char* net_interface = 0);
@@ -84,12 +99,33 @@ namespace libed2k {
         void set_settings(const session_settings& settings);
         session_settings settings() const;
 
+        // filter is compiled in the calling thread and then swapped in, use
+        // load_ip_filter() to read blocklist files. A null filter is ignored
         void set_ip_filter(const ip_filter& f);
-        const ip_filter& get_ip_filter() const;
+        void set_ip_filter(boost::shared_ptr<const compiled_ip_filter> f);
+        ip_filter get_ip_filter() const;
+
+        // peer classes limit and prioritize groups of peers, see peer_class_info.
+        // create_peer_class() returns -1 when all classes are in use
+        int create_peer_class(const std::string& label);
+        void delete_peer_class(int cid);
+        peer_class_info get_peer_class(int cid) const;
+        void set_peer_class(int cid, const peer_class_info& pci);
+
+        // the flags of the filter ranges are sets of classes (1 << cid) the
+        // peers of the range are put in. Both filters apply to new connections
+        void set_peer_class_filter(const ip_filter& f);
+        void set_peer_class_type_filter(const peer_class_type_filter& f);
 
         /** search sources for file */
         void post_sources_request(const md4_hash& hFile, boost::uint64_t nSize);
 
+        /**
+          * servers from server.met asked for sources of downloading transfers over UDP
+          * replaces previously set servers
+         */
+        void set_global_servers(const server_met& servers);
+
         int download_rate_limit() const;
         int upload_rate_limit() const;
 
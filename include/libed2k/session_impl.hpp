@@ -5,6 +5,7 @@
 #include <string>
 #include <map>
 #include <set>
+#include <deque>
 
 #include <boost/pool/object_pool.hpp>
 
@@ -23,12 +24,21 @@
 #include "libed2k/disk_io_thread.hpp"
 #include "libed2k/file_pool.hpp"
 #include "libed2k/bandwidth_manager.hpp"
+#include "libed2k/peer_class.hpp"
+#include "libed2k/client_credits.hpp"
 #include "libed2k/connection_queue.hpp"
 #include "libed2k/session_status.hpp"
 #include "libed2k/io_service.hpp"
 #include "libed2k/udp_socket.hpp"
 #include "libed2k/bloom_filter.hpp"
 #include "libed2k/kademlia/dht_tracker.hpp"
+#include "libed2k/kademlia/keyword_index.hpp"
+#include "libed2k/global_source_finder.hpp"
+#include "libed2k/lowid_callbacks.hpp"
+#include "libed2k/search_aggregator.hpp"
+#include "libed2k/slab_allocator.hpp"
+#include "libed2k/chained_buffer.hpp"
+#include "libed2k/dormant_transfer.hpp"
 
 #ifdef LIBED2K_UPNP_LOGGING
 #include <fstream>
@@ -84,7 +94,6 @@ namespace libed2k {
         public:
             typedef std::map<std::pair<std::string, boost::uint32_t>,   md4_hash> transfer_filename_map;
             typedef std::map<md4_hash, boost::shared_ptr<transfer> >    transfer_map;
-            typedef std::map<client_id_type, md4_hash>                  lowid_callbacks_map;
 
             session_impl_base(const session_settings& settings);
             virtual ~session_impl_base();
@@ -105,6 +114,7 @@ namespace libed2k {
             void set_alert_dispatch(boost::function<void(alert const&)> const&);
             alert const* wait_for_alert(time_duration max_wait);
             md4_hash callbacked_lowid(client_id_type);
+            bool callbacked_lowid(client_id_type, std::vector<md4_hash>& files);
             bool register_callback(client_id_type, md4_hash);
             void cleanup_callbacks();
 
@@ -124,6 +134,9 @@ namespace libed2k {
             transfer_map m_transfers;
             // active transfers in the session
             transfer_map m_active_transfers;
+            // complete seeds without peers kept in compact form,
+            // see session_settings::dormant_seed_timeout
+            dormant_transfers m_dormant_transfers;
 
             typedef std::list<boost::shared_ptr<transfer> > check_queue_t;
 
@@ -138,10 +151,11 @@ namespace libed2k {
 
             /** file hasher closed in self thread */
             transfer_params_maker   m_tpm;
-            lowid_callbacks_map     lowid_conn_dict;
+            // LowID peers asked to connect to us and the files waiting for them
+            lowid_callbacks         m_lowid_callbacks;
         };
 
-        class session_impl : public session_impl_base
+        class session_impl : public session_impl_base, public buffer_releaser
         {
         private:
 #ifdef LIBED2K_UPNP_LOGGING
@@ -150,7 +164,7 @@ namespace libed2k {
         public:
 
             // the size of each allocation that is chained in the send buffer
-            enum { send_buffer_size = 128 };
+            enum { send_buffer_size = 128, send_buffer_classes = 12 };
             typedef std::set<boost::intrusive_ptr<peer_connection> > connection_map;
 
             session_impl(const fingerprint& id, const char* listen_interface,
@@ -165,8 +179,22 @@ namespace libed2k {
 
             void open_listen_port();
 
-            void set_ip_filter(const ip_filter& f);
-            const ip_filter& get_ip_filter() const;
+            void set_ip_filter(boost::shared_ptr<const compiled_ip_filter> f);
+            boost::shared_ptr<const compiled_ip_filter> get_ip_filter() const;
+
+            int create_peer_class(const std::string& label);
+            void delete_peer_class(int cid);
+            peer_class_info get_peer_class(int cid) const;
+            void set_peer_class(int cid, const peer_class_info& pci);
+            void set_peer_class_filter(const ip_filter& f);
+            void set_peer_class_type_filter(const peer_class_type_filter& f);
+
+            // the classes of a new connection by its address and
+            // peer_class_type_filter::socket_type_t
+            boost::uint32_t peer_classes_for(const address& a, int socket_type) const;
+
+            // servers asked for sources over UDP
+            void set_global_servers(const std::vector<tcp::endpoint>& servers);
 
             bool listen_on(int port, const char* net_interface);
             bool is_listening() const;
@@ -175,6 +203,10 @@ namespace libed2k {
 
             void update_disk_thread_settings();
 
+            // writes clients.met on the disk thread when credits changed
+            void save_credits();
+            void on_credits_saved(int ret, disk_io_job const& j);
+
             void async_accept(boost::shared_ptr<tcp::acceptor> const& listener);
             void on_accept_connection(boost::shared_ptr<tcp::socket> const& s,
                                       boost::weak_ptr<tcp::acceptor> listener,
@@ -190,6 +222,7 @@ namespace libed2k {
 
 			void on_receive_udp(error_code const& e, udp::endpoint const& ep, char const* buf, int len);
 			void on_receive_udp_hostname(error_code const& e, char const* hostname, char const* buf, int len);
+			void on_receive_global_sources(udp::endpoint const& ep, char const* buf, int len);
 
             void maybe_update_udp_mapping(int nat, int local_port, int external_port);
 
@@ -204,6 +237,10 @@ namespace libed2k {
             boost::weak_ptr<transfer> find_transfer(const md4_hash& hash);
             virtual boost::weak_ptr<transfer> find_transfer(const std::string& filename);
             transfer_handle find_transfer_handle(const md4_hash& hash);
+            /** find transfer, dormant transfer is restored */
+            boost::shared_ptr<transfer> wake_transfer(const md4_hash& hash);
+            /** announce of transfer or dormant transfer, empty when the file isn't shared */
+            shared_file_entry get_announce(const md4_hash& hash);
             peer_connection_handle find_peer_connection_handle(const net_identifier& np);
             peer_connection_handle find_peer_connection_handle(const md4_hash& np);
             std::vector<transfer_handle> get_transfers();
@@ -231,6 +268,12 @@ namespace libed2k {
             /** add/remove transfer from current thread directly */
             virtual transfer_handle add_transfer(add_transfer_params const&, error_code& ec);
             virtual void remove_transfer(const transfer_handle& h, int options);
+            /** add transfers batch from another thread */
+            void post_transfers(std::vector<add_transfer_params> const& params);
+            void add_transfers(std::vector<add_transfer_params> const& params);
+            transfer_handle add_dormant_transfer(add_transfer_params const& params);
+            /** start deferred transfers while resume checks limit allows */
+            void start_deferred_transfers();
             /** add/remove active transfer for this session */
             bool add_active_transfer(const boost::shared_ptr<transfer>& t);
             bool remove_active_transfer(const boost::shared_ptr<transfer>& t);
@@ -274,6 +317,15 @@ namespace libed2k {
             char* allocate_z_buffer();
             void free_z_buffer(char* buf);
 
+            // pools of buffers appended to connection send buffers
+            enum buffer_pool_t { send_pool, disk_pool, z_pool };
+
+            // buffer_releaser
+            void release_buffer(int type, char* buf, int size);
+
+            // applies buffer related settings to network buffer allocators
+            void update_buffer_settings();
+
             bool can_write_to_disk() const { return m_disk_thread.can_write(); }
 
             std::string send_buffer_usage();
@@ -286,6 +338,19 @@ namespace libed2k {
             // if there are any trasfers and any free slots
             void connect_new_peers();
 
+            /** result of outgoing connection attempt, adapts the connect rate */
+            void connect_attempt_finished(const error_code& e);
+
+            // ask server and kad for sources of downloading transfers
+            // which need them most, see source request settings
+            void request_sources(const ptime& now);
+
+            /**
+              * asks the LowID peer to connect to us, through its Kad buddy
+              * when we know it or through the server
+             */
+            void send_lowid_callback(client_id_type id);
+
             /** must be locked before access data in this class */
             typedef boost::mutex mutex_t;
             mutable mutex_t m_mutex;
@@ -295,9 +360,21 @@ namespace libed2k {
             /** search file on server */
             void post_search_request(search_request& sr);
 
+            /**
+              * search the server and kad, kad looks for the keyword when it isn't empty.
+              * Results come merged by file in search_result_alert
+             */
+            void post_search(search_request& sr, const std::string& keyword);
+
             /** after simple search call you can post request more search results */
             void post_search_more_result_request();
 
+            /**
+              * the server answered a search, false when the search isn't aggregated
+              * and the answer goes to the user as is
+             */
+            bool on_server_search_result(const search_result& sr);
+
             /** this method simple send information packet to server and break search order */
             void post_cancel_search();
 
@@ -313,6 +390,9 @@ namespace libed2k {
             void update_connections_limit();
             void update_rate_settings();
             void update_active_transfers();
+            // turns complete seeds idle for dormant_seed_timeout into dormant transfers
+            void update_dormant_transfers(const ptime& now);
+            void make_dormant(const boost::shared_ptr<transfer>& t);
 
 			void start_natpmp();
 			void start_upnp();
@@ -390,6 +470,34 @@ namespace libed2k {
             // this announce timer is used
             // by the DHT.
             deadline_timer m_dht_announce_timer;
+
+            // the index of the transfer which source will be
+            // checked for kad publish next. This implements a round robin.
+            cyclic_iterator<transfer_map> m_next_dht_transfer;
+
+            // shared files grouped by keywords for kad keyword publishing
+            dht::keyword_index m_dht_keywords;
+
+            // publish traversals in progress and finished publish traversals
+            int m_dht_source_publishes;
+            int m_dht_keyword_publishes;
+            int m_dht_published_sources;
+            int m_dht_published_keywords;
+
+            // the time the next kad source lookup may be started
+            // and the number of started source lookups
+            ptime m_next_dht_sources;
+            int m_dht_source_requests;
+
+            /**
+              * starts at most one source and one keyword publish
+              * every dht_settings::publish_delay seconds
+             */
+            void on_dht_announce(error_code const& e);
+            void dht_publish_source(const md4_hash& hash, size_type size);
+            void on_dht_source_published(const kad_id& id);
+            void on_dht_keyword_published(const kad_id& id);
+
             void on_dht_router_name_lookup(error_code const& e
                     , tcp::resolver::iterator host);
             void find_keyword(const std::string& keyword);
@@ -400,7 +508,8 @@ namespace libed2k {
              *
             */
             void on_traverse_completed(const kad_id& id);
-            void on_find_dht_source(const md4_hash& hash, uint8_t type, client_id_type ip, uint16_t port, client_id_type low_id);
+            void on_find_dht_source(const md4_hash& hash, uint8_t type, client_id_type ip, uint16_t port, client_id_type low_id
+                , client_id_type buddy_ip, uint16_t buddy_port, const md4_hash& buddy_hash);
             void on_find_dht_keyword(const md4_hash& h, const std::deque<kad_info_entry>&);
 
             std::set<md4_hash>    m_active_dht_requests;
@@ -425,13 +534,13 @@ namespace libed2k {
             // by torrent::get_download_queue.
             std::vector<block_info> m_block_info_storage;
 
-            // this pool is used to allocate and recycle send
-            // buffers from.
-            boost::pool<> m_send_buffers;
-            boost::mutex m_send_buffer_mutex;
+            // send buffers are allocated from power of two size
+            // classes starting from send_buffer_size, buffers
+            // bigger than the last class come from the system
+            std::vector<boost::shared_ptr<slab_allocator> > m_send_buffers;
 
             // this pool is used to allocate and recycle compressed data buffers
-            boost::pool<> m_z_buffers;
+            slab_allocator m_z_buffers;
 
             // used to skipping data in connections
             std::vector<char> m_skip_buffer;
@@ -473,6 +582,21 @@ namespace libed2k {
 
             bandwidth_channel* m_bandwidth_channel[2];
 
+            // limits, weights and minimum rates of groups of peers
+            peer_class_pool m_classes;
+
+            // assign classes to new connections, the flags of the
+            // ranges are sets of classes
+            ip_filter m_peer_class_filter;
+            peer_class_type_filter m_peer_class_type_filter;
+
+            // what we exchanged with every peer, in clients.met
+            client_credits m_credits;
+            ptime m_next_credits_save;
+
+            // the search in progress
+            search_aggregator m_search;
+
             // ed2k server connection
             boost::intrusive_ptr<server_connection> m_server_connection;
 
@@ -486,8 +610,8 @@ namespace libed2k {
             // peers.
             connection_map m_connections;
 
-            // filters incoming connections
-            ip_filter m_ip_filter;
+            // filters incoming connections, replaced as a whole on update
+            boost::shared_ptr<const compiled_ip_filter> m_ip_filter;
 
             // the ip-address of the interface
             // we are supposed to listen on.
@@ -516,6 +640,24 @@ namespace libed2k {
             // the timer used to fire the tick
             deadline_timer m_timer;
             ptime m_last_tick;
+            // the time the next batch of get sources requests
+            // may be sent to the server and the number of sent requests
+            ptime m_next_server_sources;
+            int m_server_source_requests;
+            // servers asked for sources over UDP and the time
+            // the next UDP query may be sent
+            global_source_finder m_global_sources;
+            ptime m_next_global_sources;
+            // outgoing connection attempts per second and results of the
+            // attempts since start and during the last second
+            int m_connect_rate;
+            int m_connect_attempts;
+            int m_connect_successes;
+            int m_connect_failures;
+            int m_connect_timeouts;
+            int m_second_connect_successes;
+            int m_second_connect_failures;
+            int m_second_connect_timeouts;
             // total redundant and failed bytes
             size_type m_total_failed_bytes;
             size_type m_total_redundant_bytes;
@@ -525,6 +667,11 @@ namespace libed2k {
 
             int m_queue_pos;
 
+            // transfers added by add_transfers() and not started yet
+            std::deque<boost::weak_ptr<transfer> > m_deferred_transfers;
+            // deferred transfers started and checking resume data now
+            std::vector<boost::weak_ptr<transfer> > m_deferred_checks;
+
             rate_limited_udp_socket m_udp_socket;
 
             boost::intrusive_ptr<natpmp> m_natpmp;
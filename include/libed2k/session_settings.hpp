@@ -64,13 +64,17 @@ namespace libed2k
             peer_timeout(120)
             , peer_connect_timeout(7)
             , block_request_timeout(10)
+            , min_request_queue(3)
+            , max_request_queue(32)
             , max_failcount(3)
             , min_reconnect_time(60)
-            , connection_speed(6)
+            , connection_speed(50)
             , allow_multiple_connections_per_ip(false)
             , recv_socket_buffer_size(0)
             , send_socket_buffer_size(0)
             , send_buffer_watermark(3 * BLOCK_SIZE)
+            , sendfile_upload(false)
+            , max_inflated_packet_size(8 * 1024 * 1024)
             , listen_port(4662)
             , client_name("libed2k")
             , mod_name("libed2k")
@@ -105,10 +109,28 @@ namespace libed2k
             , m_show_shared_files(true)
             , user_agent(md4_hash::emule)
             , user_agent_str(md4_hash::emule.toString())
+            , credits_save_interval(13*60)
             , ignore_resume_timestamps(false)
             , no_recheck_incomplete_resume(false)
+            , resume_data_peers(50)
             , seeding_outgoing_connections(false)
+            , dormant_seed_timeout(0)
+            , max_deferred_resume_checks(8)
             , alert_queue_size(1000)
+            , desired_sources(400)
+            , server_source_reask_time(15*60)
+            , server_source_requests(15)
+            , server_source_request_delay(20)
+            , dht_source_reask_time(60*60)
+            , max_dht_source_lookups(5)
+            , dht_source_request_delay(1)
+            , max_source_reask_backoff(8)
+            , global_source_request_delay(2)
+            , global_source_server_interval(60)
+            , global_source_files(35)
+            , global_source_reask_time(20*60)
+            , lowid_callback_timeout(45)
+            , lowid_callback_attempts(2)
             // Disk IO settings
             , file_pool_size(40)
             , max_queued_disk_bytes(16*1024*1024)
@@ -126,6 +148,8 @@ namespace libed2k
             , file_checks_delay_per_block(0)
             , disk_cache_algorithm(avoid_readback)
             , read_cache_line_size((32*16*1024) / BLOCK_SIZE)
+            , read_ahead_blocks((2*1024*1024) / BLOCK_SIZE)
+            , max_read_ahead_blocks((8*1024*1024) / BLOCK_SIZE)
             , write_cache_line_size((32*16*1024) / BLOCK_SIZE)
             , optimistic_disk_retry(10 * 60)
             , disable_hash_checks(false)
@@ -139,7 +163,9 @@ namespace libed2k
             , read_job_every(10)
             , use_disk_read_ahead(true)
             , lock_files(false)
+            , preallocate_sparse_files(false)
             , low_prio_disk(true)
+            , use_huge_pages(false)
             , peer_tos(0)
             , upnp_ignore_nonrouters(false)
         {
@@ -158,6 +184,13 @@ namespace libed2k
         // the number of seconds to wait for block request.
         int block_request_timeout;
 
+        // the number of blocks requested from a peer ahead is the bandwidth-delay
+        // product of the connection (download rate * request round trip time)
+        // plus one request packet, limited by these values.
+        // min_request_queue less than 3 is treated as 3
+        int min_request_queue;
+        int max_request_queue;
+
         // the number of times we can fail to connect to a peer
         // before we stop retrying it.
         int max_failcount;
@@ -166,8 +199,9 @@ namespace libed2k
         // this time is multiplied with the failcount.
         int min_reconnect_time;
 
-        // the number of connection attempts that
-        // are made per second.
+        // the max number of connection attempts that are made per
+        // second, the actual rate adapts to the connect results
+        // and free half-open slots
         int connection_speed;
 
         // false to not allow multiple connections from the same
@@ -187,6 +221,16 @@ namespace libed2k
         // the upload rate is low, this is the upper limit.
         int send_buffer_watermark;
 
+        // send requested parts of seeded files with sendfile() from the
+        // file to the socket instead of reading them into disk buffers
+        // first. Only used where sendfile() is available (linux), it
+        // bypasses the read cache and the disk thread
+        bool sendfile_upload;
+
+        // the max size of packed (OP_PACKEDPROT) packet after decompression,
+        // bigger packets are dropped to protect from zip bombs
+        int max_inflated_packet_size;
+
         // ed2k peer port for incoming peer connections
         int listen_port;
         // ed2k client name
@@ -300,6 +344,12 @@ namespace libed2k
         //!< known.met file
         std::string m_known_file;
 
+        //!< clients.met file with the credits of peers, empty keeps them in memory only
+        std::string m_clients_file;
+
+        // seconds between saves of clients.met, it is saved on exit too
+        int credits_save_interval;
+
         //!< users files and directories
         //!< second parameter true for recursive search and false otherwise
         fd_list m_fd_list;
@@ -322,13 +372,82 @@ namespace libed2k
         // we have none of the files and go straight to download
         bool no_recheck_incomplete_resume;
 
+        // the number of peers of a downloading transfer kept in its resume
+        // data. They are added back when the transfer loads, so it can
+        // reconnect before the server and kad answer
+        int resume_data_peers;
+
         // this controls whether or not seeding (and complete) transfers
         // attempt to make outgoing connections or not.
         bool seeding_outgoing_connections;
 
+        // complete seeds without peers for this number of seconds are kept in
+        // compact dormant form and seeds added in seed mode are dormant at once.
+        // A dormant transfer becomes full transfer again when some peer asks
+        // for the file or its handle is used, dormant_transfer_alert and
+        // woke_transfer_alert report both. 0 disables dormant transfers
+        int dormant_seed_timeout;
+
+        // transfers added by session::add_transfers() are started later, no more
+        // than this number of them check resume data in the disk thread at once
+        int max_deferred_resume_checks;
+
         // the max alert queue size
         int alert_queue_size;
 
+        /***************************
+         * Source request settings *
+         ***************************/
+
+        // the number of known sources per transfer at which
+        // the transfer stops asking servers and kad for more.
+        // Transfers with fewer known sources are asked first
+        int desired_sources;
+
+        // minimum number of seconds between two server source
+        // requests for the same transfer
+        int server_source_reask_time;
+
+        // the max number of get sources requests sent to the
+        // server at once and the number of seconds between
+        // two such batches
+        int server_source_requests;
+        int server_source_request_delay;
+
+        // minimum number of seconds between two kad source
+        // lookups for the same transfer
+        int dht_source_reask_time;
+
+        // the max number of kad lookups running at the same
+        // time and the number of seconds between starting two
+        // source lookups
+        int max_dht_source_lookups;
+        int dht_source_request_delay;
+
+        // when a source request doesn't bring any new source
+        // the reask time of the transfer is doubled, up to
+        // this multiple of the reask time. Any new source
+        // resets it back to the reask time
+        int max_source_reask_backoff;
+
+        // servers set by session::set_global_servers are asked
+        // for sources over UDP. One query goes out every
+        // global_source_request_delay seconds, the same server
+        // is queried not often than every global_source_server_interval
+        // seconds and one query carries at most global_source_files
+        // files. The same file is asked from the same server again
+        // after global_source_reask_time seconds
+        int global_source_request_delay;
+        int global_source_server_interval;
+        int global_source_files;
+        int global_source_reask_time;
+
+        // a LowID peer asked to connect to us has lowid_callback_timeout
+        // seconds to come, then the callback is sent again until it was
+        // sent lowid_callback_attempts times
+        int lowid_callback_timeout;
+        int lowid_callback_attempts;
+
         /********************
          * Disk IO settings *
          ********************/
@@ -419,8 +538,14 @@ namespace libed2k
         // the checking rate to 1.6 MiB per second
         int file_checks_delay_per_block;
 
+        // lru, largest_contiguous and avoid_readback select how the write
+        // cache is flushed, the read cache is evicted in least recently used
+        // order. arc flushes the write cache like avoid_readback and replaces
+        // read cache pieces by adaptive replacement (ARC): pieces served once
+        // don't push out the pieces requested over and over by other peers,
+        // so a single peer reading a whole file doesn't wipe the cache
         enum disk_cache_algo_t
-        { lru, largest_contiguous, avoid_readback };
+        { lru, largest_contiguous, avoid_readback, arc };
 
         disk_cache_algo_t disk_cache_algorithm;
 
@@ -428,6 +553,16 @@ namespace libed2k
         // when reading a block into the read cache
         int read_cache_line_size;
 
+        // when a peer reads a part forward, this many blocks of the
+        // part ahead of it are prefetched into the read cache in one
+        // read and the rest of the part is hinted to the OS. 0 disables
+        // the part read-ahead
+        int read_ahead_blocks;
+
+        // the max number of prefetched blocks in the read cache
+        // which no peer has asked for yet
+        int max_read_ahead_blocks;
+
         // whenever a contiguous range of this many
         // blocks is found in the write cache, it
         // is flushed immediately
@@ -489,6 +624,13 @@ namespace libed2k
         // preventing any other process from modifying them
         bool lock_files;
 
+        // in sparse mode, reserve the space of new files with fallocate
+        // where the filesystem supports it (linux). The space is reserved
+        // as unwritten extents at once, so large files are not fragmented
+        // by out of order writes, and the extents are still reported as
+        // holes, so checking the files doesn't read them
+        bool preallocate_sparse_files;
+
         // if this is set to true, the disk I/O will be
         // run at lower-than-normal priority. This is
         // intended to make the machine more responsive
@@ -496,6 +638,12 @@ namespace libed2k
         // in the background
         bool low_prio_disk;
 
+        // if this is set to true, slabs for disk, send and
+        // compressed data buffers are allocated from huge pages
+        // when the system has them reserved, otherwise they are
+        // marked for transparent huge pages where supported
+        bool use_huge_pages;
+
         // the TOS byte of all peer traffic (including
         // web seeds) is set to this value. The default
         // is the QBSS scavenger service
@@ -524,6 +672,12 @@ namespace libed2k
             , max_torrent_search_reply(20)
             , restrict_routing_ips(true)
             , restrict_search_ips(true)
+            , source_republish_interval(5 * 60 * 60)
+            , keyword_republish_interval(24 * 60 * 60)
+            , publish_delay(2)
+            , max_source_publishes(3)
+            , max_keyword_publishes(2)
+            , max_keyword_files(150)
         {}
 
         // the maximum number of peers to send in a
@@ -565,6 +719,23 @@ namespace libed2k
         // applies the same IP restrictions on nodes
         // received during a DHT search (traversal algorithm)
         bool restrict_search_ips;
+
+        // seconds between publishing our source for the same file
+        // and publishing the same keyword, eMule uses 5 and 24 hours
+        int source_republish_interval;
+        int keyword_republish_interval;
+
+        // seconds between starting two publish traversals of the same kind,
+        // spreads publishing of large share lists over time
+        int publish_delay;
+
+        // the max number of publish traversals running at the same time
+        int max_source_publishes;
+        int max_keyword_publishes;
+
+        // the max number of files published for one keyword at once,
+        // keywords with more files rotate through them on each republish
+        int max_keyword_files;
     };
 #endif
 
@@ -34,6 +34,7 @@ POSSIBILITY OF SUCH DAMAGE.
 #define LIBED2K_SESSION_STATUS_HPP_INCLUDED
 
 #include "libed2k/config.hpp"
+#include "libed2k/allocator.hpp"
 #include <vector>
 
 namespace libed2k
@@ -136,11 +137,55 @@ namespace libed2k
 		std::vector<dht_lookup> active_requests;
 		std::vector<dht_routing_bucket> dht_routing_table;
 		int dht_total_allocations;
+
+		// kad publishing: finished source and keyword publish traversals,
+		// keywords waiting for publish, publish requests sent to storing
+		// nodes and publish responses received
+		int dht_published_sources;
+		int dht_published_keywords;
+		int dht_publish_queue;
+		int dht_publish_requests;
+		int dht_publish_replies;
 #endif
 
+		// get sources requests sent to the server, kad source
+		// lookups started by the session and the number of
+		// downloading transfers which still want more sources
+		int server_source_requests;
+		int dht_source_requests;
+		int transfers_wanting_sources;
+
+		// UDP sources queries sent to global servers
+		// and queries those servers answered
+		int global_source_queries;
+		int global_source_answers;
+
+		// callbacks of LowID peers: pending, sent including
+		// retries, files joined a pending callback, peers which
+		// came back, callbacks given up and the average time
+		// peers took to connect in milliseconds
+		int lowid_callbacks_pending;
+		int lowid_callbacks_sent;
+		int lowid_callbacks_coalesced;
+		int lowid_callbacks_succeeded;
+		int lowid_callbacks_timed_out;
+		int lowid_callback_latency;
+
+		// allocation statistics of send and
+		// compressed data buffers
+		slab_allocator_stats network_buffers;
+
 		utp_status utp_stats;
 
 		int peerlist_size;
+
+		// outgoing connection attempts and their results, and the
+		// current limit of connection attempts per second
+		int connect_attempts;
+		int connect_successes;
+		int connect_failures;
+		int connect_timeouts;
+		int connect_rate;
 	};
 
 }
@@ -0,0 +1,118 @@
+#ifndef __LIBED2K_SLAB_ALLOCATOR__
+#define __LIBED2K_SLAB_ALLOCATOR__
+
+#include <vector>
+#include <boost/noncopyable.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/thread/tss.hpp>
+#include <boost/detail/atomic_count.hpp>
+
+#include "libed2k/config.hpp"
+#include "libed2k/thread.hpp"
+#include "libed2k/allocator.hpp"
+
+namespace libed2k
+{
+    /**
+      * fixed size objects cut from big page aligned slabs
+      *
+      * objects of page size and more are page aligned, so they can be used
+      * for unbuffered (file::no_buffer) disk IO. Every thread keeps a small
+      * cache of free objects and takes the lock only when the cache runs
+      * empty or overflows, so buffers moving between network and disk
+      * threads mostly don't contend.
+     */
+    class LIBED2K_EXTRA_EXPORT slab_allocator : boost::noncopyable
+    {
+    public:
+        /**
+          * object_size is rounded up to 16 bytes, or to page size for page size objects and more
+          * cache_size is the max number of free objects kept by every thread, 0 disables caches
+         */
+        slab_allocator(int object_size, int objects_per_slab, int cache_size);
+        ~slab_allocator();
+
+        char* allocate();
+        void free(char* buf);
+
+        // give slabs without allocated objects back to the system
+        void release_memory();
+
+        // new slabs will try to use huge pages
+        void set_huge_pages(bool b);
+
+        bool is_from(char* buf) const;
+        int object_size() const { return m_object_size; }
+        slab_allocator_stats stats() const;
+
+    private:
+        struct thread_cache;
+
+        /**
+          * the lock and the list of thread caches. Caches keep it alive,
+          * a thread may exit after its allocator was destroyed
+         */
+        struct shared_state
+        {
+            shared_state(slab_allocator* a)
+                : owner(a), allocations(0), frees(0), cache_hits(0), refills(0) {}
+            mutex                       m;
+            // null once the allocator is destroyed
+            slab_allocator*             owner;
+            std::vector<thread_cache*>  caches;
+            // counters of the caches of exited threads
+            size_type                   allocations;
+            size_type                   frees;
+            size_type                   cache_hits;
+            size_type                   refills;
+        };
+
+        struct thread_cache
+        {
+            thread_cache(const boost::shared_ptr<shared_state>& s)
+                : state(s), allocations(0), frees(0), cache_hits(0), refills(0) {}
+            boost::shared_ptr<shared_state> state;
+            std::vector<char*>  objects;
+            // counted by the owning thread without the lock, stats() reads them
+            boost::detail::atomic_count allocations;
+            boost::detail::atomic_count frees;
+            boost::detail::atomic_count cache_hits;
+            // changed with the lock held
+            size_type           refills;
+        };
+
+        struct slab
+        {
+            char*   begin;
+            size_t  size;
+            bool    huge_pages;
+            bool operator<(const slab& s) const { return begin < s.begin; }
+        };
+
+        thread_cache& local_cache();
+
+        // called on thread exit, gives the cached objects back and
+        // adds the counters of the cache to the totals
+        static void release_cache(thread_cache* c);
+
+        // must be called with m_state->m held
+        bool add_slab();
+        void release_slab(const slab& s);
+        std::vector<slab>::const_iterator find_slab(char* buf) const;
+
+        const int   m_object_size;
+        const int   m_objects_per_slab;
+        const int   m_cache_size;
+        bool        m_huge_pages;
+
+        boost::shared_ptr<shared_state> m_state;
+
+        // shared free list and slabs sorted by address, guarded by m_state->m
+        std::vector<char*>  m_free;
+        std::vector<slab>   m_slabs;
+
+        boost::thread_specific_ptr<thread_cache> m_local;
+    };
+}
+
+#endif
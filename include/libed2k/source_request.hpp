@@ -0,0 +1,66 @@
+#ifndef __LIBED2K_SOURCE_REQUEST__
+#define __LIBED2K_SOURCE_REQUEST__
+
+#include <vector>
+#include <algorithm>
+
+#include "libed2k/config.hpp"
+#include "libed2k/time.hpp"
+
+namespace libed2k
+{
+    /**
+      * periodic source requests of a transfer over one channel,
+      * reask time grows while requests bring no new sources
+     */
+    class LIBED2K_EXTRA_EXPORT source_request
+    {
+    public:
+        source_request();
+
+        /** sources may be requested again */
+        bool due(const ptime& now) const { return m_next <= now; }
+
+        /**
+          * a request is sent now: the next one waits reask_time seconds times
+          * the backoff, which doubles up to max_backoff while nothing is found
+         */
+        void schedule(int reask_time, int max_backoff, const ptime& now);
+
+        /** a new source came over this channel */
+        void found() { ++m_found; }
+
+        int backoff() const { return m_backoff; }
+        ptime next() const { return m_next; }
+
+    private:
+        ptime m_next;               //!< time when sources may be requested again
+        int m_backoff;              //!< reask time multiplier
+        int m_found;                //!< new sources got over this channel
+        int m_found_at_request;     //!< found value when the last request was sent
+    };
+
+    namespace detail
+    {
+        template<typename Ptr>
+        bool more_sources_needed(const Ptr& lhs, const Ptr& rhs)
+        {
+            return lhs->sources_needed() > rhs->sources_needed();
+        }
+    }
+
+    /**
+      * moves at most max_batch of the most source-starving candidates to
+      * the front and returns their number
+     */
+    template<typename Ptr>
+    size_t source_request_batch(std::vector<Ptr>& candidates, int max_batch)
+    {
+        size_t batch = std::min(candidates.size(), size_t(std::max(max_batch, 1)));
+        std::partial_sort(candidates.begin(), candidates.begin() + batch, candidates.end(),
+                          &detail::more_sources_needed<Ptr>);
+        return batch;
+    }
+}
+
+#endif
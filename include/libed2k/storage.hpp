@@ -129,6 +129,13 @@ namespace libed2k
         // is not in a sparse region, start itself is returned
         virtual int sparse_end(int start) const { return start; }
 
+        // opens the file the range of the slot is stored in for reading
+        // and sets file_offset to where the range starts in it. Returns
+        // null if the range spans files or the storage has no real files
+        virtual boost::intrusive_ptr<file> open_range(int /* slot */, int /* offset */
+            , int /* size */, size_type& /* file_offset */, error_code& /* ec */)
+        { return boost::intrusive_ptr<file>(); }
+
         // non-zero return value indicates an error
         virtual bool move_storage(std::string const& save_path) = 0;
 
@@ -198,6 +205,8 @@ namespace libed2k
         int read(char* buf, int slot, int offset, int size);
         int write(char const* buf, int slot, int offset, int size);
         int sparse_end(int start) const;
+        boost::intrusive_ptr<file> open_range(int slot, int offset, int size
+            , size_type& file_offset, error_code& ec);
         void hint_read(int slot, int offset, int len);
         int readv(file::iovec_t const* bufs, int slot, int offset, int num_bufs);
         int writev(file::iovec_t const* buf, int slot, int offset, int num_bufs);
@@ -322,7 +331,13 @@ namespace libed2k
             peer_request const& r
             , boost::function<void(int, disk_io_job const&)> const& handler
             , int cache_line_size = 0
-            , int cache_expiry = 0);
+            , int cache_expiry = 0
+            , boost::uint32_t requester = 0);
+
+        // the file and the offset in it to send the block from without
+        // reading it through the disk thread. Null in compact mode
+        boost::intrusive_ptr<file> open_for_upload(peer_request const& r
+            , size_type& file_offset, error_code& ec);
 
         void async_read_and_hash(
             peer_request const& r
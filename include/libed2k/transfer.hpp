@@ -20,6 +20,11 @@
 #include "libed2k/stat.hpp"
 #include "libed2k/transfer_handle.hpp"
 #include "libed2k/bandwidth_limit.hpp"
+#include "libed2k/dormant_transfer.hpp"
+#include "libed2k/source_request.hpp"
+#ifndef LIBED2K_DISABLE_DHT
+#include "libed2k/kademlia/kad_packet_struct.hpp"
+#endif
 
 namespace libed2k
 {
@@ -35,6 +40,48 @@ namespace libed2k
     struct disk_io_job;
     class session_settings;
 
+    // pieces with deadline, the earliest deadline first
+    class time_critical_pieces
+    {
+    public:
+        struct entry
+        {
+            ptime deadline;
+            int piece;
+            bool operator<(const entry& rhs) const { return deadline < rhs.deadline; }
+        };
+
+        // adds the piece or moves it to the new deadline, pieces
+        // of the same deadline keep the order they were added in
+        void set(int piece, const ptime& deadline)
+        {
+            remove(piece);
+            entry e;
+            e.deadline = deadline;
+            e.piece = piece;
+            m_pieces.insert(std::upper_bound(m_pieces.begin(), m_pieces.end(), e), e);
+        }
+
+        // false if the piece had no deadline
+        bool remove(int piece)
+        {
+            for (std::vector<entry>::iterator i = m_pieces.begin(); i != m_pieces.end(); ++i)
+            {
+                if (i->piece != piece) continue;
+                m_pieces.erase(i);
+                return true;
+            }
+            return false;
+        }
+
+        void clear() { m_pieces.clear(); }
+        bool empty() const { return m_pieces.empty(); }
+        const std::vector<entry>& pieces() const { return m_pieces; }
+
+    private:
+        std::vector<entry> m_pieces;
+    };
+
     // a transfer is a class that holds information
     // for a specific download. It updates itself against
     // the tracker
@@ -69,11 +116,15 @@ namespace libed2k
         void set_state(transfer_status::state_t s);
 
         aux::session_impl& session() { return m_ses; }
+        const boost::shared_ptr<transfer_link>& link() const { return m_link; }
+        /** transfer woken from dormant state takes the link of its handles */
+        void set_link(const boost::shared_ptr<transfer_link>& link) { m_link = link; }
         const session_settings& settings() const;
 
         bool valid_metadata() const;
 
         bool want_more_peers() const;
+        // ask server and kad for sources right now
         void request_peers();
         void add_peer(const tcp::endpoint& peer, int source);
         bool connect_to_peer(peer* peerinfo);
@@ -101,19 +152,25 @@ namespace libed2k
         int num_seeds() const;
 
         bool is_paused() const;
+        // the picker is dropped once all pieces are here, a transfer
+        // not started yet has no picker and knows nothing of its pieces
         bool is_seed() const
         {
-            return !m_picker || m_picker->num_have() == m_picker->num_pieces();
+            if (!m_picker) return is_started();
+            return m_picker->num_have() == m_picker->num_pieces();
         }
 
         // this is true if we have all the pieces that we want
         bool is_finished() const
         {
             if (is_seed()) return true;
+            if (!m_picker) return false;
             return (num_pieces() - m_picker->num_have() == 0);
         }
 
         bool is_aborted() const { return m_abort; }
+        /** storage is created, transfers added in batch are started later */
+        bool is_started() const { return m_storage != 0; }
         bool is_announced() const { return m_announced; }
         void set_announced(bool announced) { m_announced = announced; }
         transfer_status::state_t state() const { return m_state; }
@@ -133,6 +190,10 @@ namespace libed2k
         void set_download_limit(int limit);
         int download_limit() const;
 
+        // peers of the transfer are in these classes besides their own
+        void set_peer_classes(boost::uint32_t classes) { m_peer_classes = classes; }
+        boost::uint32_t peer_classes() const { return m_peer_classes; }
+
         void piece_availability(std::vector<int>& avail) const;
 
         void set_piece_priority(int index, int priority);
@@ -145,6 +206,18 @@ namespace libed2k
         void set_sequential_download(bool sd);
         bool is_sequential_download() const { return m_sequential_download; }
 
+        // deadline in milliseconds from now
+        void set_piece_deadline(int index, int deadline);
+        void reset_piece_deadline(int index);
+        bool has_time_critical_pieces() const { return !m_time_critical_pieces.empty(); }
+
+        // all wanted blocks are requested already, the rest
+        // may be requested from several peers at once
+        bool end_game() const;
+
+        // cancels requests of the block in all peers except the one it came from
+        void cancel_block(const piece_block& block, peer_connection* src);
+
         int queue_position() const { return m_sequence_number; }
 
         void second_tick(stat& accumulator, int tick_interval_ms, const ptime& now);
@@ -204,7 +277,7 @@ namespace libed2k
         // returns true if we have downloaded the given piece
         bool have_piece(int index) const
         {
-            return has_picker() ? m_picker->have_piece(index) : true;
+            return has_picker() ? m_picker->have_piece(index) : is_seed();
         }
         bitfield have_pieces() const;
 
@@ -214,7 +287,8 @@ namespace libed2k
 
         size_t num_have() const
         {
-            return has_picker() ? m_picker->num_have() : num_pieces();
+            if (has_picker()) return m_picker->num_have();
+            return is_seed() ? num_pieces() : 0;
         }
 
         void peer_has(int index)
@@ -226,7 +300,7 @@ namespace libed2k
             }
             else
             {
-                assert(is_seed());
+                assert(is_seed() || !is_started());
             }
         }
 
@@ -268,6 +342,8 @@ namespace libed2k
         bool active() const;
         void activate(bool a);
         boost::uint16_t last_active() const { return m_last_active; }
+        /** complete transfer has no peers for timeout and can be kept in dormant form */
+        bool idle_seed(const ptime& now, const time_duration& timeout) const;
 
         // --------------------------------------------
         // SERVER MANAGEMENT
@@ -299,9 +375,32 @@ namespace libed2k
         bandwidth_channel m_bandwidth_channel[2];
         //int bandwidth_throttle(int channel) const;
 
+        // set of peer classes (1 << class id)
+        boost::uint32_t m_peer_classes;
+
+        // --------------------------------------------
+        // SOURCE REQUESTS
+        // --------------------------------------------
+        /** share of desired sources we still miss: 0 - enough sources, 1 - no sources at all */
+        float sources_needed() const;
+        /** downloading transfer which has less known sources than desired */
+        bool want_more_sources() const;
+        bool server_sources_due(const ptime& now) const;
+        void request_server_sources(const ptime& now);
+#ifndef LIBED2K_DISABLE_DHT
+        bool dht_sources_due(const ptime& now) const;
+        void request_dht_sources(const ptime& now);
+#endif
+
 #ifndef LIBED2K_DISABLE_DHT
+        /** source publish is due and transfer has something to share */
         bool should_announce_dht() const;
+        /** publish this transfer as source in kad */
         void dht_announce();
+        ptime next_dht_announce() const { return m_next_dht_announce; }
+        void set_next_dht_announce(const ptime& t) { m_next_dht_announce = t; }
+        /** convert transfer info into kad keyword publish entry */
+        kad_info_entry get_dht_keyword_entry() const;
         //static void on_dht_announce_response_disp(boost::weak_ptr<transfer> t
         //        , kad_id const& id);
         void on_dht_announce_response(std::vector<tcp::endpoint> const& peers);
@@ -317,6 +416,10 @@ namespace libed2k
         void write_resume_data(entry& rd) const;
         void read_resume_data(lazy_entry const& rd);
 
+        void remove_time_critical_piece(int index);
+        // spreads blocks of time critical pieces over peers, fastest first
+        void request_time_critical_pieces();
+
         // this is the upload and download statistics for the whole transfer.
         // it's updated from all its peers once every second.
         stat m_stat;
@@ -377,6 +480,9 @@ namespace libed2k
         // should store valid file path
         boost::intrusive_ptr<transfer_info> m_info;
 
+        // shared with the dormant record while the transfer sleeps
+        boost::shared_ptr<transfer_link> m_link;
+
         boost::uint32_t m_accepted;
         boost::uint32_t m_requested;
         boost::uint64_t m_transferred;
@@ -418,7 +524,12 @@ namespace libed2k
         // the object.
         piece_manager* m_storage;
 
-        duration_timer m_minute_timer;
+        source_request m_server_sources;
+#ifndef LIBED2K_DISABLE_DHT
+        source_request m_dht_sources;
+#endif
+
+        time_critical_pieces m_time_critical_pieces;
 
         /** previously saved resume data */
         std::vector<char>  m_resume_data;
@@ -433,9 +544,22 @@ namespace libed2k
 
         // the number of seconds since the last active state
         boost::uint16_t m_last_active;
+
+        // the time the last peer was disconnected
+        ptime m_last_peer_time;
+
+#ifndef LIBED2K_DISABLE_DHT
+        // the time our source for this transfer should be published in kad again
+        ptime m_next_dht_announce;
+#endif
     };
 
     extern shared_file_entry transfer2sfe(const std::pair<md4_hash, boost::shared_ptr<transfer> >& tran);
+    extern shared_file_entry make_announce(aux::session_impl& ses, const md4_hash& hash,
+                                           const std::string& name, size_type size, bool complete);
+#ifndef LIBED2K_DISABLE_DHT
+    extern kad_info_entry make_dht_keyword_entry(const md4_hash& hash, const std::string& name, size_type size);
+#endif
 }
 
 #endif
@@ -15,6 +15,7 @@ namespace libed2k
 {
     class transfer;
     class add_transfer_params;
+    struct transfer_link;
     namespace aux
     {
         class session_impl_base;
@@ -289,12 +290,20 @@ namespace libed2k
         void set_piece_priority(int index, int priority) const;
         int piece_priority(int index) const;
         std::vector<int> piece_priorities() const;
+        // request the piece before deadline milliseconds from now pass,
+        // blocks of such pieces are requested first from the fastest peers
+        void set_piece_deadline(int index, int deadline) const;
+        void reset_piece_deadline(int index) const;
         bool is_sequential_download() const;
         void set_sequential_download(bool sd) const;
         void set_upload_limit(int limit) const;
         int upload_limit() const;
         void set_download_limit(int limit) const;
         int download_limit() const;
+        // set of peer classes (1 << class id) all peers of the transfer are in,
+        // see session::create_peer_class()
+        void set_peer_classes(boost::uint32_t classes) const;
+        boost::uint32_t peer_classes() const;
         void set_upload_mode(bool b) const;
         void set_eager_mode(bool b) const;
 
@@ -312,21 +321,27 @@ namespace libed2k
         void move_storage(std::string const& save_path) const;
         bool rename_file(const std::string& name) const;
 
+        // a handle stays the same while its transfer sleeps and wakes up
         bool operator==(const transfer_handle& h) const
-        { return m_transfer.lock() == h.m_transfer.lock(); }
+        { return key() == h.key(); }
 
         bool operator!=(const transfer_handle& h) const
-        { return m_transfer.lock() != h.m_transfer.lock(); }
+        { return key() != h.key(); }
 
         bool operator<(const transfer_handle& h) const
-        { return m_transfer.lock() < h.m_transfer.lock(); }
+        { return key() < h.key(); }
     private:
 
-        transfer_handle(const boost::weak_ptr<transfer>& t):
-            m_transfer(t)
+        transfer_handle(const boost::weak_ptr<transfer>& t);
+        // handle of dormant transfer, it wakes up on the first call
+        transfer_handle(const boost::weak_ptr<transfer>& t, const boost::weak_ptr<transfer_link>& link):
+            m_transfer(t), m_link(link)
         {}
 
-        boost::weak_ptr<transfer> m_transfer;
+        boost::shared_ptr<void> key() const;
+
+        mutable boost::weak_ptr<transfer> m_transfer;
+        boost::weak_ptr<transfer_link> m_link;
     };
 
     struct LIBED2K_EXPORT block_info
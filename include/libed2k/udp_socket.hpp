@@ -42,7 +42,10 @@ POSSIBILITY OF SUCH DAMAGE.
 #include "libed2k/deadline_timer.hpp"
 
 #include <deque>
+#include <vector>
 #include <boost/function/function4.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/weak_ptr.hpp>
 
 namespace libed2k
 {
@@ -59,7 +62,9 @@ namespace libed2k
         udp_socket(io_service& ios, callback_t const& c, callback2_t const& c2, connection_queue& cc);
         ~udp_socket();
 
-        enum flags_t { dont_drop = 1, peer_connection = 2 };
+        // batch: the packet may be sent later in this io_service round,
+        // together with the other batched packets (sendmmsg on linux)
+        enum flags_t { dont_drop = 1, peer_connection = 2, batch = 4 };
 
         bool is_open() const
         {
@@ -167,6 +172,24 @@ namespace libed2k
         void maybe_realloc_buffers(int which = 3);
         bool maybe_clear_callback();
 
+#if LIBED2K_USE_MMSG
+        // datagrams per recvmmsg/sendmmsg call, packets sent with the batch
+        // flag while this many are waiting go out right away
+        enum { mmsg_batch_size = 32, max_send_batch = 1000 };
+
+        // a datagram of m_send_batch_buf
+        struct batched_packet
+        {
+            udp::endpoint ep;
+            int offset;
+            int len;
+        };
+
+        void drain_socket(udp::socket* s);
+        static void on_flush_sends(boost::weak_ptr<udp_socket*> self);
+        void flush_sends();
+#endif
+
 #if defined LIBED2K_DEBUG || LIBED2K_RELEASE_ASSERTS
 #if defined BOOST_HAS_PTHREADS
         mutable pthread_t m_thread;
@@ -242,6 +265,23 @@ namespace libed2k
         // them once we're connected
         std::deque<queued_packet> m_queue;
 
+#if LIBED2K_USE_MMSG
+        // datagrams read by drain_socket(), mmsg_batch_size buffers
+        // of m_v4_buf_size bytes
+        std::vector<char> m_batch_buf;
+
+        // packets sent with the batch flag, flushed by flush_sends().
+        // Their payloads are appended to one buffer which keeps its
+        // capacity between the flushes
+        std::vector<batched_packet> m_send_batch;
+        std::vector<char> m_send_batch_buf;
+        bool m_flush_posted;
+
+        // the posted flush holds a weak reference to this, it does
+        // nothing when the socket is gone meanwhile
+        boost::shared_ptr<udp_socket*> m_self;
+#endif
+
         // counts the number of outstanding async
         // operations hanging on this socket
         int m_outstanding_ops;
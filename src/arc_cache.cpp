@@ -0,0 +1,131 @@
+#include "libed2k/pch.hpp"
+
+#include <algorithm>
+#include <climits>
+#include <boost/cstdint.hpp>
+#include <boost/next_prior.hpp>
+
+#include "libed2k/arc_cache.hpp"
+#include "libed2k/assert.hpp"
+
+namespace libed2k
+{
+    void arc_policy::ghost_list::push(const key_type& key, int size)
+    {
+        index_t::iterator i = index.find(key);
+        if (i != index.end()) erase(i);
+
+        order.push_back(std::make_pair(key, size));
+        index.insert(std::make_pair(key, boost::prior(order.end())));
+        blocks += size;
+    }
+
+    void arc_policy::ghost_list::erase(index_t::iterator i)
+    {
+        blocks -= i->second->second;
+        order.erase(i->second);
+        index.erase(i);
+    }
+
+    void arc_policy::ghost_list::trim(int capacity)
+    {
+        while (blocks > capacity && !order.empty())
+            erase(index.find(order.front().first));
+    }
+
+    void arc_policy::ghost_list::clear()
+    {
+        order.clear();
+        index.clear();
+        blocks = 0;
+    }
+
+    arc_policy::arc_policy() : m_capacity(0), m_target(0)
+    {
+    }
+
+    void arc_policy::set_capacity(int blocks)
+    {
+        m_capacity = (std::max)(blocks, 0);
+        m_target = (std::min)(m_target, m_capacity);
+        m_ghosts[0].trim(m_capacity);
+        m_ghosts[1].trim(m_capacity);
+    }
+
+    arc_policy::list_t arc_policy::miss(const key_type& key)
+    {
+        ghost_list& b1 = m_ghosts[0];
+        ghost_list& b2 = m_ghosts[1];
+
+        ghost_list::index_t::iterator i = b1.index.find(key);
+        if (i != b1.index.end())
+        {
+            // the recent list was too short to keep this piece, grow it
+            int size = i->second->second;
+            int delta = (b2.blocks > b1.blocks && b1.blocks > 0)
+                ? int(boost::int64_t(size) * b2.blocks / b1.blocks) : size;
+            m_target = (std::min)(m_target + delta, m_capacity);
+            b1.erase(i);
+            return recent;
+        }
+
+        i = b2.index.find(key);
+        if (i != b2.index.end())
+        {
+            int size = i->second->second;
+            int delta = (b1.blocks > b2.blocks && b2.blocks > 0)
+                ? int(boost::int64_t(size) * b1.blocks / b2.blocks) : size;
+            m_target = (std::max)(m_target - delta, 0);
+            b2.erase(i);
+            return frequent;
+        }
+
+        return none;
+    }
+
+    void arc_policy::evicted(const key_type& key, int blocks, list_t from)
+    {
+        LIBED2K_ASSERT(from != none);
+        if (blocks <= 0) return;
+
+        ghost_list& g = m_ghosts[from == recent ? 0 : 1];
+        g.push(key, blocks);
+        g.trim(m_capacity);
+    }
+
+    arc_policy::list_t arc_policy::replace(int recent_blocks, int frequent_blocks) const
+    {
+        if (recent_blocks == 0) return frequent;
+        if (frequent_blocks == 0) return recent;
+        return recent_blocks > m_target ? recent : frequent;
+    }
+
+    void arc_policy::forget(void* storage)
+    {
+        for (int l = 0; l < 2; ++l)
+        {
+            ghost_list& g = m_ghosts[l];
+            ghost_list::index_t::iterator i = g.index.lower_bound(key_type(storage, INT_MIN));
+            while (i != g.index.end() && i->first.first == storage) g.erase(i++);
+        }
+    }
+
+    void arc_policy::clear()
+    {
+        m_ghosts[0].clear();
+        m_ghosts[1].clear();
+        m_target = 0;
+    }
+
+    int arc_policy::ghost_size(list_t l) const
+    {
+        if (l == none) return 0;
+        return m_ghosts[l == recent ? 0 : 1].blocks;
+    }
+
+    size_t arc_policy::ghost_pieces(list_t l) const
+    {
+        if (l == none) return 0;
+        return m_ghosts[l == recent ? 0 : 1].order.size();
+    }
+}
@@ -36,8 +36,8 @@ POSSIBILITY OF SUCH DAMAGE.
 namespace libed2k
 {
     bandwidth_channel::bandwidth_channel()
-        : tmp(0)
-        , distribute_quota(0)
+        : queued(0)
+        , queue_slot(-1)
         , m_quota_left(0)
         , m_limit(0)
     {}
@@ -62,8 +62,7 @@ namespace libed2k
         if (m_limit == 0) return;
         m_quota_left += (m_limit * dt_milliseconds + 500) / 1000;
         if (m_quota_left > m_limit * 3) m_quota_left = m_limit * 3;
-        distribute_quota = int((std::max)(m_quota_left, boost::int64_t(0)));
-   }
+    }
 
     // this is used when connections disconnect with
     // some quota left. It's returned to its bandwidth
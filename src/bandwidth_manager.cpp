@@ -30,18 +30,32 @@ POSSIBILITY OF SUCH DAMAGE.
 
 */
 
+#include <algorithm>
+
 #include "libed2k/bandwidth_manager.hpp"
-#include "libed2k/peer_connection.hpp"
 #include "libed2k/time.hpp"
 #include "libed2k/invariant_check.hpp"
 
 namespace libed2k
 {
+    namespace
+    {
+        // heap order, true if a is served after b
+        bool served_after(const bw_request& a, const bw_request& b)
+        {
+            if (a.guaranteed != b.guaranteed) return b.guaranteed;
+            if (a.finish != b.finish) return a.finish > b.finish;
+            return a.sequence > b.sequence;
+        }
+    }
 
     bandwidth_manager::bandwidth_manager(int channel)
         : m_queued_bytes(0)
         , m_channel(channel)
         , m_abort(false)
+        , m_num_blocked(0)
+        , m_virtual_time(0)
+        , m_sequence(0)
     {
     }
 
@@ -49,42 +63,46 @@ namespace libed2k
     {
         m_abort = true;
         m_queue.clear();
+        m_channels.clear();
+        m_blocked.clear();
+        m_num_blocked = 0;
+        m_guarantees.clear();
         m_queued_bytes = 0;
     }
 
 #if defined LIBED2K_DEBUG || LIBED2K_RELEASE_ASSERTS
-    bool bandwidth_manager::is_queued(const peer_connection* peer) const
+    bool bandwidth_manager::is_queued(const bandwidth_socket* peer) const
     {
         for (queue_t::const_iterator i = m_queue.begin()
             , end(m_queue.end()); i != end; ++i)
         {
             if (i->peer.get() == peer) return true;
         }
+
+        for (std::vector<queue_t>::const_iterator b = m_blocked.begin()
+            , end(m_blocked.end()); b != end; ++b)
+        {
+            for (queue_t::const_iterator i = b->begin(); i != b->end(); ++i)
+                if (i->peer.get() == peer) return true;
+        }
         return false;
     }
 #endif
 
     int bandwidth_manager::queue_size() const
     {
-        return m_queue.size();
+        return m_queue.size() + m_num_blocked;
     }
 
     int bandwidth_manager::queued_bytes() const
     {
         return m_queued_bytes;
     }
-    
-    // non prioritized means that, if there's a line for bandwidth,
-    // others will cut in front of the non-prioritized peers.
-    // this is used by web seeds
-    int bandwidth_manager::request_bandwidth(const boost::intrusive_ptr<peer_connection>& peer
+
+    int bandwidth_manager::request_bandwidth(const boost::intrusive_ptr<bandwidth_socket>& peer
         , int blk, int priority
-        , bandwidth_channel* chan1
-        , bandwidth_channel* chan2
-        , bandwidth_channel* chan3
-        , bandwidth_channel* chan4
-        , bandwidth_channel* chan5
-        )
+        , bandwidth_channel** chan, int num_channels
+        , bandwidth_channel* guarantee)
     {
         LIBED2K_INVARIANT_CHECK;
         if (m_abort) return 0;
@@ -94,13 +112,13 @@ namespace libed2k
         LIBED2K_ASSERT(!is_queued(peer.get()));
 
         bw_request bwr(peer, blk, priority);
-        int i = 0;
-        if (chan1 && chan1->throttle() > 0) bwr.channel[i++] = chan1;
-        if (chan2 && chan2->throttle() > 0) bwr.channel[i++] = chan2;
-        if (chan3 && chan3->throttle() > 0) bwr.channel[i++] = chan3;
-        if (chan4 && chan4->throttle() > 0) bwr.channel[i++] = chan4;
-        if (chan5 && chan5->throttle() > 0) bwr.channel[i++] = chan5;
-        if (i == 0)
+        for (int i = 0; i < num_channels && bwr.num_channels < bw_request::max_channels; ++i)
+        {
+            if (chan[i] && chan[i]->throttle() > 0)
+                bwr.channel[bwr.num_channels++] = chan[i];
+        }
+
+        if (bwr.num_channels == 0)
         {
             // the connection is not rate limited by any of its
             // bandwidth channels, or it doesn't belong to any
@@ -108,8 +126,22 @@ namespace libed2k
             // the queue, just satisfy the request immediately
             return blk;
         }
+
+        if (guarantee && guarantee->throttle() > 0)
+        {
+            bwr.guarantee = guarantee;
+            bwr.guaranteed = guarantee->quota_left() > 0;
+            if (std::find(m_guarantees.begin(), m_guarantees.end(), guarantee) == m_guarantees.end())
+                m_guarantees.push_back(guarantee);
+        }
+
+        bwr.finish = m_virtual_time + double(blk) / priority;
+        bwr.sequence = m_sequence++;
+        enqueue(bwr);
+
         m_queued_bytes += blk;
         m_queue.push_back(bwr);
+        std::push_heap(m_queue.begin(), m_queue.end(), &served_after);
         return 0;
     }
 
@@ -120,97 +152,147 @@ namespace libed2k
         for (queue_t::const_iterator i = m_queue.begin()
             , end(m_queue.end()); i != end; ++i)
         {
-            queued += i->request_size - i->assigned;
+            queued += i->request_size;
+        }
+
+        int blocked = 0;
+        for (std::vector<queue_t>::const_iterator b = m_blocked.begin()
+            , end(m_blocked.end()); b != end; ++b)
+        {
+            for (queue_t::const_iterator i = b->begin(); i != b->end(); ++i)
+                queued += i->request_size;
+            blocked += int(b->size());
         }
         LIBED2K_ASSERT(queued == m_queued_bytes);
+        LIBED2K_ASSERT(blocked == m_num_blocked);
+        LIBED2K_ASSERT(m_blocked.size() == m_channels.size());
+
+        for (int i = 0; i < int(m_channels.size()); ++i)
+        {
+            LIBED2K_ASSERT(m_channels[i]->queue_slot == i);
+            LIBED2K_ASSERT(m_channels[i]->queued > 0);
+        }
     }
 #endif
 
+    void bandwidth_manager::enqueue(bw_request& r)
+    {
+        for (int j = 0; j < r.num_channels; ++j) add_channel(r.channel[j]);
+        if (r.guarantee) add_channel(r.guarantee);
+    }
+
+    void bandwidth_manager::dequeue(bw_request& r)
+    {
+        for (int j = 0; j < r.num_channels; ++j) remove_channel(r.channel[j]);
+        if (r.guarantee) remove_channel(r.guarantee);
+    }
+
+    void bandwidth_manager::add_channel(bandwidth_channel* c)
+    {
+        if (c->queued++ > 0) return;
+        c->queue_slot = int(m_channels.size());
+        m_channels.push_back(c);
+        m_blocked.push_back(queue_t());
+    }
+
+    void bandwidth_manager::remove_channel(bandwidth_channel* c)
+    {
+        LIBED2K_ASSERT(c->queued > 0);
+        if (--c->queued > 0) return;
+
+        // the channel may be destructed once it has no requests
+        // queued, take it out of the list now
+        LIBED2K_ASSERT(m_channels[c->queue_slot] == c);
+        // requests blocked by it hold it queued
+        LIBED2K_ASSERT(m_blocked[c->queue_slot].empty());
+        m_channels[c->queue_slot] = m_channels.back();
+        m_channels[c->queue_slot]->queue_slot = c->queue_slot;
+        m_channels.pop_back();
+        m_blocked[c->queue_slot].swap(m_blocked.back());
+        m_blocked.pop_back();
+        c->queue_slot = -1;
+    }
+
     void bandwidth_manager::update_quotas(time_duration const& dt)
     {
         if (m_abort) return;
-        if (m_queue.empty()) return;
 
         LIBED2K_INVARIANT_CHECK;
 
         int dt_milliseconds = total_milliseconds(dt);
         if (dt_milliseconds > 3000) dt_milliseconds = 3000;
 
-        // for each bandwidth channel, call update_quota(dt)
+        // the guarantees with waiting requests are refilled below
+        for (std::vector<bandwidth_channel*>::iterator i = m_guarantees.begin()
+            , end(m_guarantees.end()); i != end; ++i)
+        {
+            if ((*i)->queued == 0) (*i)->update_quota(dt_milliseconds);
+        }
 
-        std::vector<bandwidth_channel*> channels;
+        if (m_queue.empty() && m_num_blocked == 0) return;
 
-        for (queue_t::iterator i = m_queue.begin();
-            i != m_queue.end();)
+        for (int k = 0; k < int(m_channels.size()); ++k)
         {
-            if (i->peer->is_disconnecting())
-            {
-                m_queued_bytes -= i->request_size - i->assigned;
+            bandwidth_channel* c = m_channels[k];
+            c->update_quota(dt_milliseconds);
 
-                // return all assigned quota to all the
-                // bandwidth channels this peer belongs to
-                for (int j = 0; j < 5 && i->channel[j]; ++j)
-                {
-                    bandwidth_channel* bwc = i->channel[j];
-                    bwc->return_quota(i->assigned);
-                }
+            // the requests waiting for it compete again
+            queue_t& blocked = m_blocked[k];
+            if (blocked.empty() || c->quota_left() == 0) continue;
 
-                i = m_queue.erase(i);
-                continue;
-            }
-            for (int j = 0; j < 5 && i->channel[j]; ++j)
+            for (queue_t::iterator i = blocked.begin(), end(blocked.end()); i != end; ++i)
             {
-                bandwidth_channel* bwc = i->channel[j];
-                bwc->tmp = 0;
+                m_queue.push_back(*i);
+                std::push_heap(m_queue.begin(), m_queue.end(), &served_after);
             }
-            ++i;
+            m_num_blocked -= int(blocked.size());
+            blocked.clear();
         }
 
-        for (queue_t::iterator i = m_queue.begin()
-            , end(m_queue.end()); i != end; ++i)
-        {
-            for (int j = 0; j < 5 && i->channel[j]; ++j)
-            {
-                bandwidth_channel* bwc = i->channel[j];
-                if (bwc->tmp == 0) channels.push_back(bwc);
-                LIBED2K_ASSERT(INT_MAX - bwc->tmp > i->priority);
-                bwc->tmp += i->priority;
-            }
-        }
+        queue_t tm;
 
-        for (std::vector<bandwidth_channel*>::iterator i = channels.begin()
-            , end(channels.end()); i != end; ++i)
+        while (!m_queue.empty())
         {
-            (*i)->update_quota(dt_milliseconds);
-        }
+            std::pop_heap(m_queue.begin(), m_queue.end(), &served_after);
+            bw_request& r = m_queue.back();
 
-        queue_t tm;
+            bandwidth_channel* blocking = 0;
+            int quota = r.peer->is_disconnecting() ? 0 : r.quota_left(blocking);
 
-        for (queue_t::iterator i = m_queue.begin();
-            i != m_queue.end();)
-        {
-            int a = i->assign_bandwidth();
-            if (i->assigned == i->request_size
-                || (i->ttl <= 0 && i->assigned > 0))
+            if (quota == 0 && blocking)
             {
-                a += i->request_size - i->assigned;
-                LIBED2K_ASSERT(i->assigned <= i->request_size);
-                tm.push_back(*i);
-                i = m_queue.erase(i);
+                // every waiting request is limited by this channel,
+                // nothing more can be handed out this round. They
+                // stay queued in order
+                if (blocking->queued == int(m_queue.size()) + m_num_blocked)
+                {
+                    std::push_heap(m_queue.begin(), m_queue.end(), &served_after);
+                    break;
+                }
+
+                // it keeps its place, but isn't looked at again
+                // until the channel is refilled
+                m_blocked[blocking->queue_slot].push_back(r);
+                ++m_num_blocked;
+                m_queue.pop_back();
+                continue;
             }
-            else
+
+            // disconnecting peers get nothing, their request just goes
+            r.use_quota(quota);
+            if (!r.guaranteed && r.finish > m_virtual_time) m_virtual_time = r.finish;
+            m_queued_bytes -= r.request_size;
+            dequeue(r);
+
+            if (quota > 0)
             {
-                ++i;
+                r.request_size = quota;
+                tm.push_back(r);
             }
-            m_queued_bytes -= a;
+            m_queue.pop_back();
         }
 
-        while (!tm.empty())
-        {
-            bw_request& bwr = tm.back();
-            bwr.peer->assign_bandwidth(m_channel, bwr.assigned);
-            tm.pop_back();
-        }
+        for (queue_t::iterator i = tm.begin(), end(tm.end()); i != end; ++i)
+            i->peer->assign_bandwidth(m_channel, i->request_size);
     }
 }
-
@@ -35,42 +35,47 @@ POSSIBILITY OF SUCH DAMAGE.
 #include <boost/cstdint.hpp>
 
 #include "libed2k/bandwidth_queue_entry.hpp"
-#include "libed2k/peer_connection.hpp"
 
 namespace libed2k
 {
-    bw_request::bw_request(const boost::intrusive_ptr<peer_connection>& pe
+    bw_request::bw_request(const boost::intrusive_ptr<bandwidth_socket>& pe
         , int blk, int prio)
         : peer(pe)
         , priority(prio)
-        , assigned(0)
         , request_size(blk)
-        , ttl(20)
+        , finish(0)
+        , sequence(0)
+        , guaranteed(false)
+        , num_channels(0)
+        , guarantee(0)
     {
         LIBED2K_ASSERT(priority > 0);
         std::memset(channel, 0, sizeof(channel));
     }
 
-    int bw_request::assign_bandwidth()
+    int bw_request::quota_left(bandwidth_channel*& blocking) const
     {
-        LIBED2K_ASSERT(assigned < request_size);
-        int quota = request_size - assigned;
-        LIBED2K_ASSERT(quota >= 0);
-        --ttl;
-        if (quota == 0) return quota;
+        int quota = request_size;
+        blocking = 0;
 
-        for (int j = 0; j < 5 && channel[j]; ++j)
+        for (int j = 0; j < num_channels; ++j)
         {
-            if (channel[j]->throttle() == 0) continue;
-            if (channel[j]->tmp == 0) continue;
-            quota = (std::min)(int(boost::int64_t(channel[j]->distribute_quota)
-                * priority / channel[j]->tmp), quota);
+            int left = channel[j]->quota_left();
+            if (left >= quota) continue;
+            quota = left;
+            blocking = channel[j];
         }
-        assigned += quota;
-        for (int j = 0; j < 5 && channel[j]; ++j)
-            channel[j]->use_quota(quota);
-        LIBED2K_ASSERT(assigned <= request_size);
+
+        if (quota > 0) blocking = 0;
         return quota;
     }
+
+    void bw_request::use_quota(int amount)
+    {
+        LIBED2K_ASSERT(amount >= 0 && amount <= request_size);
+        for (int j = 0; j < num_channels; ++j)
+            channel[j]->use_quota(amount);
+        if (guarantee) guarantee->use_quota(amount);
+    }
 }
 
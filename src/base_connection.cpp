@@ -1,8 +1,6 @@
 #include "libed2k/base_connection.hpp"
 #include "libed2k/session.hpp"
 #include "libed2k/session_impl.hpp"
-#define MINIZ_HEADER_FILE_ONLY
-#include "miniz.c"
 
 namespace libed2k
 {
@@ -64,7 +62,7 @@ namespace libed2k
         // set deadline timer
         m_deadline.expires_from_now(seconds(m_ses.settings().peer_timeout));
 
-        const std::list<boost::asio::const_buffer>& buffers =
+        const chained_buffer::iovec_t& buffers =
             m_send_buffer.build_iovec(amount_to_send);
         boost::asio::async_write(*m_socket, buffers, make_write_handler(
                                      boost::bind(&base_connection::on_write, self(), _1, _2)));
@@ -98,9 +96,12 @@ namespace libed2k
 
         std::memcpy(buffer.first, buf, size);
         m_send_buffer.append_buffer(
-            buffer.first, buffer.second, size,
-            boost::bind(&aux::session_impl::free_send_buffer,
-                        boost::ref(m_ses), _1, buffer.second));
+            buffer.first, buffer.second, size, &m_ses, aux::session_impl::send_pool);
+    }
+
+    void base_connection::append_send_buffer(char* buffer, int size, int pool)
+    {
+        m_send_buffer.append_buffer(buffer, size, size, &m_ses, pool);
     }
 
     void base_connection::on_timeout(const error_code& e)
@@ -183,21 +184,17 @@ namespace libed2k
 
         if (!error)
         {
-            // temporary support compression on client to client channel by copy paste code
-            int rc = Z_OK;
+            error_code ec;
             if (m_in_header.m_protocol == OP_PACKEDPROT)
             {
-                m_in_container.resize(m_in_gzip_container.size() * 10 + 300);
-                uLongf nSize = m_in_container.size();
-                rc = uncompress((Bytef*)&m_in_container[0], &nSize, (const Bytef*)&m_in_gzip_container[0], m_in_gzip_container.size());
+                ec = m_inflater.unpack(
+                    m_in_gzip_container.empty() ? NULL : &m_in_gzip_container[0], m_in_gzip_container.size(),
+                    m_in_container, m_ses.settings().max_inflated_packet_size);
 
-                if (rc != Z_OK){
-                    ERR("Unzip error: " << mz_error(rc));
-                }
-                else{
-                    m_in_container.resize(nSize);
+                if (ec)
+                {
+                    ERR("Unzip error: " << ec.message() << " <<< " << m_remote);
                 }
-
             }
 
             m_channel_state[download_channel] &= ~peer_info::bw_network;
@@ -206,7 +203,7 @@ namespace libed2k
             handler_map::iterator itr = m_handlers.find(
                 std::make_pair(m_in_header.m_type, m_in_header.m_protocol));
 
-            if (rc == Z_OK && itr != m_handlers.end())
+            if (!ec && itr != m_handlers.end())
             {
                 itr->second(error);
             }
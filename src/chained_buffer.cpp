@@ -38,9 +38,9 @@ namespace libed2k
 	void chained_buffer::pop_front(int bytes_to_pop)
 	{
 		LIBED2K_ASSERT(bytes_to_pop <= m_bytes);
-		while (bytes_to_pop > 0 && !m_vec.empty())
+		while (bytes_to_pop > 0 && m_count > 0)
 		{
-			buffer_t& b = m_vec.front();
+			buffer_t& b = at(0);
 			if (b.used_size > bytes_to_pop)
 			{
 				b.start += bytes_to_pop;
@@ -52,28 +52,42 @@ namespace libed2k
 				break;
 			}
 
-			b.free(b.buf);
+			b.releaser->release_buffer(b.type, b.buf, b.size);
 			m_bytes -= b.used_size;
 			m_capacity -= b.size;
 			bytes_to_pop -= b.used_size;
 			LIBED2K_ASSERT(m_bytes >= 0);
 			LIBED2K_ASSERT(m_capacity >= 0);
 			LIBED2K_ASSERT(m_bytes <= m_capacity);
-			m_vec.pop_front();
+			m_head = (m_head + 1) & (m_vec.size() - 1);
+			--m_count;
 		}
 	}
 
+	void chained_buffer::grow()
+	{
+		// unwrap the ring into the bigger one
+		std::vector<buffer_t> v(m_vec.empty() ? 32 : m_vec.size() * 2);
+		for (int i = 0; i < m_count; ++i) v[i] = at(i);
+		m_vec.swap(v);
+		m_head = 0;
+	}
+
 	void chained_buffer::append_buffer(char* buffer, int s, int used_size
-		, boost::function<void(char*)> const& destructor)
+		, buffer_releaser* releaser, int type)
 	{
-	    LIBED2K_ASSERT(s >= used_size);
-		buffer_t b;
+		LIBED2K_ASSERT(s >= used_size);
+		LIBED2K_ASSERT(releaser);
+		if (m_count == int(m_vec.size())) grow();
+
+		buffer_t& b = at(m_count);
+		b.releaser = releaser;
+		b.type = type;
 		b.buf = buffer;
 		b.size = s;
 		b.start = buffer;
 		b.used_size = used_size;
-		b.free = destructor;
-		m_vec.push_back(b);
+		++m_count;
 
 		m_bytes += used_size;
 		m_capacity += s;
@@ -84,8 +98,8 @@ namespace libed2k
 	// end of the last chained buffer.
 	int chained_buffer::space_in_last_buffer()
 	{
-		if (m_vec.empty()) return 0;
-		buffer_t& b = m_vec.back();
+		if (m_count == 0) return 0;
+		buffer_t& b = at(m_count - 1);
 		return b.size - b.used_size - (b.start - b.buf);
 	}
 
@@ -105,8 +119,8 @@ namespace libed2k
 	// enough room, returns 0
 	char* chained_buffer::allocate_appendix(int s)
 	{
-		if (m_vec.empty()) return 0;
-		buffer_t& b = m_vec.back();
+		if (m_count == 0) return 0;
+		buffer_t& b = at(m_count - 1);
 		char* insert = b.start + b.used_size;
 		if (insert + s > b.buf + b.size) return 0;
 		b.used_size += s;
@@ -115,22 +129,23 @@ namespace libed2k
 		return insert;
 	}
 
-	std::list<asio::const_buffer> const& chained_buffer::build_iovec(int to_send)
+	chained_buffer::iovec_t const& chained_buffer::build_iovec(int to_send)
 	{
-		m_tmp_vec.clear();
+		m_tmp_vec.num_buffers = 0;
 
-		for (std::list<buffer_t>::iterator i = m_vec.begin()
-			, end(m_vec.end()); to_send > 0 && i != end; ++i)
+		for (int i = 0; to_send > 0 && i < m_count
+			&& m_tmp_vec.num_buffers < iovec_t::max_buffers; ++i)
 		{
-			if (i->used_size > to_send)
+			buffer_t& b = at(i);
+			if (b.used_size > to_send)
 			{
-			    LIBED2K_ASSERT(to_send > 0);
-				m_tmp_vec.push_back(asio::const_buffer(i->start, to_send));
+				LIBED2K_ASSERT(to_send > 0);
+				m_tmp_vec.bufs[m_tmp_vec.num_buffers++] = asio::const_buffer(b.start, to_send);
 				break;
 			}
-			LIBED2K_ASSERT(i->used_size > 0);
-			m_tmp_vec.push_back(asio::const_buffer(i->start, i->used_size));
-			to_send -= i->used_size;
+			LIBED2K_ASSERT(b.used_size > 0);
+			m_tmp_vec.bufs[m_tmp_vec.num_buffers++] = asio::const_buffer(b.start, b.used_size);
+			to_send -= b.used_size;
 		}
 		return m_tmp_vec;
 	}
@@ -143,15 +158,15 @@ namespace libed2k
 #endif
 		LIBED2K_ASSERT(m_bytes >= 0);
 		LIBED2K_ASSERT(m_capacity >= 0);
-		for (std::list<buffer_t>::iterator i = m_vec.begin()
-			, end(m_vec.end()); i != end; ++i)
+		for (int i = 0; i < m_count; ++i)
 		{
-			i->free(i->buf);
+			buffer_t& b = at(i);
+			b.releaser->release_buffer(b.type, b.buf, b.size);
 		}
 #ifdef LIBED2K_DEBUG
 		m_bytes = -1;
 		m_capacity = -1;
-		m_vec.clear();
+		m_count = 0;
 #endif
 	}
 
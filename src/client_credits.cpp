@@ -0,0 +1,236 @@
+#include "libed2k/pch.hpp"
+
+#include <cmath>
+#include <cstring>
+#include <fstream>
+
+#include "libed2k/client_credits.hpp"
+#include "libed2k/file.hpp"
+#include "libed2k/filesystem.hpp"
+#include "libed2k/escape_string.hpp"
+#include "libed2k/assert.hpp"
+#include "libed2k/log.hpp"
+
+namespace libed2k
+{
+    namespace
+    {
+        // clients.met is little endian
+        boost::uint32_t read_le32(const char* p)
+        {
+            const unsigned char* b = reinterpret_cast<const unsigned char*>(p);
+            return boost::uint32_t(b[0]) | (boost::uint32_t(b[1]) << 8)
+                | (boost::uint32_t(b[2]) << 16) | (boost::uint32_t(b[3]) << 24);
+        }
+
+        void write_le32(boost::uint32_t v, char* p)
+        {
+            for (int i = 0; i < 4; ++i, v >>= 8) p[i] = char(v & 0xff);
+        }
+
+        // record layout, the same as CreditStruct of eMule
+        enum
+        {
+            off_hash = 0,
+            off_uploaded_lo = 16,
+            off_downloaded_lo = 20,
+            off_last_seen = 24,
+            off_uploaded_hi = 28,
+            off_downloaded_hi = 32,
+            off_reserved = 36,
+            off_key_size = 38,
+            off_key = 39,
+            header_size = 1 + 4
+        };
+
+        bool expired(boost::uint32_t last_seen, boost::uint32_t now)
+        {
+            return last_seen + boost::uint32_t(client_credits::expire_seconds) < now;
+        }
+    }
+
+    float client_credit::score_ratio() const
+    {
+        if (m_downloaded < 1000000) return 1.0f;
+
+        float ret = m_uploaded == 0 ? 10.0f : float(double(m_downloaded) * 2 / double(m_uploaded));
+        float cap = float(std::sqrt(double(m_downloaded) / 1048576.0 + 2));
+        if (ret > cap) ret = cap;
+        if (ret < 1.0f) return 1.0f;
+        if (ret > 10.0f) return 10.0f;
+        return ret;
+    }
+
+    client_credits::client_credits(const std::string& path)
+        : m_path(path), m_loaded(false), m_dirty(false)
+    {
+    }
+
+    void client_credits::load(error_code& ec)
+    {
+        m_loaded = true;
+        if (m_path.empty()) return;
+
+        std::ifstream fs(convert_to_native(m_path).c_str(), std::ios_base::binary | std::ios_base::in);
+        if (!fs) return;
+
+        fs.seekg(0, std::ios_base::end);
+        std::streamoff size = fs.tellg();
+        fs.seekg(0, std::ios_base::beg);
+        if (size < header_size)
+        {
+            ec = errors::file_too_short;
+            return;
+        }
+
+        m_raw.resize(size_t(size));
+        if (!fs.read(&m_raw[0], size))
+        {
+            m_raw.clear();
+            ec = errors::unexpected_istream_error;
+            return;
+        }
+
+        if (boost::uint8_t(m_raw[0]) != CREDITFILE_VERSION)
+        {
+            m_raw.clear();
+            ec = errors::met_file_invalid_header_byte;
+            return;
+        }
+
+        size_t count = read_le32(&m_raw[1]);
+        if (count > (m_raw.size() - header_size) / record_size)
+        {
+            // keep the complete records of a truncated file
+            count = (m_raw.size() - header_size) / record_size;
+            ec = errors::file_too_short;
+        }
+
+        boost::uint32_t now = boost::uint32_t(std::time(0));
+        for (size_t i = 0; i < count; ++i)
+        {
+            size_t off = header_size + i * record_size;
+            if (expired(read_le32(&m_raw[off + off_last_seen]), now)) continue;
+            m_index[md4_hash(&m_raw[off + off_hash])] = off;
+        }
+
+        DBG("clients.met: " << m_index.size() << " of " << count << " credits indexed");
+    }
+
+    void client_credits::ensure_loaded()
+    {
+        if (m_loaded) return;
+        error_code ec;
+        load(ec);
+        if (ec) { ERR("clients.met load failed: " << ec.message()); }
+    }
+
+    client_credit* client_credits::find(const md4_hash& hash)
+    {
+        ensure_loaded();
+
+        std::map<md4_hash, client_credit>::iterator i = m_entries.find(hash);
+        if (i != m_entries.end()) return &i->second;
+
+        std::map<md4_hash, size_t>::iterator r = m_index.find(hash);
+        if (r == m_index.end()) return 0;
+
+        client_credit& c = m_entries[hash];
+        parse(&m_raw[r->second], c);
+        m_index.erase(r);
+        if (m_index.empty()) std::vector<char>().swap(m_raw);
+        return &c;
+    }
+
+    client_credit& client_credits::get(const md4_hash& hash)
+    {
+        client_credit* c = find(hash);
+        if (!c) c = &m_entries[hash];
+        c->m_last_seen = boost::uint32_t(std::time(0));
+        m_dirty = true;
+        return *c;
+    }
+
+    void client_credits::add_uploaded(client_credit& c, boost::uint64_t bytes)
+    {
+        if (bytes == 0) return;
+        c.m_uploaded += bytes;
+        m_dirty = true;
+    }
+
+    void client_credits::add_downloaded(client_credit& c, boost::uint64_t bytes)
+    {
+        if (bytes == 0) return;
+        c.m_downloaded += bytes;
+        m_dirty = true;
+    }
+
+    void client_credits::parse(const char* rec, client_credit& c) const
+    {
+        c.m_uploaded = read_le32(rec + off_uploaded_lo)
+            | (boost::uint64_t(read_le32(rec + off_uploaded_hi)) << 32);
+        c.m_downloaded = read_le32(rec + off_downloaded_lo)
+            | (boost::uint64_t(read_le32(rec + off_downloaded_hi)) << 32);
+        c.m_last_seen = read_le32(rec + off_last_seen);
+
+        size_t key_size = boost::uint8_t(rec[off_key_size]);
+        if (key_size > client_credit::max_key_size) key_size = 0;
+        c.m_secure_ident.assign(rec + off_key, key_size);
+    }
+
+    void client_credits::write(const md4_hash& hash, const client_credit& c, char* rec) const
+    {
+        std::memset(rec, 0, record_size);
+        for (size_t i = 0; i < md4_hash::size; ++i) rec[off_hash + i] = char(hash[i]);
+        write_le32(boost::uint32_t(c.m_uploaded), rec + off_uploaded_lo);
+        write_le32(boost::uint32_t(c.m_downloaded), rec + off_downloaded_lo);
+        write_le32(c.m_last_seen, rec + off_last_seen);
+        write_le32(boost::uint32_t(c.m_uploaded >> 32), rec + off_uploaded_hi);
+        write_le32(boost::uint32_t(c.m_downloaded >> 32), rec + off_downloaded_hi);
+
+        LIBED2K_ASSERT(c.m_secure_ident.size() <= client_credit::max_key_size);
+        size_t key_size = std::min(c.m_secure_ident.size(), size_t(client_credit::max_key_size));
+        rec[off_key_size] = char(key_size);
+        if (key_size > 0) std::memcpy(rec + off_key, c.m_secure_ident.data(), key_size);
+    }
+
+    bool client_credits::save_buffer(std::vector<char>& buf)
+    {
+        if (!m_dirty || m_path.empty()) return false;
+
+        boost::uint32_t now = boost::uint32_t(std::time(0));
+        buf.resize(header_size + (m_entries.size() + m_index.size()) * record_size);
+        size_t off = header_size;
+
+        for (std::map<md4_hash, client_credit>::const_iterator i = m_entries.begin();
+             i != m_entries.end(); ++i)
+        {
+            // peers we only said hello to aren't worth a record
+            if (i->second.m_uploaded == 0 && i->second.m_downloaded == 0) continue;
+            if (expired(i->second.m_last_seen, now)) continue;
+            write(i->first, i->second, &buf[off]);
+            off += record_size;
+        }
+
+        // records nobody asked for go back as they were read
+        for (std::map<md4_hash, size_t>::const_iterator i = m_index.begin(); i != m_index.end(); ++i)
+        {
+            std::memcpy(&buf[off], &m_raw[i->second], record_size);
+            off += record_size;
+        }
+
+        buf[0] = char(CREDITFILE_VERSION);
+        write_le32(boost::uint32_t((off - header_size) / record_size), &buf[1]);
+        buf.resize(off);
+        m_dirty = false;
+        return true;
+    }
+
+    void client_credits::save(error_code& ec)
+    {
+        std::vector<char> buf;
+        if (!save_buffer(buf)) return;
+        save_file(m_path, buf, ec);
+        if (ec) save_failed();
+    }
+}
@@ -30,6 +30,7 @@ POSSIBILITY OF SUCH DAMAGE.
 
 */
 
+#include <algorithm>
 #include <boost/bind.hpp>
 #include "libed2k/config.hpp"
 #include "libed2k/invariant_check.hpp"
@@ -329,5 +330,34 @@ namespace libed2k
 		mutex_t::scoped_lock l(m_mutex);
 		try_connect(l);
 	}
+
+	int adapt_connect_rate(int rate, int successes, int failures
+		, int timeouts, int free_slots, int max_rate)
+	{
+		const int min_rate = 2;
+		int results = successes + failures + timeouts;
+
+		if (free_slots <= 0)
+		{
+			// attempts only wait for half-open slots
+			rate -= rate / 4;
+		}
+		else if (results == 0 || successes * 2 >= results)
+		{
+			rate += (std::max)(rate / 2, 1);
+		}
+		else if (timeouts * 2 > results)
+		{
+			// silent peers hold half-open slots until timeout
+			rate -= rate / 4;
+		}
+		else
+		{
+			// refused connections fail fast and cost little
+			++rate;
+		}
+
+		return (std::max)(min_rate, (std::min)(rate, (std::max)(max_rate, min_rate)));
+	}
 }
 
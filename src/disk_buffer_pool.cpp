@@ -44,11 +44,18 @@ POSSIBILITY OF SUCH DAMAGE.
 
 namespace libed2k
 {
+#ifndef LIBED2K_DISABLE_POOL_ALLOCATOR
+    // free disk buffers kept by every thread, blocks freed by
+    // the network thread are mostly reused by the disk thread
+    // once its cache runs empty
+    static const int thread_cache_blocks = 8;
+#endif
+
     disk_buffer_pool::disk_buffer_pool(int block_size)
         : m_block_size(block_size)
         , m_in_use(0)
 #ifndef LIBED2K_DISABLE_POOL_ALLOCATOR
-        , m_pool(block_size, m_settings.cache_buffer_chunk_size)
+        , m_pool(block_size, m_settings.cache_buffer_chunk_size, thread_cache_blocks)
 #endif
     {
 #if defined LIBED2K_DISK_STATS || defined LIBED2K_STATS
@@ -99,14 +106,13 @@ namespace libed2k
 
     char* disk_buffer_pool::allocate_buffer(char const* category)
     {
-        mutex::scoped_lock l(m_pool_mutex);
         LIBED2K_ASSERT(m_magic == 0x1337);
 #ifdef LIBED2K_DISABLE_POOL_ALLOCATOR
         char* ret = page_aligned_allocator::malloc(m_block_size);
 #else
-        char* ret = (char*)m_pool.malloc();
-        m_pool.set_next_size(m_settings.cache_buffer_chunk_size);
+        char* ret = m_pool.allocate();
 #endif
+        if (ret == 0) return 0;
         ++m_in_use;
 #if LIBED2K_USE_MLOCK
         if (m_settings.lock_disk_cache)
@@ -120,6 +126,7 @@ namespace libed2k
 #endif
 
 #if defined LIBED2K_DISK_STATS || defined LIBED2K_STATS
+        mutex::scoped_lock l(m_pool_mutex);
         ++m_allocations;
 #endif
 #ifdef LIBED2K_DISK_STATS
@@ -127,7 +134,7 @@ namespace libed2k
         m_buf_to_category[ret] = category;
         m_log << log_time() << " " << category << ": " << m_categories[category] << "\n";
 #endif
-        LIBED2K_ASSERT(ret == 0 || is_disk_buffer(ret, l));
+        LIBED2K_ASSERT(is_disk_buffer(ret));
         return ret;
     }
 
@@ -156,36 +163,37 @@ namespace libed2k
         // sort the pointers in order to maximize cache hits
         std::sort(bufvec, end);
 
-        mutex::scoped_lock l(m_pool_mutex);
         for (; bufvec != end; ++bufvec)
         {
             char* buf = *bufvec;
             LIBED2K_ASSERT(buf);
-            free_buffer_impl(buf, l);;
+            free_buffer_impl(buf);
         }
     }
 
     void disk_buffer_pool::free_buffer(char* buf)
     {
-        mutex::scoped_lock l(m_pool_mutex);
-        free_buffer_impl(buf, l);
+        free_buffer_impl(buf);
     }
 
-    void disk_buffer_pool::free_buffer_impl(char* buf, mutex::scoped_lock& l)
+    void disk_buffer_pool::free_buffer_impl(char* buf)
     {
         LIBED2K_ASSERT(buf);
         LIBED2K_ASSERT(m_magic == 0x1337);
-        LIBED2K_ASSERT(is_disk_buffer(buf, l));
+        LIBED2K_ASSERT(is_disk_buffer(buf));
 #if defined LIBED2K_DISK_STATS || defined LIBED2K_STATS
-        --m_allocations;
-#endif
+        {
+            mutex::scoped_lock l(m_pool_mutex);
+            --m_allocations;
 #ifdef LIBED2K_DISK_STATS
-        LIBED2K_ASSERT(m_categories.find(m_buf_to_category[buf])
-            != m_categories.end());
-        std::string const& category = m_buf_to_category[buf];
-        --m_categories[category];
-        m_log << log_time() << " " << category << ": " << m_categories[category] << "\n";
-        m_buf_to_category.erase(buf);
+            LIBED2K_ASSERT(m_categories.find(m_buf_to_category[buf])
+                != m_categories.end());
+            std::string const& category = m_buf_to_category[buf];
+            --m_categories[category];
+            m_log << log_time() << " " << category << ": " << m_categories[category] << "\n";
+            m_buf_to_category.erase(buf);
+#endif
+        }
 #endif
 #if LIBED2K_USE_MLOCK
         if (m_settings.lock_disk_cache)
@@ -209,8 +217,25 @@ namespace libed2k
     {
         LIBED2K_ASSERT(m_magic == 0x1337);
 #ifndef LIBED2K_DISABLE_POOL_ALLOCATOR
-        mutex::scoped_lock l(m_pool_mutex);
         m_pool.release_memory();
+#endif
+    }
+
+    void disk_buffer_pool::set_huge_pages(bool b)
+    {
+#ifndef LIBED2K_DISABLE_POOL_ALLOCATOR
+        m_pool.set_huge_pages(b);
+#endif
+    }
+
+    slab_allocator_stats disk_buffer_pool::buffer_stats() const
+    {
+#ifndef LIBED2K_DISABLE_POOL_ALLOCATOR
+        return m_pool.stats();
+#else
+        slab_allocator_stats ret;
+        ret.in_use = in_use();
+        return ret;
 #endif
     }
 }
@@ -78,6 +78,7 @@ namespace libed2k
         , m_waiting_to_shutdown(false)
         , m_queue_buffer_size(0)
         , m_last_file_check(libed2k::time_now_hires())
+        , m_frequent_read_blocks(0)
         , m_last_stats_flip(libed2k::time_now())
         , m_physical_ram(0)
         , m_exceeded_write_queue(false)
@@ -182,8 +183,12 @@ namespace libed2k
 
         cache_status ret = m_cache_stats;
 
+        read_cache_lists(ret.read_cache_recent_size, ret.read_cache_frequent_size);
+        ret.arc_target = m_arc.target();
+
         ret.job_queue_length = m_jobs.size() + m_sorted_read_jobs.size();
         ret.read_queue_size = m_sorted_read_jobs.size();
+        ret.buffers = buffer_stats();
 
         return ret;
     }
@@ -222,15 +227,25 @@ namespace libed2k
 
     struct update_last_use
     {
-        update_last_use(int exp): expire(exp) {}
+        update_last_use(int exp, bool frequent = false): expire(exp), frequent(frequent) {}
         void operator()(disk_io_thread::cached_piece_entry& p)
         {
             LIBED2K_ASSERT(p.storage);
             p.expire = libed2k::time_now() + libed2k::seconds(expire);
+            if (frequent) p.frequent = true;
         }
         int expire;
+        bool frequent;
     };
 
+    // the arc algorithm only replaces read cache pieces differently,
+    // the write cache is flushed like with avoid_readback
+    bool flush_avoiding_readback(session_settings const& s)
+    {
+        return s.disk_cache_algorithm == session_settings::avoid_readback
+            || s.disk_cache_algorithm == session_settings::arc;
+    }
+
     disk_io_thread::cache_piece_index_t::iterator disk_io_thread::find_cached_piece(
         disk_io_thread::cache_t& cache
         , disk_io_job const& j, mutex::scoped_lock& l)
@@ -262,7 +277,7 @@ namespace libed2k
             // we want to keep the piece in here to have an accurate
             // number for next_block_to_hash, if we're in avoid_readback mode
 
-            bool erase = m_settings.disk_cache_algorithm != session_settings::avoid_readback;
+            bool erase = !flush_avoiding_readback(m_settings);
             if (!erase)
             {
                 // however, if we've already hashed the whole piece, in-order
@@ -306,6 +321,8 @@ namespace libed2k
             --p.num_blocks;
             --m_cache_stats.cache_size;
             --m_cache_stats.read_cache_size;
+            if (p.frequent) --m_frequent_read_blocks;
+            drop_read_ahead(p.blocks[i]);
         }
         return ret;
     }
@@ -329,6 +346,8 @@ namespace libed2k
             --p.num_blocks;
             --m_cache_stats.cache_size;
             --m_cache_stats.read_cache_size;
+            if (p.frequent) --m_frequent_read_blocks;
+            drop_read_ahead(p.blocks[i]);
         }
         if (!buffers.empty()) free_multiple_buffers(&buffers[0], buffers.size());
         return ret;
@@ -344,7 +363,27 @@ namespace libed2k
         if (idx.empty()) return 0;
 
         cache_lru_index_t::iterator i = idx.begin();
-        if (i->piece == ignore.piece && i->storage == ignore.storage)
+        arc_policy::list_t list = arc_policy::none;
+
+        if (m_settings.disk_cache_algorithm == session_settings::arc)
+        {
+            // evict the oldest piece of the list the policy picks, or of
+            // the other one when that list only has the ignored piece
+            int recent = 0;
+            int frequent = 0;
+            read_cache_lists(recent, frequent);
+            list = m_arc.replace(recent, frequent);
+
+            cache_list_index_t::iterator a = oldest_read_piece(list == arc_policy::frequent, ignore);
+            if (a == m_read_pieces.get<2>().end())
+            {
+                list = (list == arc_policy::frequent) ? arc_policy::recent : arc_policy::frequent;
+                a = oldest_read_piece(list == arc_policy::frequent, ignore);
+                if (a == m_read_pieces.get<2>().end()) return 0;
+            }
+            i = m_read_pieces.project<1>(a);
+        }
+        else if (i->piece == ignore.piece && i->storage == ignore.storage)
         {
             ++i;
             if (i == idx.end()) return 0;
@@ -383,6 +422,8 @@ namespace libed2k
                     --const_cast<cached_piece_entry&>(*i).num_blocks;
                     --m_cache_stats.cache_size;
                     --m_cache_stats.read_cache_size;
+                    if (i->frequent) --m_frequent_read_blocks;
+                    drop_read_ahead(i->blocks[start]);
                     --num_blocks;
                     if (!num_blocks) break;
                 }
@@ -395,15 +436,63 @@ namespace libed2k
                 --const_cast<cached_piece_entry&>(*i).num_blocks;
                 --m_cache_stats.cache_size;
                 --m_cache_stats.read_cache_size;
+                if (i->frequent) --m_frequent_read_blocks;
+                drop_read_ahead(i->blocks[end]);
                 --num_blocks;
             }
         }
-        if (i->num_blocks == 0) idx.erase(i);
+        if (i->num_blocks == 0)
+        {
+            if (list != arc_policy::none) m_arc.evicted(i->storage_piece_pair(), blocks, list);
+            idx.erase(i);
+        }
 
         if (!buffers.empty()) free_multiple_buffers(&buffers[0], buffers.size());
         return blocks;
     }
 
+    disk_io_thread::cache_list_index_t::iterator disk_io_thread::oldest_read_piece(
+        bool frequent, ignore_t const& ignore)
+    {
+        cache_list_index_t& idx = m_read_pieces.get<2>();
+        cache_list_index_t::iterator i = idx.lower_bound(
+            std::pair<bool, libed2k::ptime>(frequent, libed2k::min_time()));
+
+        if (i != idx.end() && i->frequent == frequent
+            && i->piece == ignore.piece && i->storage == ignore.storage)
+            ++i;
+
+        if (i == idx.end() || i->frequent != frequent) return idx.end();
+        return i;
+    }
+
+    void disk_io_thread::read_cache_lists(int& recent, int& frequent) const
+    {
+        frequent = m_frequent_read_blocks;
+        recent = m_cache_stats.read_cache_size - m_frequent_read_blocks;
+    }
+
+    // returns true when the piece which isn't in the read cache was
+    // evicted recently and should be cached in the frequent list
+    bool disk_io_thread::read_cache_miss(disk_io_job const& j)
+    {
+        if (m_settings.disk_cache_algorithm != session_settings::arc) return false;
+
+        arc_policy::list_t ghost = m_arc.miss(std::pair<void*, int>(j.storage.get(), j.piece));
+        if (ghost == arc_policy::recent) ++m_cache_stats.ghost_hits_recent;
+        else if (ghost == arc_policy::frequent) ++m_cache_stats.ghost_hits_frequent;
+        return ghost != arc_policy::none;
+    }
+
+    void disk_io_thread::count_read_hit(cached_piece_entry const& p, bool hit)
+    {
+        ++m_cache_stats.blocks_read;
+        if (!hit) return;
+        ++m_cache_stats.blocks_read_hit;
+        if (p.frequent) ++m_cache_stats.blocks_read_hit_frequent;
+        else ++m_cache_stats.blocks_read_hit_recent;
+    }
+
     int contiguous_blocks(disk_io_thread::cached_piece_entry const& b)
     {
         int ret = 0;
@@ -524,7 +613,7 @@ namespace libed2k
                 ret += tmp;
             }
         }
-        else if (m_settings.disk_cache_algorithm == session_settings::avoid_readback)
+        else if (flush_avoiding_readback(m_settings))
         {
             cache_lru_index_t& idx = m_pieces.get<1>();
             for (cache_lru_index_t::iterator i = idx.begin(); i != idx.end();)
@@ -717,6 +806,7 @@ namespace libed2k
         p.num_blocks = 1;
         p.num_contiguous_blocks = 1;
         p.next_block_to_hash = 0;
+        p.frequent = false;
         p.blocks.reset(new (std::nothrow) cached_block_entry[blocks_in_piece]);
         if (!p.blocks) return -1;
         int block = j.offset / m_block_size;
@@ -765,6 +855,8 @@ namespace libed2k
                 --p.num_blocks;
                 --m_cache_stats.cache_size;
                 --m_cache_stats.read_cache_size;
+                if (p.frequent) --m_frequent_read_blocks;
+                drop_read_ahead(p.blocks[i]);
             }
             p.blocks[i].buf = allocate_buffer("read cache");
 
@@ -777,6 +869,7 @@ namespace libed2k
             ++p.num_blocks;
             ++m_cache_stats.cache_size;
             ++m_cache_stats.read_cache_size;
+            if (p.frequent) ++m_frequent_read_blocks;
             ++end_block;
             ++num_read;
             iov[iov_counter].iov_base = p.blocks[i].buf;
@@ -889,6 +982,8 @@ namespace libed2k
         blocks_to_read = (std::min)(blocks_to_read, m_settings.read_cache_line_size);
         if (j.max_cache_line > 0) blocks_to_read = (std::min)(blocks_to_read, j.max_cache_line);
 
+        bool frequent = read_cache_miss(j);
+
         if (in_use() + blocks_to_read > m_settings.cache_size)
         {
             int clear = in_use() + blocks_to_read - m_settings.cache_size;
@@ -904,6 +999,7 @@ namespace libed2k
         p.num_blocks = 0;
         p.num_contiguous_blocks = 0;
         p.next_block_to_hash = 0;
+        p.frequent = frequent;
         p.blocks.reset(new (std::nothrow) cached_block_entry[blocks_in_piece]);
         if (!p.blocks) return -1;
 
@@ -946,6 +1042,7 @@ namespace libed2k
         }
 
         int cached_read_blocks = 0;
+        int frequent_read_blocks = 0;
         for (cache_t::const_iterator i = m_read_pieces.begin()
             , end(m_read_pieces.end()); i != end; ++i)
         {
@@ -967,9 +1064,11 @@ namespace libed2k
             }
 //          LIBED2K_ASSERT(blocks == p.num_blocks);
             cached_read_blocks += blocks;
+            if (p.frequent) frequent_read_blocks += blocks;
         }
 
         LIBED2K_ASSERT(cached_read_blocks == m_cache_stats.read_cache_size);
+        LIBED2K_ASSERT(frequent_read_blocks == m_frequent_read_blocks);
         LIBED2K_ASSERT(cached_read_blocks + cached_write_blocks == m_cache_stats.cache_size);
 
 #ifdef LIBED2K_DISK_STATS
@@ -1028,6 +1127,7 @@ namespace libed2k
             pe.num_blocks = 0;
             pe.num_contiguous_blocks = 0;
             pe.next_block_to_hash = 0;
+            pe.frequent = read_cache_miss(j);
             pe.blocks.reset(new (std::nothrow) cached_block_entry[blocks_in_piece]);
             if (!pe.blocks) return -1;
             ret = read_into_piece(pe, 0, options, INT_MAX, l);
@@ -1082,12 +1182,19 @@ namespace libed2k
             h = ctx.final();
         }
 
-        ret = copy_from_piece(const_cast<cached_piece_entry&>(*p), hit, j, l);
+        bool served_again = false;
+        ret = copy_from_piece(const_cast<cached_piece_entry&>(*p), hit, served_again, j, l);
         LIBED2K_ASSERT(ret > 0);
         if (ret < 0) return ret;
+        count_read_hit(*p, hit);
         cache_piece_index_t& idx = m_read_pieces.get<0>();
         if (p->num_blocks == 0) idx.erase(p);
-        else idx.modify(p, update_last_use(j.cache_min_time));
+        else
+        {
+            // a promoted piece moves its blocks to the frequent list
+            if (served_again && !p->frequent) m_frequent_read_blocks += p->num_blocks;
+            idx.modify(p, update_last_use(j.cache_min_time, served_again));
+        }
 
         // if read cache is disabled or we exceeded the
         // limit, remove this piece from the cache
@@ -1109,8 +1216,6 @@ namespace libed2k
         }
 
         ret = j.buffer_size;
-        ++m_cache_stats.blocks_read;
-        if (hit) ++m_cache_stats.blocks_read_hit;
         return ret;
     }
 
@@ -1144,7 +1249,7 @@ namespace libed2k
         return p.blocks[start_block].buf != 0;
     }
 
-    int disk_io_thread::copy_from_piece(cached_piece_entry& p, bool& hit
+    int disk_io_thread::copy_from_piece(cached_piece_entry& p, bool& hit, bool& served_again
         , disk_io_job const& j, mutex::scoped_lock& l)
     {
         LIBED2K_ASSERT(j.buffer);
@@ -1210,6 +1315,13 @@ namespace libed2k
             std::memcpy(j.buffer + buffer_offset
                 , p.blocks[block].buf + block_offset
                 , to_copy);
+            if (p.blocks[block].served) served_again = true;
+            else if (p.blocks[block].read_ahead)
+            {
+                --m_cache_stats.read_ahead_size;
+                ++m_cache_stats.read_ahead_hits;
+            }
+            p.blocks[block].served = true;
             size -= to_copy;
             block_offset = 0;
             buffer_offset += to_copy;
@@ -1227,6 +1339,8 @@ namespace libed2k
                     --p.num_blocks;
                     --m_cache_stats.cache_size;
                     --m_cache_stats.read_cache_size;
+                    if (p.frequent) --m_frequent_read_blocks;
+                    drop_read_ahead(p.blocks[i]);
                 }
             }
             ++block;
@@ -1275,17 +1389,143 @@ namespace libed2k
 
         LIBED2K_ASSERT(p != idx.end());
 
-        ret = copy_from_piece(const_cast<cached_piece_entry&>(*p), hit, j, l);
+        bool served_again = false;
+        ret = copy_from_piece(const_cast<cached_piece_entry&>(*p), hit, served_again, j, l);
         if (ret < 0) return ret;
+        count_read_hit(*p, hit);
         if (p->num_blocks == 0) idx.erase(p);
-        else idx.modify(p, update_last_use(j.cache_min_time));
+        else
+        {
+            // a promoted piece moves its blocks to the frequent list
+            if (served_again && !p->frequent) m_frequent_read_blocks += p->num_blocks;
+            idx.modify(p, update_last_use(j.cache_min_time, served_again));
+        }
 
         ret = j.buffer_size;
-        ++m_cache_stats.blocks_read;
-        if (hit) ++m_cache_stats.blocks_read_hit;
         return ret;
     }
 
+    // a peer read a block of a part, prefetch the blocks ahead of it when
+    // it reads the part forward. Called by the disk thread, so the read-ahead
+    // job is queued directly
+    void disk_io_thread::update_read_stream(disk_io_job const& j)
+    {
+        if (m_settings.read_ahead_blocks <= 0 || !m_settings.use_read_cache || j.requester == 0)
+            return;
+
+        int piece_size = j.storage->info()->piece_size(j.piece);
+        int blocks_in_piece = (piece_size + m_block_size - 1) / m_block_size;
+        int start = 0;
+        int end = 0;
+        bool hint = false;
+
+        if (!m_read_streams.update(read_streams::key_type(j.requester, j.storage.get())
+            , j.piece, j.offset, j.buffer_size, m_block_size, blocks_in_piece
+            , m_settings.read_ahead_blocks, start, end, hint))
+            return;
+
+        {
+            mutex::scoped_lock l(m_queue_mutex);
+            if (m_abort) return;
+
+            disk_io_job ra;
+            ra.storage = j.storage;
+            ra.action = disk_io_job::read_ahead;
+            ra.piece = j.piece;
+            ra.offset = start * m_block_size;
+            ra.max_cache_line = end - start;
+            ra.cache_min_time = j.cache_min_time;
+            add_job(ra, l, boost::function<void(int, disk_io_job const&)>());
+        }
+
+        // let the OS read the rest of the part in the background
+        if (hint && m_settings.use_disk_read_ahead)
+            j.storage->hint_read_impl(j.piece, end * m_block_size, piece_size - end * m_block_size);
+    }
+
+    // prefetches the missing blocks of the window described by j into the
+    // read cache, in one read per run of missing blocks. Returns the number
+    // of blocks read or -1 on read error
+    int disk_io_thread::read_ahead(disk_io_job const& j, mutex::scoped_lock& l)
+    {
+        if (!m_settings.use_read_cache || m_settings.explicit_read_cache) return 0;
+
+        int piece_size = j.storage->info()->piece_size(j.piece);
+        int blocks_in_piece = (piece_size + m_block_size - 1) / m_block_size;
+        int start = j.offset / m_block_size;
+        int end = (std::min)(start + j.max_cache_line, blocks_in_piece);
+
+        cache_piece_index_t& idx = m_read_pieces.get<0>();
+        cache_piece_index_t::iterator p = find_cached_piece(m_read_pieces, j, l);
+
+        if (p == idx.end())
+        {
+            cached_piece_entry pe;
+            pe.piece = j.piece;
+            pe.storage = j.storage;
+            pe.expire = libed2k::time_now() + libed2k::seconds(j.cache_min_time);
+            pe.num_blocks = 0;
+            pe.num_contiguous_blocks = 0;
+            pe.next_block_to_hash = 0;
+            pe.frequent = false;
+            pe.blocks.reset(new (std::nothrow) cached_block_entry[blocks_in_piece]);
+            if (!pe.blocks) return 0;
+            p = idx.insert(pe).first;
+        }
+
+        cached_piece_entry& e = const_cast<cached_piece_entry&>(*p);
+        int ret = 0;
+
+        for (int i = start; i < end;)
+        {
+            if (e.blocks[i].buf) { ++i; continue; }
+
+            int run = i;
+            while (run < end && e.blocks[run].buf == 0) ++run;
+
+            int blocks = (std::min)(run - i
+                , m_settings.max_read_ahead_blocks - m_cache_stats.read_ahead_size);
+            if (blocks <= 0) break;
+
+            if (in_use() + blocks > m_settings.cache_size)
+            {
+                flush_cache_blocks(l, in_use() + blocks - m_settings.cache_size
+                    , ignore_t(j.piece, j.storage.get()), dont_flush_write_blocks);
+                blocks = (std::min)(blocks, m_settings.cache_size - in_use());
+                if (blocks <= 0) break;
+            }
+
+            int r = read_into_piece(e, i, 0, blocks, l);
+            if (r < 0)
+            {
+                if (r == -1) ret = -1;
+                break;
+            }
+
+            int n = 0;
+            for (; n < blocks && e.blocks[i + n].buf; ++n)
+            {
+                e.blocks[i + n].read_ahead = true;
+                if (!e.blocks[i + n].served) ++m_cache_stats.read_ahead_size;
+            }
+            if (n == 0) break;
+
+            m_cache_stats.blocks_read_ahead += n;
+            ret += n;
+            i += n;
+        }
+
+        if (e.num_blocks == 0) idx.erase(p);
+        else idx.modify(p, update_last_use(j.cache_min_time));
+        return ret;
+    }
+
+    void disk_io_thread::drop_read_ahead(cached_block_entry& b)
+    {
+        if (b.read_ahead && !b.served) --m_cache_stats.read_ahead_size;
+        b.read_ahead = false;
+    }
+
     size_type disk_io_thread::queue_buffer_size() const
     {
         mutex::scoped_lock l(m_queue_mutex);
@@ -1363,7 +1603,8 @@ namespace libed2k
         LIBED2K_ASSERT(!m_abort);
         LIBED2K_ASSERT(j.storage
             || j.action == disk_io_job::abort_thread
-            || j.action == disk_io_job::update_settings);
+            || j.action == disk_io_job::update_settings
+            || j.action == disk_io_job::write_file);
         LIBED2K_ASSERT(j.buffer_size <= m_block_size);
         mutex::scoped_lock l(m_queue_mutex);
         return add_job(j, l, f);
@@ -1420,6 +1661,8 @@ namespace libed2k
         , read_operation + cancel_on_abort // read_and_hash
         , read_operation + cancel_on_abort // cache_piece
         , 0 // finalize_file
+        , read_operation + cancel_on_abort // read_ahead
+        , 0 // write_file
     };
 
     bool should_cancel_on_abort(disk_io_job const& j)
@@ -1551,6 +1794,7 @@ namespace libed2k
 
                 m_pieces.clear();
                 m_read_pieces.clear();
+                m_arc.clear();
                 // release the io_service to allow the run() call to return
                 // we do this once we stop posting new callbacks to it.
                 m_work.reset();
@@ -1736,7 +1980,8 @@ namespace libed2k
 
             LIBED2K_ASSERT(j.storage
                 || j.action == disk_io_job::abort_thread
-                || j.action == disk_io_job::update_settings);
+                || j.action == disk_io_job::update_settings
+                || j.action == disk_io_job::write_file);
 #ifdef LIBED2K_DISK_STATS
             libed2k::ptime start = time_now();
 #endif
@@ -1776,6 +2021,7 @@ namespace libed2k
                     delete s;
 
                     m_file_pool.resize(m_settings.file_pool_size);
+                    set_huge_pages(m_settings.use_huge_pages);
 #if defined __APPLE__ && defined __MACH__ && MAC_OS_X_VERSION_MIN_REQUIRED >= 1050
                     setiopolicy_np(IOPOL_TYPE_DISK, IOPOL_SCOPE_THREAD
                         , m_settings.low_prio_disk ? IOPOL_THROTTLE : IOPOL_DEFAULT);
@@ -1794,6 +2040,12 @@ namespace libed2k
                         else
                             m_settings.cache_size = m_physical_ram / 8 / m_block_size;
                     }
+
+                    {
+                        mutex::scoped_lock l(m_piece_mutex);
+                        if (m_settings.disk_cache_algorithm != session_settings::arc) m_arc.clear();
+                        m_arc.set_capacity(m_settings.cache_size);
+                    }
                     break;
                 }
                 case disk_io_job::abort_torrent:
@@ -1801,6 +2053,8 @@ namespace libed2k
 #ifdef LIBED2K_DISK_STATS
                     m_log << log_time() << " abort_torrent " << std::endl;
 #endif
+                    m_read_streams.forget(j.storage.get());
+
                     mutex::scoped_lock jl(m_queue_mutex);
                     for (std::deque<disk_io_job>::iterator i = m_jobs.begin();
                         i != m_jobs.end();)
@@ -1856,6 +2110,7 @@ namespace libed2k
                             ++i;
                         }
                     }
+                    m_arc.forget(j.storage.get());
                     l.unlock();
                     if (!buffers.empty()) free_multiple_buffers(&buffers[0], buffers.size());
                     release_memory();
@@ -2051,6 +2306,29 @@ namespace libed2k
 #if LIBED2K_DISK_STATS
                     rename_buffer(j.buffer, "released send buffer");
 #endif
+                    update_read_stream(j);
+                    break;
+                }
+                case disk_io_job::read_ahead:
+                {
+#ifdef LIBED2K_DISK_STATS
+                    m_log << log_time() << " read_ahead " << j.piece << std::endl;
+#endif
+                    mutex::scoped_lock l(m_piece_mutex);
+                    LIBED2K_INVARIANT_CHECK;
+
+                    ret = read_ahead(j, l);
+                    if (ret < 0) test_error(j);
+                    break;
+                }
+                case disk_io_job::write_file:
+                {
+#ifdef LIBED2K_DISK_STATS
+                    m_log << log_time() << " write_file " << j.str << std::endl;
+#endif
+                    LIBED2K_ASSERT(j.file_data);
+                    save_file(j.str, *j.file_data, j.error);
+                    ret = j.error ? -1 : 0;
                     break;
                 }
                 case disk_io_job::write:
@@ -2117,7 +2395,7 @@ namespace libed2k
                         // wich indicates the piece is completely downloaded
                         flush_contiguous_blocks(const_cast<cached_piece_entry&>(*p)
                             , l, m_settings.write_cache_line_size
-                            , m_settings.disk_cache_algorithm == session_settings::avoid_readback);
+                            , flush_avoiding_readback(m_settings));
 
                         if (p->num_blocks == 0 && p->next_block_to_hash == 0) idx.erase(p);
                         test_error(j);
@@ -2302,6 +2580,7 @@ namespace libed2k
                             ++i;
                         }
                     }
+                    m_arc.forget(j.storage.get());
                     l.unlock();
                     release_memory();
                     ret = 0;
@@ -0,0 +1,161 @@
+#include "libed2k/pch.hpp"
+
+#include "libed2k/dormant_transfer.hpp"
+#include "libed2k/add_transfer_params.hpp"
+#include "libed2k/assert.hpp"
+
+namespace libed2k
+{
+    dormant_transfers::dormant_transfers() : m_free_hashes(0)
+    {
+    }
+
+    void dormant_transfers::add(const add_transfer_params& params, bool announced,
+                                const boost::shared_ptr<transfer_link>& link,
+                                const ptime& next_dht_announce)
+    {
+        remove(params.file_hash);
+
+        dormant_transfer& t = m_transfers[params.file_hash];
+        t.file_path = params.file_path;
+        t.file_size = params.file_size;
+        t.hashes = boost::uint32_t(m_hashes.size());
+        t.num_hashes = boost::uint32_t(params.piece_hashses.size());
+        t.accepted = params.accepted;
+        t.requested = params.requested;
+        t.transferred = params.transferred;
+        t.priority = params.priority;
+        t.announced = announced;
+        t.next_dht_announce = next_dht_announce;
+        t.link = link;
+
+        m_hashes.insert(m_hashes.end(), params.piece_hashses.begin(), params.piece_hashses.end());
+    }
+
+    bool dormant_transfers::params(const md4_hash& hash, add_transfer_params& params) const
+    {
+        const_iterator i = m_transfers.find(hash);
+        if (i == m_transfers.end()) return false;
+
+        const dormant_transfer& t = i->second;
+        params.file_hash = hash;
+        params.file_path = t.file_path;
+        params.file_size = t.file_size;
+        piece_hashes(t, params.piece_hashses);
+        params.seed_mode = true;
+        params.accepted = t.accepted;
+        params.requested = t.requested;
+        params.transferred = t.transferred;
+        params.priority = t.priority;
+        return true;
+    }
+
+    bool dormant_transfers::take(const md4_hash& hash, add_transfer_params& params, bool& announced)
+    {
+        iterator i = m_transfers.find(hash);
+        if (i == m_transfers.end()) return false;
+
+        this->params(hash, params);
+        announced = i->second.announced;
+        remove(i);
+        return true;
+    }
+
+    boost::shared_ptr<transfer_link> dormant_transfers::link(const md4_hash& hash) const
+    {
+        const_iterator i = m_transfers.find(hash);
+        if (i == m_transfers.end()) return boost::shared_ptr<transfer_link>();
+        return i->second.link;
+    }
+
+    bool dormant_transfers::remove(const md4_hash& hash)
+    {
+        iterator i = m_transfers.find(hash);
+        if (i == m_transfers.end()) return false;
+
+        remove(i);
+        return true;
+    }
+
+    void dormant_transfers::remove(iterator i)
+    {
+        boost::uint32_t hashes = i->second.hashes;
+        boost::uint32_t num_hashes = i->second.num_hashes;
+        m_transfers.erase(i);
+        m_free_hashes += num_hashes;
+
+        if (m_transfers.empty())
+        {
+            clear();
+            return;
+        }
+
+        // hashes of the last added transfer are simply cut
+        if (hashes + num_hashes == m_hashes.size())
+        {
+            m_hashes.resize(hashes);
+            m_free_hashes -= num_hashes;
+        }
+
+        if (m_free_hashes > 1024 && m_free_hashes > m_hashes.size() / 2) compact();
+    }
+
+    void dormant_transfers::clear()
+    {
+        m_transfers.clear();
+        std::vector<md4_hash>().swap(m_hashes);
+        m_free_hashes = 0;
+    }
+
+    void dormant_transfers::piece_hashes(const dormant_transfer& t, std::vector<md4_hash>& hashes) const
+    {
+        LIBED2K_ASSERT(t.hashes + t.num_hashes <= m_hashes.size());
+        hashes.assign(m_hashes.begin() + t.hashes, m_hashes.begin() + t.hashes + t.num_hashes);
+    }
+
+    void dormant_transfers::set_announced(bool announced)
+    {
+        for (iterator i = m_transfers.begin(); i != m_transfers.end(); ++i)
+            i->second.announced = announced;
+    }
+
+    bool dormant_transfers::pop_dht_announce(const ptime& now, const time_duration& interval,
+                                             md4_hash& hash, size_type& size)
+    {
+        iterator i = m_transfers.upper_bound(m_dht_cursor);
+
+        for (size_t n = m_transfers.size(); n > 0; --n, ++i)
+        {
+            if (i == m_transfers.end()) i = m_transfers.begin();
+            m_dht_cursor = i->first;
+
+            if (i->second.next_dht_announce <= now)
+            {
+                i->second.next_dht_announce = now + interval;
+                hash = i->first;
+                size = i->second.file_size;
+                return true;
+            }
+        }
+
+        return false;
+    }
+
+    void dormant_transfers::compact()
+    {
+        std::vector<md4_hash> hashes;
+        hashes.reserve(m_hashes.size() - m_free_hashes);
+
+        for (iterator i = m_transfers.begin(); i != m_transfers.end(); ++i)
+        {
+            dormant_transfer& t = i->second;
+            boost::uint32_t offset = boost::uint32_t(hashes.size());
+            hashes.insert(hashes.end(), m_hashes.begin() + t.hashes,
+                          m_hashes.begin() + t.hashes + t.num_hashes);
+            t.hashes = offset;
+        }
+
+        m_hashes.swap(hashes);
+        m_free_hashes = 0;
+    }
+}
@@ -40,6 +40,7 @@ POSSIBILITY OF SUCH DAMAGE.
 #include <libed2k/allocator.hpp> // page_size
 #include <libed2k/escape_string.hpp> // for string conversion
 
+#include <fstream>
 #include <boost/scoped_ptr.hpp>
 #include <boost/static_assert.hpp>
 
@@ -94,6 +95,10 @@ POSSIBILITY OF SUCH DAMAGE.
 #include <asm/unistd.h> // For __NR_fallocate
 #endif
 
+#if LIBED2K_USE_SENDFILE
+#include <sys/sendfile.h>
+#endif
+
 // circumvent the lack of support in glibc
 static int my_fallocate(int fd, int mode, loff_t offset, loff_t len)
 {
@@ -367,6 +372,30 @@ namespace libed2k
 #endif // LIBED2K_WINDOWS
     }
 
+    void save_file(std::string const& f, std::vector<char> const& buf, error_code& ec)
+    {
+        ec.clear();
+
+        // write a temporary file first, a crash must not lose the old contents
+        std::string tmp = f + ".tmp";
+        {
+            std::ofstream fs(convert_to_native(tmp).c_str(),
+                std::ios_base::binary | std::ios_base::out | std::ios_base::trunc);
+            if (!fs || (!buf.empty() && !fs.write(&buf[0], buf.size())) || !fs.flush())
+            {
+                ec = errors::unexpected_ostream_error;
+                return;
+            }
+        }
+
+#ifdef LIBED2K_WINDOWS
+        // rename doesn't replace files here
+        remove(f, ec);
+        ec.clear();
+#endif
+        rename(tmp, f, ec);
+    }
+
     std::string split_path(std::string const& f)
     {
         if (f.empty()) return f;
@@ -1898,6 +1927,42 @@ namespace libed2k
         return true;
     }
 
+    bool file::preallocate(size_type s, error_code& ec)
+    {
+        LIBED2K_ASSERT(is_open());
+        LIBED2K_ASSERT(s >= 0);
+
+#if defined LIBED2K_LINUX
+        // mode 0 allocates unwritten extents, reading them returns zeros
+        // and SEEK_DATA skips them. Don't fall back on posix_fallocate(),
+        // it writes the file when the filesystem can't do it
+        if (my_fallocate(m_fd, 0, 0, s) == 0) return true;
+        if (errno != ENOSYS && errno != EOPNOTSUPP)
+        {
+            ec.assign(errno, get_posix_category());
+            return false;
+        }
+#endif
+        return true;
+    }
+
+#if LIBED2K_USE_SENDFILE
+    size_type file::sendfile(int sock, size_type file_offset, size_type size, error_code& ec)
+    {
+        LIBED2K_ASSERT(is_open());
+        LIBED2K_ASSERT(size >= 0);
+
+        off_t offset = file_offset;
+        ssize_t ret = ::sendfile(sock, m_fd, &offset, size_t(size));
+        if (ret < 0)
+        {
+            ec.assign(errno, get_posix_category());
+            return -1;
+        }
+        return ret;
+    }
+#endif
+
     void file::finalize()
     {
 #ifdef LIBED2K_WINDOWS
@@ -1987,10 +2052,16 @@ typedef struct _FILE_ALLOCATED_RANGE_BUFFER {
         return buffer.FileOffset.QuadPart;
 
 #elif defined SEEK_DATA
-        // this is supported on solaris
+        // this is supported on solaris and linux (3.1 and later). Unwritten
+        // extents from fallocate() are reported as holes as well
         size_type ret = lseek(m_fd, start, SEEK_DATA);
-        if (ret < 0) return start;
-        return start;
+        if (ret >= 0) return ret;
+        // there is no data after start, the rest of the file is a hole
+        if (errno != ENXIO) return start;
+        error_code ec;
+        size_type file_size = get_size(ec);
+        if (ec || file_size < start) return start;
+        return file_size;
 #else
         return start;
 #endif
@@ -0,0 +1,160 @@
+#include "libed2k/pch.hpp"
+
+#include <boost/iostreams/device/array.hpp>
+#include <boost/iostreams/stream_buffer.hpp>
+
+#include "libed2k/global_source_finder.hpp"
+#include "libed2k/archive.hpp"
+#include "libed2k/time.hpp"
+#include "libed2k/log.hpp"
+
+namespace libed2k
+{
+    // eMule stops doubling server query interval at 16
+    static const int max_failures_backoff = 4;
+
+    bool parse_global_sources(const char* buf, int len, std::vector<found_file_sources>& res)
+    {
+        res.clear();
+
+        if (len < int(sizeof(udp_libed2k_header))) return false;
+        const udp_libed2k_header* uh = reinterpret_cast<const udp_libed2k_header*>(buf);
+        if (uh->m_protocol != OP_EDONKEYPROT || uh->m_type != OP_GLOBFOUNDSOURCES) return false;
+
+        int pos = sizeof(udp_libed2k_header);
+
+        while (pos < len)
+        {
+            // <HASH 16><COUNT 1>(<ID 4><PORT 2>)[COUNT]
+            if (len - pos < int(MD4_DIGEST_LENGTH + 1)) return false;
+            int count = static_cast<boost::uint8_t>(buf[pos + MD4_DIGEST_LENGTH]);
+            int size = MD4_DIGEST_LENGTH + 1 + count * 6;
+            if (len - pos < size) return false;
+
+            try
+            {
+                boost::iostreams::stream_buffer<boost::iostreams::basic_array_source<char> > buffer(buf + pos, size);
+                std::istream in_array_stream(&buffer);
+                archive::ed2k_iarchive ia(in_array_stream);
+                res.push_back(found_file_sources());
+                ia >> res.back();
+            }
+            catch(libed2k_exception& e)
+            {
+                DBG("global sources answer conversion error " << e.what());
+                return false;
+            }
+
+            pos += size;
+
+            // next block starts with own header
+            if (len - pos < int(sizeof(udp_libed2k_header))) break;
+            uh = reinterpret_cast<const udp_libed2k_header*>(buf + pos);
+            if (uh->m_protocol != OP_EDONKEYPROT || uh->m_type != OP_GLOBFOUNDSOURCES) break;
+            pos += sizeof(udp_libed2k_header);
+        }
+
+        return true;
+    }
+
+    global_source_finder::global_source_finder() : m_queries(0), m_answers(0)
+    {
+    }
+
+    void global_source_finder::set_servers(const std::vector<tcp::endpoint>& servers)
+    {
+        servers_map res;
+
+        for (std::vector<tcp::endpoint>::const_iterator i = servers.begin(); i != servers.end(); ++i)
+        {
+            udp::endpoint ep(i->address(), i->port() + 4);
+            servers_map::iterator itr = m_servers.find(ep);
+            res.insert(std::make_pair(ep, itr != m_servers.end() ? itr->second : server_entry()));
+        }
+
+        m_servers.swap(res);
+    }
+
+    void global_source_finder::clear()
+    {
+        m_servers.clear();
+    }
+
+    bool global_source_finder::ready(const ptime& now) const
+    {
+        for (servers_map::const_iterator i = m_servers.begin(); i != m_servers.end(); ++i)
+        {
+            if (i->second.next_query <= now) return true;
+        }
+
+        return false;
+    }
+
+    bool global_source_finder::next_query(const ptime& now, const std::vector<get_file_sources>& files
+        , size_t limit, const time_duration& interval, const time_duration& reask_time
+        , const udp::endpoint& skip, udp::endpoint& server, global_get_file_sources& query)
+    {
+        query.m_files.clear();
+        if (m_servers.empty()) return false;
+
+        // round robin: continue after the last queried server
+        servers_map::iterator itr = m_servers.upper_bound(m_last);
+
+        for (size_t n = m_servers.size(); n > 0; --n, ++itr)
+        {
+            if (itr == m_servers.end()) itr = m_servers.begin();
+            if (itr->first == skip || itr->second.next_query > now) continue;
+
+            server_entry& e = itr->second;
+
+            // forget files asked long ago
+            for (std::map<md4_hash, ptime>::iterator i = e.asked.begin(); i != e.asked.end();)
+            {
+                if (i->second + reask_time <= now) e.asked.erase(i++);
+                else ++i;
+            }
+
+            for (std::vector<get_file_sources>::const_iterator i = files.begin();
+                 i != files.end() && query.m_files.size() < limit; ++i)
+            {
+                if (e.asked.count(i->m_hFile) == 0) query.m_files.push_back(*i);
+            }
+
+            // nothing new for this server, its budget is kept
+            if (query.m_files.empty()) continue;
+
+            // servers keep silence when they know no sources,
+            // so unanswered query only slows down the next one
+            if (e.awaiting) e.failures = std::min(e.failures + 1, max_failures_backoff);
+
+            for (std::vector<get_file_sources>::const_iterator i = query.m_files.begin();
+                 i != query.m_files.end(); ++i)
+                e.asked[i->m_hFile] = now;
+
+            e.awaiting = true;
+            e.next_query = now + interval * (1 << e.failures);
+            m_last = itr->first;
+            server = itr->first;
+            ++m_queries;
+            return true;
+        }
+
+        return false;
+    }
+
+    bool global_source_finder::on_answer(const udp::endpoint& server)
+    {
+        servers_map::iterator itr = m_servers.find(server);
+        if (itr == m_servers.end()) return false;
+
+        // large answer may come in several datagrams
+        if (itr->second.awaiting)
+        {
+            itr->second.failures = 0;
+            itr->second.awaiting = false;
+            ++m_answers;
+        }
+
+        return true;
+    }
+}
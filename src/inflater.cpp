@@ -0,0 +1,98 @@
+#include "libed2k/pch.hpp"
+
+#include <algorithm>
+#include <cstring>
+
+#include "libed2k/inflater.hpp"
+#include "libed2k/assert.hpp"
+
+#define MINIZ_HEADER_FILE_ONLY
+#include "miniz.c"
+
+namespace libed2k
+{
+    namespace
+    {
+        // the first output chunk is a guess of usual packed packets ratio
+        const size_t min_chunk = 16 * 1024;
+        const size_t ratio_guess = 4;
+    }
+
+    inflater::inflater() : m_state_used(false)
+    {
+    }
+
+    error_code inflater::unpack(const char* src, size_t len, std::vector<char>& dst, size_t max_size)
+    {
+        dst.clear();
+        if (len == 0 || max_size == 0) return errors::decode_packet_error;
+
+        mz_stream s;
+        std::memset(&s, 0, sizeof(s));
+        s.next_in = reinterpret_cast<const unsigned char*>(src);
+        s.avail_in = static_cast<unsigned int>(len);
+        s.zalloc = &inflater::alloc_state;
+        s.zfree = &inflater::free_state;
+        s.opaque = this;
+
+        if (mz_inflateInit(&s) != MZ_OK) return errors::decode_packet_error;
+
+        error_code ec;
+        dst.resize(std::min(max_size, std::max(len * ratio_guess, min_chunk)));
+
+        for (;;)
+        {
+            if (s.total_out == dst.size())
+            {
+                if (dst.size() >= max_size)
+                {
+                    // the stream may end exactly at the limit
+                    unsigned char probe;
+                    s.next_out = &probe;
+                    s.avail_out = 1;
+                    int rc = mz_inflate(&s, MZ_SYNC_FLUSH);
+                    if (rc == MZ_STREAM_END && s.avail_out == 1) break;
+                    ec = (rc == MZ_OK || rc == MZ_STREAM_END) ?
+                        errors::inflated_packet_too_large : errors::decode_packet_error;
+                    break;
+                }
+
+                dst.resize(std::min(max_size, dst.size() * 2));
+            }
+
+            s.next_out = reinterpret_cast<unsigned char*>(&dst[0]) + s.total_out;
+            s.avail_out = static_cast<unsigned int>(dst.size() - s.total_out);
+
+            int rc = mz_inflate(&s, MZ_SYNC_FLUSH);
+            if (rc == MZ_STREAM_END) break;
+
+            // MZ_BUF_ERROR here means truncated input since output always has room
+            if (rc != MZ_OK)
+            {
+                ec = errors::decode_packet_error;
+                break;
+            }
+        }
+
+        dst.resize(ec ? 0 : s.total_out);
+        mz_inflateEnd(&s);
+        return ec;
+    }
+
+    void* inflater::alloc_state(void* opaque, size_t items, size_t size)
+    {
+        inflater* self = static_cast<inflater*>(opaque);
+        if (self->m_state_used) return 0;
+
+        if (self->m_state.size() < items * size) self->m_state.resize(items * size);
+        self->m_state_used = true;
+        return &self->m_state[0];
+    }
+
+    void inflater::free_state(void* opaque, void* address)
+    {
+        inflater* self = static_cast<inflater*>(opaque);
+        LIBED2K_ASSERT(address == &self->m_state[0]);
+        self->m_state_used = false;
+    }
+}
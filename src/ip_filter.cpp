@@ -31,7 +31,13 @@ POSSIBILITY OF SUCH DAMAGE.
 */
 
 #include "libed2k/pch.hpp"
+#include <climits>
+#include <fstream>
+#include <iterator>
+
 #include "libed2k/ip_filter.hpp"
+#include "libed2k/escape_string.hpp"
+#include "libed2k/log.hpp"
 
 #include <boost/utility.hpp>
 
@@ -86,6 +92,315 @@ namespace libed2k
     {
         return m_filter.access(port);
     }
+    compiled_ip_filter::compiled_ip_filter()
+    {
+        m_start4.push_back(0);
+        m_access4.push_back(0);
+        build_index();
+#if LIBED2K_USE_IPV6
+        m_ranges6.push_back(std::make_pair(detail::zero<address_v6::bytes_type>(), 0));
+#endif
+    }
+
+    compiled_ip_filter::compiled_ip_filter(const ip_filter& f)
+    {
+        ip_filter::filter_tuple_t rules = f.export_filter();
+#if LIBED2K_USE_IPV6
+        const std::vector<ip_range<address_v4> >& rules4 = rules.get<0>();
+        const std::vector<ip_range<address_v6> >& rules6 = rules.get<1>();
+        m_ranges6.reserve(rules6.size());
+        for (std::vector<ip_range<address_v6> >::const_iterator i = rules6.begin();
+             i != rules6.end(); ++i)
+            m_ranges6.push_back(std::make_pair(i->first.to_bytes(), i->flags));
+#else
+        const std::vector<ip_range<address_v4> >& rules4 = rules;
+#endif
+
+        // exported ranges are sorted, disjoint and cover all addresses
+        m_start4.reserve(rules4.size());
+        m_access4.reserve(rules4.size());
+        for (std::vector<ip_range<address_v4> >::const_iterator i = rules4.begin();
+             i != rules4.end(); ++i)
+        {
+            m_start4.push_back(i->first.to_ulong());
+            m_access4.push_back(i->flags);
+        }
+
+        build_index();
+    }
+
+    namespace
+    {
+        bool range_less(const ip_range<address_v4>& r1, const ip_range<address_v4>& r2)
+        {
+            return r1.first < r2.first;
+        }
+    }
+
+    compiled_ip_filter::compiled_ip_filter(std::vector<ip_range<address_v4> > ranges)
+    {
+        std::sort(ranges.begin(), ranges.end(), &range_less);
+
+        // next address not covered by ranges added so far
+        boost::uint64_t next = 0;
+        m_start4.push_back(0);
+        m_access4.push_back(0);
+
+        for (std::vector<ip_range<address_v4> >::const_iterator i = ranges.begin();
+             i != ranges.end(); ++i)
+        {
+            if ((i->flags & ip_filter::blocked) == 0) continue;
+
+            boost::uint64_t first = i->first.to_ulong();
+            boost::uint64_t last = i->last.to_ulong();
+            if (last + 1 <= next) continue;
+
+            if (first > next)
+            {
+                // gap between blocked ranges
+                if (m_access4.back() != 0)
+                {
+                    m_start4.push_back(boost::uint32_t(next));
+                    m_access4.push_back(0);
+                }
+                m_start4.push_back(boost::uint32_t(first));
+                m_access4.push_back(ip_filter::blocked);
+            }
+            else if (m_access4.back() == 0)
+            {
+                // the first range starts from zero address
+                m_access4.back() = ip_filter::blocked;
+            }
+
+            next = last + 1;
+        }
+
+        if (m_access4.back() != 0 && next <= 0xFFFFFFFFULL)
+        {
+            m_start4.push_back(boost::uint32_t(next));
+            m_access4.push_back(0);
+        }
+
+        build_index();
+#if LIBED2K_USE_IPV6
+        m_ranges6.push_back(std::make_pair(detail::zero<address_v6::bytes_type>(), 0));
+#endif
+    }
+
+    void compiled_ip_filter::build_index()
+    {
+        LIBED2K_ASSERT(!m_start4.empty() && m_start4[0] == 0);
+        m_index4.resize(0x10001);
+        boost::uint32_t j = 0;
+        for (boost::uint64_t p = 0; p <= 0x10000; ++p)
+        {
+            while (j + 1 < m_start4.size() && m_start4[j + 1] <= (p << 16)) ++j;
+            m_index4[p] = j;
+        }
+    }
+
+    int compiled_ip_filter::access(boost::uint32_t addr) const
+    {
+        // the range is between index entries of the address prefix and of the next one
+        boost::uint32_t prefix = addr >> 16;
+        const boost::uint32_t* base = &m_start4[m_index4[prefix]];
+        size_t n = m_index4[prefix + 1] - m_index4[prefix] + 1;
+
+        while (n > 1)
+        {
+            size_t half = n / 2;
+            base = (base[half] <= addr) ? base + half : base;
+            n -= half;
+        }
+
+        return m_access4[base - &m_start4[0]];
+    }
+
+    int compiled_ip_filter::access(address const& addr) const
+    {
+        if (addr.is_v4())
+            return access(boost::uint32_t(addr.to_v4().to_ulong()));
+#if LIBED2K_USE_IPV6
+        LIBED2K_ASSERT(addr.is_v6());
+        std::vector<std::pair<address_v6::bytes_type, int> >::const_iterator i =
+            std::upper_bound(m_ranges6.begin(), m_ranges6.end(),
+                std::make_pair(addr.to_v6().to_bytes(), INT_MAX));
+        LIBED2K_ASSERT(i != m_ranges6.begin());
+        return boost::prior(i)->second;
+#else
+        return 0;
+#endif
+    }
+
+    size_t compiled_ip_filter::size() const
+    {
+#if LIBED2K_USE_IPV6
+        return m_start4.size() + m_ranges6.size();
+#else
+        return m_start4.size();
+#endif
+    }
+
+    ip_filter compiled_ip_filter::rules() const
+    {
+        ip_filter f;
+        for (size_t i = 0; i < m_start4.size(); ++i)
+        {
+            if (m_access4[i] == 0) continue;
+            boost::uint32_t last = (i + 1 < m_start4.size()) ? m_start4[i + 1] - 1 : 0xFFFFFFFF;
+            f.add_rule(address_v4(m_start4[i]), address_v4(last), m_access4[i]);
+        }
+#if LIBED2K_USE_IPV6
+        for (size_t i = 0; i < m_ranges6.size(); ++i)
+        {
+            if (m_ranges6[i].second == 0) continue;
+            address_v6::bytes_type last = (i + 1 < m_ranges6.size())
+                ? detail::minus_one(m_ranges6[i + 1].first)
+                : detail::max_addr<address_v6::bytes_type>();
+            f.add_rule(address_v6(m_ranges6[i].first), address_v6(last), m_ranges6[i].second);
+        }
+#endif
+        return f;
+    }
+
+    namespace
+    {
+        inline bool is_space(char c) { return c == ' ' || c == '\t'; }
+
+        inline void skip_spaces(const char*& p, const char* end)
+        {
+            while (p != end && is_space(*p)) ++p;
+        }
+
+        bool parse_ipv4(const char*& p, const char* end, boost::uint32_t& ip)
+        {
+            skip_spaces(p, end);
+            ip = 0;
+
+            for (int octet = 0; octet < 4; ++octet)
+            {
+                if (octet > 0)
+                {
+                    if (p == end || *p != '.') return false;
+                    ++p;
+                }
+
+                int value = 0;
+                int digits = 0;
+                for (; p != end && *p >= '0' && *p <= '9' && digits < 3; ++p, ++digits)
+                    value = value * 10 + (*p - '0');
+
+                if (digits == 0 || value > 255) return false;
+                ip = (ip << 8) | value;
+            }
+
+            return true;
+        }
+
+        bool parse_ip_range(const char*& p, const char* end, boost::uint32_t& first, boost::uint32_t& last)
+        {
+            if (!parse_ipv4(p, end, first)) return false;
+            skip_spaces(p, end);
+            if (p == end || *p != '-') return false;
+            ++p;
+            return parse_ipv4(p, end, last) && first <= last;
+        }
+
+        bool parse_ip_filter_line(const char* begin, const char* end, ip_range<address_v4>& range)
+        {
+            boost::uint32_t first, last;
+            int flags = ip_filter::blocked;
+            const char* p = begin;
+
+            if (!parse_ip_range(p, end, first, last))
+            {
+                // P2P format, description can contain colons
+                const char* colon = end;
+                while (colon != begin && *(colon - 1) != ':') --colon;
+                if (colon == begin) return false;
+
+                p = colon;
+                if (!parse_ip_range(p, end, first, last)) return false;
+            }
+            else
+            {
+                skip_spaces(p, end);
+
+                // emule format, access level is optional
+                if (p != end && *p == ',')
+                {
+                    ++p;
+                    skip_spaces(p, end);
+                    int level = 0;
+                    int digits = 0;
+                    for (; p != end && *p >= '0' && *p <= '9' && digits < 4; ++p, ++digits)
+                        level = level * 10 + (*p - '0');
+                    if (digits == 0) return false;
+                    if (level >= 127) flags = 0;
+                }
+            }
+
+            range.first = address_v4(first);
+            range.last = address_v4(last);
+            range.flags = flags;
+            return true;
+        }
+    }
+
+    int parse_ip_filter(const char* begin, const char* end, std::vector<ip_range<address_v4> >& ranges)
+    {
+        int errors = 0;
+
+        while (begin != end)
+        {
+            const char* eol = begin;
+            while (eol != end && *eol != '\n' && *eol != '\r') ++eol;
+
+            const char* p = begin;
+            skip_spaces(p, eol);
+
+            if (p != eol && *p != '#' && !(*p == '/' && p + 1 != eol && *(p + 1) == '/'))
+            {
+                ip_range<address_v4> range;
+                if (parse_ip_filter_line(p, eol, range))
+                    ranges.push_back(range);
+                else
+                    ++errors;
+            }
+
+            begin = eol;
+            while (begin != end && (*begin == '\n' || *begin == '\r')) ++begin;
+        }
+
+        return errors;
+    }
+
+    boost::shared_ptr<compiled_ip_filter> load_ip_filter(const std::string& path, error_code& ec)
+    {
+        std::ifstream ifs(convert_to_native(path).c_str(), std::ios_base::in | std::ios_base::binary);
+
+        if (!ifs)
+        {
+            ec = errors::file_unavaliable;
+            return boost::shared_ptr<compiled_ip_filter>();
+        }
+
+        std::vector<char> data((std::istreambuf_iterator<char>(ifs)), std::istreambuf_iterator<char>());
+        std::vector<ip_range<address_v4> > ranges;
+        ranges.reserve(data.size() / 40);
+
+        if (!data.empty())
+        {
+            int malformed = parse_ip_filter(&data[0], &data[0] + data.size(), ranges);
+            if (malformed > 0)
+            {
+                DBG("ip filter " << path << ": " << ranges.size() << " ranges, " << malformed << " malformed lines");
+            }
+        }
+
+        return boost::shared_ptr<compiled_ip_filter>(new compiled_ip_filter(ranges));
+    }
+
 /*
     void ip_filter::print() const
     {
@@ -400,6 +400,21 @@ namespace libed2k { namespace dht
     m_dht.search_sources(ih, listen_port, size, f);
   }
 
+  void dht_tracker::publish_source(const md4_hash& ih
+    , const md4_hash& source_id
+    , const tag_list<boost::uint8_t>& tags
+    , boost::function<void(kad_id const&)> f) {
+    LIBED2K_ASSERT(m_ses.is_network_thread());
+    m_dht.publish_source(ih, source_id, tags, f);
+  }
+
+  void dht_tracker::publish_keyword(const md4_hash& keyword
+    , const std::deque<kad_info_entry>& files
+    , boost::function<void(kad_id const&)> f) {
+    LIBED2K_ASSERT(m_ses.is_network_thread());
+    m_dht.publish_keyword(keyword, files, f);
+  }
+
 
 	void dht_tracker::on_unreachable(udp::endpoint const& ep)
 	{
@@ -433,7 +448,11 @@ namespace libed2k { namespace dht
             return;
         }
 
+        // plain packets are decoded in place, only packed ones
+        // are inflated into the container
         std::vector<uint8_t> container;
+        const char* incoming = buf + 2;
+        std::size_t incoming_size = bytes_transferred - 2;
 
         if (uh.m_protocol == OP_KADEMLIAPACKEDPROT) {
                 // unzip data
@@ -451,27 +470,23 @@ namespace libed2k { namespace dht
 
                 uh.m_protocol = OP_KADEMLIAHEADER;
                 container.resize(nSize);
-        }
-        else {
-            container.assign(buf + 2, buf + bytes_transferred);
+                incoming = container.empty() ? NULL : (const char*)&container[0];
+                incoming_size = container.size();
         }
 
 #ifdef LIBED2K_DHT_VERBOSE_LOGGING
-        if (container.empty()) {
+        if (incoming_size == 0) {
             LIBED2K_LOG(dht_tracker) << " incoming data: empty(only header)";
             return;
         }
         else {
-            std::string cincoming((char*)&container[0], container.size());
+            std::string cincoming(incoming, incoming_size);
             LIBED2K_LOG(dht_tracker) << " incoming data: " << to_hex(cincoming);
         }
 #endif
         // TODO - need total fix for serialization
-        const char* incoming = NULL;
-        if (!container.empty()) incoming = (const char*)&container[0];
-
         typedef boost::iostreams::basic_array_source<char> Device;
-        boost::iostreams::stream_buffer<Device> buffer(incoming, container.size());
+        boost::iostreams::stream_buffer<Device> buffer(incoming, incoming_size);
         std::istream in_array_stream(&buffer);
         archive::ed2k_iarchive ia(in_array_stream);
 
@@ -616,11 +631,16 @@ namespace libed2k { namespace dht
                         // sources answer
                         for (std::deque<kad_info_entry>::const_iterator itr = p.results.m_collection.begin(); itr != p.results.m_collection.end(); ++itr) {
                             md4_hash h = p.target_id;
+                            std::string buddy = itr->tags.getStringTagByNameId(TAG_BUDDYHASH);
+                            // the buddy ip is published in ed2k byte order already
                             m_ses.on_find_dht_source(h
                                 , itr->tags.getIntTagByNameId(TAG_SOURCETYPE)
                                 , ntohl(itr->tags.getIntTagByNameId(TAG_SOURCEIP))
                                 , itr->tags.getIntTagByNameId(TAG_SOURCEPORT)
-                                , itr->tags.getIntTagByNameId(TAG_CLIENTLOWID));
+                                , itr->tags.getIntTagByNameId(TAG_CLIENTLOWID)
+                                , itr->tags.getIntTagByNameId(TAG_SERVERIP)
+                                , itr->tags.getIntTagByNameId(TAG_SERVERPORT)
+                                , buddy.size() == md4_hash::size * 2 ? md4_hash::fromString(buddy) : md4_hash::invalid);
                         }
                     }
                     else {
@@ -641,6 +661,9 @@ namespace libed2k { namespace dht
                 break;
             }
             case KADEMLIA2_PUBLISH_RES: {
+                kad2_publish_res p;
+                ia >> p;
+                m_dht.incoming(p, ep);
                 break;
             }
             case KADEMLIA2_PUBLISH_RES_ACK: {
@@ -845,7 +868,7 @@ namespace libed2k { namespace dht
         log_line << " data size " << m_send_buf.size();
 #endif
 
-		if (m_sock.send(addr, &m_send_buf[0], (int)m_send_buf.size(), ec, send_flags))
+		if (m_sock.send(addr, &m_send_buf[0], (int)m_send_buf.size(), ec, send_flags | udp_socket::batch))
 		{
 			if (ec) return false;
 
@@ -57,6 +57,7 @@ using detail::read_v6_endpoint;
 
 void find_data_observer::reply(const kad2_pong& r, udp::endpoint ep) { done(); }
 void find_data_observer::reply(const kad2_hello_res& r, udp::endpoint ep) { done(); }
+void find_data_observer::reply(const kad2_publish_res& r, udp::endpoint ep) { done(); }
 
 void find_data_observer::reply(const kad2_bootstrap_res& r, udp::endpoint ep) {
 
@@ -0,0 +1,170 @@
+#include "libed2k/pch.hpp"
+
+#include <algorithm>
+#include <cctype>
+
+#include "libed2k/assert.hpp"
+#include "libed2k/time.hpp"
+#include "libed2k/kademlia/keyword_index.hpp"
+
+namespace libed2k { namespace dht
+{
+    // characters eMule treats as keyword separators
+    static const char invalid_keyword_chars[] = " ()[]{}<>,._-!?:;\\/\"";
+
+    // eMule does not consider words shorter than 3 bytes
+    static const size_t min_keyword_bytes = 3;
+
+    void extract_keywords(const std::string& name, std::vector<std::string>& words)
+    {
+        words.clear();
+        std::string::size_type pos = 0;
+        std::string last;
+        // index of the word the last token gave, npos when it was skipped or repeated
+        size_t last_index = std::string::npos;
+
+        while (pos < name.size())
+        {
+            std::string::size_type end = name.find_first_of(invalid_keyword_chars, pos);
+            if (end == std::string::npos) end = name.size();
+
+            last = name.substr(pos, end - pos);
+            last_index = std::string::npos;
+
+            if (last.size() >= min_keyword_bytes)
+            {
+                std::string word = last;
+
+                // non-ASCII bytes of UTF-8 sequences are left as is
+                for (std::string::iterator i = word.begin(); i != word.end(); ++i)
+                {
+                    if (static_cast<unsigned char>(*i) < 0x80) *i = std::tolower(*i);
+                }
+
+                if (std::find(words.begin(), words.end(), word) == words.end())
+                {
+                    last_index = words.size();
+                    words.push_back(word);
+                }
+            }
+
+            pos = end + 1;
+        }
+
+        // last word of 3 ASCII characters is a file extension in almost all cases,
+        // the same word earlier in the name is kept
+        if (words.size() > 1 && last_index != std::string::npos && last.size() == min_keyword_bytes)
+        {
+            bool ascii = true;
+
+            for (std::string::const_iterator i = last.begin(); i != last.end(); ++i)
+            {
+                if (static_cast<unsigned char>(*i) >= 0x80) ascii = false;
+            }
+
+            if (ascii) words.erase(words.begin() + last_index);
+        }
+    }
+
+    keyword_index::keyword_index()
+    {
+    }
+
+    void keyword_index::add_file(const md4_hash& file, const std::string& name)
+    {
+        std::vector<std::string> words;
+        extract_keywords(name, words);
+        std::vector<md4_hash>& keywords = m_files[file];
+
+        for (std::vector<std::string>::const_iterator i = words.begin(); i != words.end(); ++i)
+        {
+            md4_hash keyword = hasher::from_string(*i);
+            if (std::find(keywords.begin(), keywords.end(), keyword) == keywords.end())
+                keywords.push_back(keyword);
+
+            keywords_map::iterator itr = m_keywords.insert(std::make_pair(keyword, keyword_entry())).first;
+
+            // new file for keyword - publish keyword with the next free slot
+            if (itr->second.files.insert(file).second) schedule(itr, min_time());
+        }
+    }
+
+    void keyword_index::remove_file(const md4_hash& file)
+    {
+        files_map::iterator fi = m_files.find(file);
+        if (fi == m_files.end()) return;
+
+        for (std::vector<md4_hash>::const_iterator i = fi->second.begin(); i != fi->second.end(); ++i)
+        {
+            keywords_map::iterator itr = m_keywords.find(*i);
+            if (itr == m_keywords.end()) continue;
+
+            itr->second.files.erase(file);
+
+            if (itr->second.files.empty())
+            {
+                m_queue.erase(std::make_pair(itr->second.next_publish, itr->first));
+                m_keywords.erase(itr);
+            }
+        }
+
+        m_files.erase(fi);
+    }
+
+    bool keyword_index::pop(const ptime& now, const time_duration& interval, size_t limit
+        , md4_hash& keyword, std::vector<md4_hash>& files)
+    {
+        files.clear();
+        if (m_queue.empty() || m_queue.begin()->first > now) return false;
+
+        keywords_map::iterator itr = m_keywords.find(m_queue.begin()->second);
+        LIBED2K_ASSERT(itr != m_keywords.end());
+        keyword_entry& e = itr->second;
+        keyword = itr->first;
+
+        if (e.offset >= e.files.size()) e.offset = 0;
+        std::set<md4_hash>::const_iterator fi = e.files.begin();
+        std::advance(fi, e.offset);
+
+        // take files starting from offset and wrap around up to limit
+        for (size_t n = std::min(limit, e.files.size()); n > 0; --n)
+        {
+            files.push_back(*fi);
+            if (++fi == e.files.end()) fi = e.files.begin();
+        }
+
+        e.offset = (e.offset + files.size()) % e.files.size();
+        schedule(itr, now + interval);
+        return true;
+    }
+
+    void keyword_index::reschedule(const md4_hash& keyword, const ptime& when)
+    {
+        keywords_map::iterator itr = m_keywords.find(keyword);
+        if (itr != m_keywords.end()) schedule(itr, when);
+    }
+
+    int keyword_index::pending(const ptime& now) const
+    {
+        int res = 0;
+
+        for (publish_queue::const_iterator i = m_queue.begin(); i != m_queue.end() && i->first <= now; ++i)
+            ++res;
+
+        return res;
+    }
+
+    void keyword_index::clear()
+    {
+        m_keywords.clear();
+        m_queue.clear();
+        m_files.clear();
+    }
+
+    void keyword_index::schedule(keywords_map::iterator i, const ptime& when)
+    {
+        m_queue.erase(std::make_pair(i->second.next_publish, i->first));
+        i->second.next_publish = when;
+        m_queue.insert(std::make_pair(when, i->first));
+    }
+}}
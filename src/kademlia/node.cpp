@@ -60,6 +60,9 @@ using detail::write_endpoint;
 // TODO: configurable?
 enum { announce_interval = 30 };
 
+// keyword publish entries per packet - keeps packets below usual MTU
+enum { max_publish_key_entries = 10 };
+
 #ifdef LIBED2K_DHT_VERBOSE_LOGGING
 LIBED2K_DEFINE_LOG(node)
 extern int g_announces;
@@ -104,6 +107,8 @@ node_impl::node_impl(libed2k::alert_manager& alerts
 	, m_send(f)
 	, m_userdata(userdata)
     , m_port(port)
+    , m_publish_requests(0)
+    , m_publish_replies(0)
 {
 }
 
@@ -226,6 +231,85 @@ namespace
             node.m_rpc.invoke(req, i->first.ep(), o);
 		}
 	}
+
+    observer_ptr make_publish_observer(node_impl& node
+        , boost::intrusive_ptr<traversal_algorithm> const& algo
+        , node_entry const& e, node_id const& target)
+    {
+        void* ptr = node.m_rpc.allocate_observer();
+        if (ptr == 0) return observer_ptr();
+        observer_ptr o(new (ptr) announce_observer(algo, e.ep(), e.id));
+#if defined LIBED2K_DEBUG || LIBED2K_RELEASE_ASSERTS
+        o->m_in_constructor = false;
+#endif
+        // publish response carries the target, bind it to the transaction
+        o->m_packet_id = target;
+        return o;
+    }
+
+    void publish_source_fun(std::vector<std::pair<node_entry, std::string> > const& v
+        , node_impl& node
+        , node_id const& target
+        , kad_id const& source_id
+        , tag_list<uint8_t> const& tags)
+    {
+#ifdef LIBED2K_DHT_VERBOSE_LOGGING
+        LIBED2K_LOG(node) << "sending publish source [ target: " << target
+            << " nodes: " << v.size() << " ]";
+#endif
+        boost::intrusive_ptr<traversal_algorithm> algo(
+            new traversal_algorithm(node, (node_id::min)()));
+
+        kad2_publish_source_req req;
+        req.client_id = target;
+        req.source_id = source_id;
+        req.tags = tags;
+
+        for (std::vector<std::pair<node_entry, std::string> >::const_iterator i = v.begin()
+            , end(v.end()); i != end; ++i)
+        {
+            observer_ptr o = make_publish_observer(node, algo, i->first, target);
+            if (!o) return;
+            if (node.m_rpc.invoke(req, i->first.ep(), o)) node.publish_request_sent();
+        }
+    }
+
+    void publish_keyword_fun(std::vector<std::pair<node_entry, std::string> > const& v
+        , node_impl& node
+        , node_id const& target
+        , std::deque<kad_info_entry> const& files)
+    {
+#ifdef LIBED2K_DHT_VERBOSE_LOGGING
+        LIBED2K_LOG(node) << "sending publish keyword [ target: " << target
+            << " files: " << files.size() << " nodes: " << v.size() << " ]";
+#endif
+        boost::intrusive_ptr<traversal_algorithm> algo(
+            new traversal_algorithm(node, (node_id::min)()));
+
+        // split files list into packets once, every storing node gets the same set
+        std::vector<kad2_publish_key_req> packets;
+        for (std::deque<kad_info_entry>::const_iterator itr = files.begin(); itr != files.end(); ++itr)
+        {
+            if (packets.empty() || packets.back().keys.m_collection.size() >= max_publish_key_entries)
+            {
+                packets.push_back(kad2_publish_key_req());
+                packets.back().client_id = target;
+            }
+
+            packets.back().keys.m_collection.push_back(*itr);
+        }
+
+        for (std::vector<std::pair<node_entry, std::string> >::const_iterator i = v.begin()
+            , end(v.end()); i != end; ++i)
+        {
+            for (std::vector<kad2_publish_key_req>::iterator p = packets.begin(); p != packets.end(); ++p)
+            {
+                observer_ptr o = make_publish_observer(node, algo, i->first, target);
+                if (!o) return;
+                if (node.m_rpc.invoke(*p, i->first.ep(), o)) node.publish_request_sent();
+            }
+        }
+    }
 }
 
 void node_impl::add_router_node(udp::endpoint router)
@@ -305,6 +389,32 @@ void node_impl::search_sources(node_id const& info_hash
     ta->start();
 }
 
+void node_impl::publish_source(node_id const& file_hash
+    , kad_id const& source_id
+    , tag_list<uint8_t> const& tags
+    , boost::function<void(kad_id const&)> f)
+{
+#ifdef LIBED2K_DHT_VERBOSE_LOGGING
+    LIBED2K_LOG(node) << "publish source [ ih: " << file_hash << " ]";
+#endif
+    boost::intrusive_ptr<find_data> ta(new find_data(*this, file_hash, f
+        , boost::bind(&publish_source_fun, _1, boost::ref(*this)
+            , file_hash, source_id, tags), KADEMLIA_STORE));
+    ta->start();
+}
+
+void node_impl::publish_keyword(node_id const& keyword_hash
+    , std::deque<kad_info_entry> const& files
+    , boost::function<void(kad_id const&)> f)
+{
+#ifdef LIBED2K_DHT_VERBOSE_LOGGING
+    LIBED2K_LOG(node) << "publish keyword [ ih: " << keyword_hash << " files: " << files.size() << " ]";
+#endif
+    boost::intrusive_ptr<find_data> ta(new find_data(*this, keyword_hash, f
+        , boost::bind(&publish_keyword_fun, _1, boost::ref(*this)
+            , keyword_hash, files), KADEMLIA_STORE));
+    ta->start();
+}
 
 void node_impl::tick()
 {
@@ -359,6 +469,8 @@ void node_impl::status(session_status& s)
 	s.dht_torrents = int(m_map.size());
 	s.active_requests.clear();
 	s.dht_total_allocations = m_rpc.num_allocated_observers();
+	s.dht_publish_requests = m_publish_requests;
+	s.dht_publish_replies = m_publish_replies;
 	for (std::set<traversal_algorithm*>::iterator i = m_running_requests.begin()
 		, end(m_running_requests.end()); i != end; ++i)
 	{
@@ -379,6 +491,13 @@ template void node_impl::incoming<kad2_hello_res>(const kad2_hello_res&, udp::en
 template void node_impl::incoming<kad2_bootstrap_res>(const kad2_bootstrap_res&, udp::endpoint);
 template void node_impl::incoming<kademlia2_res>(const kademlia2_res&, udp::endpoint);
 
+template<>
+void node_impl::incoming(const kad2_publish_res& t, udp::endpoint target) {
+    ++m_publish_replies;
+    node_id id;
+    if (m_rpc.incoming(t, target, &id)) refresh(id, boost::bind(&nop));
+}
+
 template<>
 void node_impl::incoming_request(const kad2_ping& req, udp::endpoint target) {
     kad2_pong p;
@@ -37,6 +37,8 @@ POSSIBILITY OF SUCH DAMAGE.
 #include "libed2k/session_impl.hpp"
 
 #include <boost/bind.hpp>
+#include <boost/functional/hash.hpp>
+#include <boost/next_prior.hpp>
 
 #include "libed2k/invariant_check.hpp"
 #include <libed2k/io.hpp>
@@ -165,6 +167,8 @@ rpc_manager::rpc_manager(node_id const& our_id
 	, void* userdata
 	, uint16_t port)
 	: m_pool_allocator(observer_size, 10)
+	, m_short_timeout(m_transactions.end())
+	, m_next_send_seq(0)
 	, m_send(sf)
 	, m_userdata(userdata)
 	, m_our_id(our_id)
@@ -231,6 +235,43 @@ void rpc_manager::free_observer(void* ptr)
 	m_pool_allocator.free(ptr);
 }
 
+namespace
+{
+	void hash_address(std::size_t& seed, address const& a)
+	{
+#if LIBED2K_USE_IPV6
+		if (a.is_v6())
+		{
+			address_v6::bytes_type b = a.to_v6().to_bytes();
+			boost::hash_range(seed, b.begin(), b.end());
+			return;
+		}
+#endif
+		boost::hash_combine(seed, a.to_v4().to_ulong());
+	}
+}
+
+std::size_t rpc_manager::reply_key_hash::operator()(reply_key const& k) const
+{
+	std::size_t seed = k.transaction_id;
+	hash_address(seed, k.addr);
+	boost::hash_range(seed, &k.packet_id[0], &k.packet_id[0] + kad_id::size);
+	return seed;
+}
+
+std::size_t rpc_manager::endpoint_hash::operator()(udp::endpoint const& ep) const
+{
+	std::size_t seed = ep.port();
+	hash_address(seed, ep.address());
+	return seed;
+}
+
+void rpc_manager::erase_transaction(transactions_t::iterator i)
+{
+	if (i == m_short_timeout) ++m_short_timeout;
+	m_transactions.erase(i);
+}
+
 #if defined LIBED2K_DEBUG || LIBED2K_RELEASE_ASSERTS
 size_t rpc_manager::allocation_size() const
 {
@@ -245,6 +286,9 @@ void rpc_manager::check_invariant() const
 	{
 		LIBED2K_ASSERT(*i);
 	}
+	LIBED2K_ASSERT(m_short_timeout == m_transactions.end()
+		|| m_short_timeout == m_transactions.begin()
+		|| (*boost::prior(m_short_timeout))->sent() <= (*m_short_timeout)->sent());
 }
 #endif
 
@@ -254,20 +298,17 @@ void rpc_manager::unreachable(udp::endpoint const& ep)
 	LIBED2K_LOG(rpc) << time_now_string() << " PORT_UNREACHABLE [ ip: " << ep << " ]";
 #endif
 
-	for (transactions_t::iterator i = m_transactions.begin();
-		i != m_transactions.end();)
-	{
-		LIBED2K_ASSERT(*i);
-		observer_ptr const& o = *i;
-		if (o->target_ep() != ep) { ++i; continue; }
-		observer_ptr ptr = *i;
-		m_transactions.erase(i++);
+	transactions_t::nth_index<2>::type& by_ep = m_transactions.get<2>();
+	transactions_t::nth_index<2>::type::iterator i = by_ep.find(ep);
+	if (i == by_ep.end()) return;
+
+	LIBED2K_ASSERT(*i);
+	observer_ptr ptr = *i;
+	erase_transaction(m_transactions.project<0>(i));
 #ifdef LIBED2K_DHT_VERBOSE_LOGGING
-		LIBED2K_LOG(rpc) << "  found transaction [ tid: " << ptr->transaction_id() << " ]";
+	LIBED2K_LOG(rpc) << "  found transaction [ tid: " << ptr->transaction_id() << " ]";
 #endif
-		ptr->timeout();
-		break;
-	}
+	ptr->timeout();
 }
 
 template<typename T>
@@ -277,17 +318,22 @@ bool rpc_manager::incoming(const T& t, udp::endpoint target, node_id* id) {
     if (m_destructing) return false;
 
     observer_ptr o;
-    
-    for (transactions_t::iterator i = m_transactions.begin()
-    , end(m_transactions.end()); i != end; ++i) {
-        LIBED2K_ASSERT(*i);
-        if ((*i)->transaction_id() != transaction_identifier<T>::id || 
-          (*i)->target_addr() != target.address()) continue;
-        kad_id packet_id = packet_kad_identifier(t);
-        if (packet_id != (*i)->packet_id()) continue;
-        o = *i;
-        m_transactions.erase(i);
-        break;
+
+    reply_key key(transaction_identifier<T>::id, target.address(), packet_kad_identifier(t));
+    transactions_t::nth_index<1>::type& by_reply = m_transactions.get<1>();
+    std::pair<transactions_t::nth_index<1>::type::iterator
+        , transactions_t::nth_index<1>::type::iterator> r = by_reply.equal_range(key);
+
+    if (r.first != r.second) {
+        // the same request may have gone to the node more than
+        // once, the reply is for the one sent first
+        transactions_t::nth_index<1>::type::iterator oldest = r.first;
+        for (transactions_t::nth_index<1>::type::iterator j = boost::next(r.first); j != r.second; ++j)
+            if ((*j)->send_seq() < (*oldest)->send_seq()) oldest = j;
+
+        LIBED2K_ASSERT(*oldest);
+        o = *oldest;
+        erase_transaction(m_transactions.project<0>(oldest));
     }
 
     uint16_t i = transaction_identifier<T>::id;
@@ -329,6 +375,7 @@ template bool rpc_manager::incoming<kad2_pong>(const kad2_pong& t, udp::endpoint
 template bool rpc_manager::incoming<kad2_hello_res>(const kad2_hello_res& t, udp::endpoint target, node_id* id);
 template bool rpc_manager::incoming<kad2_bootstrap_res>(const kad2_bootstrap_res& t, udp::endpoint target, node_id* id);
 template bool rpc_manager::incoming<kademlia2_res>(const kademlia2_res& t, udp::endpoint target, node_id* id);
+template bool rpc_manager::incoming<kad2_publish_res>(const kad2_publish_res& t, udp::endpoint target, node_id* id);
 
 template<typename T>
 node_id rpc_manager::extract_packet_node_id(const T&) {
@@ -385,17 +432,17 @@ time_duration rpc_manager::tick()
 		LIBED2K_LOG(rpc) << "[" << o->m_algorithm.get() << "] Timing out transaction id: " 
 			<< (*i)->transaction_id() << " from " << o->target_ep();
 #endif
-		m_transactions.erase(i++);
+		erase_transaction(i++);
 		timeouts.push_back(o);
 	}
 	
 	std::for_each(timeouts.begin(), timeouts.end(), boost::bind(&observer::timeout, _1));
 	timeouts.clear();
 
-	for (transactions_t::iterator i = m_transactions.begin();
-		i != m_transactions.end(); ++i)
+	// transactions before m_short_timeout were checked already
+	for (; m_short_timeout != m_transactions.end(); ++m_short_timeout)
 	{
-		observer_ptr o = *i;
+		observer_ptr o = *m_short_timeout;
 
 		// if we reach an observer that hasn't timed out
 		// break, because every observer after this one will
@@ -409,8 +456,6 @@ time_duration rpc_manager::tick()
 		
 		if (o->has_short_timeout()) continue;
 
-		// TODO: don't call short_timeout() again if we've
-		// already called it once
 		timeouts.push_back(o);
 	}
 
@@ -443,7 +488,12 @@ bool rpc_manager::invoke(T& t, udp::endpoint target, observer_ptr o) {
     udp_message msg = make_udp_message(t);
 
     if (m_send(m_userdata, msg, target, 1)) {
-      if (o) m_transactions.push_back(o);
+      if (o) {
+        o->set_send_seq(m_next_send_seq++);
+        m_transactions.push_back(o);
+        if (m_short_timeout == m_transactions.end())
+          m_short_timeout = boost::prior(m_transactions.end());
+      }
 #if defined LIBED2K_DEBUG || LIBED2K_RELEASE_ASSERTS
         if (o) o->m_was_sent = true;
 #endif
@@ -460,6 +510,8 @@ template bool rpc_manager::invoke<kademlia2_req>(kademlia2_req& t, udp::endpoint
 template bool rpc_manager::invoke<kad2_search_key_req>(kad2_search_key_req&, udp::endpoint target, observer_ptr o);
 template bool rpc_manager::invoke<kad2_search_notes_req>(kad2_search_notes_req&, udp::endpoint target, observer_ptr o);
 template bool rpc_manager::invoke<kad2_search_sources_req>(kad2_search_sources_req&, udp::endpoint target, observer_ptr o);
+template bool rpc_manager::invoke<kad2_publish_key_req>(kad2_publish_key_req&, udp::endpoint target, observer_ptr o);
+template bool rpc_manager::invoke<kad2_publish_source_req>(kad2_publish_source_req&, udp::endpoint target, observer_ptr o);
 
 
 template<typename T>
@@ -481,6 +533,11 @@ kad_id rpc_manager::packet_kad_identifier<kademlia2_res>(const kademlia2_res& t)
     return t.kid_target;
 }
 
+template<>
+kad_id rpc_manager::packet_kad_identifier<kad2_publish_res>(const kad2_publish_res& t) const {
+    return t.target_id;
+}
+
 #ifdef LIBED2K_DHT_VERBOSE_LOGGING
 template<typename T>
 std::string rpc_manager::request_name(const T& t) const {
@@ -0,0 +1,101 @@
+#include "libed2k/pch.hpp"
+
+#include <algorithm>
+
+#include "libed2k/lowid_callbacks.hpp"
+#include "libed2k/time.hpp"
+#include "libed2k/log.hpp"
+
+namespace libed2k
+{
+    lowid_callbacks::lowid_callbacks()
+        : m_sent(0), m_coalesced(0), m_succeeded(0), m_timed_out(0), m_total_latency(0)
+    {
+    }
+
+    bool lowid_callbacks::request(client_id_type id, const md4_hash& file, const ptime& now)
+    {
+        std::pair<callbacks_map::iterator, bool> ret =
+            m_callbacks.insert(std::make_pair(id, callback_entry()));
+        callback_entry& e = ret.first->second;
+
+        if (!ret.second)
+        {
+            if (std::find(e.files.begin(), e.files.end(), file) == e.files.end())
+            {
+                e.files.push_back(file);
+                ++m_coalesced;
+            }
+            return false;
+        }
+
+        e.files.push_back(file);
+        e.sent = now;
+        e.last = now;
+        ++m_sent;
+        return true;
+    }
+
+    void lowid_callbacks::set_buddy(client_id_type id, const udp::endpoint& buddy, const md4_hash& buddy_hash)
+    {
+        callbacks_map::iterator i = m_callbacks.find(id);
+        if (i == m_callbacks.end()) return;
+        i->second.buddy = buddy;
+        i->second.buddy_hash = buddy_hash;
+    }
+
+    bool lowid_callbacks::answered(client_id_type id, const ptime& now, std::vector<md4_hash>& files)
+    {
+        callbacks_map::iterator i = m_callbacks.find(id);
+        if (i == m_callbacks.end()) return false;
+
+        files.swap(i->second.files);
+        m_total_latency += total_milliseconds(now - i->second.sent);
+        ++m_succeeded;
+        m_callbacks.erase(i);
+        return true;
+    }
+
+    void lowid_callbacks::tick(const ptime& now, const time_duration& timeout, int max_attempts
+        , std::vector<client_id_type>& resend)
+    {
+        for (callbacks_map::iterator i = m_callbacks.begin(); i != m_callbacks.end();)
+        {
+            callback_entry& e = i->second;
+            if (now < e.last + timeout)
+            {
+                ++i;
+                continue;
+            }
+
+            if (e.attempts < max_attempts)
+            {
+                ++e.attempts;
+                e.last = now;
+                ++m_sent;
+                resend.push_back(i->first);
+                ++i;
+                continue;
+            }
+
+            DBG("lowid callback of " << i->first << " timed out after " << e.attempts << " attempts");
+            ++m_timed_out;
+            m_callbacks.erase(i++);
+        }
+    }
+
+    bool lowid_callbacks::buddy(client_id_type id, udp::endpoint& ep, md4_hash& buddy_hash, md4_hash& file) const
+    {
+        callbacks_map::const_iterator i = m_callbacks.find(id);
+        if (i == m_callbacks.end() || i->second.buddy.port() == 0) return false;
+        ep = i->second.buddy;
+        buddy_hash = i->second.buddy_hash;
+        file = i->second.files.front();
+        return true;
+    }
+
+    int lowid_callbacks::average_latency() const
+    {
+        return m_succeeded == 0 ? 0 : int(m_total_latency / m_succeeded);
+    }
+}
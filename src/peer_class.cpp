@@ -0,0 +1,115 @@
+#include "libed2k/pch.hpp"
+
+#include <algorithm>
+#include <cstring>
+
+#include "libed2k/peer_class.hpp"
+#include "libed2k/assert.hpp"
+
+namespace libed2k
+{
+    namespace
+    {
+        int clamp_weight(int w) { return (std::min)((std::max)(w, 1), 255); }
+    }
+
+    peer_class_type_filter::peer_class_type_filter()
+    {
+        std::memset(m_peer_classes, 0, sizeof(m_peer_classes));
+    }
+
+    void peer_class_type_filter::add(socket_type_t st, int peer_class)
+    {
+        LIBED2K_ASSERT(st >= 0 && st < num_socket_types);
+        LIBED2K_ASSERT(peer_class >= 0 && peer_class < peer_class_pool::max_classes);
+        m_peer_classes[st] |= boost::uint32_t(1) << peer_class;
+    }
+
+    void peer_class_type_filter::remove(socket_type_t st, int peer_class)
+    {
+        LIBED2K_ASSERT(st >= 0 && st < num_socket_types);
+        LIBED2K_ASSERT(peer_class >= 0 && peer_class < peer_class_pool::max_classes);
+        m_peer_classes[st] &= ~(boost::uint32_t(1) << peer_class);
+    }
+
+    boost::uint32_t peer_class_type_filter::apply(int st, boost::uint32_t peer_classes) const
+    {
+        if (st < 0 || st >= num_socket_types) return peer_classes;
+        return peer_classes | m_peer_classes[st];
+    }
+
+    peer_class::peer_class() : in_use(false)
+    {
+        weight[0] = weight[1] = 1;
+    }
+
+    void peer_class::set_info(const peer_class_info& pci)
+    {
+        label = pci.label;
+        // the peer_connection channel indices, upload first
+        channel[0].throttle((std::max)(pci.upload_limit, 0));
+        channel[1].throttle((std::max)(pci.download_limit, 0));
+        guarantee[0].throttle((std::max)(pci.upload_min, 0));
+        guarantee[1].throttle((std::max)(pci.download_min, 0));
+        weight[0] = clamp_weight(pci.upload_weight);
+        weight[1] = clamp_weight(pci.download_weight);
+    }
+
+    void peer_class::get_info(peer_class_info& pci) const
+    {
+        pci.label = label;
+        pci.upload_limit = channel[0].throttle();
+        pci.download_limit = channel[1].throttle();
+        pci.upload_min = guarantee[0].throttle();
+        pci.download_min = guarantee[1].throttle();
+        pci.upload_weight = weight[0];
+        pci.download_weight = weight[1];
+    }
+
+    int peer_class_pool::new_peer_class(const std::string& label)
+    {
+        for (int c = 0; c < max_classes; ++c)
+        {
+            if (m_classes[c].in_use) continue;
+
+            peer_class_info pci;
+            pci.label = label;
+            m_classes[c].set_info(pci);
+            m_classes[c].in_use = true;
+            return c;
+        }
+
+        return -1;
+    }
+
+    void peer_class_pool::delete_peer_class(int c)
+    {
+        if (!at(c)) return;
+        // the channels may still be queued, only their limits go
+        m_classes[c].set_info(peer_class_info());
+        m_classes[c].in_use = false;
+    }
+
+    peer_class* peer_class_pool::at(int c)
+    {
+        if (c < 0 || c >= max_classes || !m_classes[c].in_use) return 0;
+        return &m_classes[c];
+    }
+
+    const peer_class* peer_class_pool::at(int c) const
+    {
+        if (c < 0 || c >= max_classes || !m_classes[c].in_use) return 0;
+        return &m_classes[c];
+    }
+
+    boost::uint32_t peer_class_pool::valid(boost::uint32_t peer_classes) const
+    {
+        boost::uint32_t ret = 0;
+        for (int c = 0; c < max_classes; ++c)
+        {
+            if ((peer_classes & (boost::uint32_t(1) << c)) && m_classes[c].in_use)
+                ret |= boost::uint32_t(1) << c;
+        }
+        return ret;
+    }
+}
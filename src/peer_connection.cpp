@@ -85,16 +85,33 @@ std::pair<peer_request, peer_request> split_request(const peer_request& req)
     return std::make_pair(r, left);
 }
 
+// ids are taken on the network thread only, 0 means none
+boost::uint32_t next_read_stream_id()
+{
+    static boost::uint32_t id = 0;
+    if (++id == 0) ++id;
+    return id;
+}
+
 size_t block_size(const piece_block& b, size_type s)
 {
     std::pair<size_type, size_type> r = block_range(b.piece_index, b.block_index, s);
     return size_t(r.second - r.first);
 }
 
+int desired_queue_size(int rate, int rtt, int min_queue, int max_queue)
+{
+    // one OP_REQUESTPARTS carries three ranges, the pipeline is refilled by them
+    const int request_parts = 3;
+    size_type bdp = size_type(std::max(rate, 0)) * std::max(rtt, 0) / 1000;
+    int res = int(std::min<size_type>(div_ceil(bdp, BLOCK_SIZE), max_queue)) + request_parts;
+    return std::max(std::max(min_queue, request_parts), std::min(res, max_queue));
+}
+
 pending_block::pending_block(const piece_block& b, size_type fsize):
-    skipped(0), not_wanted(false), timed_out(false), busy(false), block(b),
+    skipped(0), not_wanted(false), timed_out(false), busy(false), time_critical(false), block(b),
     data_size(block_size(b, fsize)), data_left(block_range(b.piece_index, b.block_index, fsize)),
-    buffer(NULL), create_time(time_now())
+    buffer(NULL), create_time(time_now()), request_time(min_time())
 {
 }
 
@@ -113,6 +130,8 @@ peer_connection::peer_connection(aux::session_impl& ses,
     m_handshake_complete(false)
 {
     reset();
+    m_peer_classes = m_ses.peer_classes_for(
+        remote.address(), peer_class_type_filter::tcp_outgoing);
 }
 
 peer_connection::peer_connection(aux::session_impl& ses,
@@ -129,6 +148,8 @@ peer_connection::peer_connection(aux::session_impl& ses,
     m_handshake_complete(false)
 {
     reset();
+    m_peer_classes = m_ses.peer_classes_for(
+        remote.address(), peer_class_type_filter::tcp_incoming);
 
     // connection is already established
     do_read();
@@ -150,10 +171,16 @@ void peer_connection::reset()
     m_upload_limit = 0;
     m_download_limit = 0;
     m_speed = slow;
-    m_desired_queue_size = 3;
+    m_desired_queue_size = std::max(m_ses.settings().min_request_queue, 3);
+    m_rtt = 0;
+    m_rtt_pending = false;
+    m_read_stream_id = next_read_stream_id();
     m_max_busy_blocks = 1;
+    m_endgame_mode = false;
     m_recv_pos = 0;
     m_recv_compressed = false;
+    m_upload_offset = 0;
+    m_credit = 0;
 
     add_handler(std::make_pair(OP_HELLO, OP_EDONKEYPROT), boost::bind(&peer_connection::on_hello, this, _1));
     add_handler(get_proto_pair<client_hello_answer>(), boost::bind(&peer_connection::on_hello_answer, this, _1));
@@ -324,12 +351,17 @@ void peer_connection::get_peer_info(peer_info& p) const
     // this will set the flags so that we can update them later
     p.flags = 0;
     p.flags |= is_seed() ? peer_info::seed : 0;
+    p.flags |= m_endgame_mode ? peer_info::endgame_mode : 0;
 
     p.source = m_peer?m_peer->source:peer_info::incoming;
     p.failcount = 0;
     p.num_hashfails = 0;
     p.inet_as = 0xffff;
 
+    p.rtt = m_rtt;
+    p.download_queue_length = int(m_download_queue.size() + m_request_queue.size());
+    p.target_dl_queue_length = int(m_desired_queue_size);
+
     p.send_buffer_size = m_send_buffer.capacity();
     p.used_send_buffer = m_send_buffer.size();
     p.write_state = m_channel_state[upload_channel];
@@ -407,6 +439,8 @@ void peer_connection::second_tick(int tick_interval_ms)
     if (t->eager_mode() || t->num_free_blocks() == 0)
         abort_expired_requests();
 
+    update_desired_queue_size();
+
     if (!is_closed())
         fill_send_buffer();
 
@@ -415,8 +449,7 @@ void peer_connection::second_tick(int tick_interval_ms)
 
 bool peer_connection::attach_to_transfer(const md4_hash& hash)
 {
-    boost::weak_ptr<transfer> wpt = m_ses.find_transfer(hash);
-    boost::shared_ptr<transfer> t = wpt.lock();
+    boost::shared_ptr<transfer> t = m_ses.wake_transfer(hash);
 
     if (t && t->is_aborted())
     {
@@ -456,7 +489,7 @@ bool peer_connection::attach_to_transfer(const md4_hash& hash)
     // check to make sure we don't have another connection with the same
     // hash and peer_id. If we do. close this connection.
     if (!t->attach_peer(this)) return false;
-    m_transfer = wpt;
+    m_transfer = t;
 
     // if the transfer isn't ready to accept
     // connections yet, we'll have to wait with
@@ -483,12 +516,41 @@ void peer_connection::do_write(int /*quota ignored*/)
     if (!has_upload_bandwidth()) return;
     if (!can_write()) return;
 
-    base_connection::do_write(m_quota[upload_channel]);
+    if (m_send_buffer.empty() && m_upload_file)
+        send_file();
+    else
+        base_connection::do_write(m_quota[upload_channel]);
 }
 
-int peer_connection::request_upload_bandwidth(
-    bandwidth_channel* bwc1, bandwidth_channel* bwc2,
-    bandwidth_channel* bwc3, bandwidth_channel* bwc4)
+int peer_connection::bandwidth_channels(int channel, bandwidth_channel** chan,
+                                        bandwidth_channel*& guarantee, int& weight)
+{
+    boost::shared_ptr<transfer> t = m_transfer.lock();
+    int n = 0;
+    guarantee = 0;
+    weight = 1;
+
+    chan[n++] = m_ses.m_bandwidth_channel[channel];
+
+    boost::uint32_t classes = m_peer_classes | (t ? t->peer_classes() : 0);
+    for (int c = 0; classes != 0 && c < peer_class_pool::max_classes; ++c)
+    {
+        if ((classes & (boost::uint32_t(1) << c)) == 0) continue;
+        classes &= ~(boost::uint32_t(1) << c);
+
+        peer_class* pc = m_ses.m_classes.at(c);
+        if (!pc) continue;
+        if (n < bw_request::max_channels - 2) chan[n++] = &pc->channel[channel];
+        if (!guarantee && pc->guarantee[channel].throttle() > 0) guarantee = &pc->guarantee[channel];
+        weight = std::max(weight, pc->weight[channel]);
+    }
+
+    if (t) chan[n++] = &t->m_bandwidth_channel[channel];
+    chan[n++] = &m_bandwidth_channel[channel];
+    return n;
+}
+
+int peer_connection::request_upload_bandwidth()
 {
     boost::shared_ptr<transfer> t = m_transfer.lock();
 
@@ -502,16 +564,25 @@ int peer_connection::request_upload_bandwidth(
     // peers that we are not interested in are non-prioritized
     LIBED2K_ASSERT((m_channel_state[upload_channel] & peer_info::bw_limit) == 0);
 
+    int pending = m_send_buffer.size() + (m_upload_file ? m_upload_req.length : 0);
+
+    bandwidth_channel* chan[bw_request::max_channels];
+    bandwidth_channel* guarantee;
+    int weight;
+    int n = bandwidth_channels(upload_channel, chan, guarantee, weight);
+
+    // peers which gave us more than they got are served first, as in the
+    // eMule upload queue
+    if (m_credit) weight = int(weight * m_credit->score_ratio());
+
     return m_ses.m_upload_rate.request_bandwidth(
         self_as<peer_connection>(),
-        std::max(m_send_buffer.size(),
+        std::max(pending,
                  m_statistics.upload_rate() * 2 / (1000 / m_ses.m_settings.tick_interval)),
-        priority, bwc1, bwc2, bwc3, bwc4);
+        priority * weight, chan, n, guarantee);
 }
 
-int peer_connection::request_download_bandwidth(
-    bandwidth_channel* bwc1, bandwidth_channel* bwc2,
-    bandwidth_channel* bwc3, bandwidth_channel* bwc4)
+int peer_connection::request_download_bandwidth()
 {
     boost::shared_ptr<transfer> t = m_transfer.lock();
 
@@ -519,6 +590,11 @@ int peer_connection::request_download_bandwidth(
     int priority = m_priority + (t ? (t->priority() << 8) : 0);
     int outstanding = outstanding_bytes();
 
+    bandwidth_channel* chan[bw_request::max_channels];
+    bandwidth_channel* guarantee;
+    int weight;
+    int n = bandwidth_channels(download_channel, chan, guarantee, weight);
+
     LIBED2K_ASSERT(outstanding >= 0);
     LIBED2K_ASSERT((m_channel_state[download_channel] & peer_info::bw_limit) == 0);
     return m_ses.m_download_rate.request_bandwidth(
@@ -526,22 +602,17 @@ int peer_connection::request_download_bandwidth(
         std::max(
             std::max(outstanding, m_recv_req.length - m_recv_pos),
             m_statistics.download_rate() * 2 / (1000 / m_ses.m_settings.tick_interval)),
-        priority, bwc1, bwc2, bwc3, bwc4);
+        priority * weight, chan, n, guarantee);
 }
 
 bool peer_connection::has_download_bandwidth()
 {
-    boost::shared_ptr<transfer> t = m_transfer.lock();
-
     if (m_quota[download_channel] == 0 && !m_connecting)
     {
         // in this case, we have outstanding data to
         // receive, but no bandwidth quota. So, we simply
         // request bandwidth from the bandwidth manager
-        int ret = request_download_bandwidth(
-            &m_ses.m_download_channel,
-            t ? &t->m_bandwidth_channel[download_channel] : 0,
-            &m_bandwidth_channel[download_channel]);
+        int ret = request_download_bandwidth();
 
         if (ret == 0)
         {
@@ -559,17 +630,12 @@ bool peer_connection::has_download_bandwidth()
 
 bool peer_connection::has_upload_bandwidth()
 {
-    boost::shared_ptr<transfer> t = m_transfer.lock();
-
-    if (m_quota[upload_channel] == 0 && !m_send_buffer.empty() && !m_connecting)
+    if (m_quota[upload_channel] == 0 && (!m_send_buffer.empty() || m_upload_file) && !m_connecting)
     {
         // in this case, we have data to send, but no
         // bandwidth. So, we simply request bandwidth
         // from the bandwidth manager
-        int ret = request_upload_bandwidth(
-            &m_ses.m_upload_channel,
-            t ? &t->m_bandwidth_channel[upload_channel] : 0,
-            &m_bandwidth_channel[upload_channel]);
+        int ret = request_upload_bandwidth();
 
         if (ret == 0)
         {
@@ -590,7 +656,7 @@ void peer_connection::request_block()
     boost::shared_ptr<transfer> t = m_transfer.lock();
 
     if (m_disconnecting) return;
-    if (!t || t->is_seed() || t->upload_mode() || !can_request()) return;
+    if (!t || t->is_seed() || !t->has_picker() || t->upload_mode() || !can_request()) return;
 
     int num_requests = m_desired_queue_size
         - (int)m_download_queue.size()
@@ -662,6 +728,29 @@ void peer_connection::request_block()
         num_requests--;
     }
 
+    // end-game: every wanted block is requested already. Blocks requested from
+    // a single peer are requested once more, the copy which comes later is
+    // cancelled. This way a slow peer doesn't hold the last blocks
+    m_endgame_mode = t->end_game();
+    if (m_endgame_mode)
+    {
+        const std::vector<piece_picker::downloading_piece>& dq = p.get_download_queue();
+        for (std::vector<piece_picker::downloading_piece>::const_iterator i = dq.begin();
+             i != dq.end() && num_requests > 0; ++i)
+        {
+            if (!m_remote_pieces[i->index]) continue;
+
+            for (int k = 0, n = p.blocks_in_piece(i->index); k < n && num_requests > 0; ++k)
+            {
+                piece_block b(i->index, k);
+                if (p.is_downloaded(b) || p.num_peers(b) != 1 || requesting(b)) continue;
+                if (add_request(b, req_busy)) --num_requests;
+            }
+        }
+
+        return;
+    }
+
     // if we don't have any potential busy blocks to request
     // or if we already have outstanding requests, don't
     // pick a busy piece
@@ -691,7 +780,8 @@ bool peer_connection::add_request(const piece_block& block, int flags)
     else if (speed == medium) state = piece_picker::medium;
     else state = piece_picker::slow;
 
-    if ((flags & req_busy) && num_requesting_busy_blocks() >= m_max_busy_blocks)
+    if ((flags & req_busy) && !(flags & req_time_critical) && !m_endgame_mode &&
+        num_requesting_busy_blocks() >= m_max_busy_blocks)
     {
         // this block is busy (i.e. it has been requested
         // from another peer already). Only allow m_max_busy_blocks busy
@@ -704,10 +794,81 @@ bool peer_connection::add_request(const piece_block& block, int flags)
         return false;
 
     pending_block pb(block, t->size());
-    m_request_queue.push_back(pb);
+    pb.busy = (flags & req_busy) != 0;
+    pb.time_critical = (flags & req_time_critical) != 0;
+
+    if (pb.time_critical)
+    {
+        // time critical blocks are sent before the others
+        std::vector<pending_block>::iterator i = m_request_queue.begin();
+        while (i != m_request_queue.end() && i->time_critical) ++i;
+        m_request_queue.insert(i, pb);
+    }
+    else
+        m_request_queue.push_back(pb);
+
     return true;
 }
 
+int peer_connection::request_time_critical_piece(int piece, bool late)
+{
+    boost::shared_ptr<transfer> t = m_transfer.lock();
+
+    if (m_disconnecting) return 0;
+    if (!t || t->is_seed() || !t->has_picker() || t->upload_mode() || !can_request()) return 0;
+    if (!m_remote_pieces[piece]) return 0;
+
+    piece_picker& p = t->picker();
+    if (p.have_piece(piece)) return 0;
+
+    int num_requests = int(m_desired_queue_size) - int(num_requesting_time_critical_blocks());
+    int res = 0;
+
+    for (int k = 0, n = p.blocks_in_piece(piece); k < n && res < num_requests; ++k)
+    {
+        piece_block b(piece, k);
+        if (p.is_downloaded(b) || requesting(b)) continue;
+
+        int flags = req_time_critical;
+        if (p.is_requested(b))
+        {
+            // don't wait the block from other peer when the deadline is missed
+            if (!late || p.num_peers(b) > 1) continue;
+            flags |= req_busy;
+        }
+
+        if (add_request(b, flags)) ++res;
+    }
+
+    if (res > 0) send_block_requests();
+    return res;
+}
+
+void peer_connection::cancel_request(const piece_block& block)
+{
+    boost::shared_ptr<transfer> t = m_transfer.lock();
+    if (!t || !t->has_picker()) return;
+
+    std::vector<pending_block>::iterator i =
+        std::find_if(m_request_queue.begin(), m_request_queue.end(), has_block(block));
+    if (i != m_request_queue.end())
+    {
+        t->picker().abort_download(block, get_peer());
+        m_request_queue.erase(i);
+        return;
+    }
+
+    // ed2k can't cancel a single range, so the data is skipped when it comes
+    i = std::find_if(m_download_queue.begin(), m_download_queue.end(), has_block(block));
+    if (i == m_download_queue.end() || i->not_wanted) return;
+
+    DBG("cancel block request: "
+        "{piece: " << block.piece_index << ", block: " << block.block_index <<
+        ", remote: " << m_remote << "}");
+    t->picker().abort_download(block, get_peer());
+    i->not_wanted = true;
+}
+
 void peer_connection::send_block_requests()
 {
     if (m_channel_state[upload_channel] & peer_info::bw_seq) return;
@@ -728,6 +889,9 @@ void peer_connection::send_block_requests()
     client_request_parts_64 rp;
     rp.m_hFile = t->hash();
 
+    // round trip can be measured only when the peer has nothing to send before our request
+    bool measure_rtt = m_download_queue.empty();
+
     while (!m_request_queue.empty() && m_download_queue.size() < m_desired_queue_size)
     {
         pending_block block = m_request_queue.front();
@@ -736,7 +900,7 @@ void peer_connection::send_block_requests()
         // if we're a seed, we don't have a piece picker
         // so we don't have to worry about invariants getting
         // out of sync with it
-        if (t->is_seed()) continue;
+        if (t->is_seed() || !t->has_picker()) continue;
 
         // this can happen if a block times out, is re-requested and
         // then arrives "unexpectedly"
@@ -746,6 +910,15 @@ void peer_connection::send_block_requests()
             continue;
         }
 
+        if (measure_rtt)
+        {
+            m_rtt_pending = true;
+            m_rtt_block = block.block;
+            m_rtt_request_time = time_now_hires();
+            measure_rtt = false;
+        }
+
+        block.request_time = time_now_hires();
         m_download_queue.push_back(block);
         rp.append(block_range(block.block.piece_index, block.block.block_index, t->size()));
         if (rp.full())
@@ -800,7 +973,7 @@ void peer_connection::abort_expired_requests()
             DBG("abort expired block request: "                         \
                 "{piece: " << b.piece_index << ", block: " << b.block_index << \
                 ", remote: " << m_remote << "}");                       \
-            picker.abort_download(b);                                   \
+            if (!pi->not_wanted) picker.abort_download(b);              \
             pi = reqs.erase(pi);                                        \
         }                                                               \
         else                                                            \
@@ -866,6 +1039,25 @@ size_t peer_connection::num_requesting_busy_blocks() const
     return res;
 }
 
+size_t peer_connection::num_requesting_time_critical_blocks() const
+{
+    size_t res = 0;
+
+    for (std::vector<pending_block>::const_iterator i = m_download_queue.begin(),
+             end(m_download_queue.end()); i != end; ++i)
+    {
+        if (i->time_critical && !i->not_wanted) ++res;
+    }
+
+    for (std::vector<pending_block>::const_iterator i = m_request_queue.begin(),
+             end(m_request_queue.end()); i != end; ++i)
+    {
+        if (i->time_critical) ++res;
+    }
+
+    return res;
+}
+
 int peer_connection::outstanding_bytes() const
 {
     int res = 0;
@@ -945,6 +1137,7 @@ char* peer_connection::release_disk_receive_buffer()
 void peer_connection::on_timeout()
 {
     boost::mutex::scoped_lock l(m_ses.m_mutex);
+    if (m_connecting && !m_disconnecting) m_ses.connect_attempt_finished(errors::timed_out);
     disconnect(errors::timed_out);
 }
 
@@ -991,6 +1184,7 @@ void peer_connection::on_sent(const error_code& error, std::size_t bytes_transfe
 
     LIBED2K_ASSERT(amount_payload <= (int)bytes_transferred);
     m_statistics.sent_bytes(amount_payload, bytes_transferred - amount_payload);
+    if (m_credit) m_ses.m_credits.add_uploaded(*m_credit, amount_payload);
 }
 
 void peer_connection::disconnect(error_code const& ec, int error)
@@ -1057,6 +1251,7 @@ void peer_connection::on_connect(error_code const& e)
 
     m_connecting = false;
     m_ses.m_half_open.done(m_connection_ticket);
+    m_ses.connect_attempt_finished(e);
 
     error_code ec;
     if (e)
@@ -1131,7 +1326,7 @@ bool peer_connection::can_write() const
 {
     // if we have requests or pending data to be sent or announcements to be made
     // we want to send data
-    return !m_send_buffer.empty()
+    return (!m_send_buffer.empty() || m_upload_file)
         && m_quota[upload_channel] > 0
         && !m_connecting;
 }
@@ -1260,7 +1455,7 @@ void peer_connection::fill_send_buffer()
     {
         const peer_request& req = m_requests.front();
         write_part(req);
-        send_data(req);
+        if (!start_send_file(req)) send_data(req);
         m_requests.erase(m_requests.begin());
     }
 }
@@ -1277,7 +1472,7 @@ void peer_connection::send_data(const peer_request& req)
     if (r.length > 0)
     {
         t->filesystem().async_read(r, boost::bind(&peer_connection::on_disk_read_complete,
-                                                  self_as<peer_connection>(), _1, _2, r, left));
+                                                  self_as<peer_connection>(), _1, _2, r, left), 0, 0, m_read_stream_id);
         m_channel_state[upload_channel] |= peer_info::bw_seq;
     }
     else
@@ -1310,8 +1505,7 @@ void peer_connection::on_disk_read_complete(
         t->handle_disk_error(j, this);
         return;
     }
-    append_send_buffer(buffer.get(), r.length,
-                       boost::bind(&aux::session_impl::free_disk_buffer, boost::ref(m_ses), _1));
+    append_send_buffer(buffer.get(), r.length, aux::session_impl::disk_pool);
     buffer.release();
 
     m_payloads.push_back(range(m_send_buffer.size() - r.length, r.length));
@@ -1319,6 +1513,109 @@ void peer_connection::on_disk_read_complete(
     send_data(left);
 }
 
+bool peer_connection::start_send_file(const peer_request& req)
+{
+#if LIBED2K_USE_SENDFILE
+    if (!m_ses.settings().sendfile_upload) return false;
+
+    // pieces of unfinished transfers may still be in the write cache
+    boost::shared_ptr<transfer> t = m_transfer.lock();
+    if (!t || !t->is_seed() || req.length <= 0) return false;
+
+    error_code ec;
+    m_upload_file = t->filesystem().open_for_upload(req, m_upload_offset, ec);
+    if (!m_upload_file) return false;
+
+    // sendfile() must not block the network thread on a full socket
+    m_socket->non_blocking(true, ec);
+    if (ec)
+    {
+        m_upload_file.reset();
+        return false;
+    }
+
+    // the part is sent by do_write() once its header is out, other
+    // messages wait for it like they wait for disk reads
+    m_upload_req = req;
+    m_channel_state[upload_channel] |= peer_info::bw_seq;
+    return true;
+#else
+    return false;
+#endif
+}
+
+void peer_connection::send_file()
+{
+    m_deadline.expires_from_now(seconds(m_ses.settings().peer_timeout));
+
+    // wait until the socket is writable, then sendfile() in the handler
+    m_socket->async_write_some(boost::asio::null_buffers(), make_write_handler(
+        boost::bind(&peer_connection::on_send_file, self_as<peer_connection>(), _1)));
+    m_channel_state[upload_channel] |= peer_info::bw_network;
+}
+
+void peer_connection::on_send_file(const error_code& error)
+{
+    boost::mutex::scoped_lock l(m_ses.m_mutex);
+
+    // keep ourselves alive in until this function exits in
+    // case we disconnect
+    boost::intrusive_ptr<peer_connection> me(this);
+
+    m_channel_state[upload_channel] &= ~peer_info::bw_network;
+
+    if (error)
+    {
+        disconnect(error);
+        return;
+    }
+    if (is_closed() || !m_upload_file) return;
+
+#if LIBED2K_USE_SENDFILE
+    LIBED2K_ASSERT(m_send_buffer.empty());
+    LIBED2K_ASSERT(m_upload_req.length > 0);
+
+    error_code ec;
+    int amount = std::min(m_upload_req.length, m_quota[upload_channel]);
+    size_type ret = m_upload_file->sendfile(
+        m_socket->native_handle(), m_upload_offset, amount, ec);
+
+    if (ec == boost::system::errc::resource_unavailable_try_again)
+    {
+        do_write();
+        return;
+    }
+
+    if (ret <= 0)
+    {
+        // the file or the filesystem can't do it, read the rest of the
+        // part through the disk thread, it reports real disk errors
+        DBG("sendfile failed: " << ec.message() << ", read the rest ==> " << m_remote);
+        peer_request left = m_upload_req;
+        m_upload_file.reset();
+        send_data(left);
+        return;
+    }
+
+    m_upload_offset += ret;
+    m_upload_req.start += int(ret);
+    m_upload_req.length -= int(ret);
+
+    // all sent bytes are payload, the send buffer is empty
+    m_payloads.push_back(range(0, int(ret)));
+    on_sent(error_code(), std::size_t(ret));
+
+    if (m_upload_req.length == 0)
+    {
+        m_upload_file.reset();
+        m_channel_state[upload_channel] &= ~peer_info::bw_seq;
+        fill_send_buffer();
+    }
+
+    do_write();
+#endif
+}
+
 void peer_connection::receive_data(const peer_request& req, bool compressed)
 {
     LIBED2K_ASSERT((m_channel_state[download_channel] & (peer_info::bw_network | peer_info::bw_seq)) == 0);
@@ -1327,6 +1624,13 @@ void peer_connection::receive_data(const peer_request& req, bool compressed)
     m_recv_pos = 0;
     m_recv_req = req;
     m_recv_compressed = compressed;
+
+    if (m_rtt_pending && mk_block(req) == m_rtt_block)
+    {
+        int sample = total_milliseconds(time_now_hires() - m_rtt_request_time);
+        m_rtt = (m_rtt == 0) ? sample : (m_rtt * 7 + sample) / 8;
+        m_rtt_pending = false;
+    }
     m_channel_state[download_channel] |= peer_info::bw_seq;
     receive_data();
 }
@@ -1362,6 +1666,13 @@ void peer_connection::receive_data()
         return;
     }
 
+    // the block came from other peer already
+    if (b->not_wanted)
+    {
+        skip_data();
+        return;
+    }
+
     if (!b->buffer && !(b->buffer = allocate_receive_buffer(block_size(block, t->size()))))
         return;
 
@@ -1396,6 +1707,7 @@ void peer_connection::on_receive_data(const error_code& error, std::size_t bytes
     LIBED2K_ASSERT(int(bytes_transferred) <= m_quota[download_channel]);
     m_quota[download_channel] -= bytes_transferred;
     m_statistics.received_bytes(bytes_transferred, 0);
+    if (m_credit) m_ses.m_credits.add_downloaded(*m_credit, bytes_transferred);
 
     m_recv_pos += bytes_transferred;
     LIBED2K_ASSERT(int(bytes_transferred) <= m_recv_req.length);
@@ -1406,7 +1718,7 @@ void peer_connection::on_receive_data(const error_code& error, std::size_t bytes
     m_last_receive = time_now();
 
     boost::shared_ptr<transfer> t = m_transfer.lock();
-    if (!t || t->is_seed()) return;
+    if (!t || t->is_seed() || !t->has_picker()) return;
 
     piece_picker& picker = t->picker();
     piece_manager& fs = t->filesystem();
@@ -1443,6 +1755,11 @@ void peer_connection::on_receive_data(const error_code& error, std::size_t bytes
     {
         if (complete_block(*b))
         {
+            if (m_ses.m_alerts.should_post<block_finished_alert>())
+                m_ses.m_alerts.post_alert(block_finished_alert(
+                    t->handle(), block_finished.piece_index, block_finished.block_index,
+                    time_now_hires() - b->request_time));
+
             disk_buffer_holder holder(m_ses.m_disk_thread, release_disk_receive_buffer());
             peer_request req = mk_peer_request(b->block, t->size());
             fs.async_write(req, holder,
@@ -1450,9 +1767,14 @@ void peer_connection::on_receive_data(const error_code& error, std::size_t bytes
                                        self_as<peer_connection>(), _1, _2, req, t));
 
             bool was_finished = picker.is_piece_finished(m_recv_req.piece);
+            bool duplicated = picker.num_peers(block_finished) > 1;
             picker.mark_as_writing(block_finished, get_peer());
             m_download_queue.erase(b);
 
+            // the block was requested from several peers in end-game or for
+            // time critical piece, others needn't send it anymore
+            if (duplicated) t->cancel_block(block_finished, this);
+
             // did we just finish the piece?
             // this means all blocks are either written
             // to disk or are in the disk write cache
@@ -1473,6 +1795,14 @@ void peer_connection::on_receive_data(const error_code& error, std::size_t bytes
     do_read();
 }
 
+void peer_connection::update_desired_queue_size()
+{
+    const session_settings& settings = m_ses.settings();
+    m_desired_queue_size = desired_queue_size(
+        int(m_statistics.download_payload_rate()), m_rtt,
+        settings.min_request_queue, settings.max_request_queue);
+}
+
 void peer_connection::skip_data()
 {
     char* skip_buf = &m_ses.m_skip_buffer[0];
@@ -1502,6 +1832,15 @@ void peer_connection::on_skip_data(const error_code& error, std::size_t bytes_tr
     if (m_recv_pos < m_recv_req.length)
         skip_data();
     else {
+        // forget the cancelled block when all its data is skipped
+        std::vector<pending_block>::iterator b = std::find_if(
+            m_download_queue.begin(), m_download_queue.end(), has_block(mk_block(m_recv_req)));
+        if (b != m_download_queue.end() && b->not_wanted)
+        {
+            b->complete(mk_range(m_recv_req));
+            if (b->completed()) m_download_queue.erase(b);
+        }
+
         m_channel_state[download_channel] &= ~(peer_info::bw_network | peer_info::bw_seq);
         do_read();
         request_block();
@@ -1821,19 +2160,27 @@ void peer_connection::on_hello(const error_code& error)
         DECODE_PACKET(client_hello, hello);
         // store user info
         m_hClient = hello.m_hClient;
+        m_credit = &m_ses.m_credits.get(m_hClient);
         m_options.m_nPort = hello.m_network_point.m_nPort;
         parse_misc_info(hello.m_list);
         DBG("hello {"
                 << " server point = " << hello.m_server_network_point
                 << " network point = " << hello.m_network_point
                 << "} <== " << m_remote);
-        md4_hash file_hash = m_ses.callbacked_lowid(hello.m_network_point.m_nIP);
-
-        if (file_hash != md4_hash::invalid)
+        // peers called through a Kad buddy may not have a low id and
+        // are known by their address
+        std::vector<md4_hash> files;
+        if (m_ses.callbacked_lowid(hello.m_network_point.m_nIP, files) ||
+            m_ses.callbacked_lowid(address2int(m_remote.address()), files))
         {
-            DBG("lowid peer detected for " << file_hash.toString());
+            DBG("lowid peer detected for " << files.size() << " files");
             m_active = true;
-            attach_to_transfer(file_hash);
+            m_peer_classes = m_ses.m_classes.valid(m_ses.m_peer_class_type_filter.apply(
+                peer_class_type_filter::lowid_callback, m_peer_classes));
+
+            // the first transfer still wanting the peer takes the connection
+            for (std::vector<md4_hash>::const_iterator i = files.begin(); i != files.end(); ++i)
+                if (attach_to_transfer(*i)) break;
         }
 
         write_hello_answer();
@@ -1852,6 +2199,7 @@ void peer_connection::on_hello_answer(const error_code& error)
         parse_misc_info(packet.m_list);
 
         m_hClient = packet.m_hClient;
+        m_credit = &m_ses.m_credits.get(m_hClient);
         DBG("hello answer {name: " << m_options.m_strName
             << " : mod name: " << m_options.m_strModVersion
             << ", port: " << m_options.m_nPort << "} <== " << m_remote);
@@ -2217,6 +2565,9 @@ void peer_connection::on_shared_files_request(const error_code& error)
             // TODO - suppress output unshared dirs - now we announce all directories all files
             std::transform(m_ses.m_transfers.begin(), m_ses.m_transfers.end(),
                            std::back_inserter(sfa.m_files.m_collection), &transfer2sfe);
+            for (dormant_transfers::const_iterator i = m_ses.m_dormant_transfers.begin();
+                 i != m_ses.m_dormant_transfers.end(); ++i)
+                sfa.m_files.m_collection.push_back(m_ses.get_announce(i->first));
             // erase empty announces
             sfa.m_files.m_collection.erase(
                 std::remove_if(sfa.m_files.m_collection.begin(), sfa.m_files.m_collection.end(),
@@ -2246,7 +2597,7 @@ void peer_connection::on_ismod_files_request(const error_code& error)
         DBG("request ismod directory content: {hash: " << req.m_hash << "} <== " << m_remote);
 
         // check we public collection now
-        if (boost::shared_ptr<transfer> ct = m_ses.find_transfer(req.m_hash).lock())
+        if (boost::shared_ptr<transfer> ct = m_ses.wake_transfer(req.m_hash))
         {
             emule_collection coll = emule_collection::fromFile(ct->file_path());
             client_directory_content_result ans;
@@ -2255,8 +2606,8 @@ void peer_connection::on_ismod_files_request(const error_code& error)
             for(std::deque<emule_collection_entry>::const_iterator i = coll.m_files.begin();
                 i != coll.m_files.end(); ++i)
             {
-                boost::shared_ptr<transfer> t = m_ses.find_transfer(i->m_filehash).lock();
-                if (t) ans.m_files.m_collection.push_back(t->get_announce());
+                shared_file_entry se = m_ses.get_announce(i->m_filehash);
+                if (!se.is_empty()) ans.m_files.m_collection.push_back(se);
             }
 
             DBG("ismod directory content: {hash: " << ans.m_hdirectory <<
@@ -2278,8 +2629,10 @@ void peer_connection::on_shared_files_answer(const error_code& error)
         DECODE_PACKET(client_shared_files_answer, packet);
         DBG("shared files: " << boost::algorithm::join(filelist(packet.m_files), ", ") <<
             " <== " << m_remote);
+        boost::shared_ptr<shared_files_list> files(new shared_files_list);
+        files->swap(packet.m_files);
         m_ses.m_alerts.post_alert_should(
-            shared_files_alert(get_network_point(), get_connection_hash(), packet.m_files, false));
+            shared_files_alert(get_network_point(), get_connection_hash(), files, false));
     }
     else
     {
@@ -2319,6 +2672,13 @@ void peer_connection::on_shared_directories_request(const error_code& error)
                 if (!dir.empty()) dirs.push_back(dir);
             }
 
+            for (dormant_transfers::const_iterator i = m_ses.m_dormant_transfers.begin();
+                 i != m_ses.m_dormant_transfers.end(); ++i)
+            {
+                std::string dir = collection_dir(filename(i->second.file_path));
+                if (!dir.empty()) dirs.push_back(dir);
+            }
+
             std::deque<std::string>::iterator itr = std::unique(dirs.begin(), dirs.end());
             dirs.resize(itr - dirs.begin());
 
@@ -2375,8 +2735,8 @@ void peer_connection::on_shared_directory_files_request(const error_code& error)
                 for(std::deque<emule_collection_entry>::const_iterator i = coll.m_files.begin();
                     i != coll.m_files.end(); ++i)
                 {
-                    boost::shared_ptr<transfer> t = m_ses.find_transfer(i->m_filehash).lock();
-                    if (t) ans.m_list.m_collection.push_back(t->get_announce());
+                    shared_file_entry se = m_ses.get_announce(i->m_filehash);
+                    if (!se.is_empty()) ans.m_list.m_collection.push_back(se);
                 }
 
                 DBG("shared directory files: {dir: " << ans.m_directory.m_collection <<
@@ -2400,10 +2760,12 @@ void peer_connection::on_shared_directory_files_answer(const error_code& error)
         DBG("shared directory files: {dir: " << sdf.m_directory.m_collection << 
             ", files: [" << boost::algorithm::join(filelist(sdf.m_list), ", ") <<
             "]} <== " << m_remote);
+        boost::shared_ptr<shared_files_list> files(new shared_files_list);
+        files->swap(sdf.m_list);
         m_ses.m_alerts.post_alert_should(shared_directory_files_alert(get_network_point(),
                 get_connection_hash(),
                 sdf.m_directory.m_collection,
-                sdf.m_list));
+                files));
     }
     else
     {
@@ -2419,10 +2781,12 @@ void peer_connection::on_ismod_directory_files(const error_code& error)
         DBG("ismod directory files: {dir: " << cdcr.m_hdirectory <<
             ", files: [" << boost::algorithm::join(filelist(cdcr.m_files), ", ") <<
             "]} <== " << m_remote);
+        boost::shared_ptr<shared_files_list> files(new shared_files_list);
+        files->swap(cdcr.m_files);
         m_ses.m_alerts.post_alert_should(ismod_shared_directory_files_alert(get_network_point(),
                 get_connection_hash(),
                 cdcr.m_hdirectory,
-                cdcr.m_files));
+                files));
     }
     else
     {
@@ -1985,6 +1985,20 @@ namespace libed2k
 		return std::make_pair(start, end);
 	}
 
+	bool piece_picker::all_requested() const
+	{
+		if (m_num_have + m_num_filtered + int(m_downloads.size()) < num_pieces())
+			return false;
+
+		for (std::vector<downloading_piece>::const_iterator i = m_downloads.begin()
+			, end(m_downloads.end()); i != end; ++i)
+		{
+			if (i->requested + i->finished + i->writing < blocks_in_piece(i->index))
+				return false;
+		}
+		return true;
+	}
+
 	bool piece_picker::is_piece_finished(int index) const
 	{
 		LIBED2K_ASSERT(index < (int)m_piece_map.size());
@@ -8,6 +8,7 @@
 #include "libed2k/peer_connection.hpp"
 #include "libed2k/broadcast_socket.hpp"
 #include "libed2k/random.hpp"
+#include "libed2k/io.hpp"
 
 using namespace libed2k;
 
@@ -57,7 +58,7 @@ peer* policy::add_peer(const tcp::endpoint& ep, int source, char flags)
     aux::session_impl& ses = m_transfer->session();
 
     // if the IP is blocked, don't add it
-    if (ses.m_ip_filter.access(ep.address()) & ip_filter::blocked)
+    if (ses.m_ip_filter->access(ep.address()) & ip_filter::blocked)
     {
         error_code ec;
         DBG("blocked peer: " << ep.address().to_string(ec));
@@ -390,6 +391,17 @@ void policy::connection_closed(const peer_connection& c, int session_time)
         if (p->failcount < 31) ++p->failcount;
     }
 
+    // remember useful peers to connect them first next time
+    p->transferred = !c.failed() && c.statistics().total_payload_download() > 0;
+    if (p->transferred) p->last_transferred = boost::uint32_t(std::time(0));
+
+    if (c.remote_pieces().size() > 0 && c.is_seed() != p->seed)
+    {
+        if (p->seed) --m_num_seeds;
+        else ++m_num_seeds;
+        p->seed = !p->seed;
+    }
+
     if (is_connect_candidate(*p, m_finished))
         ++m_num_connect_candidates;
 
@@ -438,7 +450,7 @@ void policy::ip_filter_updated()
 
     for (peers_t::iterator i = m_peers.begin(); i != m_peers.end();)
     {
-        if ((ses.m_ip_filter.access((*i)->address()) & ip_filter::blocked) == 0)
+        if ((ses.m_ip_filter->access((*i)->address()) & ip_filter::blocked) == 0)
         {
             ++i;
             continue;
@@ -611,6 +623,10 @@ bool policy::compare_peer(peer const& lhs, peer const& rhs/*, address const& ext
     bool rhs_local = is_local(rhs.address());
     if (lhs_local != rhs_local) return lhs_local > rhs_local;
 
+    // then peers we have downloaded from and peers which have complete file
+    if (lhs.transferred != rhs.transferred) return lhs.transferred > rhs.transferred;
+    if (lhs.seed != rhs.seed) return lhs.seed > rhs.seed;
+
     if (lhs.last_connected != rhs.last_connected)
         return lhs.last_connected < rhs.last_connected;
 
@@ -868,3 +884,74 @@ bool policy::should_erase_immediately(peer const& p) const
     //if (&p == m_locked_peer) return false;
     return p.source == peer_info::resume_data;
 }
+
+namespace
+{
+    enum { resume_peer_size = 4 + 2 + 1 + 1 + 4 };
+
+    // peers we downloaded from recently go first
+    bool better_resume_peer(const peer* lhs, const peer* rhs)
+    {
+        if (lhs->last_transferred != rhs->last_transferred)
+            return lhs->last_transferred > rhs->last_transferred;
+        if (lhs->failcount != rhs->failcount) return lhs->failcount < rhs->failcount;
+        if (lhs->seed != rhs->seed) return lhs->seed > rhs->seed;
+        return source_rank(lhs->source) > source_rank(rhs->source);
+    }
+}
+
+void policy::save_peers(std::string& out, int max_peers) const
+{
+    const int max_failcount = m_transfer->session().settings().max_failcount;
+    std::vector<const peer*> peers;
+
+    for (peers_t::const_iterator i = m_peers.begin(); i != m_peers.end(); ++i)
+    {
+        const peer* p = *i;
+        if (!p->connectable || !p->address().is_v4() || int(p->failcount) >= max_failcount)
+            continue;
+        peers.push_back(p);
+    }
+
+    size_t n = std::min(peers.size(), size_t(std::max(max_peers, 0)));
+    std::partial_sort(peers.begin(), peers.begin() + n, peers.end(), &better_resume_peer);
+
+    out.resize(n * resume_peer_size);
+    if (n == 0) return;
+
+    char* ptr = &out[0];
+    for (size_t k = 0; k < n; ++k)
+    {
+        const peer* p = peers[k];
+        detail::write_uint32(p->address().to_v4().to_ulong(), ptr);
+        detail::write_uint16(p->port(), ptr);
+        // the way the peer came in doesn't help to reach it again
+        detail::write_uint8(p->source & ~peer_info::incoming & 0xff, ptr);
+        detail::write_uint8(p->failcount, ptr);
+        detail::write_uint32(p->last_transferred, ptr);
+    }
+}
+
+int policy::load_peers(const char* buf, int len)
+{
+    int ret = 0;
+
+    for (; len >= resume_peer_size; len -= resume_peer_size)
+    {
+        ip::address_v4 addr(detail::read_uint32(buf));
+        int port = detail::read_uint16(buf);
+        int source = detail::read_uint8(buf);
+        int failcount = detail::read_uint8(buf);
+        boost::uint32_t last_transferred = detail::read_uint32(buf);
+
+        peer* p = add_peer(tcp::endpoint(addr, port), source | peer_info::resume_data, 0);
+        if (!p) continue;
+
+        p->last_transferred = last_transferred;
+        p->transferred = last_transferred != 0;
+        set_failcount(p, std::min(failcount, 31));
+        ++ret;
+    }
+
+    return ret;
+}
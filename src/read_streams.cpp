@@ -0,0 +1,91 @@
+#include "libed2k/pch.hpp"
+
+#include <algorithm>
+
+#include "libed2k/read_streams.hpp"
+#include "libed2k/assert.hpp"
+
+namespace libed2k
+{
+    bool read_streams::update(const key_type& key, int piece, int offset, int size, int block_size
+        , int blocks_in_piece, int read_ahead_blocks, int& start, int& end, bool& hint)
+    {
+        hint = false;
+        index_t::iterator i = m_index.find(key);
+
+        if (i == m_index.end())
+        {
+            if (m_index.size() >= max_streams)
+            {
+                m_index.erase(m_order.front().key);
+                m_order.pop_front();
+            }
+
+            stream s;
+            s.key = key;
+            s.piece = -1;
+            s.next_offset = 0;
+            s.sequential = 0;
+            s.read_ahead_end = 0;
+            s.hinted = false;
+            m_order.push_back(s);
+            i = m_index.insert(std::make_pair(key, --m_order.end())).first;
+        }
+        else
+        {
+            m_order.splice(m_order.end(), m_order, i->second);
+        }
+
+        stream& s = *i->second;
+        bool forward = s.piece == piece
+            && offset >= s.next_offset - block_size
+            && offset <= s.next_offset + block_size;
+
+        if (forward)
+        {
+            ++s.sequential;
+        }
+        else
+        {
+            s.piece = piece;
+            s.sequential = 1;
+            s.read_ahead_end = 0;
+            s.hinted = false;
+        }
+
+        s.next_offset = offset + size;
+        if (s.sequential < 2) return false;
+
+        int block = s.next_offset / block_size;
+        if (s.read_ahead_end - block > read_ahead_blocks / 2) return false;
+
+        start = (std::max)(block, s.read_ahead_end);
+        end = (std::min)(block + read_ahead_blocks, blocks_in_piece);
+        if (start >= end) return false;
+        s.read_ahead_end = end;
+
+        if (!s.hinted && end < blocks_in_piece)
+        {
+            hint = true;
+            s.hinted = true;
+        }
+
+        return true;
+    }
+
+    void read_streams::forget(void const* storage)
+    {
+        for (order_t::iterator i = m_order.begin(); i != m_order.end();)
+        {
+            if (i->key.second != storage) { ++i; continue; }
+            m_index.erase(i->key);
+            i = m_order.erase(i);
+        }
+    }
+
+    void read_streams::clear()
+    {
+        m_order.clear();
+        m_index.clear();
+    }
+}
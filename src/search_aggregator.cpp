@@ -0,0 +1,107 @@
+#include "libed2k/pch.hpp"
+
+#include "libed2k/search_aggregator.hpp"
+#include "libed2k/ctag.hpp"
+
+namespace libed2k
+{
+    namespace
+    {
+        template<typename Size>
+        size_type file_size(const tag_list<Size>& tags)
+        {
+            return size_type(tags.getIntTagByNameId(FT_FILESIZE))
+                + (size_type(tags.getIntTagByNameId(FT_FILESIZE_HI)) << 32);
+        }
+
+        bool same(const search_result_entry& lhs, const search_result_entry& rhs)
+        {
+            return lhs.size == rhs.size && lhs.name == rhs.name && lhs.sources == rhs.sources
+                && lhs.complete_sources == rhs.complete_sources && lhs.names == rhs.names
+                && lhs.origins == rhs.origins;
+        }
+    }
+
+    search_aggregator::search_aggregator() : m_server(false), m_more(false)
+    {
+    }
+
+    void search_aggregator::start(bool server, const md4_hash& kad_target)
+    {
+        m_files.clear();
+        m_server = server;
+        m_kad_target = kad_target;
+        m_more = false;
+    }
+
+    void search_aggregator::stop()
+    {
+        start(false, md4_hash::invalid);
+    }
+
+    void search_aggregator::add_server_results(const shared_files_list& files, bool more,
+                                               std::vector<search_result_entry>& changed)
+    {
+        m_more = more;
+
+        for (std::vector<shared_file_entry>::const_iterator i = files.m_collection.begin();
+             i != files.m_collection.end(); ++i)
+        {
+            add(i->m_hFile, file_size(i->m_list), i->m_list.getStringTagByNameId(FT_FILENAME),
+                int(i->m_list.getIntTagByNameId(FT_SOURCES)),
+                int(i->m_list.getIntTagByNameId(FT_COMPLETE_SOURCES)),
+                search_result_entry::server, changed);
+        }
+    }
+
+    void search_aggregator::add_kad_results(const std::deque<kad_info_entry>& entries,
+                                            std::vector<search_result_entry>& changed)
+    {
+        for (std::deque<kad_info_entry>::const_iterator i = entries.begin(); i != entries.end(); ++i)
+        {
+            add(md4_hash(i->hash), file_size(i->tags), i->tags.getStringTagByNameId(FT_FILENAME),
+                int(i->tags.getIntTagByNameId(FT_SOURCES)),
+                int(i->tags.getIntTagByNameId(FT_COMPLETE_SOURCES)),
+                search_result_entry::kad, changed);
+        }
+    }
+
+    void search_aggregator::add(const md4_hash& hash, size_type size, const std::string& name,
+                                int sources, int complete, int origin,
+                                std::vector<search_result_entry>& changed)
+    {
+        if (!hash.defined()) return;
+
+        std::pair<std::map<md4_hash, file_entry>::iterator, bool> ret =
+            m_files.insert(std::make_pair(hash, file_entry()));
+        file_entry& f = ret.first->second;
+        search_result_entry before = f.result;
+
+        if (origin == search_result_entry::server)
+        {
+            f.server_sources = sources;
+            f.server_complete = complete;
+        }
+        else
+        {
+            f.kad_sources = std::max(f.kad_sources, sources);
+            f.kad_complete = std::max(f.kad_complete, complete);
+        }
+
+        search_result_entry& r = f.result;
+        r.hash = hash;
+        if (r.size == 0) r.size = size;
+        r.sources = f.server_sources + f.kad_sources;
+        r.complete_sources = f.server_complete + f.kad_complete;
+        r.origins |= origin;
+
+        if (!name.empty())
+        {
+            int n = ++f.names[name];
+            if (r.name.empty() || (r.name != name && n > f.names[r.name])) r.name = name;
+            r.names = int(f.names.size());
+        }
+
+        if (ret.second || !same(before, r)) changed.push_back(r);
+    }
+}
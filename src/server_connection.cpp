@@ -109,6 +109,8 @@ namespace libed2k
             t.set_announced(false);
         }
 
+        m_ses.m_dormant_transfers.set_announced(false);
+
         last_close_result = ec;
         m_ses.m_alerts.post_alert_should(server_connection_closed(params.name, params.host, params.port, ec));
     }
@@ -175,9 +177,9 @@ namespace libed2k
             if (params.announce() && d >= params.announce_timeout)
             {
 #ifdef LIBED2K_IS74
-                if (announced_transfers_count != m_ses.m_transfers.size() + 1)
+                if (announced_transfers_count != m_ses.m_transfers.size() + m_ses.m_dormant_transfers.size() + 1)
 #else
-                if (announced_transfers_count != m_ses.m_transfers.size())
+                if (announced_transfers_count != m_ses.m_transfers.size() + m_ses.m_dormant_transfers.size())
 #endif
                 {
                     // unshared transfers exist
@@ -207,6 +209,18 @@ namespace libed2k
                         }
                     }
 
+                    for (dormant_transfers::iterator i = m_ses.m_dormant_transfers.begin();
+                         i != m_ses.m_dormant_transfers.end() &&
+                             offer_list.m_collection.size() < params.announce_items_per_call_limit; ++i)
+                    {
+                        dormant_transfer& t = i->second;
+                        if (t.announced) continue;
+
+                        offer_list.add(make_announce(m_ses, i->first, filename(t.file_path), t.file_size, true));
+                        t.announced = true;
+                        ++announced_transfers_count;
+                    }
+
                     // generate announce for user as transfer when all transfers were announced but user wasn't
 #ifdef LIBED2K_IS74
                     if (offer_list.m_collection.size() < params.announce_items_per_call_limit)
@@ -221,6 +235,10 @@ namespace libed2k
                             total_size.nQuadPart += t.size();
                         }
 
+                        for (dormant_transfers::const_iterator i = m_ses.m_dormant_transfers.begin();
+                             i != m_ses.m_dormant_transfers.end(); ++i)
+                            total_size.nQuadPart += i->second.file_size;
+
                         shared_file_entry se;
                         se.m_hFile = m_ses.settings().user_agent;
 
@@ -358,8 +376,9 @@ namespace libed2k
             if (isLowId(i->m_nIP) && !isLowId(m_client_id))
             {
                 // peer LowID and we is not LowID - send callback request
+                // transfers wanting the same peer share one callback
                 if (m_ses.register_callback(i->m_nIP, sources.m_hFile))
-                    post_callback_request(i->m_nIP);
+                    m_ses.send_lowid_callback(i->m_nIP);
             }
             else
             {
@@ -476,20 +495,17 @@ namespace libed2k
             if (m_in_header.m_protocol == OP_PACKEDPROT)
             {
                 DBG("packed packet reseived");
-                // unzip data
-                m_in_container.resize(m_in_gzip_container.size() * 10 + 300);
-                uLongf nSize = m_in_container.size();
-                int nRet = uncompress((Bytef*)&m_in_container[0], &nSize, (const Bytef*)&m_in_gzip_container[0], m_in_gzip_container.size());
+                error_code ec = m_inflater.unpack(
+                    m_in_gzip_container.empty() ? NULL : &m_in_gzip_container[0], m_in_gzip_container.size(),
+                    m_in_container, m_ses.settings().max_inflated_packet_size);
 
-                if (nRet != Z_OK)
+                if (ec)
                 {
-                    ERR("Unzip error: " << mz_error(nRet));
+                    ERR("Unzip error: " << ec.message());
                     //unpack error - pass packet
                     do_read();
                     return;
                 }
-
-                m_in_container.resize(nSize);
             }
 
 
@@ -568,9 +584,13 @@ namespace libed2k
                         search_result sfl;
                         ia >> sfl;
 
+                        if (m_ses.on_server_search_result(sfl)) break;
+
+                        boost::shared_ptr<shared_files_list> files(new shared_files_list);
+                        files->swap(sfl.m_files);
                         m_ses.m_alerts.post_alert_should(
                                 shared_files_alert(net_identifier(address2int(m_target.address()), m_target.port()), m_hServer,
-                                        sfl.m_files, (sfl.m_more_results_avaliable != 0)));
+                                        files, (sfl.m_more_results_avaliable != 0)));
                         break;
                     }
                     case OP_CALLBACKREQUESTED:
@@ -587,7 +607,8 @@ namespace libed2k
                         break;
                     }
                     case OP_CALLBACK_FAIL:
-                        DBG("callback request failed - cleanup callbacks? ");
+                        // no client id in the answer, the callback times out
+                        DBG("callback request failed");
                         break;
                     default:
                         ERR("server ignore unhandled packet: " << std::hex << int(m_in_header.m_type));
@@ -29,6 +29,11 @@ namespace libed2k
         return m_impl->status();
     }
 
+    cache_status session::get_cache_status() const
+    {
+        return m_impl->m_disk_thread.status();
+    }
+
     transfer_handle session::add_transfer(const add_transfer_params& params)
     {
         boost::mutex::scoped_lock l(m_impl->m_mutex);
@@ -45,6 +50,12 @@ namespace libed2k
         m_impl->post_transfer(params);
     }
 
+    void session::add_transfers(const std::vector<add_transfer_params>& params)
+    {
+        boost::mutex::scoped_lock l(m_impl->m_mutex);
+        m_impl->post_transfers(params);
+    }
+
     peer_connection_handle session::add_peer_connection(const net_identifier& np)
     {
         boost::mutex::scoped_lock l(m_impl->m_mutex);
@@ -101,6 +112,11 @@ namespace libed2k
         m_impl->m_io_service.post(boost::bind(&aux::session_impl::post_search_request, m_impl, ro));
     }
 
+    void session::post_search(search_request& sr, const std::string& keyword)
+    {
+        m_impl->m_io_service.post(boost::bind(&aux::session_impl::post_search, m_impl, sr, keyword));
+    }
+
     void session::post_search_more_result_request()
     {
         m_impl->m_io_service.post(boost::bind(&aux::session_impl::post_search_more_result_request, m_impl));
@@ -116,6 +132,20 @@ namespace libed2k
         m_impl->m_io_service.post(boost::bind(&aux::session_impl::post_sources_request, m_impl, hFile, nSize));
     }
 
+    void session::set_global_servers(const server_met& servers)
+    {
+        std::vector<tcp::endpoint> eps;
+
+        for (std::deque<server_met_entry>::const_iterator i = servers.m_servers.m_collection.begin();
+             i != servers.m_servers.m_collection.end(); ++i)
+        {
+            eps.push_back(tcp::endpoint(ip::address::from_string(int2ipstr(i->m_network_point.m_nIP))
+                , i->m_network_point.m_nPort));
+        }
+
+        m_impl->m_io_service.post(boost::bind(&aux::session_impl::set_global_servers, m_impl, eps));
+    }
+
     void session::listen_on(int port, const char* net_interface /*= 0*/)
     {
         m_impl->m_io_service.post(boost::bind(&aux::session_impl::listen_on, m_impl, port, net_interface));
@@ -146,15 +176,60 @@ namespace libed2k
     }
 
     void session::set_ip_filter(const ip_filter& f)
+    {
+        set_ip_filter(boost::shared_ptr<const compiled_ip_filter>(new compiled_ip_filter(f)));
+    }
+
+    void session::set_ip_filter(boost::shared_ptr<const compiled_ip_filter> f)
     {
         boost::mutex::scoped_lock l(m_impl->m_mutex);
         m_impl->set_ip_filter(f);
     }
 
-    const ip_filter& session::get_ip_filter() const
+    ip_filter session::get_ip_filter() const
+    {
+        boost::shared_ptr<const compiled_ip_filter> f;
+        {
+            boost::mutex::scoped_lock l(m_impl->m_mutex);
+            f = m_impl->get_ip_filter();
+        }
+        return f->rules();
+    }
+
+    int session::create_peer_class(const std::string& label)
+    {
+        boost::mutex::scoped_lock l(m_impl->m_mutex);
+        return m_impl->create_peer_class(label);
+    }
+
+    void session::delete_peer_class(int cid)
+    {
+        boost::mutex::scoped_lock l(m_impl->m_mutex);
+        m_impl->delete_peer_class(cid);
+    }
+
+    peer_class_info session::get_peer_class(int cid) const
+    {
+        boost::mutex::scoped_lock l(m_impl->m_mutex);
+        return m_impl->get_peer_class(cid);
+    }
+
+    void session::set_peer_class(int cid, const peer_class_info& pci)
+    {
+        boost::mutex::scoped_lock l(m_impl->m_mutex);
+        m_impl->set_peer_class(cid, pci);
+    }
+
+    void session::set_peer_class_filter(const ip_filter& f)
+    {
+        boost::mutex::scoped_lock l(m_impl->m_mutex);
+        m_impl->set_peer_class_filter(f);
+    }
+
+    void session::set_peer_class_type_filter(const peer_class_type_filter& f)
     {
         boost::mutex::scoped_lock l(m_impl->m_mutex);
-        return m_impl->get_ip_filter();
+        m_impl->set_peer_class_type_filter(f);
     }
 
     transfer_handle session::find_transfer(const md4_hash & hash) const
@@ -62,28 +62,25 @@ alert const* session_impl_base::wait_for_alert(time_duration max_wait)
 
 md4_hash session_impl_base::callbacked_lowid(client_id_type id)
 {
-    md4_hash res(md4_hash::invalid);
-    lowid_callbacks_map::iterator itr = lowid_conn_dict.find(id);
-
-    if (itr != lowid_conn_dict.end())
-    {
-        res = itr->second;
-        lowid_conn_dict.erase(itr);
-    }
+    std::vector<md4_hash> files;
+    if (!callbacked_lowid(id, files) || files.empty()) return md4_hash::invalid;
+    return files.front();
+}
 
-    return res;
+bool session_impl_base::callbacked_lowid(client_id_type id, std::vector<md4_hash>& files)
+{
+    return m_lowid_callbacks.answered(id, time_now(), files);
 }
 
 bool session_impl_base::register_callback(client_id_type id, md4_hash filehash)
 {
     LIBED2K_ASSERT(filehash != md4_hash::invalid);
-    std::pair<lowid_callbacks_map::iterator, bool> ret = lowid_conn_dict.insert(std::make_pair(id, filehash));
-    return ret.second;
+    return m_lowid_callbacks.request(id, filehash, time_now());
 }
 
 void session_impl_base::cleanup_callbacks()
 {
-    lowid_conn_dict.clear();
+    m_lowid_callbacks.clear();
 }
 
 void session_impl_base::set_alert_mask(boost::uint32_t m)
@@ -116,21 +113,34 @@ session_impl::session_impl(const fingerprint& id, const char* listen_interface,
     session_impl_base(settings),
     m_host_resolver(m_io_service),
     m_peer_pool(500),
-    m_send_buffers(send_buffer_size),
-    m_z_buffers(BLOCK_SIZE),
+    m_z_buffers(BLOCK_SIZE, 4, 2),
     m_skip_buffer(4096),
     m_filepool(40),
     m_disk_thread(m_io_service, boost::bind(&session_impl::on_disk_queue, this), m_filepool, BLOCK_SIZE),
     m_half_open(m_io_service),
     m_download_rate(peer_connection::download_channel),
     m_upload_rate(peer_connection::upload_channel),
+    m_credits(settings.m_clients_file),
+    m_next_credits_save(time_now_hires() + seconds(settings.credits_save_interval)),
     m_server_connection(new server_connection(*this)),
     m_next_connect_transfer(m_active_transfers),
+    m_ip_filter(new compiled_ip_filter),
     m_paused(false),
     m_created(time_now_hires()),
     m_second_timer(seconds(1)),
     m_timer(m_io_service),
     m_last_tick(m_created),
+    m_next_server_sources(min_time()),
+    m_server_source_requests(0),
+    m_next_global_sources(min_time()),
+    m_connect_rate(10),
+    m_connect_attempts(0),
+    m_connect_successes(0),
+    m_connect_failures(0),
+    m_connect_timeouts(0),
+    m_second_connect_successes(0),
+    m_second_connect_failures(0),
+    m_second_connect_timeouts(0),
     m_total_failed_bytes(0),
     m_total_redundant_bytes(0),
     m_queue_pos(0),
@@ -140,6 +150,13 @@ session_impl::session_impl(const fingerprint& id, const char* listen_interface,
                  m_half_open)
 #ifndef LIBED2K_DISABLE_DHT
         , m_dht_announce_timer(m_io_service)
+        , m_next_dht_transfer(m_transfers)
+        , m_dht_source_publishes(0)
+        , m_dht_keyword_publishes(0)
+        , m_dht_published_sources(0)
+        , m_dht_published_keywords(0)
+        , m_next_dht_sources(min_time())
+        , m_dht_source_requests(0)
 #endif
 {
     DBG("*** create ed2k session ***");
@@ -156,6 +173,16 @@ session_impl::session_impl(const fingerprint& id, const char* listen_interface,
 
     LIBED2K_ASSERT_VAL(!ec, ec.message());
 
+    for (int i = 0; i < send_buffer_classes; ++i)
+    {
+        // at least 64 KiB slabs, small buffers are cached more by threads
+        int size = send_buffer_size << i;
+        m_send_buffers.push_back(boost::shared_ptr<slab_allocator>(
+            new slab_allocator(size, std::max(64*1024 / size, 4), std::max(64 >> i, 2))));
+    }
+
+    update_buffer_settings();
+
 #ifdef WIN32
     // windows XP has a limit on the number of
     // simultaneous half-open TCP connections
@@ -332,7 +359,9 @@ void session_impl::set_settings(const session_settings& s)
         || m_settings.ignore_resume_timestamps != s.ignore_resume_timestamps
         || m_settings.no_recheck_incomplete_resume != s.no_recheck_incomplete_resume
         || m_settings.low_prio_disk != s.low_prio_disk
-        || m_settings.lock_files != s.lock_files)
+        || m_settings.use_huge_pages != s.use_huge_pages
+        || m_settings.lock_files != s.lock_files
+        || m_settings.preallocate_sparse_files != s.preallocate_sparse_files)
         update_disk_io_thread = true;
 
     bool connections_limit_changed = m_settings.connections_limit != s.connections_limit;
@@ -351,6 +380,8 @@ void session_impl::set_settings(const session_settings& s)
 
     if (m_settings.connection_speed < 0) m_settings.connection_speed = 200;
 
+    update_buffer_settings();
+
     if (update_disk_io_thread)
         update_disk_thread_settings();
 }
@@ -361,6 +392,13 @@ void session_impl::operator()()
 
     //eh_initializer();
 
+    {
+        boost::mutex::scoped_lock l(m_mutex);
+        error_code ec;
+        m_credits.load(ec);
+        if (ec) { ERR("clients.met load failed: " << ec.message()); }
+    }
+
     if (m_listen_interface.port() != 0)
     {
         boost::mutex::scoped_lock l(m_mutex);
@@ -389,6 +427,9 @@ void session_impl::operator()()
     boost::mutex::scoped_lock l(m_mutex);
     m_transfers.clear();
     m_active_transfers.clear();
+    m_dormant_transfers.clear();
+    m_deferred_transfers.clear();
+    m_deferred_checks.clear();
 }
 
 void session_impl::open_listen_port()
@@ -425,9 +466,16 @@ void session_impl::open_listen_port()
     ec.clear();
 }
 
-void session_impl::set_ip_filter(const ip_filter& f)
+void session_impl::set_global_servers(const std::vector<tcp::endpoint>& servers)
+{
+    m_global_sources.set_servers(servers);
+}
+
+void session_impl::set_ip_filter(boost::shared_ptr<const compiled_ip_filter> f)
 {
-    m_ip_filter = f;
+    // a null filter, e.g. a blocklist which failed to load, keeps the current one
+    if (!f) return;
+    m_ip_filter.swap(f);
 
     // Close connections whose endpoint is filtered
     // by the new ip-filter
@@ -436,11 +484,62 @@ void session_impl::set_ip_filter(const ip_filter& f)
         i->second->ip_filter_updated();
 }
 
-const ip_filter& session_impl::get_ip_filter() const
+boost::shared_ptr<const compiled_ip_filter> session_impl::get_ip_filter() const
 {
     return m_ip_filter;
 }
 
+int session_impl::create_peer_class(const std::string& label)
+{
+    return m_classes.new_peer_class(label);
+}
+
+void session_impl::delete_peer_class(int cid)
+{
+    if (!m_classes.at(cid)) return;
+
+    // the id may be given to a new class, nobody should be in it
+    boost::uint32_t mask = ~(boost::uint32_t(1) << cid);
+    for (connection_map::iterator i = m_connections.begin(),
+             end(m_connections.end()); i != end; ++i)
+        (*i)->set_peer_classes((*i)->peer_classes() & mask);
+    for (transfer_map::iterator i = m_transfers.begin(),
+             end(m_transfers.end()); i != end; ++i)
+        i->second->set_peer_classes(i->second->peer_classes() & mask);
+    for (int st = 0; st < peer_class_type_filter::num_socket_types; ++st)
+        m_peer_class_type_filter.m_peer_classes[st] &= mask;
+
+    m_classes.delete_peer_class(cid);
+}
+
+peer_class_info session_impl::get_peer_class(int cid) const
+{
+    peer_class_info pci;
+    if (const peer_class* pc = m_classes.at(cid)) pc->get_info(pci);
+    return pci;
+}
+
+void session_impl::set_peer_class(int cid, const peer_class_info& pci)
+{
+    if (peer_class* pc = m_classes.at(cid)) pc->set_info(pci);
+}
+
+void session_impl::set_peer_class_filter(const ip_filter& f)
+{
+    m_peer_class_filter = f;
+}
+
+void session_impl::set_peer_class_type_filter(const peer_class_type_filter& f)
+{
+    m_peer_class_type_filter = f;
+}
+
+boost::uint32_t session_impl::peer_classes_for(const address& a, int socket_type) const
+{
+    boost::uint32_t classes = boost::uint32_t(m_peer_class_filter.access(a));
+    return m_classes.valid(m_peer_class_type_filter.apply(socket_type, classes));
+}
+
 bool session_impl::listen_on(int port, const char* net_interface)
 {
     DBG("listen_on(" << ((net_interface)?net_interface:"null") << ":" << port);
@@ -518,6 +617,28 @@ void session_impl::update_disk_thread_settings()
     m_disk_thread.add_job(j);
 }
 
+void session_impl::save_credits()
+{
+    // the records are copied here, the file is written by the disk thread
+    boost::shared_ptr<std::vector<char> > buf(new std::vector<char>);
+    if (!m_credits.save_buffer(*buf)) return;
+
+    disk_io_job j;
+    j.action = disk_io_job::write_file;
+    j.str = m_credits.path();
+    j.file_data = buf;
+    m_disk_thread.add_job(j, boost::bind(&session_impl::on_credits_saved, this, _1, _2));
+}
+
+void session_impl::on_credits_saved(int ret, disk_io_job const& j)
+{
+    boost::mutex::scoped_lock l(m_mutex);
+    if (ret == 0) return;
+
+    ERR("clients.met save failed: " << j.error.message());
+    m_credits.save_failed();
+}
+
 void session_impl::async_accept(boost::shared_ptr<ip::tcp::acceptor> const& listener)
 {
     boost::shared_ptr<tcp::socket> c(new tcp::socket(m_io_service));
@@ -602,7 +723,7 @@ void session_impl::incoming_connection(boost::shared_ptr<tcp::socket> const& s)
 
     DBG("<== INCOMING CONNECTION " << endp);
 
-    if (m_ip_filter.access(endp.address()) & ip_filter::blocked)
+    if (m_ip_filter->access(endp.address()) & ip_filter::blocked)
     {
         DBG("filtered blocked ip " << endp);
         m_alerts.post_alert_should(peer_blocked_alert(transfer_handle(), endp.address()));
@@ -689,6 +810,8 @@ void session_impl::on_receive_udp(error_code const& e, udp::endpoint const& ep,
         if (e == asio::error::connection_refused
             || e == asio::error::connection_reset
             || e == asio::error::connection_aborted
+            || e == asio::error::host_unreachable
+            || e == asio::error::network_unreachable
 #ifdef WIN32
             || e == error_code(ERROR_HOST_UNREACHABLE, get_system_category())
             || e == error_code(ERROR_PORT_UNREACHABLE, get_system_category())
@@ -697,6 +820,11 @@ void session_impl::on_receive_udp(error_code const& e, udp::endpoint const& ep,
 #endif
             )
         {
+            // also the batched kad sends which failed, the requests to
+            // this node won't be answered
+#ifndef LIBED2K_DISABLE_DHT
+            if (m_dht) m_dht->on_unreachable(ep);
+#endif
         }
         else
         {
@@ -710,6 +838,13 @@ void session_impl::on_receive_udp(error_code const& e, udp::endpoint const& ep,
         return;
     }
 
+    // answers of global servers on our sources queries
+    if (len >= int(sizeof(udp_libed2k_header)) && proto_type(buf[0]) == OP_EDONKEYPROT)
+    {
+        on_receive_global_sources(ep, buf, len);
+        return;
+    }
+
     // now process only dht packets
 #ifndef LIBED2K_DISABLE_DHT
     // this is probably a dht message
@@ -721,6 +856,38 @@ void session_impl::on_receive_udp_hostname(error_code const& e, char const* host
 {
 }
 
+void session_impl::on_receive_global_sources(udp::endpoint const& ep, char const* buf, int len)
+{
+    std::vector<found_file_sources> res;
+
+    // use well formed blocks of broken packet anyway
+    if (!parse_global_sources(buf, len, res))
+    {
+        DBG("global sources answer from " << ep << " can't be parsed completely, blocks: " << res.size());
+        if (res.empty()) return;
+    }
+
+    // ignore packets of servers we didn't ask
+    if (!m_global_sources.on_answer(ep)) return;
+
+    for (std::vector<found_file_sources>::const_iterator i = res.begin(); i != res.end(); ++i)
+    {
+        boost::shared_ptr<transfer> t = find_transfer(i->m_hFile).lock();
+        if (!t) continue;
+
+        APP("found " << i->m_sources.m_collection.size() << " global sources for " << i->m_hFile << " from " << ep);
+
+        for (std::vector<net_identifier>::const_iterator j = i->m_sources.m_collection.begin();
+             j != i->m_sources.m_collection.end(); ++j)
+        {
+            // LowID sources need callback through the server they are connected to
+            if (isLowId(j->m_nIP)) continue;
+            t->add_peer(tcp::endpoint(ip::address::from_string(int2ipstr(j->m_nIP)), j->m_nPort)
+                , peer_info::tracker);
+        }
+    }
+}
+
 void session_impl::maybe_update_udp_mapping(int nat, int local_port, int external_port)
 {
     int local, external, protocol;
@@ -800,7 +967,52 @@ boost::intrusive_ptr<peer_connection> session_impl::find_peer_connection(const m
 
 transfer_handle session_impl::find_transfer_handle(const md4_hash& hash)
 {
-    return transfer_handle(find_transfer(hash));
+    return transfer_handle(wake_transfer(hash));
+}
+
+boost::shared_ptr<transfer> session_impl::wake_transfer(const md4_hash& hash)
+{
+    boost::shared_ptr<transfer> t = find_transfer(hash).lock();
+
+    // transfer added in batch is needed right now
+    if (t && !t->is_started() && !t->is_aborted()) t->start();
+    if (t || m_abort) return t;
+
+    add_transfer_params params;
+    bool announced = false;
+    dormant_transfers::const_iterator d = m_dormant_transfers.find(hash);
+    if (d == m_dormant_transfers.end()) return t;
+    boost::shared_ptr<transfer_link> link = d->second.link;
+#ifndef LIBED2K_DISABLE_DHT
+    ptime next_dht_announce = d->second.next_dht_announce;
+#endif
+    m_dormant_transfers.take(hash, params, announced);
+
+    DBG("wake up dormant transfer: {hash: " << hash << ", path: " << convert_to_native(params.file_path) << "}");
+
+    t.reset(new transfer(*this, m_listen_interface, ++m_queue_pos, params));
+    // handles given out while the transfer was dormant stay valid
+    if (link) t->set_link(link);
+    t->set_announced(announced);
+#ifndef LIBED2K_DISABLE_DHT
+    t->set_next_dht_announce(next_dht_announce);
+#endif
+    t->start();
+    m_transfers.insert(std::make_pair(hash, t));
+    m_alerts.post_alert_should(woke_transfer_alert(transfer_handle(t)));
+    return t;
+}
+
+shared_file_entry session_impl::get_announce(const md4_hash& hash)
+{
+    transfer_map::const_iterator i = m_transfers.find(hash);
+    if (i != m_transfers.end()) return i->second->get_announce();
+
+    dormant_transfers::const_iterator d = m_dormant_transfers.find(hash);
+    if (d != m_dormant_transfers.end())
+        return make_announce(*this, hash, filename(d->second.file_path), d->second.file_size, true);
+
+    return shared_file_entry();
 }
 
 peer_connection_handle session_impl::find_peer_connection_handle(const net_identifier& np)
@@ -825,6 +1037,12 @@ std::vector<transfer_handle> session_impl::get_transfers()
         ret.push_back(t.handle());
     }
 
+    for (dormant_transfers::const_iterator i = m_dormant_transfers.begin();
+         i != m_dormant_transfers.end(); ++i)
+    {
+        ret.push_back(transfer_handle(boost::weak_ptr<transfer>(), i->second.link));
+    }
+
     return ret;
 }
 
@@ -908,21 +1126,32 @@ transfer_handle session_impl::add_transfer(add_transfer_params const& params, er
     // is the transfer already active?
     boost::shared_ptr<transfer> transfer_ptr = find_transfer(params.file_hash).lock();
 
-    if (transfer_ptr)
+    if (transfer_ptr || m_dormant_transfers.contains(params.file_hash))
     {
         if (!params.duplicate_is_error)
         {
-            return transfer_handle(transfer_ptr);
+            return transfer_handle(wake_transfer(params.file_hash));
         }
 
         ec = errors::duplicate_transfer;
         return transfer_handle();
     }
 
+    // complete file is kept dormant until some peer asks for it
+    if (params.seed_mode && m_settings.dormant_seed_timeout > 0)
+    {
+        transfer_handle handle = add_dormant_transfer(params);
+        m_alerts.post_alert_should(added_transfer_alert(handle));
+        return handle;
+    }
+
     transfer_ptr.reset(new transfer(*this, m_listen_interface, ++m_queue_pos, params));
     transfer_ptr->start();
 
     m_transfers.insert(std::make_pair(params.file_hash, transfer_ptr));
+#ifndef LIBED2K_DISABLE_DHT
+    m_dht_keywords.add_file(params.file_hash, transfer_ptr->name());
+#endif
 
     transfer_handle handle(transfer_ptr);
     m_alerts.post_alert_should(added_transfer_alert(handle));
@@ -930,25 +1159,139 @@ transfer_handle session_impl::add_transfer(add_transfer_params const& params, er
     return handle;
 }
 
+transfer_handle session_impl::add_dormant_transfer(add_transfer_params const& params)
+{
+    boost::shared_ptr<transfer_link> link(new transfer_link(*this, params.file_hash));
+    m_dormant_transfers.add(params, false, link);
+#ifndef LIBED2K_DISABLE_DHT
+    m_dht_keywords.add_file(params.file_hash, filename(params.file_path));
+#endif
+    return transfer_handle(boost::weak_ptr<transfer>(), link);
+}
+
+void session_impl::post_transfers(std::vector<add_transfer_params> const& params)
+{
+    DBG("session_impl::post_transfers");
+    m_io_service.post(boost::bind(&session_impl::add_transfers, this, params));
+}
+
+void session_impl::add_transfers(std::vector<add_transfer_params> const& params)
+{
+    boost::mutex::scoped_lock l(m_mutex);
+
+    APP("add transfers: {count: " << params.size() << "}");
+
+    std::vector<transfer_handle> handles(params.size());
+    std::vector<error_code> errs(params.size());
+
+    for (size_t i = 0; i < params.size(); ++i)
+    {
+        const add_transfer_params& p = params[i];
+
+        if (is_aborted())
+        {
+            errs[i] = errors::session_closing;
+            continue;
+        }
+
+        if (m_transfers.count(p.file_hash) != 0 || m_dormant_transfers.contains(p.file_hash))
+        {
+            if (p.duplicate_is_error) errs[i] = errors::duplicate_transfer;
+            else handles[i] = transfer_handle(wake_transfer(p.file_hash));
+            continue;
+        }
+
+        if (p.seed_mode && m_settings.dormant_seed_timeout > 0)
+        {
+            handles[i] = add_dormant_transfer(p);
+            continue;
+        }
+
+        // storage and resume data check are deferred to start_deferred_transfers
+        boost::shared_ptr<transfer> t(new transfer(*this, m_listen_interface, ++m_queue_pos, p));
+        m_transfers.insert(std::make_pair(p.file_hash, t));
+#ifndef LIBED2K_DISABLE_DHT
+        m_dht_keywords.add_file(p.file_hash, t->name());
+#endif
+        m_deferred_transfers.push_back(t);
+        handles[i] = transfer_handle(t);
+    }
+
+    m_alerts.post_alert_should(added_transfers_alert(handles, errs));
+    start_deferred_transfers();
+}
+
+void session_impl::start_deferred_transfers()
+{
+    for (std::vector<boost::weak_ptr<transfer> >::iterator i = m_deferred_checks.begin();
+         i != m_deferred_checks.end();)
+    {
+        boost::shared_ptr<transfer> t = i->lock();
+        if (t && !t->is_aborted() && t->state() == transfer_status::checking_resume_data) ++i;
+        else i = m_deferred_checks.erase(i);
+    }
+
+    int limit = std::max(m_settings.max_deferred_resume_checks, 1);
+
+    while (!m_deferred_transfers.empty() && int(m_deferred_checks.size()) < limit)
+    {
+        boost::shared_ptr<transfer> t = m_deferred_transfers.front().lock();
+        m_deferred_transfers.pop_front();
+        if (!t || t->is_aborted() || t->is_started()) continue;
+
+        t->start();
+        if (t->state() == transfer_status::checking_resume_data) m_deferred_checks.push_back(t);
+    }
+}
+
 void session_impl::remove_transfer(const transfer_handle& h, int options)
 {
     boost::shared_ptr<transfer> tptr = h.m_transfer.lock();
-    if (!tptr) return;
+    boost::shared_ptr<transfer_link> link = h.m_link.lock();
+    if (!tptr && !link) return;
 
-    remove_active_transfer(tptr);
-    transfer_map::iterator i = m_transfers.find(tptr->hash());
+    md4_hash hash = link ? link->hash : tptr->hash();
 
-    if (i != m_transfers.end())
+    // the hash may be taken by another transfer added after this one was removed
+    dormant_transfers::const_iterator d = m_dormant_transfers.find(hash);
+    if (d != m_dormant_transfers.end() && (!link || d->second.link == link))
+    {
+        if (options & session::delete_files)
+        {
+            error_code ec;
+            remove(d->second.file_path, ec);
+            if (ec) m_alerts.post_alert_should(delete_failed_transfer_alert(h, ec));
+            else m_alerts.post_alert_should(deleted_file_alert(h, hash));
+        }
+
+        m_dormant_transfers.remove(hash);
+#ifndef LIBED2K_DISABLE_DHT
+        m_dht_keywords.remove_file(hash);
+#endif
+        m_alerts.post_alert_should(deleted_transfer_alert(hash));
+        return;
+    }
+
+    transfer_map::iterator i = m_transfers.find(hash);
+
+    if (i != m_transfers.end() && (!link || i->second->link() == link))
     {
         transfer& t = *i->second;
-        md4_hash hash = t.hash();
+        remove_active_transfer(i->second);
 
         if (options & session::delete_files)
             t.delete_files();
         t.abort();
 
         //t.set_queue_position(-1);
+#ifndef LIBED2K_DISABLE_DHT
+        m_dht_keywords.remove_file(hash);
+        if (i == m_next_dht_transfer) m_next_dht_transfer.inc();
+        m_transfers.erase(i);
+        m_next_dht_transfer.validate();
+#else
         m_transfers.erase(i);
+#endif
 
         m_alerts.post_alert_should(deleted_transfer_alert(hash));
     }
@@ -1019,20 +1362,48 @@ peer_connection_handle session_impl::add_peer_connection(net_identifier np, erro
 
 std::pair<char*, int> session_impl::allocate_send_buffer(int size)
 {
-    int num_buffers = (size + send_buffer_size - 1) / send_buffer_size;
+    int c = 0;
+    while (c < send_buffer_classes && (send_buffer_size << c) < size) ++c;
 
-    boost::mutex::scoped_lock l(m_send_buffer_mutex);
+    if (c == send_buffer_classes)
+    {
+        int capacity = (size + page_size() - 1) / page_size() * page_size();
+        return std::make_pair(page_aligned_allocator::malloc(capacity), capacity);
+    }
 
-    return std::make_pair((char*)m_send_buffers.ordered_malloc(num_buffers),
-                          num_buffers * send_buffer_size);
+    return std::make_pair(m_send_buffers[c]->allocate(), int(send_buffer_size << c));
 }
 
 void session_impl::free_send_buffer(char* buf, int size)
 {
-    int num_buffers = size / send_buffer_size;
+    // size is the capacity returned by allocate_send_buffer
+    int c = 0;
+    while (c < send_buffer_classes && (send_buffer_size << c) != size) ++c;
 
-    boost::mutex::scoped_lock l(m_send_buffer_mutex);
-    m_send_buffers.ordered_free(buf, num_buffers);
+    if (c == send_buffer_classes)
+        page_aligned_allocator::free(buf);
+    else
+        m_send_buffers[c]->free(buf);
+}
+
+void session_impl::release_buffer(int type, char* buf, int size)
+{
+    switch (type)
+    {
+        case send_pool: free_send_buffer(buf, size); break;
+        case disk_pool: free_disk_buffer(buf); break;
+        case z_pool: free_z_buffer(buf); break;
+        default: LIBED2K_ASSERT(false);
+    }
+}
+
+void session_impl::update_buffer_settings()
+{
+    for (std::vector<boost::shared_ptr<slab_allocator> >::iterator i = m_send_buffers.begin();
+         i != m_send_buffers.end(); ++i)
+        (*i)->set_huge_pages(m_settings.use_huge_pages);
+
+    m_z_buffers.set_huge_pages(m_settings.use_huge_pages);
 }
 
 char* session_impl::allocate_disk_buffer(char const* category)
@@ -1047,12 +1418,12 @@ void session_impl::free_disk_buffer(char* buf)
 
 char* session_impl::allocate_z_buffer()
 {
-    return (char*)m_z_buffers.ordered_malloc();
+    return m_z_buffers.allocate();
 }
 
 void session_impl::free_z_buffer(char* buf)
 {
-    m_z_buffers.ordered_free(buf);
+    m_z_buffers.free(buf);
 }
 
 std::string session_impl::send_buffer_usage()
@@ -1116,6 +1487,45 @@ session_status session_impl::status() const
     s.tracker_upload_rate = m_stat.transfer_rate(stat::upload_tracker_protocol);
     s.total_tracker_upload = m_stat.total_transfer(stat::upload_tracker_protocol);
 
+#ifndef LIBED2K_DISABLE_DHT
+    s.dht_publish_requests = 0;
+    s.dht_publish_replies = 0;
+    if (m_dht) m_dht->dht_status(s);
+    s.dht_published_sources = m_dht_published_sources;
+    s.dht_published_keywords = m_dht_published_keywords;
+    s.dht_publish_queue = m_dht_keywords.pending(time_now());
+    s.dht_source_requests = m_dht_source_requests;
+#else
+    s.dht_source_requests = 0;
+#endif
+
+    s.server_source_requests = m_server_source_requests;
+    s.global_source_queries = m_global_sources.queries();
+    s.global_source_answers = m_global_sources.answers();
+    s.lowid_callbacks_pending = int(m_lowid_callbacks.size());
+    s.lowid_callbacks_sent = m_lowid_callbacks.sent();
+    s.lowid_callbacks_coalesced = m_lowid_callbacks.coalesced();
+    s.lowid_callbacks_succeeded = m_lowid_callbacks.succeeded();
+    s.lowid_callbacks_timed_out = m_lowid_callbacks.timed_out();
+    s.lowid_callback_latency = m_lowid_callbacks.average_latency();
+    s.transfers_wanting_sources = 0;
+
+    s.connect_attempts = m_connect_attempts;
+    s.connect_successes = m_connect_successes;
+    s.connect_failures = m_connect_failures;
+    s.connect_timeouts = m_connect_timeouts;
+    s.connect_rate = m_connect_rate;
+
+    for (std::vector<boost::shared_ptr<slab_allocator> >::const_iterator i = m_send_buffers.begin();
+         i != m_send_buffers.end(); ++i)
+        s.network_buffers += (*i)->stats();
+    s.network_buffers += m_z_buffers.stats();
+
+    for (transfer_map::const_iterator i = m_active_transfers.begin(); i != m_active_transfers.end(); ++i)
+    {
+        if (i->second->want_more_sources()) ++s.transfers_wanting_sources;
+    }
+
     return s;
 }
 
@@ -1148,6 +1558,9 @@ void session_impl::abort()
     stop_dht();
 #endif
 
+    // queued ahead of the disk thread abort, so it is still written
+    save_credits();
+
     DBG("aborting all transfers (" << m_transfers.size() << ")");
     // abort all transfers
     for (transfer_map::iterator i = m_transfers.begin(),
@@ -1260,6 +1673,8 @@ void session_impl::on_tick(error_code const& e)
 
     m_last_tick = now;
 
+    if (!m_deferred_transfers.empty()) start_deferred_transfers();
+
     // only tick the following once per second
     if (!m_second_timer.expired(now)) return;
 
@@ -1272,6 +1687,7 @@ void session_impl::on_tick(error_code const& e)
 
     m_server_connection->second_tick(tick_interval_ms);
     update_active_transfers();
+    update_dormant_transfers(now);
 
     // --------------------------------------------------------------
     // second_tick every active transfer
@@ -1309,6 +1725,19 @@ void session_impl::on_tick(error_code const& e)
 
     m_stat.second_tick(tick_interval_ms);
 
+    std::vector<client_id_type> resend;
+    m_lowid_callbacks.tick(now, seconds(m_settings.lowid_callback_timeout)
+        , m_settings.lowid_callback_attempts, resend);
+    for (std::vector<client_id_type>::const_iterator i = resend.begin(); i != resend.end(); ++i)
+        send_lowid_callback(*i);
+
+    if (now >= m_next_credits_save)
+    {
+        save_credits();
+        m_next_credits_save = now + seconds(m_settings.credits_save_interval);
+    }
+
+    request_sources(now);
     connect_new_peers();
 
     // --------------------------------------------------------------
@@ -1317,65 +1746,224 @@ void session_impl::on_tick(error_code const& e)
     // TODO: should it be implemented?
 }
 
-void session_impl::connect_new_peers()
+void session_impl::send_lowid_callback(client_id_type id)
 {
-    // TODO:
-    // this loop will "hand out" max(connection_speed, half_open.free_slots())
-    // to the transfers, in a round robin fashion, so that every transfer is
-    // equally likely to connect to a peer
+    udp::endpoint buddy;
+    md4_hash buddy_hash;
+    md4_hash file;
+
+    if (m_lowid_callbacks.buddy(id, buddy, buddy_hash, file))
+    {
+        buddy_callback_request req;
+        req.m_hBuddy = buddy_hash;
+        req.m_hFile = file;
+        req.m_nPort = listen_port();
+
+        udp_message msg = make_udp_message(req);
+        std::string buf(reinterpret_cast<const char*>(&msg.first), sizeof(msg.first));
+        buf += msg.second;
+
+        DBG("lowid callback of " << id << " through buddy " << buddy);
+        error_code ec;
+        m_udp_socket.send(buddy, buf.c_str(), int(buf.size()), ec);
+        if (ec) { DBG("lowid callback through buddy " << buddy << " failed " << ec.message()); }
+    }
+    else if (m_server_connection->connected() && !isLowId(m_server_connection->client_id()))
+    {
+        m_server_connection->post_callback_request(id);
+    }
+}
 
+void session_impl::connect_new_peers()
+{
     int free_slots = m_half_open.free_slots();
-    if (!m_active_transfers.empty() && free_slots > -m_half_open.limit() &&
-        num_connections() < m_settings.connections_limit && !m_abort)
+
+    m_connect_rate = adapt_connect_rate(m_connect_rate, m_second_connect_successes,
+        m_second_connect_failures, m_second_connect_timeouts, free_slots, m_settings.connection_speed);
+    m_second_connect_successes = 0;
+    m_second_connect_failures = 0;
+    m_second_connect_timeouts = 0;
+
+    if (m_active_transfers.empty() || free_slots <= -m_half_open.limit() ||
+        num_connections() >= m_settings.connections_limit || m_abort)
+        return;
+
+    // transfers which want peers, the first one changes every second
+    std::vector<transfer*> transfers;
+    m_next_connect_transfer.validate();
+    for (size_t n = m_active_transfers.size(); n > 0; --n, ++m_next_connect_transfer)
     {
-        // this is the maximum number of connections we will
-        // attempt this tick
-        int max_connections_per_second = 10;
-        int steps_since_last_connect = 0;
-        int num_active_transfers = int(m_active_transfers.size());
-        m_next_connect_transfer.validate();
+        transfer* t = m_next_connect_transfer->second.get();
+        if (t->want_more_peers()) transfers.push_back(t);
+    }
+    ++m_next_connect_transfer;
 
-        for (;;)
+    // hand out connection attempts to the transfers one by one, so every
+    // transfer gets the same share, and drop transfers without candidates
+    int attempts = m_connect_rate;
+    size_t i = 0;
+
+    while (attempts > 0 && !transfers.empty())
+    {
+        if (i >= transfers.size()) i = 0;
+        transfer& t = *transfers[i];
+        bool connected = false;
+
+        try
         {
-            transfer& t = *m_next_connect_transfer->second;
-            if (t.want_more_peers())
-            {
-                try
-                {
-                    if (t.try_connect_peer())
-                    {
-                        --max_connections_per_second;
-                        --free_slots;
-                        steps_since_last_connect = 0;
-                    }
-                }
-                catch (std::bad_alloc&)
-                {
-                    // we ran out of memory trying to connect to a peer
-                    // lower the global limit to the number of peers
-                    // we already have
-                    m_settings.connections_limit = num_connections();
-                    if (m_settings.connections_limit < 2) m_settings.connections_limit = 2;
-                }
-            }
+            connected = t.want_more_peers() && t.try_connect_peer();
+        }
+        catch (std::bad_alloc&)
+        {
+            // we ran out of memory trying to connect to a peer
+            // lower the global limit to the number of peers
+            // we already have
+            m_settings.connections_limit = num_connections();
+            if (m_settings.connections_limit < 2) m_settings.connections_limit = 2;
+        }
 
-            ++m_next_connect_transfer;
-            ++steps_since_last_connect;
-
-            // if we have gone two whole loops without
-            // handing out a single connection, break
-            if (steps_since_last_connect > num_active_transfers * 2) break;
-            // if there are no more free connection slots, abort
-            if (free_slots <= -m_half_open.limit()) break;
-            // if we should not make any more connections
-            // attempts this tick, abort
-            if (max_connections_per_second == 0) break;
-            // maintain the global limit on number of connections
-            if (num_connections() >= m_settings.connections_limit) break;
+        if (connected)
+        {
+            --attempts;
+            --free_slots;
+            ++m_connect_attempts;
+            ++i;
+        }
+        else
+        {
+            transfers.erase(transfers.begin() + i);
         }
+
+        // if there are no more free connection slots, abort
+        if (free_slots <= -m_half_open.limit()) break;
+        // maintain the global limit on number of connections
+        if (num_connections() >= m_settings.connections_limit) break;
     }
 }
 
+void session_impl::connect_attempt_finished(const error_code& e)
+{
+    if (!e)
+    {
+        ++m_connect_successes;
+        ++m_second_connect_successes;
+    }
+    else if (e == error_code(errors::timed_out) || e == error_code(boost::asio::error::timed_out))
+    {
+        ++m_connect_timeouts;
+        ++m_second_connect_timeouts;
+    }
+    else
+    {
+        ++m_connect_failures;
+        ++m_second_connect_failures;
+    }
+}
+
+void session_impl::request_sources(const ptime& now)
+{
+    if (m_abort) return;
+
+    // --------------------------------------------------------------
+    // server: a batch of the most source-starving transfers
+    // --------------------------------------------------------------
+    if (m_server_connection->connected() && m_next_server_sources <= now)
+    {
+        std::vector<boost::shared_ptr<transfer> > candidates;
+
+        for (transfer_map::iterator i = m_active_transfers.begin(); i != m_active_transfers.end(); ++i)
+        {
+            if (i->second->want_more_sources() && i->second->server_sources_due(now))
+                candidates.push_back(i->second);
+        }
+
+        if (!candidates.empty())
+        {
+            size_t batch = source_request_batch(candidates, m_settings.server_source_requests);
+
+            for (size_t n = 0; n < batch; ++n)
+                candidates[n]->request_server_sources(now);
+
+            m_server_source_requests += batch;
+            m_next_server_sources = now + seconds(m_settings.server_source_request_delay);
+        }
+    }
+
+    // --------------------------------------------------------------
+    // global servers: the next server with query budget over UDP
+    // --------------------------------------------------------------
+    if (m_global_sources.size() > 0 && m_next_global_sources <= now && m_global_sources.ready(now))
+    {
+        std::vector<boost::shared_ptr<transfer> > candidates;
+
+        for (transfer_map::iterator i = m_active_transfers.begin(); i != m_active_transfers.end(); ++i)
+        {
+            if (i->second->want_more_sources()) candidates.push_back(i->second);
+        }
+
+        std::sort(candidates.begin(), candidates.end(),
+                  &detail::more_sources_needed<boost::shared_ptr<transfer> >);
+        std::vector<get_file_sources> files(candidates.size());
+
+        for (size_t n = 0; n < candidates.size(); ++n)
+        {
+            files[n].m_hFile = candidates[n]->hash();
+            files[n].m_file_size.nQuadPart = candidates[n]->size();
+        }
+
+        // the server we are connected to gets TCP requests
+        udp::endpoint skip;
+        if (m_server_connection->connected())
+            skip = udp::endpoint(m_server_connection->m_target.address(), m_server_connection->m_target.port() + 4);
+
+        udp::endpoint server;
+        global_get_file_sources query;
+
+        if (!files.empty() && m_global_sources.next_query(now, files
+            , size_t(std::max(m_settings.global_source_files, 1))
+            , seconds(m_settings.global_source_server_interval)
+            , seconds(m_settings.global_source_reask_time), skip, server, query))
+        {
+            udp_message msg = make_udp_message(query);
+            std::string buf(reinterpret_cast<const char*>(&msg.first), sizeof(msg.first));
+            buf += msg.second;
+
+            DBG("global sources query to " << server << " files " << query.m_files.size());
+            error_code ec;
+            m_udp_socket.send(server, buf.c_str(), int(buf.size()), ec);
+            if (ec) { DBG("global sources query to " << server << " failed " << ec.message()); }
+
+            m_next_global_sources = now + seconds(m_settings.global_source_request_delay);
+        }
+    }
+
+#ifndef LIBED2K_DISABLE_DHT
+    // --------------------------------------------------------------
+    // kad: one lookup for the most source-starving transfer
+    // --------------------------------------------------------------
+    if (m_dht && m_dht->has_nodes() && m_next_dht_sources <= now &&
+        int(m_active_dht_requests.size()) < m_settings.max_dht_source_lookups)
+    {
+        boost::shared_ptr<transfer> best;
+
+        for (transfer_map::iterator i = m_active_transfers.begin(); i != m_active_transfers.end(); ++i)
+        {
+            const boost::shared_ptr<transfer>& t = i->second;
+            if (!t->want_more_sources() || !t->dht_sources_due(now) ||
+                m_active_dht_requests.count(t->hash()) > 0) continue;
+            if (!best || detail::more_sources_needed(t, best)) best = t;
+        }
+
+        if (best)
+        {
+            best->request_dht_sources(now);
+            ++m_dht_source_requests;
+            m_next_dht_sources = now + seconds(m_settings.dht_source_request_delay);
+        }
+    }
+#endif
+}
+
 void session_impl::setup_socket_buffers(ip::tcp::socket& s)
 {
     error_code ec;
@@ -1441,9 +2029,25 @@ session_impl::listen_socket_t session_impl::setup_listener(
 
 void session_impl::post_search_request(search_request& ro)
 {
+    m_search.stop();
     m_server_connection->post_search_request(ro);
 }
 
+void session_impl::post_search(search_request& sr, const std::string& keyword)
+{
+    md4_hash target = md4_hash::invalid;
+#ifndef LIBED2K_DISABLE_DHT
+    if (m_dht && !keyword.empty()) target = hasher::from_string(keyword);
+#endif
+
+    m_search.start(m_server_connection->connected(), target);
+    if (m_server_connection->connected()) m_server_connection->post_search_request(sr);
+
+#ifndef LIBED2K_DISABLE_DHT
+    if (target.defined()) find_keyword(keyword);
+#endif
+}
+
 void session_impl::post_search_more_result_request()
 {
     m_server_connection->post_search_more_result_request();
@@ -1451,10 +2055,22 @@ void session_impl::post_search_more_result_request()
 
 void session_impl::post_cancel_search()
 {
+    m_search.stop();
     shared_files_list sl;
     m_server_connection->post_announce(sl);
 }
 
+bool session_impl::on_server_search_result(const search_result& sr)
+{
+    if (!m_search.server_active()) return false;
+
+    boost::shared_ptr<std::vector<search_result_entry> > changed(new std::vector<search_result_entry>);
+    m_search.add_server_results(sr.m_files, sr.m_more_results_avaliable != 0, *changed);
+    // an empty page still tells whether more results are there
+    m_alerts.post_alert_should(search_result_alert(changed, m_search.more(), int(m_search.size())));
+    return true;
+}
+
 void session_impl::post_sources_request(const md4_hash& hFile, boost::uint64_t nSize)
 {
     m_server_connection->post_sources_request(hFile, nSize);
@@ -1549,6 +2165,45 @@ void session_impl::update_rate_settings()
     m_upload_channel.throttle(m_settings.upload_rate_limit);
 }
 
+void session_impl::update_dormant_transfers(const ptime& now)
+{
+    if (m_settings.dormant_seed_timeout <= 0) return;
+
+    for (transfer_map::iterator i = m_transfers.begin(); i != m_transfers.end();)
+    {
+        boost::shared_ptr<transfer> t = i->second;
+        ++i;
+        if (t->idle_seed(now, seconds(m_settings.dormant_seed_timeout))) make_dormant(t);
+    }
+}
+
+void session_impl::make_dormant(const boost::shared_ptr<transfer>& t)
+{
+    DBG("transfer goes dormant: {hash: " << t->hash() << ", file: " << t->name() << "}");
+
+    add_transfer_params params = t->params();
+    params.seed_mode = true;
+#ifndef LIBED2K_DISABLE_DHT
+    m_dormant_transfers.add(params, t->is_announced(), t->link(), t->next_dht_announce());
+#else
+    m_dormant_transfers.add(params, t->is_announced(), t->link());
+#endif
+    m_alerts.post_alert_should(dormant_transfer_alert(t->handle()));
+
+    remove_active_transfer(t);
+    t->abort();
+
+    transfer_map::iterator i = m_transfers.find(t->hash());
+    LIBED2K_ASSERT(i != m_transfers.end());
+#ifndef LIBED2K_DISABLE_DHT
+    if (i == m_next_dht_transfer) m_next_dht_transfer.inc();
+    m_transfers.erase(i);
+    m_next_dht_transfer.validate();
+#else
+    m_transfers.erase(i);
+#endif
+}
+
 void session_impl::update_active_transfers()
 {
     for (transfer_map::iterator i = m_active_transfers.begin(),
@@ -1813,24 +2468,144 @@ void session_impl::set_external_address(address const& ip
         m_dht->start(startup_state);
         m_alerts.post_alert_should(dht_started());
 
-        // announce all torrents we have to the DHT
-        // TODO - should be implemented
-        /*for (torrent_map::const_iterator i = m_torrents.begin()
-            , end(m_torrents.end()); i != end; ++i)
-        {
-            i->second->dht_announce();
-        }
-        */
+        // publish traversals of the previous tracker will never finish
+        m_dht_source_publishes = 0;
+        m_dht_keyword_publishes = 0;
+
+        // start publishing our transfers to the DHT
+        error_code ec;
+        m_dht_announce_timer.expires_from_now(seconds(m_dht_settings.publish_delay), ec);
+        m_dht_announce_timer.async_wait(
+            boost::bind(&session_impl::on_dht_announce, this, _1));
     }
 
     void session_impl::stop_dht()
     {
         if (!m_dht) return;
+        error_code ec;
+        m_dht_announce_timer.cancel(ec);
         m_dht->stop();
         m_dht = 0;
         m_alerts.post_alert_should(dht_stopped());
     }
 
+    void session_impl::on_dht_announce(error_code const& e)
+    {
+        if (e || is_aborted() || !m_dht) return;
+
+        error_code ec;
+        m_dht_announce_timer.expires_from_now(seconds(m_dht_settings.publish_delay), ec);
+        m_dht_announce_timer.async_wait(
+            boost::bind(&session_impl::on_dht_announce, this, _1));
+
+        // nobody to store our data yet
+        if (!m_dht->has_nodes()) return;
+
+        // nobody can connect to us with low id, sources are useless
+        bool low_id = m_server_connection->connected() && isLowId(m_server_connection->client_id());
+
+        if (!low_id && m_dht_source_publishes < m_dht_settings.max_source_publishes)
+        {
+            m_next_dht_transfer.validate();
+
+            // find next transfer which source publish is due
+            for (size_t n = m_transfers.size(); n > 0; --n)
+            {
+                boost::shared_ptr<transfer> t = m_next_dht_transfer->second;
+                ++m_next_dht_transfer;
+
+                if (t->should_announce_dht())
+                {
+                    t->dht_announce();
+                    ++m_dht_source_publishes;
+                    break;
+                }
+            }
+
+            md4_hash hash;
+            size_type size = 0;
+            if (m_dht_source_publishes < m_dht_settings.max_source_publishes
+                && !m_listen_sockets.empty()
+                && m_dormant_transfers.pop_dht_announce(time_now()
+                    , seconds(m_dht_settings.source_republish_interval), hash, size))
+            {
+                dht_publish_source(hash, size);
+                ++m_dht_source_publishes;
+            }
+        }
+
+        md4_hash keyword;
+        std::vector<md4_hash> files;
+
+        if (m_dht_keyword_publishes < m_dht_settings.max_keyword_publishes
+            && m_dht_keywords.pop(time_now(), seconds(m_dht_settings.keyword_republish_interval)
+                , m_dht_settings.max_keyword_files, keyword, files))
+        {
+            std::deque<kad_info_entry> entries;
+
+            for (std::vector<md4_hash>::const_iterator i = files.begin(); i != files.end(); ++i)
+            {
+                transfer_map::const_iterator itr = m_transfers.find(*i);
+                if (itr != m_transfers.end())
+                {
+                    if (itr->second->num_have() > 0)
+                        entries.push_back(itr->second->get_dht_keyword_entry());
+                    continue;
+                }
+
+                dormant_transfers::const_iterator d = m_dormant_transfers.find(*i);
+                if (d != m_dormant_transfers.end())
+                    entries.push_back(make_dht_keyword_entry(
+                        *i, filename(d->second.file_path), d->second.file_size));
+            }
+
+            if (!entries.empty())
+            {
+                DBG("dht publish keyword " << keyword << " files " << entries.size());
+                m_dht->publish_keyword(keyword, entries
+                    , boost::bind(&session_impl::on_dht_keyword_published, this, _1));
+                ++m_dht_keyword_publishes;
+            }
+            else
+            {
+                // files are not checked yet or have no pieces - try later
+                m_dht_keywords.reschedule(keyword, time_now() + minutes(10));
+            }
+        }
+    }
+
+    void session_impl::dht_publish_source(const md4_hash& hash, size_type size)
+    {
+        // open source without buddy and crypt options
+        tag_list<boost::uint8_t> tags;
+        tags.add_tag(make_typed_tag(boost::uint8_t(1), TAG_SOURCETYPE, false));
+        tags.add_tag(make_typed_tag(boost::uint16_t(listen_port()), TAG_SOURCEPORT, false));
+
+        if (size > 0xFFFFFFFFLL)
+            tags.add_tag(make_typed_tag(boost::uint64_t(size), TAG_FILESIZE, false));
+        else
+            tags.add_tag(make_typed_tag(boost::uint32_t(size), TAG_FILESIZE, false));
+
+        m_dht->publish_source(hash
+            , m_settings.user_agent
+            , tags
+            , boost::bind(&session_impl::on_dht_source_published, this, _1));
+    }
+
+    void session_impl::on_dht_source_published(const kad_id& id)
+    {
+        DBG("dht publish source for " << id << " completed");
+        if (m_dht_source_publishes > 0) --m_dht_source_publishes;
+        ++m_dht_published_sources;
+    }
+
+    void session_impl::on_dht_keyword_published(const kad_id& id)
+    {
+        DBG("dht publish keyword " << id << " completed");
+        if (m_dht_keyword_publishes > 0) --m_dht_keyword_publishes;
+        ++m_dht_published_keywords;
+    }
+
     void session_impl::set_dht_settings(dht_settings const& settings)
     {
         m_dht_settings = settings;
@@ -1931,9 +2706,26 @@ void session_impl::set_external_address(address const& ip
         , uint8_t type
         , client_id_type ip
         , uint16_t port
-        , client_id_type low_id) {
+        , client_id_type low_id
+        , client_id_type buddy_ip
+        , uint16_t buddy_port
+        , const md4_hash& buddy_hash) {
         DBG("dht found peer " << hash << " type " << type << " ip " << int2ipstr(ip) << " port " << port << " low id " << low_id);
 
+        // firewalled sources are reached through their buddy, the peer
+        // comes back with its low id or from its ip
+        if (type == 3 || type == 5) {
+            if (buddy_ip == 0 || buddy_port == 0 || buddy_hash == md4_hash::invalid) return;
+            if (!find_transfer(hash).lock()) return;
+
+            client_id_type id = low_id != 0 ? low_id : ip;
+            bool send = m_lowid_callbacks.request(id, hash, time_now());
+            m_lowid_callbacks.set_buddy(id
+                , udp::endpoint(ip::address::from_string(int2ipstr(buddy_ip)), buddy_port), buddy_hash);
+            if (send) send_lowid_callback(id);
+            return;
+        }
+
         if (ip != 0) {
             boost::shared_ptr<transfer> transfer_ptr = find_transfer(hash).lock();
             if (transfer_ptr) {
@@ -1946,7 +2738,15 @@ void session_impl::set_external_address(address const& ip
     }
 
     void session_impl::on_find_dht_keyword(const md4_hash& h, const std::deque<kad_info_entry>& kk) {
-        m_alerts.post_alert_should(dht_keyword_search_result_alert(h, kk));
+        if (!m_search.kad_target(h)) {
+            m_alerts.post_alert_should(dht_keyword_search_result_alert(h, kk));
+            return;
+        }
+
+        boost::shared_ptr<std::vector<search_result_entry> > changed(new std::vector<search_result_entry>);
+        m_search.add_kad_results(kk, *changed);
+        if (!changed->empty())
+            m_alerts.post_alert_should(search_result_alert(changed, m_search.more(), int(m_search.size())));
     }
 
 #endif
@@ -0,0 +1,293 @@
+#include "libed2k/pch.hpp"
+
+#include <algorithm>
+
+#include "libed2k/slab_allocator.hpp"
+#include "libed2k/assert.hpp"
+
+#if !defined LIBED2K_WINDOWS && !defined LIBED2K_BEOS
+#include <sys/mman.h>
+#define LIBED2K_USE_MMAP_SLABS 1
+#endif
+
+namespace libed2k
+{
+    namespace
+    {
+        // huge pages are 2 MiB on the platforms supporting MAP_HUGETLB
+        const size_t huge_page_size = 2 * 1024 * 1024;
+
+        int round_object_size(int size)
+        {
+            if (size >= page_size()) return (size + page_size() - 1) / page_size() * page_size();
+            return (size + 15) / 16 * 16;
+        }
+    }
+
+    slab_allocator::slab_allocator(int object_size, int objects_per_slab, int cache_size)
+        : m_object_size(round_object_size(object_size))
+        , m_objects_per_slab(std::max(objects_per_slab, 1))
+        , m_cache_size(std::max(cache_size, 0))
+        , m_huge_pages(false)
+        , m_state(new shared_state(this))
+        , m_local(&slab_allocator::release_cache)
+    {
+    }
+
+    slab_allocator::~slab_allocator()
+    {
+        {
+            // caches of running threads are deleted when they exit
+            mutex::scoped_lock l(m_state->m);
+            m_state->owner = 0;
+        }
+
+        for (std::vector<slab>::const_iterator i = m_slabs.begin(); i != m_slabs.end(); ++i)
+            release_slab(*i);
+    }
+
+    char* slab_allocator::allocate()
+    {
+        thread_cache& c = local_cache();
+
+        if (c.objects.empty())
+        {
+            mutex::scoped_lock l(m_state->m);
+
+            // refill cache up to half to leave room for frees
+            size_t want = std::max(m_cache_size / 2, 1);
+
+            while (m_free.size() < want && add_slab());
+
+            size_t n = std::min(want, m_free.size());
+            if (n == 0) return 0;
+            c.objects.insert(c.objects.end(), m_free.end() - n, m_free.end());
+            m_free.resize(m_free.size() - n);
+            ++c.refills;
+        }
+        else
+        {
+            ++c.cache_hits;
+        }
+
+        char* ret = c.objects.back();
+        c.objects.pop_back();
+        ++c.allocations;
+        return ret;
+    }
+
+    void slab_allocator::free(char* buf)
+    {
+        LIBED2K_ASSERT(buf);
+        thread_cache& c = local_cache();
+        c.objects.push_back(buf);
+        ++c.frees;
+
+        if (int(c.objects.size()) > m_cache_size)
+        {
+            // give back the older half, recently freed objects are hot in CPU cache
+            size_t n = c.objects.size() - m_cache_size / 2;
+            mutex::scoped_lock l(m_state->m);
+            m_free.insert(m_free.end(), c.objects.begin(), c.objects.begin() + n);
+            c.objects.erase(c.objects.begin(), c.objects.begin() + n);
+            ++c.refills;
+        }
+    }
+
+    void slab_allocator::release_memory()
+    {
+        mutex::scoped_lock l(m_state->m);
+
+        // objects in thread caches of other threads keep their slabs
+        thread_cache* c = m_local.get();
+
+        if (c && c->state == m_state)
+        {
+            m_free.insert(m_free.end(), c->objects.begin(), c->objects.end());
+            c->objects.clear();
+        }
+
+        std::sort(m_free.begin(), m_free.end());
+        std::vector<char*> rest;
+        std::vector<slab> slabs;
+        std::vector<char*>::iterator f = m_free.begin();
+
+        for (std::vector<slab>::const_iterator i = m_slabs.begin(); i != m_slabs.end(); ++i)
+        {
+            std::vector<char*>::iterator first = std::lower_bound(f, m_free.end(), i->begin);
+            std::vector<char*>::iterator last = std::lower_bound(first, m_free.end(), i->begin + i->size);
+            rest.insert(rest.end(), f, first);
+
+            if (size_t(last - first) == i->size / m_object_size)
+            {
+                release_slab(*i);
+            }
+            else
+            {
+                rest.insert(rest.end(), first, last);
+                slabs.push_back(*i);
+            }
+
+            f = last;
+        }
+
+        rest.insert(rest.end(), f, m_free.end());
+        m_free.swap(rest);
+        m_slabs.swap(slabs);
+    }
+
+    void slab_allocator::set_huge_pages(bool b)
+    {
+        mutex::scoped_lock l(m_state->m);
+        m_huge_pages = b;
+    }
+
+    bool slab_allocator::is_from(char* buf) const
+    {
+        mutex::scoped_lock l(m_state->m);
+        std::vector<slab>::const_iterator i = find_slab(buf);
+        return i != m_slabs.end() && (buf - i->begin) % m_object_size == 0;
+    }
+
+    slab_allocator_stats slab_allocator::stats() const
+    {
+        mutex::scoped_lock l(m_state->m);
+        slab_allocator_stats res;
+        size_type in_use = 0;
+
+        for (std::vector<slab>::const_iterator i = m_slabs.begin(); i != m_slabs.end(); ++i)
+        {
+            ++res.slabs;
+            if (i->huge_pages) ++res.huge_page_slabs;
+            res.reserved_bytes += i->size;
+        }
+
+        res.allocations = m_state->allocations;
+        res.cache_hits = m_state->cache_hits;
+        res.refills = m_state->refills;
+        in_use = m_state->allocations - m_state->frees;
+
+        for (std::vector<thread_cache*>::const_iterator i = m_state->caches.begin();
+             i != m_state->caches.end(); ++i)
+        {
+            const size_type allocations = long((*i)->allocations);
+            res.allocations += allocations;
+            res.cache_hits += long((*i)->cache_hits);
+            res.refills += (*i)->refills;
+            in_use += allocations - long((*i)->frees);
+        }
+
+        res.in_use = int(in_use);
+        return res;
+    }
+
+    slab_allocator::thread_cache& slab_allocator::local_cache()
+    {
+        thread_cache* c = m_local.get();
+
+        // a cache of a destroyed allocator which lived at the same address
+        if (!c || c->state != m_state)
+        {
+            c = new thread_cache(m_state);
+            c->objects.reserve(m_cache_size + 1);
+            {
+                mutex::scoped_lock l(m_state->m);
+                m_state->caches.push_back(c);
+            }
+            m_local.reset(c);
+        }
+
+        return *c;
+    }
+
+    void slab_allocator::release_cache(thread_cache* c)
+    {
+        boost::shared_ptr<shared_state> s = c->state;
+
+        {
+            mutex::scoped_lock l(s->m);
+            std::vector<thread_cache*>::iterator i = std::find(s->caches.begin(), s->caches.end(), c);
+            if (i != s->caches.end()) s->caches.erase(i);
+
+            s->allocations += long(c->allocations);
+            s->frees += long(c->frees);
+            s->cache_hits += long(c->cache_hits);
+            s->refills += c->refills;
+
+            // the slabs of a destroyed allocator are gone already
+            if (s->owner)
+                s->owner->m_free.insert(s->owner->m_free.end(), c->objects.begin(), c->objects.end());
+        }
+
+        delete c;
+    }
+
+    bool slab_allocator::add_slab()
+    {
+        slab s;
+        s.size = size_t(m_object_size) * m_objects_per_slab;
+        s.huge_pages = false;
+        s.begin = 0;
+
+#ifdef LIBED2K_USE_MMAP_SLABS
+#ifdef MAP_HUGETLB
+        if (m_huge_pages)
+        {
+            size_t size = (s.size + huge_page_size - 1) / huge_page_size * huge_page_size;
+            void* p = mmap(0, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+
+            if (p != MAP_FAILED)
+            {
+                s.begin = static_cast<char*>(p);
+                s.size = size;
+                s.huge_pages = true;
+            }
+        }
+#endif
+
+        if (s.begin == 0)
+        {
+            void* p = mmap(0, s.size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+            if (p == MAP_FAILED) return false;
+            s.begin = static_cast<char*>(p);
+#ifdef MADV_HUGEPAGE
+            // no reserved huge pages - let transparent huge pages back the slab
+            if (m_huge_pages) madvise(p, s.size, MADV_HUGEPAGE);
+#endif
+        }
+#else
+        s.begin = page_aligned_allocator::malloc(s.size);
+        if (s.begin == 0) return false;
+#endif
+
+        // huge page slab may fit more objects than asked
+        size_t count = s.size / m_object_size;
+        m_free.reserve(m_free.size() + count);
+
+        // hand out objects from the slab start first
+        for (size_t n = count; n > 0; --n)
+            m_free.push_back(s.begin + (n - 1) * m_object_size);
+
+        m_slabs.insert(std::upper_bound(m_slabs.begin(), m_slabs.end(), s), s);
+        return true;
+    }
+
+    void slab_allocator::release_slab(const slab& s)
+    {
+#ifdef LIBED2K_USE_MMAP_SLABS
+        munmap(s.begin, s.size);
+#else
+        page_aligned_allocator::free(s.begin);
+#endif
+    }
+
+    std::vector<slab_allocator::slab>::const_iterator slab_allocator::find_slab(char* buf) const
+    {
+        slab key;
+        key.begin = buf;
+        std::vector<slab>::const_iterator i = std::upper_bound(m_slabs.begin(), m_slabs.end(), key);
+        if (i == m_slabs.begin()) return m_slabs.end();
+        --i;
+        return (buf < i->begin + i->size) ? i : m_slabs.end();
+    }
+}
@@ -0,0 +1,26 @@
+#include "libed2k/pch.hpp"
+
+#include "libed2k/source_request.hpp"
+
+namespace libed2k
+{
+    source_request::source_request():
+        m_next(min_time()), m_backoff(1), m_found(0), m_found_at_request(0)
+    {
+    }
+
+    void source_request::schedule(int reask_time, int max_backoff, const ptime& now)
+    {
+        // previous request brought nothing - wait longer this time
+        if (m_found == m_found_at_request)
+            m_backoff = std::min(m_backoff * 2, std::max(max_backoff, 1));
+        else
+            m_backoff = 1;
+
+        // the very first request has nothing to judge by
+        if (m_next == min_time()) m_backoff = 1;
+
+        m_found_at_request = m_found;
+        m_next = now + seconds(reask_time * m_backoff);
+    }
+}
@@ -445,7 +445,9 @@ namespace libed2k
             // if the file already exists, but is larger than what
             // it's supposed to be, also truncate it
             // if the file is empty, just create it either way.
-            if ((ec && allocate_files) || (!ec && s.file_size > file_iter->size) || file_iter->size == 0)
+            // sparse files are created up front too when their space is preallocated
+            bool preallocate = !allocate_files && m_settings && settings().preallocate_sparse_files;
+            if ((ec && (allocate_files || preallocate)) || (!ec && s.file_size > file_iter->size) || file_iter->size == 0)
             {
                 std::string dir = parent_path(file_path);
 
@@ -467,6 +469,7 @@ namespace libed2k
                 else if (f)
                 {
                     f->set_size(file_iter->size, ec);
+                    if (!ec && preallocate) f->preallocate(file_iter->size, ec);
                     if (ec) set_error(file_path, ec);
                 }
                 if (ec) break;
@@ -627,8 +630,45 @@ namespace libed2k
         boost::intrusive_ptr<file> file_handle = open_file(file_iter, file::read_only, ec);
         if (!file_handle || ec) return slot;
 
+        // the slot holding the first data byte, data_start is relative to the file
         size_type data_start = file_handle->sparse_end(file_offset);
-        return int((data_start + m_files.piece_length() - 1) / m_files.piece_length());
+        if (data_start <= file_offset) return slot;
+        size_type offset = (size_type)slot * m_files.piece_length() + data_start - file_offset;
+        // no data up to the end of the storage, the last slot is a hole too
+        if (offset >= m_files.total_size()) return m_files.num_pieces();
+        return int(offset / m_files.piece_length());
+    }
+
+    boost::intrusive_ptr<file> default_storage::open_range(int slot, int offset, int size
+        , size_type& file_offset, error_code& ec)
+    {
+        LIBED2K_ASSERT(slot >= 0);
+        LIBED2K_ASSERT(slot < m_files.num_pieces());
+        LIBED2K_ASSERT(offset >= 0);
+        LIBED2K_ASSERT(size > 0);
+
+        file_offset = slot * (size_type)m_files.piece_length() + offset;
+        file_storage::iterator file_iter;
+
+        for (file_iter = files().begin(); file_iter != files().end(); ++file_iter)
+        {
+            if (file_offset < file_iter->size)
+                break;
+
+            file_offset -= file_iter->size;
+        }
+
+        if (file_iter == files().end() || file_iter->pad_file
+            || file_offset + size > file_iter->size)
+            return boost::intrusive_ptr<file>();
+
+        boost::intrusive_ptr<file> file_handle = open_file(file_iter, file::read_only, ec);
+        // unbuffered files need aligned reads, let the disk thread do them
+        if (!file_handle || ec || (file_handle->open_mode() & file::no_buffer))
+            return boost::intrusive_ptr<file>();
+
+        file_offset += files().file_base(*file_iter);
+        return file_handle;
     }
 
     bool default_storage::verify_resume_data(lazy_entry const& rd, error_code& error)
@@ -1612,7 +1652,8 @@ ret:
         peer_request const& r
         , boost::function<void(int, disk_io_job const&)> const& handler
         , int cache_line_size
-        , int cache_expiry)
+        , int cache_expiry
+        , boost::uint32_t requester)
     {
         disk_io_job j;
         j.storage = this;
@@ -1623,6 +1664,7 @@ ret:
         j.buffer = 0;
         j.max_cache_line = cache_line_size;
         j.cache_min_time = cache_expiry;
+        j.requester = requester;
 
         // if a buffer is not specified, only one block can be read
         // since that is the size of the pool allocator's buffers
@@ -2497,6 +2539,14 @@ ret:
                 m_hash_to_piece.insert(std::pair<const md4_hash, int>(m_info->hash_for_piece(i), i));
         }
 
+        // the slot lies in a hole of a sparse file, there is nothing to read
+        // and hash. Skip it and the following slots up to the next data
+        if (m_storage_mode != internal_storage_mode_compact_deprecated)
+        {
+            int data_slot = m_storage->sparse_end(m_current_slot);
+            if (data_slot > m_current_slot) return data_slot - m_current_slot;
+        }
+
         partial_hash ph;
         int num_read = 0;
         int piece_size = m_files.piece_size(m_current_slot);
@@ -2933,6 +2983,16 @@ ret:
         return written;
     }
 
+    boost::intrusive_ptr<file> piece_manager::open_for_upload(peer_request const& r
+        , size_type& file_offset, error_code& ec)
+    {
+        // in compact mode the slot of a piece may change while the
+        // block is being sent
+        if (m_storage_mode == internal_storage_mode_compact_deprecated)
+            return boost::intrusive_ptr<file>();
+        return m_storage->open_range(r.piece, r.start, r.length, file_offset, ec);
+    }
+
     int piece_manager::slot_for(int piece) const
     {
         if (m_storage_mode != internal_storage_mode_compact_deprecated) return piece;
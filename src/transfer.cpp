@@ -12,6 +12,14 @@
 
 namespace libed2k
 {
+    namespace
+    {
+        bool faster_peer(peer_connection* lhs, peer_connection* rhs)
+        {
+            return lhs->statistics().download_payload_rate() > rhs->statistics().download_payload_rate();
+        }
+    }
+
     /** fake constructor */
     transfer::transfer(aux::session_impl& ses, const std::vector<peer_entry>& pl,
                        const md4_hash& hash, const std::string& filepath, size_type size):
@@ -20,9 +28,10 @@ namespace libed2k
         m_complete(-1),
         m_incomplete(-1),
         m_policy(this),
-        m_info(new transfer_info(hash, filename(filepath), size)),
-        m_minute_timer(minutes(1), min_time())
-    {}
+        m_info(new transfer_info(hash, filename(filepath), size))
+    {
+        m_peer_classes = 0;
+    }
 
     transfer::transfer(aux::session_impl& ses, ip::tcp::endpoint const& net_interface,
                        int seq, add_transfer_params const& p):
@@ -55,10 +64,16 @@ namespace libed2k
         m_progress_ppm(0),
         m_total_failed_bytes(0),
         m_total_redundant_bytes(0),
-        m_minute_timer(minutes(1), min_time()),
+        m_storage(0),
         m_need_save_resume_data(true),
-        m_last_active(0)
+        m_last_active(0),
+        m_last_peer_time(time_now())
+#ifndef LIBED2K_DISABLE_DHT
+        , m_next_dht_announce(min_time())
+#endif
     {
+        m_peer_classes = 0;
+        m_link.reset(new transfer_link(ses, p.file_hash));
         if (p.resume_data) m_resume_data.swap(*p.resume_data);
     }
 
@@ -204,10 +219,66 @@ namespace libed2k
 #endif
     }
 
+    float transfer::sources_needed() const
+    {
+        int desired = m_ses.settings().desired_sources;
+        if (desired <= 0) return 0;
+        int known = std::min(int(m_policy.num_peers()), desired);
+        return 1.f - float(known) / desired;
+    }
+
+    bool transfer::want_more_sources() const
+    {
+        return !is_paused() && !m_abort && !is_finished() &&
+            m_state != transfer_status::checking_files &&
+            m_state != transfer_status::checking_resume_data &&
+            m_state != transfer_status::queued_for_checking &&
+            int(m_policy.num_peers()) < m_ses.settings().desired_sources;
+    }
+
+    bool transfer::server_sources_due(const ptime& now) const
+    {
+        return m_server_sources.due(now);
+    }
+
+    void transfer::request_server_sources(const ptime& now)
+    {
+        DBG("request server sources: {hash: " << hash() << ", known: " << m_policy.num_peers() <<
+            ", backoff: " << m_server_sources.backoff() << "}");
+        m_server_sources.schedule(m_ses.settings().server_source_reask_time,
+                                  m_ses.settings().max_source_reask_backoff, now);
+        m_ses.m_server_connection->post_sources_request(hash(), size());
+    }
+
+#ifndef LIBED2K_DISABLE_DHT
+    bool transfer::dht_sources_due(const ptime& now) const
+    {
+        return m_dht_sources.due(now);
+    }
+
+    void transfer::request_dht_sources(const ptime& now)
+    {
+        DBG("request kad sources: {hash: " << hash() << ", known: " << m_policy.num_peers() <<
+            ", backoff: " << m_dht_sources.backoff() << "}");
+        m_dht_sources.schedule(m_ses.settings().dht_source_reask_time,
+                               m_ses.settings().max_source_reask_backoff, now);
+        m_ses.find_sources(hash(), size());
+    }
+#endif
+
     void transfer::add_peer(const tcp::endpoint& peer, int source)
     {
+        size_t known = m_policy.num_peers();
         m_policy.add_peer(peer, source, 0);
 
+        if (m_policy.num_peers() > known)
+        {
+            if (source & peer_info::tracker) m_server_sources.found();
+#ifndef LIBED2K_DISABLE_DHT
+            if (source & peer_info::dht) m_dht_sources.found();
+#endif
+        }
+
         state_updated();
     }
 
@@ -221,7 +292,7 @@ namespace libed2k
         peerinfo->next_connect = 0;
 
         tcp::endpoint ep(peerinfo->endpoint);
-        LIBED2K_ASSERT((m_ses.m_ip_filter.access(peerinfo->address()) & ip_filter::blocked) == 0);
+        LIBED2K_ASSERT((m_ses.m_ip_filter->access(peerinfo->address()) & ip_filter::blocked) == 0);
 
         boost::shared_ptr<tcp::socket> sock(new tcp::socket(m_ses.m_io_service));
         m_ses.setup_socket_buffers(*sock);
@@ -262,7 +333,7 @@ namespace libed2k
         DBG("transfer::attach_peer");
         LIBED2K_ASSERT(!p->has_transfer());
 
-        if (m_ses.m_ip_filter.access(p->remote().address()) & ip_filter::blocked)
+        if (m_ses.m_ip_filter->access(p->remote().address()) & ip_filter::blocked)
         {
             m_ses.m_alerts.post_alert_should(peer_blocked_alert(handle(), p->remote().address()));
             p->disconnect(errors::banned_by_ip_filter);
@@ -332,6 +403,7 @@ namespace libed2k
         m_policy.connection_closed(*c, m_ses.session_time());
         c->set_peer(0);
         m_connections.erase(c);
+        m_last_peer_time = time_now();
     }
 
     void transfer::get_peer_info(std::vector<peer_info>& infos)
@@ -413,6 +485,7 @@ namespace libed2k
     {
         //TODO: update progress
         m_picker->we_have(index);
+        remove_time_critical_piece(index);
     }
 
     size_t transfer::num_pieces() const
@@ -441,6 +514,7 @@ namespace libed2k
     // called when transfer is complete (all pieces downloaded)
     void transfer::completed()
     {
+        m_time_critical_pieces.clear();
         m_picker.reset();
         set_state(transfer_status::seeding);
     }
@@ -671,7 +745,7 @@ namespace libed2k
 
     void transfer::piece_availability(std::vector<int>& avail) const
     {
-        if (is_seed())
+        if (is_seed() || !has_picker())
         {
             avail.clear();
             return;
@@ -682,7 +756,7 @@ namespace libed2k
 
     void transfer::set_piece_priority(int index, int priority)
     {
-        if (is_seed()) return;
+        if (is_seed() || !has_picker()) return;
 
         // this call is only valid on transfers with metadata
         LIBED2K_ASSERT(m_picker.get());
@@ -696,7 +770,7 @@ namespace libed2k
 
     int transfer::piece_priority(int index) const
     {
-        if (is_seed()) return 1;
+        if (is_seed() || !has_picker()) return 1;
 
         // this call is only valid on transfers with metadata
         LIBED2K_ASSERT(m_picker.get());
@@ -709,7 +783,7 @@ namespace libed2k
 
 	void transfer::piece_priorities(std::vector<int>* pieces) const
     {
-        if (is_seed())
+        if (is_seed() || !has_picker())
         {
             pieces->clear();
             pieces->resize(num_pieces(), 1);
@@ -732,6 +806,62 @@ namespace libed2k
 
     void transfer::set_sequential_download(bool sd) { m_sequential_download = sd; }
 
+    void transfer::set_piece_deadline(int index, int deadline)
+    {
+        LIBED2K_ASSERT(index >= 0);
+        LIBED2K_ASSERT(index < int(num_pieces()));
+        if (index < 0 || index >= int(num_pieces())) return;
+        if (is_seed() || !has_picker() || have_piece(index)) return;
+
+        m_time_critical_pieces.set(index, time_now() + milliseconds(deadline));
+        request_time_critical_pieces();
+    }
+
+    void transfer::reset_piece_deadline(int index)
+    {
+        remove_time_critical_piece(index);
+    }
+
+    void transfer::remove_time_critical_piece(int index)
+    {
+        m_time_critical_pieces.remove(index);
+    }
+
+    void transfer::request_time_critical_pieces()
+    {
+        if (m_time_critical_pieces.empty() || !has_picker() || is_paused()) return;
+
+        std::vector<peer_connection*> peers(m_connections.begin(), m_connections.end());
+        std::sort(peers.begin(), peers.end(), &faster_peer);
+        ptime now = time_now();
+
+        // earliest deadline first, each piece goes to the fastest peers having free
+        // request slots. When the deadline is missed blocks on the way are requested
+        // once more from another peer
+        const std::vector<time_critical_pieces::entry>& pieces = m_time_critical_pieces.pieces();
+        for (std::vector<time_critical_pieces::entry>::const_iterator i = pieces.begin();
+             i != pieces.end(); ++i)
+        {
+            bool late = i->deadline < now;
+            for (std::vector<peer_connection*>::iterator p = peers.begin(); p != peers.end(); ++p)
+                (*p)->request_time_critical_piece(i->piece, late);
+        }
+    }
+
+    bool transfer::end_game() const
+    {
+        return has_picker() && !is_finished() && m_picker->all_requested();
+    }
+
+    void transfer::cancel_block(const piece_block& block, peer_connection* src)
+    {
+        for (std::set<peer_connection*>::iterator i = m_connections.begin();
+             i != m_connections.end(); ++i)
+        {
+            if (*i != src) (*i)->cancel_request(block);
+        }
+    }
+
     void transfer::piece_failed(int index)
     {
         LIBED2K_ASSERT(m_storage);
@@ -1151,6 +1281,16 @@ namespace libed2k
             ERR("fastresume data rejected: " << j.error.message() << " ret: " << ret);
         }
 
+        // the peers are good whether the pieces passed the check or not
+        if (m_resume_entry.type() == lazy_entry::dict_t)
+        {
+            if (lazy_entry const* peers = m_resume_entry.dict_find_string("peers"))
+            {
+                int n = m_policy.load_peers(peers->string_ptr(), peers->string_length());
+                DBG("resume data peers: {hash: " << hash() << ", peers: " << n << "}");
+            }
+        }
+
         // if ret != 0, it means we need a full check. We don't necessarily need
         // that when the resume data check fails.
         if (ret == 0)
@@ -1253,9 +1393,6 @@ namespace libed2k
 
     void transfer::second_tick(stat& accumulator, int tick_interval_ms, const ptime& now)
     {
-        if (m_minute_timer.expired(now) && m_connections.size() == 0 && !is_paused() && !is_aborted())
-            request_peers();
-
         // if we're in upload only mode and we're auto-managed
         // leave upload mode every 10 minutes hoping that the error
         // condition has been fixed
@@ -1294,6 +1431,8 @@ namespace libed2k
             }
         }
 
+        request_time_critical_pieces();
+
         if (m_upload_mode) ++m_upload_mode_time;
 
         accumulator += m_stat;
@@ -1387,88 +1526,24 @@ namespace libed2k
 
     shared_file_entry transfer::get_announce() const
     {
-        shared_file_entry entry;
-
         // do not announce transfer without pieces or in checking state
         if (m_state == transfer_status::queued_for_checking
                 || m_state == transfer_status::checking_files
                 || m_state == transfer_status::checking_resume_data ||
                 num_have() == 0)
         {
-            return entry;
-        }
-
-        // TODO - implement generate file entry from transfer here
-        entry.m_hFile = hash();
-        if (m_ses.m_server_connection->tcp_flags() & SRV_TCPFLG_COMPRESSION)
-        {
-            if (!is_seed())
-            {
-                // publishing an incomplete file
-                entry.m_network_point.m_nIP     = 0xFCFCFCFC;
-                entry.m_network_point.m_nPort   = 0xFCFC;
-            }
-            else
-            {
-                // publishing a complete file
-                entry.m_network_point.m_nIP     = 0xFBFBFBFB;
-                entry.m_network_point.m_nPort   = 0xFBFB;
-            }
-        }
-        else
-        {
-            entry.m_network_point.m_nIP     = m_ses.m_server_connection->client_id();
-            entry.m_network_point.m_nPort   = m_ses.settings().listen_port;
+            return shared_file_entry();
         }
 
-        entry.m_list.add_tag(make_string_tag(name(), FT_FILENAME, true));
-
-        __file_size fs;
-        fs.nQuadPart = size();
-        entry.m_list.add_tag(make_typed_tag(fs.u.nLowPart, FT_FILESIZE, true));
-
-        if (fs.u.nHighPart > 0)
-        {
-            entry.m_list.add_tag(make_typed_tag(fs.u.nHighPart, FT_FILESIZE_HI, true));
-        }
-
-        bool bFileTypeAdded = false;
-
-        if (m_ses.m_server_connection->tcp_flags() & SRV_TCPFLG_TYPETAGINTEGER)
-        {
-            // Send integer file type tags to newer servers
-            boost::uint32_t eFileType = GetED2KFileTypeSearchID(GetED2KFileTypeID(name()));
-
-            if (eFileType >= ED2KFT_AUDIO && eFileType <= ED2KFT_EMULECOLLECTION)
-            {
-                entry.m_list.add_tag(make_typed_tag(eFileType, FT_FILETYPE, true));
-                bFileTypeAdded = true;
-            }
-        }
-
-        if (!bFileTypeAdded)
-        {
-            // Send string file type tags to:
-            //  - newer servers, in case there is no integer type available for the file type (e.g. emulecollection)
-            //  - older servers
-            //  - all clients
-            std::string strED2KFileType(GetED2KFileTypeSearchTerm(GetED2KFileTypeID(name())));
-
-            if (!strED2KFileType.empty())
-            {
-                entry.m_list.add_tag(make_string_tag(strED2KFileType, FT_FILETYPE, true));
-            }
-        }
-
-        return entry;
+        return make_announce(m_ses, hash(), name(), size(), is_seed());
     }
 
     void transfer::save_resume_data(int flags)
     {
         if (!m_owning_storage.get())
         {
-            m_ses.m_alerts.post_alert_should(
-                save_resume_data_failed_alert(handle(), errors::destructing_transfer));
+            m_ses.m_alerts.post_alert_should(save_resume_data_failed_alert(
+                handle(), m_storage ? errors::destructing_transfer : errors::transfer_not_ready));
             return;
         }
 
@@ -1516,7 +1591,8 @@ namespace libed2k
             && !m_paused
             && !has_error()
             && !m_abort
-            && !m_ses.is_paused();
+            && !m_ses.is_paused()
+            && is_started();
     }
 
     void transfer::file_checked()
@@ -1596,7 +1672,6 @@ namespace libed2k
         if (j.offset >= 0 && !m_picker->have_piece(j.offset))
         {
             we_have(j.offset);
-            //remove_time_critical_piece(j.offset);
         }
 
         // we're not done checking yet
@@ -1730,6 +1805,10 @@ namespace libed2k
             hv.push_back(piece_hashses.at(n).toString());
         }
 
+        // seeds find their peers when those ask for the file
+        if (!is_seed())
+            m_policy.save_peers(ret["peers"].string(), m_ses.settings().resume_data_peers);
+
         ret["upload_rate_limit"] = upload_limit();
         ret["download_rate_limit"] = download_limit();
         // TODO - add real values
@@ -1840,6 +1919,12 @@ namespace libed2k
         return m_connections.size() > 0 || !is_seed();
     }
 
+    bool transfer::idle_seed(const ptime& now, const time_duration& timeout) const
+    {
+        return m_state == transfer_status::seeding && m_connections.empty() &&
+            !m_abort && !is_paused() && now - m_last_peer_time >= timeout;
+    }
+
     void transfer::activate(bool act)
     {
         if (act && active() && m_ses.add_active_transfer(shared_from_this()))
@@ -1847,6 +1932,74 @@ namespace libed2k
         else if (!act && !active()) m_ses.remove_active_transfer(shared_from_this());
     }
 
+    shared_file_entry make_announce(aux::session_impl& ses, const md4_hash& hash,
+                                    const std::string& name, size_type size, bool complete)
+    {
+        shared_file_entry entry;
+        entry.m_hFile = hash;
+        if (ses.m_server_connection->tcp_flags() & SRV_TCPFLG_COMPRESSION)
+        {
+            if (!complete)
+            {
+                // publishing an incomplete file
+                entry.m_network_point.m_nIP     = 0xFCFCFCFC;
+                entry.m_network_point.m_nPort   = 0xFCFC;
+            }
+            else
+            {
+                // publishing a complete file
+                entry.m_network_point.m_nIP     = 0xFBFBFBFB;
+                entry.m_network_point.m_nPort   = 0xFBFB;
+            }
+        }
+        else
+        {
+            entry.m_network_point.m_nIP     = ses.m_server_connection->client_id();
+            entry.m_network_point.m_nPort   = ses.settings().listen_port;
+        }
+
+        entry.m_list.add_tag(make_string_tag(name, FT_FILENAME, true));
+
+        __file_size fs;
+        fs.nQuadPart = size;
+        entry.m_list.add_tag(make_typed_tag(fs.u.nLowPart, FT_FILESIZE, true));
+
+        if (fs.u.nHighPart > 0)
+        {
+            entry.m_list.add_tag(make_typed_tag(fs.u.nHighPart, FT_FILESIZE_HI, true));
+        }
+
+        bool bFileTypeAdded = false;
+
+        if (ses.m_server_connection->tcp_flags() & SRV_TCPFLG_TYPETAGINTEGER)
+        {
+            // Send integer file type tags to newer servers
+            boost::uint32_t eFileType = GetED2KFileTypeSearchID(GetED2KFileTypeID(name));
+
+            if (eFileType >= ED2KFT_AUDIO && eFileType <= ED2KFT_EMULECOLLECTION)
+            {
+                entry.m_list.add_tag(make_typed_tag(eFileType, FT_FILETYPE, true));
+                bFileTypeAdded = true;
+            }
+        }
+
+        if (!bFileTypeAdded)
+        {
+            // Send string file type tags to:
+            //  - newer servers, in case there is no integer type available for the file type (e.g. emulecollection)
+            //  - older servers
+            //  - all clients
+            std::string strED2KFileType(GetED2KFileTypeSearchTerm(GetED2KFileTypeID(name)));
+
+            if (!strED2KFileType.empty())
+            {
+                entry.m_list.add_tag(make_string_tag(strED2KFileType, FT_FILETYPE, true));
+            }
+        }
+
+        return entry;
+    }
+
     shared_file_entry transfer2sfe(const std::pair<md4_hash, boost::shared_ptr<transfer> >& tran)
     {
         return tran.second->get_announce();
@@ -1858,7 +2011,18 @@ namespace libed2k
     {
         LIBED2K_ASSERT(m_ses.is_network_thread());
         if (m_ses.m_listen_sockets.empty()) return false;
-        return true;
+        if (is_paused() || is_aborted()) return false;
+
+        // do not publish transfer without pieces or in checking state
+        if (m_state == transfer_status::queued_for_checking
+                || m_state == transfer_status::checking_files
+                || m_state == transfer_status::checking_resume_data
+                || num_have() == 0)
+        {
+            return false;
+        }
+
+        return m_next_dht_announce <= time_now();
     }
 
     void transfer::dht_announce()
@@ -1867,13 +2031,34 @@ namespace libed2k
         if (!m_ses.m_dht) return;
         if (!should_announce_dht()) return;
 
-        int port = m_ses.listen_port();
+        m_next_dht_announce = time_now() + seconds(m_ses.m_dht_settings.source_republish_interval);
+        m_ses.dht_publish_source(hash(), size());
+    }
 
-        boost::weak_ptr<transfer> self(shared_from_this());
+    kad_info_entry transfer::get_dht_keyword_entry() const
+    {
+        return make_dht_keyword_entry(hash(), name(), size());
+    }
 
-        //m_ses.m_dht->announce(hash()
-        //    , port
-        //    , boost::bind(&transfer::on_dht_announce_response_disp, self, _1));
+    kad_info_entry make_dht_keyword_entry(const md4_hash& hash, const std::string& name, size_type size)
+    {
+        kad_info_entry entry;
+        entry.hash = hash;
+        entry.tags.add_tag(make_string_tag(name, TAG_FILENAME, false));
+
+        if (size > 0xFFFFFFFFLL)
+            entry.tags.add_tag(make_typed_tag(boost::uint64_t(size), TAG_FILESIZE, false));
+        else
+            entry.tags.add_tag(make_typed_tag(boost::uint32_t(size), TAG_FILESIZE, false));
+
+        std::string strED2KFileType(GetED2KFileTypeSearchTerm(GetED2KFileTypeID(name)));
+
+        if (!strED2KFileType.empty())
+            entry.tags.add_tag(make_string_tag(strED2KFileType, TAG_FILETYPE, false));
+
+        // we are the only known source
+        entry.tags.add_tag(make_typed_tag(boost::uint32_t(1), TAG_SOURCES, false));
+        return entry;
     }
 
     // static
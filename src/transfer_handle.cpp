@@ -1,28 +1,46 @@
 #include "libed2k/transfer_handle.hpp"
 #include "libed2k/session_impl.hpp"
 #include "libed2k/transfer.hpp"
+#include "libed2k/filesystem.hpp"
+#include "libed2k/util.hpp"
 
 using libed2k::aux::session_impl;
 
 
 #define LIBED2K_FORWARD(call) \
-    boost::shared_ptr<transfer> t = m_transfer.lock(); \
+    session_impl::mutex_t::scoped_lock l; \
+    boost::shared_ptr<transfer> t = lock_transfer(m_transfer, m_link, l); \
     if (!t) return; \
-    session_impl::mutex_t::scoped_lock l(t->session().m_mutex); \
     t->call
 
 #define LIBED2K_FORWARD_RETURN(call, def) \
-    boost::shared_ptr<transfer> t = m_transfer.lock(); \
+    session_impl::mutex_t::scoped_lock l; \
+    boost::shared_ptr<transfer> t = lock_transfer(m_transfer, m_link, l); \
     if (!t) return def; \
-    session_impl::mutex_t::scoped_lock l(t->session().m_mutex); \
     return t->call
 
 #define LIBED2K_FORWARD_RETURN2(call, def) \
-    boost::shared_ptr<transfer> t = m_transfer.lock(); \
+    session_impl::mutex_t::scoped_lock l; \
+    boost::shared_ptr<transfer> t = lock_transfer(m_transfer, m_link, l); \
     if (!t) return def; \
-    session_impl::mutex_t::scoped_lock l(t->session().m_mutex); \
     t->call
 
+// read-only calls of a dormant transfer are answered from its record
+#define LIBED2K_FORWARD_DORMANT(call) \
+    session_impl::mutex_t::scoped_lock l; \
+    const dormant_transfer* d = 0; \
+    boost::shared_ptr<transfer> t = peek_transfer(m_transfer, m_link, l, d); \
+    if (d || !t) return; \
+    t->call
+
+#define LIBED2K_FORWARD_DORMANT_RETURN(call, dormant, def) \
+    session_impl::mutex_t::scoped_lock l; \
+    const dormant_transfer* d = 0; \
+    boost::shared_ptr<transfer> t = peek_transfer(m_transfer, m_link, l, d); \
+    if (d) return dormant; \
+    if (!t) return def; \
+    return t->call
+
 #if 0
 
 #define LIBED2K_FORWARD(call) \
@@ -47,6 +65,89 @@ using libed2k::aux::session_impl;
 
 namespace libed2k
 {
+    namespace
+    {
+        /**
+          * the transfer of a handle with the session locked. A dormant transfer
+          * or one that went dormant after the handle was made is woken up
+         */
+        boost::shared_ptr<transfer> lock_transfer(boost::weak_ptr<transfer>& wt,
+            const boost::weak_ptr<transfer_link>& wl, session_impl::mutex_t::scoped_lock& l)
+        {
+            boost::shared_ptr<transfer> t = wt.lock();
+            boost::shared_ptr<transfer_link> link = wl.lock();
+            if (!t && !link) return t;
+
+            session_impl::mutex_t::scoped_lock sl(link ? link->ses.m_mutex : t->session().m_mutex);
+            l.swap(sl);
+
+            if (link && (!t || t->is_aborted()))
+            {
+                boost::shared_ptr<transfer> w = link->ses.wake_transfer(link->hash);
+                // a transfer added again under the same hash isn't ours
+                if (w && w->link() == link)
+                {
+                    wt = w;
+                    t = w;
+                }
+            }
+
+            return t;
+        }
+
+        /**
+          * the same as lock_transfer, but a dormant transfer is left asleep
+          * and its record is returned instead
+         */
+        boost::shared_ptr<transfer> peek_transfer(boost::weak_ptr<transfer>& wt,
+            const boost::weak_ptr<transfer_link>& wl, session_impl::mutex_t::scoped_lock& l,
+            const dormant_transfer*& d)
+        {
+            d = 0;
+            boost::shared_ptr<transfer> t = wt.lock();
+            boost::shared_ptr<transfer_link> link = wl.lock();
+            if (!t && !link) return t;
+
+            session_impl::mutex_t::scoped_lock sl(link ? link->ses.m_mutex : t->session().m_mutex);
+            l.swap(sl);
+
+            if (link && (!t || t->is_aborted()))
+            {
+                dormant_transfers::const_iterator i = link->ses.m_dormant_transfers.find(link->hash);
+                if (i != link->ses.m_dormant_transfers.end() && i->second.link == link)
+                {
+                    d = &i->second;
+                    return boost::shared_ptr<transfer>();
+                }
+
+                // woken up by someone else since the handle was made
+                boost::shared_ptr<transfer> w = link->ses.find_transfer(link->hash).lock();
+                if (w && w->link() == link)
+                {
+                    wt = w;
+                    t = w;
+                }
+            }
+
+            return t;
+        }
+
+        transfer_status dormant_status(const dormant_transfer& d)
+        {
+            transfer_status st;
+            st.seed_mode = true;
+            st.state = transfer_status::seeding;
+            st.total_wanted = d.file_size;
+            st.total_done = d.file_size;
+            st.total_wanted_done = d.file_size;
+            st.progress_ppm = 1000000;
+            st.progress = 1.f;
+            st.priority = d.priority;
+            st.num_pieces = int(piece_count(d.file_size));
+            st.pieces.resize(st.num_pieces, true);
+            return st;
+        }
+    }
 
 #ifndef BOOST_NO_EXCEPTIONS
     void throw_invalid_handle()
@@ -57,79 +158,110 @@ namespace libed2k
 
     bool transfer_handle::is_valid() const
     {
-        return !m_transfer.expired();
+        return !m_transfer.expired() || !m_link.expired();
+    }
+
+    transfer_handle::transfer_handle(const boost::weak_ptr<transfer>& t) : m_transfer(t)
+    {
+        boost::shared_ptr<transfer> p = t.lock();
+        if (p) m_link = p->link();
+    }
+
+    boost::shared_ptr<void> transfer_handle::key() const
+    {
+        boost::shared_ptr<void> k = m_link.lock();
+        if (!k) k = m_transfer.lock();
+        return k;
     }
 
     md4_hash transfer_handle::hash() const
     {
+        // doesn't wake dormant transfer up
+        boost::shared_ptr<transfer_link> link = m_link.lock();
+        if (link) return link->hash;
+
         static const md4_hash empty_hash(md4_hash::terminal);
         LIBED2K_FORWARD_RETURN(hash(), empty_hash);
     }
 
     std::string transfer_handle::name() const
     {
-        LIBED2K_FORWARD_RETURN(name(), std::string());
+        LIBED2K_FORWARD_DORMANT_RETURN(name(), filename(d->file_path), std::string());
     }
 
     std::string transfer_handle::save_path() const
     {
-        LIBED2K_FORWARD_RETURN(save_path(), std::string());
+        LIBED2K_FORWARD_DORMANT_RETURN(save_path(), parent_path(d->file_path), std::string());
     }
 
     size_type transfer_handle::size() const
     {
-        LIBED2K_FORWARD_RETURN(size(), 0);
+        LIBED2K_FORWARD_DORMANT_RETURN(size(), d->file_size, 0);
     }
 
     add_transfer_params transfer_handle::params() const
     {
-        LIBED2K_FORWARD_RETURN(params(), add_transfer_params());
+        add_transfer_params ret;
+        session_impl::mutex_t::scoped_lock l;
+        const dormant_transfer* d = 0;
+        boost::shared_ptr<transfer> t = peek_transfer(m_transfer, m_link, l, d);
+
+        if (d)
+        {
+            boost::shared_ptr<transfer_link> link = m_link.lock();
+            link->ses.m_dormant_transfers.params(link->hash, ret);
+        }
+        else if (t) ret = t->params();
+
+        return ret;
     }
 
     bool transfer_handle::is_seed() const
     {
-        LIBED2K_FORWARD_RETURN(is_seed(), false);
+        LIBED2K_FORWARD_DORMANT_RETURN(is_seed(), true, false);
     }
 
     bool transfer_handle::is_finished() const
     {
-        LIBED2K_FORWARD_RETURN(is_finished(), false);
+        LIBED2K_FORWARD_DORMANT_RETURN(is_finished(), true, false);
     }
 
     bool transfer_handle::is_paused() const
     {
-        LIBED2K_FORWARD_RETURN(is_paused(), false);
+        LIBED2K_FORWARD_DORMANT_RETURN(is_paused(), false, false);
     }
 
     bool transfer_handle::is_aborted() const
     {
-        LIBED2K_FORWARD_RETURN(is_aborted(), false);
+        LIBED2K_FORWARD_DORMANT_RETURN(is_aborted(), false, false);
     }
 
     bool transfer_handle::is_announced() const
     {
-        LIBED2K_FORWARD_RETURN(is_announced(), false);
+        LIBED2K_FORWARD_DORMANT_RETURN(is_announced(), d->announced, false);
     }
 
     transfer_status transfer_handle::status() const
     {
-        LIBED2K_FORWARD_RETURN(status(), transfer_status());
+        LIBED2K_FORWARD_DORMANT_RETURN(status(), dormant_status(*d), transfer_status());
     }
 
     transfer_status::state_t transfer_handle::state() const
     {
         // TODO - some default status there?
-        LIBED2K_FORWARD_RETURN(state(), transfer_status::queued_for_checking);
+        LIBED2K_FORWARD_DORMANT_RETURN(state(), transfer_status::seeding, transfer_status::queued_for_checking);
     }
 
     void transfer_handle::get_peer_info(std::vector<peer_info>& infos) const
     {
-        LIBED2K_FORWARD(get_peer_info(infos));
+        infos.clear();
+        LIBED2K_FORWARD_DORMANT(get_peer_info(infos));
     }
 
     void transfer_handle::piece_availability(std::vector<int>& avail) const
     {
-        LIBED2K_FORWARD(piece_availability(avail));
+        avail.clear();
+        LIBED2K_FORWARD_DORMANT(piece_availability(avail));
     }
 
     void transfer_handle::set_piece_priority(int index, int priority) const
@@ -149,9 +281,19 @@ namespace libed2k
         return ret;
     }
 
+    void transfer_handle::set_piece_deadline(int index, int deadline) const
+    {
+        LIBED2K_FORWARD(set_piece_deadline(index, deadline));
+    }
+
+    void transfer_handle::reset_piece_deadline(int index) const
+    {
+        LIBED2K_FORWARD(reset_piece_deadline(index));
+    }
+
     bool transfer_handle::is_sequential_download() const
     {
-        LIBED2K_FORWARD_RETURN(is_sequential_download(), false);
+        LIBED2K_FORWARD_DORMANT_RETURN(is_sequential_download(), false, false);
     }
 
     void transfer_handle::set_sequential_download(bool sd) const
@@ -174,6 +316,16 @@ namespace libed2k
         LIBED2K_FORWARD(set_download_limit(limit));
     }
 
+    void transfer_handle::set_peer_classes(boost::uint32_t classes) const
+    {
+        LIBED2K_FORWARD(set_peer_classes(classes));
+    }
+
+    boost::uint32_t transfer_handle::peer_classes() const
+    {
+        LIBED2K_FORWARD_RETURN(peer_classes(), 0);
+    }
+
     int transfer_handle::download_limit() const
     {
         LIBED2K_FORWARD_RETURN(download_limit(), 0);
@@ -201,17 +353,17 @@ namespace libed2k
 
     size_t transfer_handle::num_pieces() const
     {
-        LIBED2K_FORWARD_RETURN(num_pieces(), 0);
+        LIBED2K_FORWARD_DORMANT_RETURN(num_pieces(), piece_count(d->file_size), 0);
     }
 
     int transfer_handle::num_peers() const
     {
-        LIBED2K_FORWARD_RETURN(num_peers(), 0);
+        LIBED2K_FORWARD_DORMANT_RETURN(num_peers(), 0, 0);
     }
 
     int transfer_handle::num_seeds() const
     {
-        LIBED2K_FORWARD_RETURN(num_seeds(), 0);
+        LIBED2K_FORWARD_DORMANT_RETURN(num_seeds(), 0, 0);
     }
 
     void transfer_handle::save_resume_data(int flags) const
@@ -221,7 +373,7 @@ namespace libed2k
 
     bool transfer_handle::need_save_resume_data() const
     {
-        LIBED2K_FORWARD_RETURN(need_save_resume_data(), false);
+        LIBED2K_FORWARD_DORMANT_RETURN(need_save_resume_data(), false, false);
     }
 
     void transfer_handle::move_storage(const std::string& save_path) const
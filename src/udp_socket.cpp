@@ -40,6 +40,10 @@ POSSIBILITY OF SUCH DAMAGE.
 #include "libed2k/broadcast_socket.hpp" // for is_any
 #include <stdlib.h>
 #include <boost/bind.hpp>
+#if LIBED2K_USE_MMSG
+#include <sys/socket.h>
+#include <cstring>
+#endif
 #include <boost/array.hpp>
 #if BOOST_VERSION < 103500
 #include <asio/read.hpp>
@@ -82,6 +86,10 @@ udp_socket::udp_socket(asio::io_service& ios
     , m_tunnel_packets(false)
     , m_force_proxy(false)
     , m_abort(false)
+#if LIBED2K_USE_MMSG
+    , m_flush_posted(false)
+    , m_self(new udp_socket*(this))
+#endif
     , m_outstanding_ops(0)
 {
 #if defined LIBED2K_DEBUG || LIBED2K_RELEASE_ASSERTS
@@ -175,6 +183,9 @@ bool udp_socket::maybe_clear_callback()
     if (m_outstanding_ops + m_v4_outstanding
 #if LIBED2K_USE_IPV6
         + m_v6_outstanding
+#endif
+#if LIBED2K_USE_MMSG
+        + m_flush_posted
 #endif
         == 0)
     {
@@ -220,6 +231,26 @@ void udp_socket::send(udp::endpoint const& ep, char const* p, int len, error_cod
 
     if (m_force_proxy) return;
 
+#if LIBED2K_USE_MMSG
+    if ((flags & batch) && m_send_batch.size() < max_send_batch)
+    {
+        batched_packet bp;
+        bp.ep = ep;
+        bp.offset = int(m_send_batch_buf.size());
+        bp.len = len;
+        m_send_batch.push_back(bp);
+        m_send_batch_buf.insert(m_send_batch_buf.end(), p, p + len);
+
+        if (!m_flush_posted)
+        {
+            m_flush_posted = true;
+            get_io_service().post(boost::bind(&udp_socket::on_flush_sends
+                , boost::weak_ptr<udp_socket*>(m_self)));
+        }
+        return;
+    }
+#endif
+
 #if LIBED2K_USE_IPV6
     if (ep.address().is_v4() && m_ipv4_sock.is_open())
 #endif
@@ -388,6 +419,11 @@ void udp_socket::on_read(udp::socket* s, error_code const& e, std::size_t bytes_
 
         if (m_abort) return;
 
+#if LIBED2K_USE_MMSG
+        if (!m_tunnel_packets) drain_socket(s);
+        if (m_abort) return;
+#endif
+
         if (num_outstanding() == 0)
         {
             maybe_realloc_buffers(2);
@@ -422,6 +458,11 @@ void udp_socket::on_read(udp::socket* s, error_code const& e, std::size_t bytes_
 
         if (m_abort) return;
 
+#if LIBED2K_USE_MMSG
+        if (!m_tunnel_packets) drain_socket(s);
+        if (m_abort) return;
+#endif
+
         if (m_v4_outstanding == 0)
         {
             maybe_realloc_buffers(1);
@@ -441,6 +482,139 @@ void udp_socket::on_read(udp::socket* s, error_code const& e, std::size_t bytes_
 #endif
 }
 
+#if LIBED2K_USE_MMSG
+// the socket was readable. Datagrams which arrived meanwhile are read
+// in batches with recvmmsg() instead of one async read each. The number
+// of batches is limited to not starve other handlers during a flood
+void udp_socket::drain_socket(udp::socket* s)
+{
+    const int max_batches = 4;
+    const int buf_size = m_v4_buf_size;
+    if (buf_size <= 0) return;
+    m_batch_buf.resize(std::size_t(mmsg_batch_size) * buf_size);
+
+    mmsghdr msgs[mmsg_batch_size];
+    iovec iov[mmsg_batch_size];
+    sockaddr_storage addrs[mmsg_batch_size];
+
+    for (int batch = 0; batch < max_batches; ++batch)
+    {
+        std::memset(msgs, 0, sizeof(msgs));
+        for (int i = 0; i < mmsg_batch_size; ++i)
+        {
+            iov[i].iov_base = &m_batch_buf[std::size_t(i) * buf_size];
+            iov[i].iov_len = buf_size;
+            msgs[i].msg_hdr.msg_iov = &iov[i];
+            msgs[i].msg_hdr.msg_iovlen = 1;
+            msgs[i].msg_hdr.msg_name = &addrs[i];
+            msgs[i].msg_hdr.msg_namelen = sizeof(addrs[i]);
+        }
+
+        // errors (and EAGAIN) are left to the async read
+        int n = recvmmsg(s->native_handle(), msgs, mmsg_batch_size, MSG_DONTWAIT, 0);
+        if (n <= 0) return;
+
+        for (int i = 0; i < n; ++i)
+        {
+            // the async read reports truncated datagrams as errors, skip them
+            if (msgs[i].msg_hdr.msg_flags & MSG_TRUNC) continue;
+
+            udp::endpoint ep;
+            std::memcpy(ep.data(), &addrs[i], (std::min)(std::size_t(msgs[i].msg_hdr.msg_namelen), std::size_t(ep.capacity())));
+            ep.resize(msgs[i].msg_hdr.msg_namelen);
+
+            LIBED2K_TRY {
+                m_callback(error_code(), ep, static_cast<char const*>(iov[i].iov_base), msgs[i].msg_len);
+            } LIBED2K_CATCH (std::exception&) {}
+
+            if (m_abort) return;
+        }
+
+        if (n < mmsg_batch_size) return;
+    }
+}
+
+void udp_socket::on_flush_sends(boost::weak_ptr<udp_socket*> self)
+{
+    boost::shared_ptr<udp_socket*> s = self.lock();
+    if (s) (*s)->flush_sends();
+}
+
+// sends the packets queued with the batch flag, with one sendmmsg() call
+// for up to mmsg_batch_size packets to the same socket. Packets which
+// couldn't be sent are reported to the callback with their endpoint
+void udp_socket::flush_sends()
+{
+    LIBED2K_ASSERT(m_flush_posted);
+    m_flush_posted = false;
+
+    if (m_abort)
+    {
+        m_send_batch.clear();
+        m_send_batch_buf.clear();
+        maybe_clear_callback();
+        return;
+    }
+
+    std::vector<std::pair<udp::endpoint, error_code> > failed;
+    mmsghdr msgs[mmsg_batch_size];
+    iovec iov[mmsg_batch_size];
+
+    for (std::size_t first = 0; first < m_send_batch.size();)
+    {
+        udp::socket* s = 0;
+        int n = 0;
+        std::memset(msgs, 0, sizeof(msgs));
+
+        for (; first + n < m_send_batch.size() && n < mmsg_batch_size; ++n)
+        {
+            batched_packet& bp = m_send_batch[first + n];
+            udp::socket* ps = &m_ipv4_sock;
+#if LIBED2K_USE_IPV6
+            if (!bp.ep.address().is_v4() || !m_ipv4_sock.is_open()) ps = &m_ipv6_sock;
+#endif
+            if (s && ps != s) break;
+            s = ps;
+
+            iov[n].iov_base = &m_send_batch_buf[bp.offset];
+            iov[n].iov_len = bp.len;
+            msgs[n].msg_hdr.msg_iov = &iov[n];
+            msgs[n].msg_hdr.msg_iovlen = 1;
+            msgs[n].msg_hdr.msg_name = bp.ep.data();
+            msgs[n].msg_hdr.msg_namelen = bp.ep.size();
+        }
+
+        int ret = s->is_open() ? sendmmsg(s->native_handle(), msgs, n, MSG_DONTWAIT) : n;
+        if (ret < 0) ret = 0;
+        first += ret;
+
+        if (ret < n)
+        {
+            // the send buffer is full or this packet failed. Send it the
+            // regular way, which waits for the buffer, and go on batching
+            error_code ec;
+            batched_packet& bp = m_send_batch[first];
+            s->send_to(asio::buffer(&m_send_batch_buf[bp.offset], bp.len), bp.ep, 0, ec);
+            if (ec) failed.push_back(std::make_pair(bp.ep, ec));
+            ++first;
+        }
+    }
+
+    m_send_batch.clear();
+    m_send_batch_buf.clear();
+
+    // the callback may send again, so it's called when the batch is done
+    for (std::vector<std::pair<udp::endpoint, error_code> >::const_iterator i = failed.begin();
+         i != failed.end(); ++i)
+    {
+        if (!m_callback || m_abort) break;
+        LIBED2K_TRY {
+            m_callback(i->second, i->first, 0, 0);
+        } LIBED2K_CATCH (std::exception&) {}
+    }
+}
+#endif // LIBED2K_USE_MMSG
+
 void udp_socket::wrap(udp::endpoint const& ep, char const* p, int len, error_code& ec)
 {
     CHECK_MAGIC;
@@ -0,0 +1,594 @@
+/**
+  * loopback swarm benchmark
+  *
+  * starts in-process ed2k server, seeding and downloading sessions on 127.0.0.1,
+  * downloads generated files and prints results as JSON to stdout:
+  * bench [--seeds N] [--downloaders M] [--files K] [--size MB] [--port P] [--timeout S] [--dir PATH] [--keep]
+ */
+
+#include <algorithm>
+#include <cstdlib>
+#include <ctime>
+#include <deque>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <boost/asio.hpp>
+#include <boost/bind.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/enable_shared_from_this.hpp>
+#include <boost/thread.hpp>
+#include <boost/iostreams/device/array.hpp>
+#include <boost/iostreams/stream_buffer.hpp>
+#include <boost/lexical_cast.hpp>
+
+#include "libed2k/config.hpp"
+
+#ifndef LIBED2K_WINDOWS
+#include <sys/resource.h>
+#endif
+
+#include "libed2k/session.hpp"
+#include "libed2k/session_settings.hpp"
+#include "libed2k/session_status.hpp"
+#include "libed2k/disk_io_thread.hpp"
+#include "libed2k/alert_types.hpp"
+#include "libed2k/add_transfer_params.hpp"
+#include "libed2k/file.hpp"
+#include "libed2k/filesystem.hpp"
+#include "libed2k/packet_struct.hpp"
+#include "libed2k/archive.hpp"
+#include "libed2k/io_service.hpp"
+#include "libed2k/server_connection.hpp"
+#include "libed2k/transfer_handle.hpp"
+#include "libed2k/util.hpp"
+#include "libed2k/time.hpp"
+
+using namespace libed2k;
+
+struct bench_config
+{
+    bench_config() : seeds(2), downloaders(2), files(1), size_mb(32), port(24662), timeout(300), keep(false), dir("bench_data") {}
+    int seeds;
+    int downloaders;
+    int files;
+    int size_mb;
+    int port;
+    int timeout;
+    bool keep;
+    std::string dir;
+};
+
+class server_client;
+
+/**
+  * minimal ed2k server: gives HighID on login, remembers offered files
+  * and answers sources requests with all clients offered the file
+ */
+class fake_server
+{
+public:
+    fake_server() : m_acceptor(m_io), m_offers(0) {}
+
+    unsigned short start();
+    void stop();
+
+    // number of file offers received from clients
+    int offers() const
+    {
+        boost::mutex::scoped_lock l(m_mutex);
+        return m_offers;
+    }
+
+    io_service& io() { return m_io; }
+
+    void add_source(const md4_hash& hash, const net_identifier& src)
+    {
+        boost::mutex::scoped_lock l(m_mutex);
+        std::vector<net_identifier>& v = m_files[hash];
+        if (std::find(v.begin(), v.end(), src) != v.end()) return;
+        v.push_back(src);
+        ++m_offers;
+    }
+
+    std::vector<net_identifier> sources(const md4_hash& hash, const net_identifier& except) const
+    {
+        boost::mutex::scoped_lock l(m_mutex);
+        std::vector<net_identifier> res;
+        std::map<md4_hash, std::vector<net_identifier> >::const_iterator itr = m_files.find(hash);
+        if (itr == m_files.end()) return res;
+
+        for (std::vector<net_identifier>::const_iterator i = itr->second.begin(); i != itr->second.end(); ++i)
+        {
+            if (*i != except) res.push_back(*i);
+        }
+
+        return res;
+    }
+
+private:
+    void accept();
+    void on_accept(const error_code& ec, boost::shared_ptr<server_client> c);
+
+    io_service      m_io;
+    tcp::acceptor   m_acceptor;
+    boost::shared_ptr<boost::thread> m_thread;
+
+    mutable boost::mutex m_mutex;
+    std::map<md4_hash, std::vector<net_identifier> > m_files;
+    int m_offers;
+};
+
+class server_client : public boost::enable_shared_from_this<server_client>
+{
+public:
+    server_client(fake_server& srv) : m_server(srv), m_socket(srv.io()), m_client_id(0) {}
+
+    tcp::socket& socket() { return m_socket; }
+    void start() { read_header(); }
+
+private:
+    void read_header()
+    {
+        boost::asio::async_read(m_socket, boost::asio::buffer(&m_header, sizeof(m_header)),
+            boost::bind(&server_client::on_header, shared_from_this(), boost::asio::placeholders::error));
+    }
+
+    void on_header(const error_code& error)
+    {
+        if (error || m_header.check_packet()) return;
+        m_body.resize(m_header.body_size());
+
+        if (m_body.empty())
+        {
+            read_header();
+            return;
+        }
+
+        boost::asio::async_read(m_socket, boost::asio::buffer(&m_body[0], m_body.size()),
+            boost::bind(&server_client::on_body, shared_from_this(), boost::asio::placeholders::error));
+    }
+
+    void on_body(const error_code& error)
+    {
+        if (error) return;
+
+        // clients don't compress packets to server without compression flag
+        if (m_header.m_protocol == OP_EDONKEYPROT)
+        {
+            try
+            {
+                dispatch();
+            }
+            catch(libed2k_exception& e)
+            {
+                std::cerr << "server: bad packet " << int(m_header.m_type) << ": " << e.what() << std::endl;
+                return;
+            }
+        }
+
+        read_header();
+    }
+
+    void dispatch()
+    {
+        typedef boost::iostreams::basic_array_source<char> Device;
+        boost::iostreams::stream_buffer<Device> buffer(&m_body[0], m_body.size());
+        std::istream in_array_stream(&buffer);
+        archive::ed2k_iarchive ia(in_array_stream);
+
+        switch(m_header.m_type)
+        {
+            case OP_LOGINREQUEST:
+            {
+                cs_login_request login;
+                ia >> login;
+                error_code ec;
+                tcp::endpoint remote = m_socket.remote_endpoint(ec);
+                if (ec) return;
+                m_client_id = address2int(remote.address());
+                m_self = net_identifier(tcp::endpoint(remote.address(), login.m_network_point.m_nPort));
+
+                id_change idc;
+                idc.m_client_id = m_client_id;
+                write(idc);
+                break;
+            }
+            case OP_OFFERFILES:
+            {
+                shared_files_list offer;
+                ia >> offer;
+
+                for (std::vector<shared_file_entry>::const_iterator i = offer.m_collection.begin();
+                     i != offer.m_collection.end(); ++i)
+                    m_server.add_source(i->m_hFile, m_self);
+                break;
+            }
+            case OP_GETSOURCES:
+            {
+                get_file_sources gfs;
+                gfs.m_file_size.nQuadPart = 0;
+                ia >> gfs;
+
+                found_file_sources fs;
+                fs.m_hFile = gfs.m_hFile;
+                fs.m_sources.m_collection = m_server.sources(gfs.m_hFile, m_self);
+                fs.m_sources.m_size = static_cast<boost::uint8_t>(std::min<size_t>(fs.m_sources.m_collection.size(), 0xFF));
+                fs.m_sources.m_collection.resize(fs.m_sources.m_size);
+                write(fs);
+                break;
+            }
+            default:
+                break;
+        }
+    }
+
+    template<typename T>
+    void write(const T& t)
+    {
+        message msg = make_message(t);
+        m_write_queue.push_back(std::string(reinterpret_cast<const char*>(&msg.first), sizeof(msg.first)) + msg.second);
+        if (m_write_queue.size() == 1) do_write();
+    }
+
+    void do_write()
+    {
+        boost::asio::async_write(m_socket, boost::asio::buffer(m_write_queue.front()),
+            boost::bind(&server_client::on_write, shared_from_this(), boost::asio::placeholders::error));
+    }
+
+    void on_write(const error_code& error)
+    {
+        if (error) return;
+        m_write_queue.pop_front();
+        if (!m_write_queue.empty()) do_write();
+    }
+
+    fake_server&            m_server;
+    tcp::socket             m_socket;
+    libed2k_header          m_header;
+    std::vector<char>       m_body;
+    std::deque<std::string> m_write_queue;
+    boost::uint32_t         m_client_id;
+    net_identifier          m_self;
+};
+
+unsigned short fake_server::start()
+{
+    tcp::endpoint ep(ip::address::from_string("127.0.0.1"), 0);
+    m_acceptor.open(ep.protocol());
+    m_acceptor.set_option(tcp::acceptor::reuse_address(true));
+    m_acceptor.bind(ep);
+    m_acceptor.listen();
+    accept();
+    m_thread.reset(new boost::thread(boost::bind(&io_service::run, &m_io)));
+    return m_acceptor.local_endpoint().port();
+}
+
+void fake_server::stop()
+{
+    m_io.stop();
+    if (m_thread) m_thread->join();
+}
+
+void fake_server::accept()
+{
+    boost::shared_ptr<server_client> c(new server_client(*this));
+    m_acceptor.async_accept(c->socket(), boost::bind(&fake_server::on_accept, this, boost::asio::placeholders::error, c));
+}
+
+void fake_server::on_accept(const error_code& ec, boost::shared_ptr<server_client> c)
+{
+    if (ec) return;
+    c->start();
+    accept();
+}
+
+double cpu_seconds()
+{
+#ifdef LIBED2K_WINDOWS
+    return double(std::clock()) / CLOCKS_PER_SEC;
+#else
+    rusage ru;
+    getrusage(RUSAGE_SELF, &ru);
+    return ru.ru_utime.tv_sec + ru.ru_stime.tv_sec + (ru.ru_utime.tv_usec + ru.ru_stime.tv_usec) / 1000000.0;
+#endif
+}
+
+// incompressible pseudo random content, different for every file
+bool generate_file(const std::string& path, size_type size, boost::uint32_t seed)
+{
+    std::ofstream ofs(convert_to_native(path).c_str(), std::ios_base::binary);
+    std::vector<boost::uint32_t> buf(256 * 1024);
+    boost::uint32_t x = seed * 2654435761u + 1;
+
+    while (size > 0 && ofs)
+    {
+        for (std::vector<boost::uint32_t>::iterator i = buf.begin(); i != buf.end(); ++i)
+        {
+            x ^= x << 13;
+            x ^= x >> 17;
+            x ^= x << 5;
+            *i = x;
+        }
+
+        size_type n = std::min<size_type>(size, buf.size() * sizeof(boost::uint32_t));
+        ofs.write(reinterpret_cast<const char*>(&buf[0]), n);
+        size -= n;
+    }
+
+    return bool(ofs);
+}
+
+session_settings make_settings(const bench_config& cfg, int port, const std::string& name)
+{
+    session_settings settings;
+    settings.listen_port = port;
+    settings.client_name = name;
+    // every session must look like a different client
+    settings.user_agent = hasher(name.c_str(), int(name.size())).final();
+    settings.user_agent_str = settings.user_agent.toString();
+    settings.allow_multiple_connections_per_ip = true;
+    settings.unchoke_slots_limit = std::max(8, cfg.downloaders);
+    settings.alert_queue_size = 100000;
+    // ask server again soon, seeds may be announced after the first request
+    settings.server_source_reask_time = 1;
+    settings.server_source_request_delay = 0;
+    settings.max_source_reask_backoff = 2;
+    return settings;
+}
+
+void server_connect(session& ses, unsigned short port)
+{
+    ses.server_connect(server_connection_parameters("bench", "127.0.0.1", port, 10, 60, 60, 1, 200));
+}
+
+size_type percentile(const std::vector<size_type>& sorted, int p)
+{
+    if (sorted.empty()) return 0;
+    return sorted[std::min(sorted.size() - 1, sorted.size() * p / 100)];
+}
+
+// buffers taken from the slab allocators of the network and disk buffer pools,
+// always 0 when built with LIBED2K_DISABLE_POOL_ALLOCATOR
+size_type total_slab_allocations(const std::vector<boost::shared_ptr<session> >& sessions)
+{
+    size_type res = 0;
+
+    for (std::vector<boost::shared_ptr<session> >::const_iterator i = sessions.begin(); i != sessions.end(); ++i)
+    {
+        res += (*i)->status().network_buffers.allocations;
+        res += (*i)->get_cache_status().buffers.allocations;
+    }
+
+    return res;
+}
+
+bool parse_args(int argc, char* argv[], bench_config& cfg)
+{
+    for (int i = 1; i < argc; ++i)
+    {
+        std::string arg = argv[i];
+
+        if (arg == "--keep")
+        {
+            cfg.keep = true;
+            continue;
+        }
+
+        if (i + 1 >= argc) return false;
+        std::string value = argv[++i];
+
+        if (arg == "--dir") cfg.dir = value;
+        else if (arg == "--seeds") cfg.seeds = std::atoi(value.c_str());
+        else if (arg == "--downloaders") cfg.downloaders = std::atoi(value.c_str());
+        else if (arg == "--files") cfg.files = std::atoi(value.c_str());
+        else if (arg == "--size") cfg.size_mb = std::atoi(value.c_str());
+        else if (arg == "--port") cfg.port = std::atoi(value.c_str());
+        else if (arg == "--timeout") cfg.timeout = std::atoi(value.c_str());
+        else return false;
+    }
+
+    return cfg.seeds > 0 && cfg.downloaders > 0 && cfg.files > 0 && cfg.size_mb > 0 && cfg.port > 0;
+}
+
+int main(int argc, char* argv[])
+{
+    bench_config cfg;
+
+    if (!parse_args(argc, argv, cfg))
+    {
+        std::cerr << "usage: " << argv[0] << " [--seeds N] [--downloaders M] [--files K] [--size MB]"
+            " [--port P] [--timeout S] [--dir PATH] [--keep]" << std::endl;
+        return 1;
+    }
+
+    error_code ec;
+    const size_type file_size = size_type(cfg.size_mb) * 1024 * 1024;
+    const std::string seed_dir = combine_path(cfg.dir, "seed");
+    create_directories(seed_dir, ec);
+
+    if (ec)
+    {
+        std::cerr << "can't create " << seed_dir << ": " << ec.message() << std::endl;
+        return 1;
+    }
+
+    // --------------------------------------------------------------
+    // files and their hashes
+    // --------------------------------------------------------------
+    std::vector<add_transfer_params> files;
+
+    for (int i = 0; i < cfg.files; ++i)
+    {
+        std::string path = combine_path(seed_dir, "file" + boost::lexical_cast<std::string>(i) + ".dat");
+
+        if (!generate_file(path, file_size, i))
+        {
+            std::cerr << "can't write " << path << std::endl;
+            return 1;
+        }
+
+        std::pair<add_transfer_params, error_code> res = file2atp()(path, false);
+
+        if (res.second)
+        {
+            std::cerr << "can't hash " << path << ": " << res.second.message() << std::endl;
+            return 1;
+        }
+
+        files.push_back(res.first);
+    }
+
+    fake_server server;
+    unsigned short server_port = server.start();
+
+    // --------------------------------------------------------------
+    // seeds announce files and the swarm is ready
+    // --------------------------------------------------------------
+    std::vector<boost::shared_ptr<session> > seeds;
+    std::vector<boost::shared_ptr<session> > downloaders;
+    fingerprint print;
+
+    for (int i = 0; i < cfg.seeds; ++i)
+    {
+        boost::shared_ptr<session> ses(new session(print, "127.0.0.1",
+            make_settings(cfg, cfg.port + i, "bench-seed-" + boost::lexical_cast<std::string>(i))));
+
+        for (std::vector<add_transfer_params>::const_iterator f = files.begin(); f != files.end(); ++f)
+            ses->add_transfer(*f);
+
+        server_connect(*ses, server_port);
+        seeds.push_back(ses);
+    }
+
+    ptime deadline = time_now() + seconds(cfg.timeout);
+
+    while (server.offers() < cfg.seeds * cfg.files && time_now() < deadline)
+        boost::this_thread::sleep(boost::posix_time::milliseconds(20));
+
+    if (server.offers() < cfg.seeds * cfg.files)
+    {
+        std::cerr << "seeds were not announced in time" << std::endl;
+        return 1;
+    }
+
+    // --------------------------------------------------------------
+    // measured part: downloaders start and fetch all files
+    // --------------------------------------------------------------
+    size_type allocations_base = total_slab_allocations(seeds);
+    double cpu_base = cpu_seconds();
+    ptime start = time_now_hires();
+
+    for (int i = 0; i < cfg.downloaders; ++i)
+    {
+        std::string name = "bench-down-" + boost::lexical_cast<std::string>(i);
+        std::string dir = combine_path(cfg.dir, name);
+        create_directories(dir, ec);
+
+        boost::shared_ptr<session> ses(new session(print, "127.0.0.1",
+            make_settings(cfg, cfg.port + cfg.seeds + i, name)));
+        ses->set_alert_mask(alert::progress_notification | alert::status_notification);
+
+        for (std::vector<add_transfer_params>::const_iterator f = files.begin(); f != files.end(); ++f)
+        {
+            add_transfer_params atp = *f;
+            atp.file_path = combine_path(dir, filename(f->file_path));
+            atp.seed_mode = false;
+            ses->add_transfer(atp);
+        }
+
+        server_connect(*ses, server_port);
+        downloaders.push_back(ses);
+    }
+
+    const int expected = cfg.downloaders * cfg.files;
+    int finished = 0;
+    std::vector<size_type> latencies;
+    size_type queue_samples = 0;
+    size_type queue_sum = 0;
+    int queue_max = 0;
+    deadline = time_now() + seconds(cfg.timeout);
+
+    while (finished < expected && time_now() < deadline)
+    {
+        boost::this_thread::sleep(boost::posix_time::milliseconds(20));
+
+        for (std::vector<boost::shared_ptr<session> >::iterator i = downloaders.begin(); i != downloaders.end(); ++i)
+        {
+            std::auto_ptr<alert> a = (*i)->pop_alert();
+
+            while (a.get())
+            {
+                if (block_finished_alert* p = dynamic_cast<block_finished_alert*>(a.get()))
+                    latencies.push_back(total_microseconds(p->latency));
+                else if (dynamic_cast<finished_transfer_alert*>(a.get()))
+                    ++finished;
+
+                a = (*i)->pop_alert();
+            }
+        }
+
+        int depth = 0;
+
+        for (std::vector<boost::shared_ptr<session> >::iterator i = seeds.begin(); i != seeds.end(); ++i)
+            depth += (*i)->get_cache_status().job_queue_length;
+        for (std::vector<boost::shared_ptr<session> >::iterator i = downloaders.begin(); i != downloaders.end(); ++i)
+            depth += (*i)->get_cache_status().job_queue_length;
+
+        queue_sum += depth;
+        queue_max = std::max(queue_max, depth);
+        ++queue_samples;
+    }
+
+    double elapsed = total_microseconds(time_now_hires() - start) / 1000000.0;
+    double cpu = cpu_seconds() - cpu_base;
+    size_type bytes = 0;
+
+    for (std::vector<boost::shared_ptr<session> >::iterator i = downloaders.begin(); i != downloaders.end(); ++i)
+        bytes += (*i)->status().total_payload_download;
+
+    std::vector<boost::shared_ptr<session> > all(seeds);
+    all.insert(all.end(), downloaders.begin(), downloaders.end());
+    size_type allocations = total_slab_allocations(all) - allocations_base;
+
+    std::sort(latencies.begin(), latencies.end());
+    double mib = bytes / (1024.0 * 1024.0);
+
+    std::cout << "{" << std::endl
+        << "  \"seeds\": " << cfg.seeds << "," << std::endl
+        << "  \"downloaders\": " << cfg.downloaders << "," << std::endl
+        << "  \"files\": " << cfg.files << "," << std::endl
+        << "  \"file_size\": " << file_size << "," << std::endl
+        << "  \"completed\": " << finished << "," << std::endl
+        << "  \"expected\": " << expected << "," << std::endl
+        << "  \"timed_out\": " << (finished < expected ? "true" : "false") << "," << std::endl
+        << "  \"elapsed_s\": " << elapsed << "," << std::endl
+        << "  \"bytes\": " << bytes << "," << std::endl
+        << "  \"throughput_mib_s\": " << (elapsed > 0 ? mib / elapsed : 0) << "," << std::endl
+        << "  \"cpu_s\": " << cpu << "," << std::endl
+        << "  \"cpu_ms_per_mib\": " << (mib > 0 ? cpu * 1000 / mib : 0) << "," << std::endl
+        << "  \"block_latency_ms\": {"
+        << "\"samples\": " << latencies.size()
+        << ", \"p50\": " << percentile(latencies, 50) / 1000.0
+        << ", \"p99\": " << percentile(latencies, 99) / 1000.0
+        << ", \"max\": " << (latencies.empty() ? 0 : latencies.back() / 1000.0) << "}," << std::endl
+        << "  \"disk_queue_depth\": {"
+        << "\"avg\": " << (queue_samples > 0 ? double(queue_sum) / queue_samples : 0)
+        << ", \"max\": " << queue_max << "}," << std::endl
+        << "  \"slab_allocations\": " << allocations << "," << std::endl
+        << "  \"slab_allocations_per_mib\": " << (mib > 0 ? allocations / mib : 0) << std::endl
+        << "}" << std::endl;
+
+    downloaders.clear();
+    seeds.clear();
+    server.stop();
+
+    if (!cfg.keep) remove_all(cfg.dir, ec);
+
+    return finished < expected ? 2 : 0;
+}
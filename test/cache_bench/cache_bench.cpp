@@ -0,0 +1,328 @@
+/**
+  * read cache trace replay benchmark
+  *
+  * replays block read requests through the disk thread read cache with LRU and with
+  * ARC replacement and prints hit rates as JSON to stdout. The requests are served from
+  * sparse files created in the data directory. The trace is read from file, one
+  * "<file> <piece> <block>" request per line, or generated: peers reading a hot set of
+  * pieces mixed with one peer reading a large file sequentially
+  * cache_bench [--trace FILE] [--cache MB] [--line BLOCKS] [--requests N] [--hot-pieces N]
+  *             [--scan-size MB] [--scan-share PERCENT] [--seed N] [--dir PATH] [--keep]
+ */
+
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <string>
+#include <vector>
+
+#include <boost/bind.hpp>
+#include <boost/function.hpp>
+#include <boost/intrusive_ptr.hpp>
+#include <boost/lexical_cast.hpp>
+#include <boost/shared_ptr.hpp>
+
+#include "libed2k/constants.hpp"
+#include "libed2k/disk_io_thread.hpp"
+#include "libed2k/file_pool.hpp"
+#include "libed2k/filesystem.hpp"
+#include "libed2k/io_service.hpp"
+#include "libed2k/peer_request.hpp"
+#include "libed2k/session_settings.hpp"
+#include "libed2k/storage.hpp"
+#include "libed2k/transfer_info.hpp"
+
+using namespace libed2k;
+
+struct bench_config
+{
+    bench_config() : cache_mb(64), line(2), requests(200000), hot_pieces(8),
+        scan_mb(4096), scan_share(25), seed(1), dir("cache_bench_data"), keep(false) {}
+    std::string trace;
+    int cache_mb;
+    int line;
+    int requests;
+    int hot_pieces;
+    int scan_mb;
+    int scan_share;
+    int seed;
+    std::string dir;
+    bool keep;
+};
+
+struct request
+{
+    int file;
+    int piece;
+    int block;
+};
+
+const int blocks_per_piece = int((PIECE_SIZE + BLOCK_SIZE - 1) / BLOCK_SIZE);
+
+std::string file_name(int file)
+{
+    return "file" + boost::lexical_cast<std::string>(file) + ".dat";
+}
+
+/**
+  * disk thread with a storage per trace file, each read waits for its
+  * completion so the cache sees the requests in trace order
+ */
+class cache_run
+{
+public:
+    cache_run(const bench_config& cfg, const std::vector<size_type>& sizes
+        , session_settings::disk_cache_algo_t algorithm)
+        : m_disk(m_ios, &cache_run::on_queue, m_files)
+        , m_owner(new int(0)), m_line(cfg.line), m_done(false), m_errors(0)
+    {
+        session_settings* s = new session_settings;
+        s->cache_size = int(size_type(cfg.cache_mb) * 1024 * 1024 / BLOCK_SIZE);
+        s->cache_expiry = 24*60*60;
+        s->read_cache_line_size = cfg.line;
+        s->use_read_cache = true;
+        s->explicit_read_cache = false;
+        s->volatile_read_cache = false;
+        s->disk_cache_algorithm = algorithm;
+
+        disk_io_job j;
+        j.buffer = (char*)s;
+        j.action = disk_io_job::update_settings;
+        m_disk.add_job(j);
+
+        std::vector<boost::uint8_t> prio(1, 1);
+
+        for (size_t i = 0; i < sizes.size(); ++i)
+        {
+            boost::intrusive_ptr<transfer_info> info(
+                new transfer_info(md4_hash::invalid, file_name(int(i)), sizes[i]));
+            m_storages.push_back(new piece_manager(m_owner, info, cfg.dir, m_files
+                , m_disk, default_storage_constructor, storage_mode_sparse, prio));
+        }
+    }
+
+    ~cache_run()
+    {
+        m_disk.abort();
+        m_disk.join();
+        m_storages.clear();
+    }
+
+    void read(const request& r)
+    {
+        piece_manager& pm = *m_storages[r.file];
+        int start = r.block * BLOCK_SIZE;
+        int piece_size = pm.info()->piece_size(r.piece);
+        if (start >= piece_size) return;
+
+        peer_request req(r.piece, start, (std::min)(int(BLOCK_SIZE), piece_size - start));
+        m_done = false;
+        pm.async_read(req, boost::bind(&cache_run::on_read, this, _1, _2), m_line, 24*60*60);
+        while (!m_done) m_ios.run_one();
+    }
+
+    void print(std::ostream& os, int requests) const
+    {
+        cache_status st = m_disk.status();
+        os << "{ \"hit_rate\": " << (requests ? double(st.blocks_read_hit) / requests : 0)
+            << ", \"hits\": " << st.blocks_read_hit
+            << ", \"hits_recent\": " << st.blocks_read_hit_recent
+            << ", \"hits_frequent\": " << st.blocks_read_hit_frequent
+            << ", \"disk_reads\": " << st.reads
+            << ", \"errors\": " << m_errors;
+        if (st.ghost_hits_recent + st.ghost_hits_frequent > 0 || st.arc_target > 0)
+            os << ", \"ghost_hits\": " << st.ghost_hits_recent + st.ghost_hits_frequent
+                << ", \"arc_target\": " << st.arc_target;
+        os << " }";
+    }
+
+private:
+    static void on_queue() {}
+
+    void on_read(int ret, disk_io_job const& j)
+    {
+        if (j.buffer) m_disk.free_buffer(j.buffer);
+        if (ret < 0) ++m_errors;
+        m_done = true;
+    }
+
+    io_service m_ios;
+    file_pool m_files;
+    disk_io_thread m_disk;
+    boost::shared_ptr<void> m_owner;
+    std::vector<boost::intrusive_ptr<piece_manager> > m_storages;
+    int m_line;
+    bool m_done;
+    int m_errors;
+};
+
+bool load_trace(const std::string& path, std::vector<request>& trace)
+{
+    std::ifstream in(path.c_str());
+    if (!in) return false;
+
+    std::map<std::string, int> files;
+    std::string file;
+    request r;
+
+    while (in >> file >> r.piece >> r.block)
+    {
+        if (r.piece < 0 || r.block < 0 || r.block >= blocks_per_piece) continue;
+        std::map<std::string, int>::iterator i = files.insert(std::make_pair(file, int(files.size()))).first;
+        r.file = i->second;
+        trace.push_back(r);
+    }
+
+    return true;
+}
+
+void generate_trace(const bench_config& cfg, std::vector<request>& trace)
+{
+    std::srand(cfg.seed);
+    int scan_blocks = int(size_type(cfg.scan_mb) * 1024 * 1024 / BLOCK_SIZE);
+    int scan_pos = 0;
+
+    for (int n = 0; n < cfg.requests; ++n)
+    {
+        request r;
+
+        if (std::rand() % 100 < cfg.scan_share)
+        {
+            // the sequential reader restarts at the beginning of its file
+            r.file = 0;
+            r.piece = scan_pos / blocks_per_piece;
+            r.block = scan_pos % blocks_per_piece;
+            scan_pos = (scan_pos + 1) % scan_blocks;
+        }
+        else
+        {
+            // skewed popularity of the hot pieces, spread over a few files
+            double x = double(std::rand()) / RAND_MAX;
+            int hot = (std::min)(int(x * x * cfg.hot_pieces), cfg.hot_pieces - 1);
+            r.file = 1 + hot % 4;
+            r.piece = hot / 4;
+            r.block = std::rand() % blocks_per_piece;
+        }
+
+        trace.push_back(r);
+    }
+}
+
+/** creates sparse files covering the pieces the trace reads */
+bool create_files(const bench_config& cfg, const std::vector<request>& trace, std::vector<size_type>& sizes)
+{
+    for (std::vector<request>::const_iterator i = trace.begin(); i != trace.end(); ++i)
+    {
+        if (i->file >= int(sizes.size())) sizes.resize(i->file + 1, 0);
+        sizes[i->file] = (std::max)(sizes[i->file], (i->piece + 1) * PIECE_SIZE);
+    }
+
+    error_code ec;
+    create_directories(cfg.dir, ec);
+    if (ec) return false;
+
+    for (size_t n = 0; n < sizes.size(); ++n)
+    {
+        // files the trace doesn't read still need a piece for their storage
+        if (sizes[n] == 0) sizes[n] = PIECE_SIZE;
+        file f(combine_path(cfg.dir, file_name(int(n))), file::read_write | file::sparse, ec);
+        if (ec || !f.set_size(sizes[n], ec)) return false;
+    }
+
+    return true;
+}
+
+bool parse_args(int argc, char* argv[], bench_config& cfg)
+{
+    for (int i = 1; i < argc; ++i)
+    {
+        std::string arg = argv[i];
+
+        if (arg == "--keep")
+        {
+            cfg.keep = true;
+            continue;
+        }
+
+        if (i + 1 >= argc) return false;
+        std::string value = argv[++i];
+
+        if (arg == "--trace") cfg.trace = value;
+        else if (arg == "--cache") cfg.cache_mb = std::atoi(value.c_str());
+        else if (arg == "--line") cfg.line = std::atoi(value.c_str());
+        else if (arg == "--requests") cfg.requests = std::atoi(value.c_str());
+        else if (arg == "--hot-pieces") cfg.hot_pieces = std::atoi(value.c_str());
+        else if (arg == "--scan-size") cfg.scan_mb = std::atoi(value.c_str());
+        else if (arg == "--scan-share") cfg.scan_share = std::atoi(value.c_str());
+        else if (arg == "--seed") cfg.seed = std::atoi(value.c_str());
+        else if (arg == "--dir") cfg.dir = value;
+        else return false;
+    }
+
+    return cfg.cache_mb > 0 && cfg.line > 0 && cfg.requests > 0 && cfg.hot_pieces > 0
+        && cfg.scan_mb > 0 && cfg.scan_share >= 0 && cfg.scan_share <= 100;
+}
+
+int main(int argc, char* argv[])
+{
+    bench_config cfg;
+
+    if (!parse_args(argc, argv, cfg))
+    {
+        std::cerr << "usage: " << argv[0] << " [--trace FILE] [--cache MB] [--line BLOCKS] [--requests N]"
+            " [--hot-pieces N] [--scan-size MB] [--scan-share PERCENT] [--seed N] [--dir PATH] [--keep]" << std::endl;
+        return 1;
+    }
+
+    std::vector<request> trace;
+
+    if (!cfg.trace.empty())
+    {
+        if (!load_trace(cfg.trace, trace))
+        {
+            std::cerr << "can't read " << cfg.trace << std::endl;
+            return 1;
+        }
+    }
+    else
+    {
+        generate_trace(cfg, trace);
+    }
+
+    std::vector<size_type> sizes;
+
+    if (!create_files(cfg, trace, sizes))
+    {
+        std::cerr << "can't create files in " << cfg.dir << std::endl;
+        return 1;
+    }
+
+    int requests = int(trace.size());
+    std::cout << "{" << std::endl
+        << "  \"requests\": " << requests << "," << std::endl
+        << "  \"cache_blocks\": " << int(size_type(cfg.cache_mb) * 1024 * 1024 / BLOCK_SIZE) << "," << std::endl;
+
+    {
+        cache_run lru(cfg, sizes, session_settings::lru);
+        for (std::vector<request>::const_iterator i = trace.begin(); i != trace.end(); ++i) lru.read(*i);
+        std::cout << "  \"lru\": ";
+        lru.print(std::cout, requests);
+        std::cout << "," << std::endl;
+    }
+
+    {
+        cache_run arc(cfg, sizes, session_settings::arc);
+        for (std::vector<request>::const_iterator i = trace.begin(); i != trace.end(); ++i) arc.read(*i);
+        std::cout << "  \"arc\": ";
+        arc.print(std::cout, requests);
+        std::cout << std::endl;
+    }
+
+    std::cout << "}" << std::endl;
+
+    error_code ec;
+    if (!cfg.keep) remove_all(cfg.dir, ec);
+
+    return 0;
+}
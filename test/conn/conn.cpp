@@ -252,9 +252,9 @@ void alerts_reader(const boost::system::error_code& ec, boost::asio::deadline_ti
         else if (shared_files_alert* p = dynamic_cast<shared_files_alert*>(a.get()))
         {
             boost::mutex::scoped_lock l(m_sf_mutex);
-            DBG("ALERT: RESULT: " << p->m_files.m_collection.size());
+            DBG("ALERT: RESULT: " << p->m_files->m_collection.size());
             vSF.clear();
-            vSF = p->m_files;
+            vSF = *p->m_files;
 
             boost::uint64_t nSize = 0;
 
@@ -0,0 +1,134 @@
+/**
+  * kad rpc transaction table benchmark
+  *
+  * sends N pings through the rpc manager of a kad node (packets are dropped),
+  * then matches pong replies for them in random order, reports some endpoints
+  * unreachable and runs the timeout tick. Prints nanoseconds per operation as JSON:
+  * rpc_bench [--rpcs N] [--seed N]
+ */
+
+#include <algorithm>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include <boost/asio.hpp>
+
+#include "libed2k/alert.hpp"
+#include "libed2k/session_settings.hpp"
+#include "libed2k/time.hpp"
+#include "libed2k/kademlia/node.hpp"
+#include "libed2k/kademlia/rpc_manager.hpp"
+#include "libed2k/kademlia/traversal_algorithm.hpp"
+
+using namespace libed2k;
+using namespace libed2k::dht;
+
+namespace
+{
+    int packets_sent = 0;
+
+    bool send_fun(void*, const udp_message&, udp::endpoint const&, int)
+    {
+        ++packets_sent;
+        return true;
+    }
+
+    struct bench_algorithm : traversal_algorithm
+    {
+        bench_algorithm(node_impl& node) : traversal_algorithm(node, node_id()) {}
+        virtual char const* name() const { return "rpc_bench"; }
+    };
+
+    udp::endpoint node_endpoint(int i)
+    {
+        return udp::endpoint(address_v4(0x0a000000 + i), boost::uint16_t(4672 + i % 1000));
+    }
+
+    double ns_per_op(ptime start, ptime end, int ops)
+    {
+        return ops ? double(total_microseconds(end - start)) * 1000 / ops : 0;
+    }
+}
+
+int main(int argc, char* argv[])
+{
+    int rpcs = 10000;
+    int seed = 1;
+
+    for (int i = 1; i < argc; ++i)
+    {
+        std::string arg = argv[i];
+        if (i + 1 < argc && arg == "--rpcs") rpcs = std::atoi(argv[++i]);
+        else if (i + 1 < argc && arg == "--seed") seed = std::atoi(argv[++i]);
+        else
+        {
+            std::cerr << "usage: " << argv[0] << " [--rpcs N] [--seed N]" << std::endl;
+            return 1;
+        }
+    }
+
+    if (rpcs <= 0) return 1;
+    std::srand(seed);
+
+    io_service ios;
+    alert_manager alerts(ios);
+    dht_settings settings;
+    node_impl node(alerts, &send_fun, settings, generate_random_id()
+        , address_v4::loopback(), 4661, node_impl::external_ip_fun(), 0);
+    boost::intrusive_ptr<traversal_algorithm> algo(new bench_algorithm(node));
+
+    std::vector<udp::endpoint> endpoints;
+    for (int i = 0; i < rpcs; ++i) endpoints.push_back(node_endpoint(i));
+
+    ptime start = time_now_hires();
+    for (int i = 0; i < rpcs; ++i)
+    {
+        void* ptr = node.m_rpc.allocate_observer();
+        if (ptr == 0) break;
+        observer_ptr o(new (ptr) null_observer(algo, endpoints[i], generate_random_id()));
+#if defined LIBED2K_DEBUG || LIBED2K_RELEASE_ASSERTS
+        o->m_in_constructor = false;
+#endif
+        kad2_ping ping;
+        node.m_rpc.invoke(ping, endpoints[i], o);
+    }
+    ptime invoked = time_now_hires();
+
+    // replies arrive in random order, half of the rpcs get one
+    std::random_shuffle(endpoints.begin(), endpoints.end());
+    int replies = rpcs / 2;
+    int matched = 0;
+    kad2_pong pong;
+    pong.udp_port = 4665;
+    for (int i = 0; i < replies; ++i)
+    {
+        node_id id = node_id::invalid;
+        node.m_rpc.incoming(pong, endpoints[i], &id);
+        if (id != node_id::invalid) ++matched;
+    }
+    ptime replied = time_now_hires();
+
+    // a quarter of the nodes is unreachable
+    int unreachable = rpcs / 4;
+    for (int i = replies; i < replies + unreachable; ++i)
+        node.m_rpc.unreachable(endpoints[i]);
+    ptime unreached = time_now_hires();
+
+    const int ticks = 100;
+    for (int i = 0; i < ticks; ++i) node.m_rpc.tick();
+    ptime ticked = time_now_hires();
+
+    std::cout << "{" << std::endl
+        << "  \"rpcs\": " << rpcs << "," << std::endl
+        << "  \"sent\": " << packets_sent << "," << std::endl
+        << "  \"matched\": " << matched << "," << std::endl
+        << "  \"invoke_ns\": " << ns_per_op(start, invoked, rpcs) << "," << std::endl
+        << "  \"incoming_ns\": " << ns_per_op(invoked, replied, replies) << "," << std::endl
+        << "  \"unreachable_ns\": " << ns_per_op(replied, unreached, unreachable) << "," << std::endl
+        << "  \"tick_ns\": " << ns_per_op(unreached, ticked, ticks) << std::endl
+        << "}" << std::endl;
+
+    return 0;
+}
@@ -0,0 +1,206 @@
+/**
+  * upload path benchmark
+  *
+  * sends a file over a loopback tcp connection twice: the buffered way, reading
+  * 256KB blocks into memory and writing them to the socket, and with sendfile()
+  * where it is available. The file is read once before, so both runs are served
+  * from the page cache. Prints CPU time of the sending thread per MB as JSON:
+  * sendfile_bench [--size MB] [--file PATH]
+ */
+
+#include <cstdlib>
+#include <ctime>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include <boost/asio.hpp>
+#include <boost/bind.hpp>
+#include <boost/thread.hpp>
+
+#include "libed2k/address.hpp"
+#include "libed2k/constants.hpp"
+#include "libed2k/filesystem.hpp"
+#include "libed2k/io_service.hpp"
+#include "libed2k/socket.hpp"
+#include "libed2k/time.hpp"
+
+using namespace libed2k;
+
+namespace
+{
+    struct run_stats
+    {
+        run_stats() : bytes(0), cpu_us(0), wall_us(0) {}
+        size_type bytes;
+        boost::int64_t cpu_us;
+        boost::int64_t wall_us;
+    };
+
+    // CPU time of the calling thread
+    boost::int64_t thread_cpu_us()
+    {
+#ifdef CLOCK_THREAD_CPUTIME_ID
+        timespec ts;
+        clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+        return boost::int64_t(ts.tv_sec) * 1000000 + ts.tv_nsec / 1000;
+#else
+        return boost::int64_t(std::clock()) * 1000000 / CLOCKS_PER_SEC;
+#endif
+    }
+
+    void drain(tcp::acceptor* acceptor, size_type* received)
+    {
+        io_service ios;
+        tcp::socket sock(ios);
+        error_code ec;
+        acceptor->accept(sock, ec);
+        if (ec) return;
+
+        std::vector<char> buf(BLOCK_SIZE);
+        for (;;)
+        {
+            std::size_t n = sock.read_some(boost::asio::buffer(buf), ec);
+            if (ec) break;
+            *received += n;
+        }
+    }
+
+    bool send_buffered(file& f, tcp::socket& sock, size_type size, error_code& ec)
+    {
+        std::vector<char> block(BLOCK_SIZE);
+        for (size_type pos = 0; pos < size;)
+        {
+            file::iovec_t b = { &block[0], std::size_t(std::min(size - pos, BLOCK_SIZE)) };
+            size_type n = f.readv(pos, &b, 1, ec);
+            if (n <= 0) return false;
+            boost::asio::write(sock, boost::asio::buffer(&block[0], std::size_t(n)), ec);
+            if (ec) return false;
+            pos += n;
+        }
+        return true;
+    }
+
+#if LIBED2K_USE_SENDFILE
+    bool send_file(file& f, tcp::socket& sock, size_type size, error_code& ec)
+    {
+        for (size_type pos = 0; pos < size;)
+        {
+            size_type n = f.sendfile(sock.native_handle(), pos, std::min(size - pos, BLOCK_SIZE), ec);
+            if (n <= 0) return false;
+            pos += n;
+        }
+        return true;
+    }
+#endif
+
+    bool run(std::string const& path, size_type size, bool zero_copy, run_stats& st)
+    {
+        io_service ios;
+        error_code ec;
+        tcp::acceptor acceptor(ios, tcp::endpoint(address_v4::loopback(), 0));
+        size_type received = 0;
+        boost::thread receiver(boost::bind(&drain, &acceptor, &received));
+
+        tcp::socket sock(ios);
+        sock.connect(acceptor.local_endpoint(), ec);
+        file f(path, file::read_only, ec);
+        if (ec) return false;
+
+        ptime start = time_now_hires();
+        boost::int64_t cpu_start = thread_cpu_us();
+        bool ok = false;
+#if LIBED2K_USE_SENDFILE
+        if (zero_copy) ok = send_file(f, sock, size, ec);
+        else
+#endif
+        ok = send_buffered(f, sock, size, ec);
+        st.cpu_us = thread_cpu_us() - cpu_start;
+
+        sock.close(ec);
+        receiver.join();
+        st.wall_us = total_microseconds(time_now_hires() - start);
+        st.bytes = received;
+        return ok && received == size;
+    }
+
+    void print(std::ostream& os, run_stats const& st)
+    {
+        double mb = double(st.bytes) / (1024 * 1024);
+        os << "{ \"cpu_ms_per_mb\": " << (mb > 0 ? st.cpu_us / 1000.0 / mb : 0)
+            << ", \"mb_per_second\": " << (st.wall_us > 0 ? mb * 1000000 / st.wall_us : 0)
+            << " }";
+    }
+}
+
+int main(int argc, char* argv[])
+{
+    int size_mb = 256;
+    std::string path = "sendfile_bench.tmp";
+
+    for (int i = 1; i < argc; ++i)
+    {
+        std::string arg = argv[i];
+        if (i + 1 < argc && arg == "--size") size_mb = std::atoi(argv[++i]);
+        else if (i + 1 < argc && arg == "--file") path = argv[++i];
+        else
+        {
+            std::cerr << "usage: " << argv[0] << " [--size MB] [--file PATH]" << std::endl;
+            return 1;
+        }
+    }
+
+    if (size_mb <= 0) return 1;
+    size_type size = size_type(size_mb) * 1024 * 1024;
+
+    error_code ec;
+    {
+        file f(path, file::read_write, ec);
+        if (ec)
+        {
+            std::cerr << "can't open " << path << ": " << ec.message() << std::endl;
+            return 1;
+        }
+
+        std::vector<char> block(BLOCK_SIZE);
+        for (size_type pos = 0; pos < size && !ec; pos += BLOCK_SIZE)
+        {
+            for (std::size_t i = 0; i < block.size(); ++i) block[i] = char(std::rand());
+            file::iovec_t b = { &block[0], block.size() };
+            f.writev(pos, &b, 1, ec);
+        }
+
+        // warm the page cache, both runs should read from memory
+        for (size_type pos = 0; pos < size && !ec; pos += BLOCK_SIZE)
+        {
+            file::iovec_t b = { &block[0], block.size() };
+            f.readv(pos, &b, 1, ec);
+        }
+    }
+
+    run_stats buffered;
+    run_stats zero_copy;
+    bool ok = !ec && run(path, size, false, buffered);
+#if LIBED2K_USE_SENDFILE
+    ok = ok && run(path, size, true, zero_copy);
+#endif
+    remove(path, ec);
+
+    if (!ok)
+    {
+        std::cerr << "transfer failed" << std::endl;
+        return 1;
+    }
+
+    std::cout << "{" << std::endl
+        << "  \"size_mb\": " << size_mb << "," << std::endl
+        << "  \"buffered\": ";
+    print(std::cout, buffered);
+#if LIBED2K_USE_SENDFILE
+    std::cout << "," << std::endl << "  \"sendfile\": ";
+    print(std::cout, zero_copy);
+#endif
+    std::cout << std::endl << "}" << std::endl;
+
+    return 0;
+}
@@ -0,0 +1,147 @@
+/**
+  * udp receive flood benchmark
+  *
+  * a sender thread floods a udp_socket bound on 127.0.0.1 with kad sized datagrams,
+  * the socket callback counts them on the io_service thread. Prints received packets
+  * per second and the share of packets dropped by the kernel as JSON:
+  * udp_bench [--packets N] [--size BYTES] [--timeout S]
+ */
+
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include <boost/asio.hpp>
+#include <boost/bind.hpp>
+#include <boost/thread.hpp>
+
+#include "libed2k/address.hpp"
+#include "libed2k/connection_queue.hpp"
+#include "libed2k/deadline_timer.hpp"
+#include "libed2k/io_service.hpp"
+#include "libed2k/socket.hpp"
+#include "libed2k/time.hpp"
+#include "libed2k/udp_socket.hpp"
+
+using namespace libed2k;
+
+namespace
+{
+    struct flood_stats
+    {
+        flood_stats() : received(0), bytes(0), expected(0) {}
+        int received;
+        boost::uint64_t bytes;
+        int expected;
+        ptime first;
+        ptime last;
+    };
+
+    void on_receive(flood_stats* st, io_service* ios, error_code const& ec
+        , udp::endpoint const&, char const*, int size)
+    {
+        if (ec) return;
+        if (st->received == 0) st->first = time_now_hires();
+        ++st->received;
+        st->bytes += size;
+        st->last = time_now_hires();
+        if (st->received == st->expected) ios->stop();
+    }
+
+    void on_receive_hostname(error_code const&, char const*, char const*, int) {}
+
+    void flood(udp::endpoint target, int packets, int size)
+    {
+        io_service ios;
+        udp::socket sock(ios);
+        error_code ec;
+        sock.open(udp::v4(), ec);
+        if (ec) return;
+
+        std::vector<char> packet(size, 0);
+        packet[0] = char(0xe4); // OP_KADEMLIAHEADER
+
+        for (int i = 0; i < packets; ++i)
+        {
+            sock.send_to(boost::asio::buffer(packet), target, 0, ec);
+            // give the receiver a chance to keep up now and then, the socket
+            // buffer holds only a few hundred datagrams
+            if ((i & 255) == 255) boost::this_thread::yield();
+        }
+    }
+
+    void on_timeout(io_service* ios, error_code const& ec)
+    {
+        if (ec) return;
+        ios->stop();
+    }
+}
+
+int main(int argc, char* argv[])
+{
+    int packets = 200000;
+    int size = 100;
+    int timeout = 30;
+
+    for (int i = 1; i < argc; ++i)
+    {
+        std::string arg = argv[i];
+        if (i + 1 < argc && arg == "--packets") packets = std::atoi(argv[++i]);
+        else if (i + 1 < argc && arg == "--size") size = std::atoi(argv[++i]);
+        else if (i + 1 < argc && arg == "--timeout") timeout = std::atoi(argv[++i]);
+        else
+        {
+            std::cerr << "usage: " << argv[0] << " [--packets N] [--size BYTES] [--timeout S]" << std::endl;
+            return 1;
+        }
+    }
+
+    if (packets <= 0 || size <= 0 || size > 1500 || timeout <= 0) return 1;
+
+    io_service ios;
+    connection_queue cq(ios);
+    flood_stats st;
+    st.expected = packets;
+
+    udp_socket sock(ios, boost::bind(&on_receive, &st, &ios, _1, _2, _3, _4)
+        , boost::bind(&on_receive_hostname, _1, _2, _3, _4), cq);
+
+    error_code ec;
+    sock.bind(udp::endpoint(address_v4::loopback(), 0), ec);
+    if (ec)
+    {
+        std::cerr << "bind: " << ec.message() << std::endl;
+        return 1;
+    }
+    sock.set_buf_size(2000);
+    sock.set_option(boost::asio::socket_base::receive_buffer_size(4 * 1024 * 1024), ec);
+
+    udp::endpoint target(address_v4::loopback(), boost::uint16_t(sock.local_port()));
+    if (target.port() == 0) target.port(sock.local_endpoint(ec).port());
+
+    deadline_timer timer(ios);
+    timer.expires_from_now(seconds(timeout), ec);
+    timer.async_wait(boost::bind(&on_timeout, &ios, _1));
+
+    boost::thread sender(boost::bind(&flood, target, packets, size));
+    ios.run();
+    sender.join();
+
+    sock.close();
+    timer.cancel(ec);
+    ios.reset();
+    ios.poll(ec);
+
+    double secs = st.received > 1 ? double(total_microseconds(st.last - st.first)) / 1000000 : 0;
+    std::cout << "{" << std::endl
+        << "  \"packets\": " << packets << "," << std::endl
+        << "  \"size\": " << size << "," << std::endl
+        << "  \"received\": " << st.received << "," << std::endl
+        << "  \"dropped_percent\": " << 100.0 * (packets - st.received) / packets << "," << std::endl
+        << "  \"packets_per_second\": " << (secs > 0 ? st.received / secs : 0) << "," << std::endl
+        << "  \"batched_receive\": " << (LIBED2K_USE_MMSG ? "true" : "false") << std::endl
+        << "}" << std::endl;
+
+    return 0;
+}
@@ -92,4 +92,23 @@ BOOST_AUTO_TEST_CASE(test_alerts)
     BOOST_CHECK(bGlobal);
 }
 
+BOOST_AUTO_TEST_CASE(test_shared_files_alert_clone)
+{
+    libed2k::io_service io;
+    libed2k::alert_manager al(io);
+    al.set_alert_mask(libed2k::alert::peer_notification);
+
+    boost::shared_ptr<libed2k::shared_files_list> files(new libed2k::shared_files_list);
+    files->add(libed2k::shared_file_entry(libed2k::md4_hash::terminal, 1, 2));
+    libed2k::shared_files_alert sfa(libed2k::net_identifier(), libed2k::md4_hash::invalid, files, false);
+    al.post_alert(sfa);
+
+    // the queued copy refers to the same list
+    std::auto_ptr<libed2k::alert> a = pop_alert(al);
+    libed2k::shared_files_alert* p = dynamic_cast<libed2k::shared_files_alert*>(a.get());
+    BOOST_REQUIRE(p);
+    BOOST_CHECK(p->m_files.get() == files.get());
+    BOOST_CHECK_EQUAL(p->m_files->m_collection.size(), 1u);
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,98 @@
+#ifndef WIN32
+#define BOOST_TEST_DYN_LINK
+#endif
+
+#ifdef STAND_ALONE
+#   define BOOST_TEST_MODULE Main
+#endif
+
+#include <boost/test/unit_test.hpp>
+
+#include "libed2k/arc_cache.hpp"
+
+namespace
+{
+    int storage1;
+    int storage2;
+
+    libed2k::arc_policy::key_type key(int piece, void* storage = &storage1)
+    {
+        return libed2k::arc_policy::key_type(storage, piece);
+    }
+}
+
+BOOST_AUTO_TEST_SUITE(test_arc_cache)
+
+BOOST_AUTO_TEST_CASE(test_arc_ghost_hits)
+{
+    libed2k::arc_policy arc;
+    arc.set_capacity(100);
+
+    arc.evicted(key(1), 10, libed2k::arc_policy::recent);
+    arc.evicted(key(2), 20, libed2k::arc_policy::frequent);
+    BOOST_CHECK_EQUAL(arc.ghost_size(libed2k::arc_policy::recent), 10);
+    BOOST_CHECK_EQUAL(arc.ghost_size(libed2k::arc_policy::frequent), 20);
+
+    // recent ghost hit grows the recent target by the ghost sizes ratio
+    BOOST_CHECK_EQUAL(arc.miss(key(1)), libed2k::arc_policy::recent);
+    BOOST_CHECK_EQUAL(arc.target(), 20);
+    BOOST_CHECK_EQUAL(arc.ghost_size(libed2k::arc_policy::recent), 0);
+    BOOST_CHECK_EQUAL(arc.miss(key(1)), libed2k::arc_policy::none);
+    BOOST_CHECK_EQUAL(arc.miss(key(3)), libed2k::arc_policy::none);
+
+    BOOST_CHECK_EQUAL(arc.miss(key(2)), libed2k::arc_policy::frequent);
+    BOOST_CHECK_EQUAL(arc.target(), 0);
+    BOOST_CHECK_EQUAL(arc.ghost_pieces(libed2k::arc_policy::frequent), 0U);
+
+    // target never exceeds the cache size
+    arc.evicted(key(4), 500, libed2k::arc_policy::recent);
+    arc.evicted(key(5), 50, libed2k::arc_policy::recent);
+    BOOST_CHECK_EQUAL(arc.miss(key(5)), libed2k::arc_policy::recent);
+    BOOST_CHECK_EQUAL(arc.target(), 50);
+    arc.evicted(key(6), 90, libed2k::arc_policy::recent);
+    BOOST_CHECK_EQUAL(arc.miss(key(6)), libed2k::arc_policy::recent);
+    BOOST_CHECK_EQUAL(arc.target(), 100);
+}
+
+BOOST_AUTO_TEST_CASE(test_arc_ghosts_bounded)
+{
+    libed2k::arc_policy arc;
+    arc.set_capacity(30);
+
+    for (int i = 0; i < 4; ++i) arc.evicted(key(i), 10, libed2k::arc_policy::recent);
+    BOOST_CHECK_EQUAL(arc.ghost_size(libed2k::arc_policy::recent), 30);
+    BOOST_CHECK_EQUAL(arc.ghost_pieces(libed2k::arc_policy::recent), 3U);
+    BOOST_CHECK_EQUAL(arc.miss(key(0)), libed2k::arc_policy::none);
+
+    // evicted again: moved to the tail instead of being duplicated
+    arc.evicted(key(1), 10, libed2k::arc_policy::recent);
+    arc.set_capacity(10);
+    BOOST_CHECK_EQUAL(arc.ghost_pieces(libed2k::arc_policy::recent), 1U);
+    BOOST_CHECK_EQUAL(arc.miss(key(2)), libed2k::arc_policy::none);
+    BOOST_CHECK_EQUAL(arc.miss(key(1)), libed2k::arc_policy::recent);
+}
+
+BOOST_AUTO_TEST_CASE(test_arc_replace_forget)
+{
+    libed2k::arc_policy arc;
+    arc.set_capacity(100);
+
+    BOOST_CHECK_EQUAL(arc.replace(0, 5), libed2k::arc_policy::frequent);
+    BOOST_CHECK_EQUAL(arc.replace(5, 0), libed2k::arc_policy::recent);
+    BOOST_CHECK_EQUAL(arc.replace(5, 5), libed2k::arc_policy::recent);
+
+    arc.evicted(key(1), 40, libed2k::arc_policy::recent);
+    arc.evicted(key(2), 40, libed2k::arc_policy::recent);
+    BOOST_CHECK_EQUAL(arc.miss(key(1)), libed2k::arc_policy::recent);
+    BOOST_CHECK_EQUAL(arc.replace(5, 5), libed2k::arc_policy::frequent);
+    BOOST_CHECK_EQUAL(arc.replace(60, 5), libed2k::arc_policy::recent);
+
+    arc.evicted(key(1, &storage2), 10, libed2k::arc_policy::frequent);
+    arc.evicted(key(3, &storage2), 10, libed2k::arc_policy::recent);
+    arc.forget(&storage2);
+    BOOST_CHECK_EQUAL(arc.ghost_pieces(libed2k::arc_policy::recent), 1U);
+    BOOST_CHECK_EQUAL(arc.ghost_pieces(libed2k::arc_policy::frequent), 0U);
+    BOOST_CHECK_EQUAL(arc.miss(key(2)), libed2k::arc_policy::recent);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
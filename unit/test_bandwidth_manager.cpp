@@ -0,0 +1,264 @@
+#ifndef WIN32
+#define BOOST_TEST_DYN_LINK
+#endif
+
+#ifdef STAND_ALONE
+#   define BOOST_TEST_MODULE Main
+#endif
+
+#include <vector>
+#include <boost/test/unit_test.hpp>
+
+#include "libed2k/bandwidth_manager.hpp"
+#include "libed2k/time.hpp"
+
+namespace
+{
+    struct test_peer : libed2k::bandwidth_socket
+    {
+        test_peer(int prio) : priority(prio), quota(0), waiting(false), disconnecting(false), polls(0)
+        {
+            std::fill(channel, channel + 3, static_cast<libed2k::bandwidth_channel*>(0));
+            guarantee = 0;
+        }
+
+        void assign_bandwidth(int /*channel*/, int amount)
+        {
+            BOOST_CHECK(waiting);
+            quota += amount;
+            waiting = false;
+        }
+
+        // called once each time the manager looks at the request
+        bool is_disconnecting() const { ++polls; return disconnecting; }
+
+        // asks again as soon as the last request was served, like
+        // a peer with a full send buffer
+        void request(libed2k::bandwidth_manager& m, int blk)
+        {
+            if (waiting) return;
+            int n = 0;
+            while (n < 3 && channel[n]) ++n;
+            int r = m.request_bandwidth(boost::intrusive_ptr<libed2k::bandwidth_socket>(this),
+                                        blk, priority, channel, n, guarantee);
+            if (r > 0) quota += r;
+            else waiting = true;
+        }
+
+        int priority;
+        int quota;
+        bool waiting;
+        bool disconnecting;
+        mutable int polls;
+        libed2k::bandwidth_channel* channel[3];
+        libed2k::bandwidth_channel* guarantee;
+    };
+
+    typedef boost::intrusive_ptr<test_peer> peer_ptr;
+
+    // runs the given number of 100 ms ticks
+    void run(libed2k::bandwidth_manager& m, std::vector<peer_ptr>& peers, int ticks, int blk)
+    {
+        for (int t = 0; t < ticks; ++t)
+        {
+            for (std::vector<peer_ptr>::iterator i = peers.begin(); i != peers.end(); ++i)
+                (*i)->request(m, blk);
+            m.update_quotas(libed2k::milliseconds(100));
+        }
+    }
+
+    void close_to(int value, int expected, int percent)
+    {
+        BOOST_CHECK_MESSAGE(std::abs(value - expected) <= expected * percent / 100,
+                            value << " is not within " << percent << "% of " << expected);
+    }
+}
+
+BOOST_AUTO_TEST_SUITE(test_bandwidth_manager)
+
+BOOST_AUTO_TEST_CASE(test_weighted_share)
+{
+    libed2k::bandwidth_manager m(0);
+    libed2k::bandwidth_channel global;
+    global.throttle(10000);
+
+    std::vector<peer_ptr> peers;
+    peers.push_back(new test_peer(1));
+    peers.push_back(new test_peer(3));
+    peers[0]->channel[0] = &global;
+    peers[1]->channel[0] = &global;
+
+    run(m, peers, 200, 1000);
+
+    // 20 seconds of 10 kB/s split 1:3
+    close_to(peers[0]->quota + peers[1]->quota, 200000, 2);
+    close_to(peers[0]->quota, 50000, 5);
+    close_to(peers[1]->quota, 150000, 5);
+    m.close();
+}
+
+BOOST_AUTO_TEST_CASE(test_unlimited_is_granted_at_once)
+{
+    libed2k::bandwidth_manager m(0);
+    libed2k::bandwidth_channel unlimited;
+    peer_ptr p(new test_peer(1));
+    p->channel[0] = &unlimited;
+    p->request(m, 1000);
+    BOOST_CHECK_EQUAL(p->quota, 1000);
+    BOOST_CHECK(!p->waiting);
+    BOOST_CHECK_EQUAL(m.queue_size(), 0);
+}
+
+BOOST_AUTO_TEST_CASE(test_partial_grant)
+{
+    libed2k::bandwidth_manager m(0);
+    libed2k::bandwidth_channel global;
+    global.throttle(10000);
+
+    peer_ptr p(new test_peer(1));
+    p->channel[0] = &global;
+    p->request(m, 5000);
+    BOOST_CHECK(p->waiting);
+    BOOST_CHECK_EQUAL(m.queued_bytes(), 5000);
+
+    // one tick only has 1000 bytes, they are handed out right away
+    m.update_quotas(libed2k::milliseconds(100));
+    BOOST_CHECK_EQUAL(p->quota, 1000);
+    BOOST_CHECK(!p->waiting);
+    BOOST_CHECK_EQUAL(m.queue_size(), 0);
+    BOOST_CHECK_EQUAL(m.queued_bytes(), 0);
+    BOOST_CHECK_EQUAL(global.quota_left(), 0);
+}
+
+BOOST_AUTO_TEST_CASE(test_blocked_channel_does_not_stall)
+{
+    libed2k::bandwidth_manager m(0);
+    libed2k::bandwidth_channel global;
+    libed2k::bandwidth_channel slow;
+    global.throttle(10000);
+    slow.throttle(1000);
+
+    // the slow peer asks first and with a higher priority, it's
+    // blocked by its own channel most of the time
+    std::vector<peer_ptr> peers;
+    peers.push_back(new test_peer(10));
+    peers.push_back(new test_peer(1));
+    peers[0]->channel[0] = &global;
+    peers[0]->channel[1] = &slow;
+    peers[1]->channel[0] = &global;
+
+    run(m, peers, 100, 1000);
+
+    close_to(peers[0]->quota, 10000, 10);
+    close_to(peers[1]->quota, 90000, 5);
+    m.close();
+}
+
+BOOST_AUTO_TEST_CASE(test_disconnecting_peer_is_dropped)
+{
+    libed2k::bandwidth_manager m(0);
+    libed2k::bandwidth_channel global;
+    global.throttle(10000);
+
+    peer_ptr p(new test_peer(1));
+    p->channel[0] = &global;
+    p->request(m, 500);
+    p->disconnecting = true;
+    m.update_quotas(libed2k::milliseconds(100));
+    BOOST_CHECK_EQUAL(m.queue_size(), 0);
+    BOOST_CHECK_EQUAL(p->quota, 0);
+    BOOST_CHECK_EQUAL(global.quota_left(), 1000);
+}
+
+BOOST_AUTO_TEST_CASE(test_minimum_rate)
+{
+    libed2k::bandwidth_manager m(0);
+    libed2k::bandwidth_channel global;
+    libed2k::bandwidth_channel min_rate;
+    global.throttle(10000);
+    min_rate.throttle(4000);
+
+    // the guaranteed peer has a tenth of the weight of the other
+    std::vector<peer_ptr> peers;
+    peers.push_back(new test_peer(1));
+    peers.push_back(new test_peer(10));
+    peers[0]->channel[0] = &global;
+    peers[0]->guarantee = &min_rate;
+    peers[1]->channel[0] = &global;
+
+    run(m, peers, 200, 1000);
+
+    // by weight alone it would get about 18000 of 200000
+    BOOST_CHECK_GE(peers[0]->quota, 80000 * 95 / 100);
+    close_to(peers[0]->quota + peers[1]->quota, 200000, 2);
+    m.close();
+}
+
+BOOST_AUTO_TEST_CASE(test_guarantee_refills_while_idle)
+{
+    libed2k::bandwidth_manager m(0);
+    libed2k::bandwidth_channel global;
+    libed2k::bandwidth_channel min_rate;
+    global.throttle(10000);
+    min_rate.throttle(4000);
+
+    peer_ptr p(new test_peer(1));
+    p->channel[0] = &global;
+    p->guarantee = &min_rate;
+    p->request(m, 400);
+    m.update_quotas(libed2k::milliseconds(100));
+    BOOST_CHECK_EQUAL(p->quota, 400);
+    BOOST_CHECK_EQUAL(m.queue_size(), 0);
+    BOOST_CHECK_EQUAL(min_rate.quota_left(), 0);
+
+    // nothing is queued, the guarantee still fills up to its cap
+    for (int i = 0; i < 5; ++i) m.update_quotas(libed2k::milliseconds(100));
+    BOOST_CHECK_EQUAL(min_rate.quota_left(), 2000);
+    for (int i = 0; i < 50; ++i) m.update_quotas(libed2k::milliseconds(100));
+    BOOST_CHECK_EQUAL(min_rate.quota_left(), 12000);
+
+    // so the next request is served ahead of the others
+    peer_ptr other(new test_peer(100));
+    other->channel[0] = &global;
+    other->request(m, 500);
+    p->request(m, 500);
+    global.use_quota(global.quota_left());
+    m.update_quotas(libed2k::milliseconds(50));
+    BOOST_CHECK_EQUAL(p->quota, 900);
+    BOOST_CHECK(other->waiting);
+    m.close();
+}
+
+BOOST_AUTO_TEST_CASE(test_blocked_request_waits_for_its_channel)
+{
+    libed2k::bandwidth_manager m(0);
+    libed2k::bandwidth_channel global;
+    libed2k::bandwidth_channel slow;
+    global.throttle(10000);
+    slow.throttle(1000);
+    // the slow channel owes five seconds worth of bytes
+    slow.use_quota(5000);
+
+    std::vector<peer_ptr> peers;
+    peers.push_back(new test_peer(10));
+    peers.push_back(new test_peer(1));
+    peers[0]->channel[0] = &global;
+    peers[0]->channel[1] = &slow;
+    peers[1]->channel[0] = &global;
+
+    run(m, peers, 10, 1000);
+
+    // looked at once, then it waits until its channel is out of debt
+    BOOST_CHECK_EQUAL(peers[0]->polls, 1);
+    BOOST_CHECK_EQUAL(peers[0]->quota, 0);
+    BOOST_CHECK(peers[0]->waiting);
+    BOOST_CHECK_EQUAL(m.queue_size(), 1);
+    BOOST_CHECK_GE(peers[1]->quota, 9000);
+
+    run(m, peers, 50, 1000);
+    BOOST_CHECK_GT(peers[0]->quota, 0);
+    BOOST_CHECK_GT(peers[0]->polls, 1);
+    m.close();
+}
+
+BOOST_AUTO_TEST_SUITE_END()
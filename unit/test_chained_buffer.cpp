@@ -0,0 +1,112 @@
+#ifndef WIN32
+#define BOOST_TEST_DYN_LINK
+#endif
+
+#ifdef STAND_ALONE
+#   define BOOST_TEST_MODULE Main
+#endif
+
+#include <map>
+#include <string>
+#include <boost/test/unit_test.hpp>
+
+#include "libed2k/chained_buffer.hpp"
+
+namespace
+{
+    // hands out new[] buffers and counts releases per pool type
+    struct test_releaser : libed2k::buffer_releaser
+    {
+        char* allocate(int size) { ++allocated; return new char[size]; }
+
+        void release_buffer(int type, char* buf, int)
+        {
+            ++released[type];
+            delete[] buf;
+        }
+
+        int allocated;
+        std::map<int, int> released;
+
+        test_releaser() : allocated(0) {}
+    };
+
+    int iovec_bytes(libed2k::chained_buffer::iovec_t const& v)
+    {
+        int ret = 0;
+        for (libed2k::chained_buffer::iovec_t::const_iterator i = v.begin(); i != v.end(); ++i)
+            ret += int(boost::asio::buffer_size(*i));
+        return ret;
+    }
+}
+
+BOOST_AUTO_TEST_SUITE(test_chained_buffer)
+
+BOOST_AUTO_TEST_CASE(test_chained_buffer_append_pop)
+{
+    test_releaser r;
+    {
+        libed2k::chained_buffer b;
+        BOOST_CHECK(b.empty());
+        BOOST_CHECK_EQUAL(b.space_in_last_buffer(), 0);
+        BOOST_CHECK(b.append("abc", 3) == 0);
+
+        b.append_buffer(r.allocate(16), 16, 4, &r, 0);
+        BOOST_CHECK_EQUAL(b.size(), 4);
+        BOOST_CHECK_EQUAL(b.capacity(), 16);
+        BOOST_CHECK_EQUAL(b.space_in_last_buffer(), 12);
+
+        char* p = b.append("abcdef", 6);
+        BOOST_REQUIRE(p != 0);
+        BOOST_CHECK_EQUAL(std::string(p, 6), "abcdef");
+        BOOST_CHECK_EQUAL(b.size(), 10);
+        BOOST_CHECK(b.allocate_appendix(7) == 0);
+
+        b.append_buffer(r.allocate(8), 8, 8, &r, 1);
+        BOOST_CHECK_EQUAL(b.size(), 18);
+        BOOST_CHECK_EQUAL(iovec_bytes(b.build_iovec(12)), 12);
+        BOOST_CHECK_EQUAL(b.build_iovec(12).num_buffers, 2);
+
+        b.pop_front(3);
+        BOOST_CHECK_EQUAL(b.size(), 15);
+        BOOST_CHECK_EQUAL(r.released[0], 0);
+
+        b.pop_front(9);
+        BOOST_CHECK_EQUAL(b.size(), 6);
+        BOOST_CHECK_EQUAL(b.capacity(), 8);
+        BOOST_CHECK_EQUAL(r.released[0], 1);
+        BOOST_CHECK_EQUAL(r.released[1], 0);
+    }
+
+    // the rest is released by the destructor to its own pool
+    BOOST_CHECK_EQUAL(r.released[1], 1);
+}
+
+BOOST_AUTO_TEST_CASE(test_chained_buffer_ring)
+{
+    test_releaser r;
+    libed2k::chained_buffer b;
+
+    // keep a window of buffers in the ring while it wraps around and grows
+    int popped = 0;
+    for (int i = 0; i < 200; ++i)
+    {
+        b.append_buffer(r.allocate(10), 10, 10, &r, 2);
+        if (i % 3 == 2) { b.pop_front(15); popped += 15; }
+    }
+
+    BOOST_CHECK_EQUAL(b.size(), 200 * 10 - popped);
+    BOOST_CHECK_EQUAL(r.released[2], popped / 10);
+
+    // the iovec holds at most max_buffers buffers
+    libed2k::chained_buffer::iovec_t const& v = b.build_iovec(b.size());
+    BOOST_CHECK_EQUAL(v.num_buffers, int(libed2k::chained_buffer::iovec_t::max_buffers));
+    BOOST_CHECK_EQUAL(iovec_bytes(v), 10 - popped % 10 + (libed2k::chained_buffer::iovec_t::max_buffers - 1) * 10);
+
+    b.pop_front(b.size());
+    BOOST_CHECK(b.empty());
+    BOOST_CHECK_EQUAL(b.capacity(), 0);
+    BOOST_CHECK_EQUAL(r.released[2], r.allocated);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
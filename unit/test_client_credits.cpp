@@ -0,0 +1,140 @@
+#ifndef WIN32
+#define BOOST_TEST_DYN_LINK
+#endif
+
+#ifdef STAND_ALONE
+#   define BOOST_TEST_MODULE Main
+#endif
+
+#include <cstdio>
+#include <boost/test/unit_test.hpp>
+
+#include "libed2k/client_credits.hpp"
+#include "libed2k/filesystem.hpp"
+
+BOOST_AUTO_TEST_SUITE(test_client_credits)
+
+BOOST_AUTO_TEST_CASE(test_credit_score_ratio)
+{
+    libed2k::client_credit c;
+    BOOST_CHECK_EQUAL(c.score_ratio(), 1.0f);
+
+    // less than 1MB from the peer doesn't count
+    c.m_downloaded = 999999;
+    BOOST_CHECK_EQUAL(c.score_ratio(), 1.0f);
+
+    // nothing uploaded, limited by sqrt(MB + 2)
+    c.m_downloaded = 7 * 1048576;
+    BOOST_CHECK_CLOSE(c.score_ratio(), 3.0f, 0.01);
+
+    // twice the download to upload ratio
+    c.m_downloaded = 100 * 1048576;
+    c.m_uploaded = 80 * 1048576;
+    BOOST_CHECK_CLOSE(c.score_ratio(), 2.5f, 0.01);
+
+    c.m_uploaded = 1000 * 1048576;
+    BOOST_CHECK_EQUAL(c.score_ratio(), 1.0f);
+
+    c.m_downloaded = boost::uint64_t(1000) * 1048576;
+    c.m_uploaded = 1;
+    BOOST_CHECK_EQUAL(c.score_ratio(), 10.0f);
+}
+
+BOOST_AUTO_TEST_CASE(test_credits_save_load)
+{
+    const std::string path = "test_clients.met";
+    std::remove(path.c_str());
+
+    libed2k::md4_hash h1 = libed2k::md4_hash::fromString("000102030405060708090A0B0C0D0E0F");
+    libed2k::md4_hash h2 = libed2k::md4_hash::fromString("1F1E1D1C1B1A19181716151413121110");
+    libed2k::md4_hash h3 = libed2k::md4_hash::fromString("20202020202020202020202020202020");
+
+    {
+        libed2k::client_credits cc(path);
+        BOOST_CHECK(cc.find(h1) == 0);
+
+        libed2k::client_credit& c1 = cc.get(h1);
+        cc.add_uploaded(c1, boost::uint64_t(5) << 32);
+        cc.add_downloaded(c1, 1234);
+        c1.m_secure_ident = std::string("\x01\x02\x03", 3);
+
+        libed2k::client_credit& c2 = cc.get(h2);
+        cc.add_downloaded(c2, 42);
+
+        // never exchanged data, not saved
+        cc.get(h3);
+        BOOST_CHECK_EQUAL(cc.size(), 3u);
+
+        libed2k::error_code ec;
+        cc.save(ec);
+        BOOST_CHECK(!ec);
+        BOOST_CHECK(!cc.dirty());
+    }
+
+    {
+        libed2k::client_credits cc(path);
+        libed2k::error_code ec;
+        cc.load(ec);
+        BOOST_CHECK(!ec);
+        BOOST_CHECK_EQUAL(cc.size(), 2u);
+        BOOST_CHECK(cc.find(h3) == 0);
+
+        libed2k::client_credit* c1 = cc.find(h1);
+        BOOST_REQUIRE(c1);
+        BOOST_CHECK_EQUAL(c1->m_uploaded, boost::uint64_t(5) << 32);
+        BOOST_CHECK_EQUAL(c1->m_downloaded, 1234u);
+        BOOST_CHECK_EQUAL(c1->m_secure_ident, std::string("\x01\x02\x03", 3));
+
+        // the record of h2 wasn't touched and goes back as it was
+        cc.add_downloaded(*c1, 1);
+        cc.save(ec);
+        BOOST_CHECK(!ec);
+    }
+
+    {
+        libed2k::client_credits cc(path);
+        libed2k::client_credit* c2 = cc.find(h2);
+        BOOST_REQUIRE(c2);
+        BOOST_CHECK_EQUAL(c2->m_downloaded, 42u);
+        BOOST_CHECK_EQUAL(c2->m_uploaded, 0u);
+        BOOST_CHECK_EQUAL(cc.find(h1)->m_downloaded, 1235u);
+    }
+
+    std::remove(path.c_str());
+}
+
+BOOST_AUTO_TEST_CASE(test_credits_save_buffer)
+{
+    const std::string path = "test_clients_buffer.met";
+    std::remove(path.c_str());
+
+    libed2k::md4_hash h = libed2k::md4_hash::fromString("000102030405060708090A0B0C0D0E0F");
+    std::vector<char> buf;
+
+    {
+        libed2k::client_credits cc(path);
+        BOOST_CHECK(!cc.save_buffer(buf));
+        cc.add_downloaded(cc.get(h), 100);
+        BOOST_CHECK(cc.save_buffer(buf));
+        BOOST_CHECK(!cc.dirty());
+
+        // a failed write keeps the changes for the next save
+        cc.save_failed();
+        BOOST_CHECK(cc.dirty());
+
+        libed2k::error_code ec;
+        libed2k::save_file(path, buf, ec);
+        BOOST_CHECK(!ec);
+    }
+
+    {
+        libed2k::client_credits cc(path);
+        libed2k::client_credit* c = cc.find(h);
+        BOOST_REQUIRE(c);
+        BOOST_CHECK_EQUAL(c->m_downloaded, 100u);
+    }
+
+    std::remove(path.c_str());
+}
+
+BOOST_AUTO_TEST_SUITE_END()
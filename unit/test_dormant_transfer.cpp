@@ -0,0 +1,208 @@
+#ifndef WIN32
+#define BOOST_TEST_DYN_LINK
+#endif
+
+#ifdef STAND_ALONE
+#   define BOOST_TEST_MODULE Main
+#endif
+
+#include <cstdio>
+#include <fstream>
+#include <boost/test/unit_test.hpp>
+#include <boost/lexical_cast.hpp>
+
+#include "libed2k/dormant_transfer.hpp"
+#include "libed2k/add_transfer_params.hpp"
+#include "libed2k/constants.hpp"
+#include "libed2k/session.hpp"
+#include "libed2k/alert_types.hpp"
+#include "libed2k/file.hpp"
+
+namespace
+{
+    libed2k::add_transfer_params seed(int n, int pieces)
+    {
+        libed2k::add_transfer_params params;
+        params.file_hash = libed2k::md4_hash::fromString("31D6CFE0D16AE931B73C59D7E0C089C0");
+        params.file_hash[0] = n;
+        params.file_path = "/tmp/file" + boost::lexical_cast<std::string>(n);
+        params.file_size = libed2k::size_type(pieces) * libed2k::PIECE_SIZE;
+        params.seed_mode = true;
+
+        for (int i = 0; i < pieces; ++i)
+        {
+            libed2k::md4_hash h = libed2k::md4_hash::fromString("000102030405060708090A0B0C0D0E0F");
+            h[0] = n;
+            h[1] = i;
+            params.piece_hashses.push_back(h);
+        }
+
+        return params;
+    }
+
+    template<typename Alert>
+    bool wait_for(libed2k::session& ses, int timeout)
+    {
+        libed2k::ptime deadline = libed2k::time_now() + libed2k::seconds(timeout);
+
+        while (libed2k::time_now() < deadline)
+        {
+            if (!ses.wait_for_alert(libed2k::milliseconds(100))) continue;
+            std::auto_ptr<libed2k::alert> a = ses.pop_alert();
+            if (dynamic_cast<Alert*>(a.get())) return true;
+        }
+
+        return false;
+    }
+}
+
+BOOST_AUTO_TEST_SUITE(test_dormant_transfer)
+
+BOOST_AUTO_TEST_CASE(test_dormant_add_take)
+{
+    libed2k::dormant_transfers dts;
+    libed2k::add_transfer_params p1 = seed(1, 3);
+    libed2k::add_transfer_params p2 = seed(2, 5);
+    p2.accepted = 7;
+    dts.add(p1, false);
+    dts.add(p2, true);
+
+    BOOST_CHECK_EQUAL(dts.size(), 2U);
+    BOOST_CHECK_EQUAL(dts.arena_size(), 8U);
+    BOOST_CHECK(dts.contains(p1.file_hash));
+
+    libed2k::add_transfer_params res;
+    BOOST_REQUIRE(dts.params(p2.file_hash, res));
+    BOOST_CHECK(res.piece_hashses == p2.piece_hashses);
+    BOOST_CHECK_EQUAL(dts.size(), 2U);
+
+    bool announced = false;
+    BOOST_REQUIRE(dts.take(p2.file_hash, res, announced));
+    BOOST_CHECK(announced);
+    BOOST_CHECK(res.seed_mode);
+    BOOST_CHECK_EQUAL(res.file_path, p2.file_path);
+    BOOST_CHECK_EQUAL(res.file_size, p2.file_size);
+    BOOST_CHECK_EQUAL(res.accepted, 7U);
+    BOOST_CHECK(res.piece_hashses == p2.piece_hashses);
+
+    // hashes of the last transfer are cut from the arena
+    BOOST_CHECK_EQUAL(dts.arena_size(), 3U);
+    BOOST_CHECK(!dts.take(p2.file_hash, res, announced));
+
+    BOOST_REQUIRE(dts.take(p1.file_hash, res, announced));
+    BOOST_CHECK(!announced);
+    BOOST_CHECK(res.piece_hashses == p1.piece_hashses);
+    BOOST_CHECK(dts.empty());
+    BOOST_CHECK_EQUAL(dts.arena_size(), 0U);
+}
+
+BOOST_AUTO_TEST_CASE(test_dormant_compact)
+{
+    libed2k::dormant_transfers dts;
+
+    for (int i = 0; i < 40; ++i) dts.add(seed(i, 100), false);
+    BOOST_CHECK_EQUAL(dts.arena_size(), 4000U);
+
+    // remove all but the last one, the arena is compacted on the way
+    for (int i = 0; i < 39; ++i) BOOST_CHECK(dts.remove(seed(i, 0).file_hash));
+    BOOST_CHECK(dts.arena_size() < 2000U);
+
+    libed2k::add_transfer_params last = seed(39, 100);
+    libed2k::add_transfer_params res;
+    bool announced;
+    BOOST_REQUIRE(dts.take(last.file_hash, res, announced));
+    BOOST_CHECK(res.piece_hashses == last.piece_hashses);
+    BOOST_CHECK_EQUAL(dts.arena_size(), 0U);
+}
+
+BOOST_AUTO_TEST_CASE(test_dormant_dht_announce)
+{
+    libed2k::dormant_transfers dts;
+    dts.add(seed(1, 1), false);
+    dts.add(seed(2, 2), false);
+
+    libed2k::ptime now = libed2k::time_now_hires();
+    libed2k::md4_hash h1, h2, h;
+    libed2k::size_type size = 0;
+
+    BOOST_REQUIRE(dts.pop_dht_announce(now, libed2k::minutes(5), h1, size));
+    BOOST_REQUIRE(dts.pop_dht_announce(now, libed2k::minutes(5), h2, size));
+    BOOST_CHECK(h1 != h2);
+
+    // both are published, nothing to do until the interval is over
+    BOOST_CHECK(!dts.pop_dht_announce(now, libed2k::minutes(5), h, size));
+    BOOST_CHECK(dts.pop_dht_announce(now + libed2k::minutes(6), libed2k::minutes(5), h, size));
+    BOOST_CHECK(h == h1);
+
+    // announced while it was running, not due again when it goes dormant
+    libed2k::add_transfer_params p3 = seed(3, 1);
+    dts.add(p3, false, boost::shared_ptr<libed2k::transfer_link>(), now + libed2k::minutes(20));
+    BOOST_CHECK(dts.find(p3.file_hash)->second.next_dht_announce == now + libed2k::minutes(20));
+    BOOST_CHECK(dts.pop_dht_announce(now + libed2k::minutes(12), libed2k::minutes(5), h, size));
+    BOOST_CHECK(h != p3.file_hash);
+    BOOST_CHECK(dts.pop_dht_announce(now + libed2k::minutes(12), libed2k::minutes(5), h, size));
+    BOOST_CHECK(h != p3.file_hash);
+    BOOST_CHECK(!dts.pop_dht_announce(now + libed2k::minutes(12), libed2k::minutes(5), h, size));
+}
+
+BOOST_AUTO_TEST_CASE(test_dormant_session_handles)
+{
+    using namespace libed2k;
+    const std::string path = "test_dormant_seed.dat";
+
+    {
+        std::ofstream f(path.c_str(), std::ios::binary);
+        f << std::string(100000, 'x');
+    }
+
+    std::pair<add_transfer_params, error_code> atp = file2atp()(path, false);
+    BOOST_REQUIRE(!atp.second);
+    BOOST_REQUIRE(atp.first.seed_mode);
+
+    session_settings settings;
+    settings.listen_port = 4741;
+    settings.dormant_seed_timeout = 1;
+
+    {
+        session ses(fingerprint(), "127.0.0.1", settings);
+        ses.set_alert_mask(alert::status_notification);
+
+        // seed goes dormant at once, its handle is valid and listed
+        transfer_handle h = ses.add_transfer(atp.first);
+        BOOST_CHECK(h.is_valid());
+        BOOST_CHECK(h.hash() == atp.first.file_hash);
+        std::vector<transfer_handle> transfers = ses.get_transfers();
+        BOOST_REQUIRE_EQUAL(transfers.size(), 1U);
+        BOOST_CHECK(transfers[0] == h);
+
+        // queries are answered while it sleeps
+        BOOST_CHECK_EQUAL(h.name(), path);
+        BOOST_CHECK_EQUAL(h.size(), 100000);
+        BOOST_CHECK(h.is_seed());
+        transfer_status st = h.status();
+        BOOST_CHECK_EQUAL(st.state, transfer_status::seeding);
+        BOOST_CHECK_EQUAL(st.total_done, 100000);
+        BOOST_CHECK(h.params().piece_hashses == atp.first.piece_hashses);
+        BOOST_CHECK(!wait_for<woke_transfer_alert>(ses, 1));
+
+        // a call changing the transfer wakes it up
+        h.set_upload_limit(100000);
+        BOOST_CHECK(wait_for<woke_transfer_alert>(ses, 5));
+
+        // no peers, sleeps again and the old handle still works
+        BOOST_CHECK(wait_for<dormant_transfer_alert>(ses, 10));
+        BOOST_CHECK(h.is_valid());
+        transfers = ses.get_transfers();
+        BOOST_REQUIRE_EQUAL(transfers.size(), 1U);
+        BOOST_CHECK(transfers[0] == h);
+
+        ses.remove_transfer(h, session::none);
+        BOOST_CHECK(wait_for<deleted_transfer_alert>(ses, 5));
+        BOOST_CHECK(!h.is_valid());
+        BOOST_CHECK(ses.get_transfers().empty());
+    }
+
+    std::remove(path.c_str());
+}
+
+BOOST_AUTO_TEST_SUITE_END()
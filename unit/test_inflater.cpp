@@ -0,0 +1,77 @@
+#ifndef WIN32
+#define BOOST_TEST_DYN_LINK
+#endif
+
+#ifdef STAND_ALONE
+#   define BOOST_TEST_MODULE Main
+#endif
+
+#include <string>
+#include <vector>
+#include <boost/test/unit_test.hpp>
+
+#include "libed2k/inflater.hpp"
+
+#define MINIZ_HEADER_FILE_ONLY
+#include "../src/miniz.c"
+
+namespace
+{
+    std::vector<char> pack(const std::vector<char>& data)
+    {
+        mz_ulong size = mz_compressBound(data.size());
+        std::vector<char> res(size);
+        BOOST_REQUIRE(mz_compress(reinterpret_cast<unsigned char*>(&res[0]), &size,
+            reinterpret_cast<const unsigned char*>(&data[0]), data.size()) == MZ_OK);
+        res.resize(size);
+        return res;
+    }
+}
+
+BOOST_AUTO_TEST_SUITE(test_inflater)
+
+BOOST_AUTO_TEST_CASE(test_inflater_ratio)
+{
+    // search results and shared files lists are packed much better than 10 times
+    std::vector<char> data(1024 * 1024);
+    for (size_t i = 0; i < data.size(); ++i) data[i] = char(i % 64 < 4 ? i / 64 : 'a');
+
+    std::vector<char> packed = pack(data);
+    BOOST_CHECK(packed.size() * 10 < data.size());
+
+    libed2k::inflater inf;
+    std::vector<char> res;
+    BOOST_CHECK(!inf.unpack(&packed[0], packed.size(), res, 8 * 1024 * 1024));
+    BOOST_CHECK(res == data);
+
+    // the same decompressor is reused for next packets
+    std::vector<char> small(data.begin(), data.begin() + 100);
+    packed = pack(small);
+    BOOST_CHECK(!inf.unpack(&packed[0], packed.size(), res, 8 * 1024 * 1024));
+    BOOST_CHECK(res == small);
+}
+
+BOOST_AUTO_TEST_CASE(test_inflater_limits)
+{
+    std::vector<char> data(256 * 1024, 'z');
+    std::vector<char> packed = pack(data);
+    libed2k::inflater inf;
+    std::vector<char> res;
+
+    BOOST_CHECK(inf.unpack(&packed[0], packed.size(), res, 64 * 1024) ==
+        libed2k::error_code(libed2k::errors::inflated_packet_too_large));
+    BOOST_CHECK(res.empty());
+
+    // exact limit is enough
+    BOOST_CHECK(!inf.unpack(&packed[0], packed.size(), res, data.size()));
+    BOOST_CHECK_EQUAL(res.size(), data.size());
+
+    // truncated and broken streams
+    BOOST_CHECK(inf.unpack(&packed[0], packed.size() / 2, res, data.size()) ==
+        libed2k::error_code(libed2k::errors::decode_packet_error));
+    std::string garbage("not a zlib stream");
+    BOOST_CHECK(inf.unpack(garbage.c_str(), garbage.size(), res, data.size()) ==
+        libed2k::error_code(libed2k::errors::decode_packet_error));
+}
+
+BOOST_AUTO_TEST_SUITE_END()
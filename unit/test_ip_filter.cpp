@@ -0,0 +1,126 @@
+#ifndef WIN32
+#define BOOST_TEST_DYN_LINK
+#endif
+
+#ifdef STAND_ALONE
+#   define BOOST_TEST_MODULE Main
+#endif
+
+#include <string>
+#include <vector>
+#include <cstdlib>
+#include <boost/test/unit_test.hpp>
+
+#include "libed2k/ip_filter.hpp"
+
+namespace
+{
+    libed2k::address_v4 ip(const char* str)
+    {
+        return libed2k::address_v4::from_string(str);
+    }
+
+    libed2k::ip_range<libed2k::address_v4> range(const char* first, const char* last)
+    {
+        libed2k::ip_range<libed2k::address_v4> r;
+        r.first = ip(first);
+        r.last = ip(last);
+        r.flags = libed2k::ip_filter::blocked;
+        return r;
+    }
+}
+
+BOOST_AUTO_TEST_SUITE(test_ip_filter)
+
+BOOST_AUTO_TEST_CASE(test_compiled_ip_filter_ranges)
+{
+    std::vector<libed2k::ip_range<libed2k::address_v4> > ranges;
+    ranges.push_back(range("10.0.0.0", "10.0.255.255"));
+    ranges.push_back(range("0.0.0.0", "0.0.0.255"));
+    ranges.push_back(range("10.0.100.0", "10.1.0.5"));  // overlaps
+    ranges.push_back(range("10.1.0.6", "10.1.0.6"));    // adjacent
+    ranges.push_back(range("255.255.255.0", "255.255.255.255"));
+    ranges.push_back(range("192.168.0.1", "192.168.0.1"));
+    ranges.back().flags = 0;
+
+    libed2k::compiled_ip_filter f(ranges);
+    BOOST_CHECK_EQUAL(f.size(), 5U);
+
+    BOOST_CHECK_EQUAL(f.access(ip("0.0.0.0")), int(libed2k::ip_filter::blocked));
+    BOOST_CHECK_EQUAL(f.access(ip("0.0.1.0")), 0);
+    BOOST_CHECK_EQUAL(f.access(ip("9.255.255.255")), 0);
+    BOOST_CHECK_EQUAL(f.access(ip("10.0.0.0")), int(libed2k::ip_filter::blocked));
+    BOOST_CHECK_EQUAL(f.access(ip("10.1.0.6")), int(libed2k::ip_filter::blocked));
+    BOOST_CHECK_EQUAL(f.access(ip("10.1.0.7")), 0);
+    BOOST_CHECK_EQUAL(f.access(ip("192.168.0.1")), 0);
+    BOOST_CHECK_EQUAL(f.access(ip("255.255.254.255")), 0);
+    BOOST_CHECK_EQUAL(f.access(ip("255.255.255.255")), int(libed2k::ip_filter::blocked));
+}
+
+BOOST_AUTO_TEST_CASE(test_compiled_ip_filter_matches_rules)
+{
+    libed2k::ip_filter rules;
+    std::srand(1);
+
+    for (int i = 0; i < 2000; ++i)
+    {
+        boost::uint32_t first = (boost::uint32_t(std::rand()) << 16) ^ std::rand();
+        boost::uint32_t last = first + std::rand() % 100000;
+        if (last < first) last = 0xFFFFFFFF;
+        rules.add_rule(libed2k::address_v4(first), libed2k::address_v4(last),
+                       (i % 5 == 0) ? 0 : int(libed2k::ip_filter::blocked));
+    }
+
+    libed2k::compiled_ip_filter f(rules);
+
+    for (int i = 0; i < 100000; ++i)
+    {
+        libed2k::address_v4 a((boost::uint32_t(std::rand()) << 16) ^ std::rand());
+        BOOST_REQUIRE_EQUAL(f.access(a), rules.access(a));
+    }
+
+    libed2k::ip_filter::filter_tuple_t restored = f.rules().export_filter();
+    libed2k::ip_filter::filter_tuple_t original = rules.export_filter();
+    BOOST_REQUIRE_EQUAL(restored.size(), original.size());
+
+    for (size_t i = 0; i < original.size(); ++i)
+    {
+        BOOST_CHECK(restored[i].first == original[i].first);
+        BOOST_CHECK(restored[i].last == original[i].last);
+        BOOST_CHECK_EQUAL(restored[i].flags, original[i].flags);
+    }
+}
+
+BOOST_AUTO_TEST_CASE(test_parse_ip_filter)
+{
+    std::string data =
+        "# comment\r\n"
+        "001.002.003.000 - 001.002.003.255 , 000 , Some organization\r\n"
+        "  004.000.000.000-004.000.000.010,200,allowed by level\n"
+        "\n"
+        "// another comment\n"
+        "P2P range: with colon:5.5.5.5-5.5.6.5\n"
+        "006.000.000.000 - 006.000.000.010\n"
+        "bad line\n"
+        "7.0.0.10 - 7.0.0.1 , 0 , reversed\n"
+        "8.0.0.300 - 8.0.1.0 , 0 , overflow";
+
+    std::vector<libed2k::ip_range<libed2k::address_v4> > ranges;
+    BOOST_CHECK_EQUAL(libed2k::parse_ip_filter(data.c_str(), data.c_str() + data.size(), ranges), 3);
+    BOOST_REQUIRE_EQUAL(ranges.size(), 4U);
+
+    BOOST_CHECK(ranges[0].first == ip("1.2.3.0"));
+    BOOST_CHECK(ranges[0].last == ip("1.2.3.255"));
+    BOOST_CHECK_EQUAL(ranges[0].flags, int(libed2k::ip_filter::blocked));
+    BOOST_CHECK_EQUAL(ranges[1].flags, 0);
+    BOOST_CHECK(ranges[2].first == ip("5.5.5.5"));
+    BOOST_CHECK(ranges[2].last == ip("5.5.6.5"));
+    BOOST_CHECK(ranges[3].last == ip("6.0.0.10"));
+
+    libed2k::compiled_ip_filter f(ranges);
+    BOOST_CHECK_EQUAL(f.access(ip("1.2.3.4")), int(libed2k::ip_filter::blocked));
+    BOOST_CHECK_EQUAL(f.access(ip("4.0.0.1")), 0);
+    BOOST_CHECK_EQUAL(f.access(ip("5.5.6.0")), int(libed2k::ip_filter::blocked));
+}
+
+BOOST_AUTO_TEST_SUITE_END()
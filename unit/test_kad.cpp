@@ -19,8 +19,55 @@
 #include "libed2k/hasher.hpp"
 #include "libed2k/packet_struct.hpp"
 #include "libed2k/kademlia/node_id.hpp"
+#include "libed2k/time.hpp"
+#include "libed2k/kademlia/keyword_index.hpp"
+#include "libed2k/kademlia/node.hpp"
+#include "libed2k/kademlia/rpc_manager.hpp"
+#include "libed2k/kademlia/traversal_algorithm.hpp"
+#include "libed2k/alert.hpp"
 #include "common.hpp"
 
+namespace libed2k { namespace aux { extern ptime g_current_time; } }
+
+namespace
+{
+    using libed2k::dht::node_id;
+    using libed2k::dht::observer;
+    using libed2k::udp;
+
+    bool send_nothing(void*, const libed2k::udp_message&, udp::endpoint const&, int) { return true; }
+
+    std::vector<node_id> g_replies;
+
+    // no members of its own, it must fit the observer pool
+    struct test_observer : observer
+    {
+        test_observer(boost::intrusive_ptr<libed2k::dht::traversal_algorithm> const& a
+            , udp::endpoint const& ep, node_id const& id) : observer(a, ep, id) {}
+
+        void reply(const libed2k::kad2_pong&, udp::endpoint) { flags |= flag_done; g_replies.push_back(id()); }
+        void reply(const libed2k::kad2_hello_res&, udp::endpoint) {}
+        void reply(const libed2k::kad2_bootstrap_res&, udp::endpoint) {}
+        void reply(const libed2k::kademlia2_res&, udp::endpoint) {}
+        void reply(const libed2k::kad2_publish_res&, udp::endpoint) {}
+    };
+
+    libed2k::dht::observer_ptr ping(libed2k::dht::node_impl& node
+        , boost::intrusive_ptr<libed2k::dht::traversal_algorithm> const& algo
+        , udp::endpoint const& ep, node_id const& id)
+    {
+        void* ptr = node.m_rpc.allocate_observer();
+        BOOST_REQUIRE(ptr);
+        libed2k::dht::observer_ptr o(new (ptr) test_observer(algo, ep, id));
+#if defined LIBED2K_DEBUG || LIBED2K_RELEASE_ASSERTS
+        o->m_in_constructor = false;
+#endif
+        libed2k::kad2_ping p;
+        BOOST_REQUIRE(node.m_rpc.invoke(p, ep, o));
+        return o;
+    }
+}
+
 BOOST_AUTO_TEST_SUITE(test_kad)
 BOOST_AUTO_TEST_CASE(test_kad_support_methods) {
     libed2k::md4_hash hash = libed2k::md4_hash::fromString("1AA8AFE3018B38D9B4D880D0683CCEB5");
@@ -99,6 +146,161 @@ BOOST_AUTO_TEST_CASE(test_kad_tolerance) {
     BOOST_CHECK_EQUAL(KADEMLIA_TOLERANCE_ZONE, libed2k::dht::distance_exp(tolerance, md4_hash::invalid));
 }
 
+BOOST_AUTO_TEST_CASE(test_kad_keywords_extraction) {
+    std::vector<std::string> words;
+    libed2k::dht::extract_keywords("Lady Gaga - Love Game (The Fame).mp3", words);
+    BOOST_REQUIRE_EQUAL(words.size(), 6U);
+    BOOST_CHECK_EQUAL(words[0], "lady");
+    BOOST_CHECK_EQUAL(words[1], "gaga");
+    BOOST_CHECK_EQUAL(words[2], "love");
+    BOOST_CHECK_EQUAL(words[3], "game");
+    BOOST_CHECK_EQUAL(words[4], "the");
+    BOOST_CHECK_EQUAL(words[5], "fame");
+
+    // duplicates and short words were removed, extension isn't last word of 3 chars
+    libed2k::dht::extract_keywords("game.of.the.game.avi1", words);
+    BOOST_REQUIRE_EQUAL(words.size(), 3U);
+    BOOST_CHECK_EQUAL(words[1], "the");
+    BOOST_CHECK_EQUAL(words[2], "avi1");
+
+    // repeated 3 char word at the end is a word, not an extension
+    libed2k::dht::extract_keywords("mp3 collection.mp3", words);
+    BOOST_REQUIRE_EQUAL(words.size(), 2U);
+    BOOST_CHECK_EQUAL(words[0], "mp3");
+    BOOST_CHECK_EQUAL(words[1], "collection");
+
+    libed2k::dht::extract_keywords("the best of.avi", words);
+    BOOST_REQUIRE_EQUAL(words.size(), 2U);
+    BOOST_CHECK_EQUAL(words[0], "the");
+    BOOST_CHECK_EQUAL(words[1], "best");
+
+    // single word is never treated as extension
+    libed2k::dht::extract_keywords("abc", words);
+    BOOST_CHECK_EQUAL(words.size(), 1U);
+}
+
+BOOST_AUTO_TEST_CASE(test_kad_keyword_index) {
+    using libed2k::md4_hash;
+    using libed2k::hasher;
+    libed2k::dht::keyword_index index;
+    index.add_file(md4_hash::emule, "first track.mp3");
+    index.add_file(md4_hash::libed2k, "second track.mp3");
+    BOOST_CHECK_EQUAL(index.size(), 3U);
+
+    libed2k::ptime now = libed2k::time_now_hires();
+    BOOST_CHECK_EQUAL(index.pending(now), 3);
+
+    // common keyword publishes both files at once
+    md4_hash keyword;
+    std::vector<md4_hash> files;
+    size_t total = 0;
+    while (index.pop(now, libed2k::minutes(1), 10, keyword, files)) {
+        if (keyword == hasher::from_string("track")) BOOST_CHECK_EQUAL(files.size(), 2U);
+        else BOOST_CHECK_EQUAL(files.size(), 1U);
+        ++total;
+    }
+
+    BOOST_CHECK_EQUAL(total, 3U);
+    BOOST_CHECK_EQUAL(index.pending(now), 0);
+
+    // files over limit rotate on each publish
+    index.reschedule(hasher::from_string("track"), now);
+    BOOST_REQUIRE(index.pop(now, libed2k::minutes(1), 1, keyword, files));
+    BOOST_REQUIRE_EQUAL(files.size(), 1U);
+    md4_hash first = files[0];
+    index.reschedule(keyword, now);
+    BOOST_REQUIRE(index.pop(now, libed2k::minutes(1), 1, keyword, files));
+    BOOST_CHECK(files[0] != first);
+
+    index.remove_file(md4_hash::emule);
+    BOOST_CHECK_EQUAL(index.size(), 2U);
+
+    // removal needs only the hash of the file
+    index.remove_file(md4_hash::libed2k);
+    BOOST_CHECK_EQUAL(index.size(), 0U);
+}
+
+BOOST_AUTO_TEST_CASE(test_kad_duplicate_transactions) {
+    using namespace libed2k;
+    using namespace libed2k::dht;
+    io_service io;
+    alert_manager alerts(io);
+    node_impl node(alerts, &send_nothing, dht_settings(), node_id::min(), address::from_string("127.0.0.1"), 4665, node_impl::external_ip_fun(), 0);
+    boost::intrusive_ptr<traversal_algorithm> algo(new traversal_algorithm(node, node_id::min()));
+    aux::g_current_time = time_now_hires();
+    g_replies.clear();
+
+    const udp::endpoint ep(address::from_string("10.0.0.1"), 4672);
+    const udp::endpoint other(address::from_string("10.1.0.1"), 4672);
+    observer_ptr o1 = ping(node, algo, ep, md4_hash::emule);
+    ping(node, algo, other, md4_hash::terminal);
+    observer_ptr o2 = ping(node, algo, ep, md4_hash::libed2k);
+
+    // the same transaction id twice to a node, replies match the oldest first
+    kad2_pong pong;
+    pong.udp_port = 4672;
+    node_id id;
+    BOOST_CHECK(node.m_rpc.incoming(pong, ep, &id));
+    BOOST_CHECK_EQUAL(id, md4_hash::emule);
+    // the routing table keeps the first id of the address, the reply still matches
+    node.m_rpc.incoming(pong, ep, &id);
+    BOOST_CHECK_EQUAL(id, md4_hash::libed2k);
+    BOOST_CHECK(!node.m_rpc.incoming(pong, ep, &id));
+
+    BOOST_REQUIRE_EQUAL(g_replies.size(), 2U);
+    BOOST_CHECK_EQUAL(g_replies[0], md4_hash::emule);
+    BOOST_CHECK_EQUAL(g_replies[1], md4_hash::libed2k);
+    BOOST_CHECK(o1->flags & observer::flag_done);
+    BOOST_CHECK(o2->flags & observer::flag_done);
+
+    // the other node still waits for its reply
+    node.m_rpc.incoming(pong, other, &id);
+    BOOST_CHECK_EQUAL(id, md4_hash::terminal);
+    BOOST_CHECK_EQUAL(g_replies.size(), 3U);
+}
+
+BOOST_AUTO_TEST_CASE(test_kad_transactions_timeout_order) {
+    using namespace libed2k;
+    using namespace libed2k::dht;
+    io_service io;
+    alert_manager alerts(io);
+    node_impl node(alerts, &send_nothing, dht_settings(), node_id::min(), address::from_string("127.0.0.1"), 4665, node_impl::external_ip_fun(), 0);
+    boost::intrusive_ptr<traversal_algorithm> algo(new traversal_algorithm(node, node_id::min()));
+    const ptime start = time_now_hires();
+    g_replies.clear();
+
+    const udp::endpoint ep1(address::from_string("10.0.0.1"), 4672);
+    const udp::endpoint ep2(address::from_string("10.1.0.1"), 4672);
+    const udp::endpoint ep3(address::from_string("10.2.0.1"), 4672);
+    aux::g_current_time = start;
+    observer_ptr o1 = ping(node, algo, ep1, md4_hash::emule);
+    aux::g_current_time = start + seconds(1);
+    observer_ptr o2 = ping(node, algo, ep2, md4_hash::terminal);
+    aux::g_current_time = start + seconds(2);
+    observer_ptr o3 = ping(node, algo, ep3, md4_hash::libed2k);
+
+    // transactions time out in the order they were sent
+    aux::g_current_time = start + seconds(12);
+    BOOST_CHECK(node.m_rpc.tick() == seconds(1));
+    BOOST_CHECK(o1->flags & observer::flag_done);
+    BOOST_CHECK(!(o2->flags & observer::flag_done));
+    BOOST_CHECK(!(o3->flags & observer::flag_done));
+
+    // a late reply finds nothing, the others still match
+    kad2_pong pong;
+    pong.udp_port = 4672;
+    node_id id;
+    BOOST_CHECK(!node.m_rpc.incoming(pong, ep1, &id));
+    BOOST_CHECK(node.m_rpc.incoming(pong, ep3, &id));
+    BOOST_CHECK_EQUAL(id, md4_hash::libed2k);
+
+    aux::g_current_time = start + seconds(13);
+    node.m_rpc.tick();
+    BOOST_CHECK(o2->flags & observer::flag_done);
+    BOOST_CHECK(!node.m_rpc.incoming(pong, ep2, &id));
+    BOOST_REQUIRE_EQUAL(g_replies.size(), 1U);
+    BOOST_CHECK_EQUAL(g_replies[0], md4_hash::libed2k);
+}
 
 BOOST_AUTO_TEST_SUITE_END()
 #endif
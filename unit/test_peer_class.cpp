@@ -0,0 +1,73 @@
+#ifndef WIN32
+#define BOOST_TEST_DYN_LINK
+#endif
+
+#ifdef STAND_ALONE
+#   define BOOST_TEST_MODULE Main
+#endif
+
+#include <boost/test/unit_test.hpp>
+
+#include "libed2k/peer_class.hpp"
+
+BOOST_AUTO_TEST_SUITE(test_peer_class)
+
+BOOST_AUTO_TEST_CASE(test_peer_class_pool)
+{
+    libed2k::peer_class_pool pool;
+    int friends = pool.new_peer_class("friends");
+    int lowid = pool.new_peer_class("lowid");
+    BOOST_CHECK_EQUAL(friends, 0);
+    BOOST_CHECK_EQUAL(lowid, 1);
+    BOOST_CHECK(pool.at(2) == 0);
+    BOOST_CHECK(pool.at(-1) == 0);
+
+    libed2k::peer_class_info pci;
+    pci.label = "friends";
+    pci.upload_limit = 50000;
+    pci.upload_min = 10000;
+    pci.upload_weight = 1000;
+    pool.at(friends)->set_info(pci);
+
+    libed2k::peer_class_info res;
+    pool.at(friends)->get_info(res);
+    BOOST_CHECK_EQUAL(res.label, "friends");
+    BOOST_CHECK_EQUAL(res.upload_limit, 50000);
+    BOOST_CHECK_EQUAL(res.upload_min, 10000);
+    BOOST_CHECK_EQUAL(res.download_limit, 0);
+    // weights are clamped
+    BOOST_CHECK_EQUAL(res.upload_weight, 255);
+    BOOST_CHECK_EQUAL(res.download_weight, 1);
+
+    BOOST_CHECK_EQUAL(pool.valid(0xff), 3u);
+
+    // the id is reused and the new class starts unlimited
+    pool.delete_peer_class(friends);
+    BOOST_CHECK(pool.at(friends) == 0);
+    BOOST_CHECK_EQUAL(pool.valid(0xff), 2u);
+    BOOST_CHECK_EQUAL(pool.new_peer_class("rare files"), friends);
+    BOOST_CHECK_EQUAL(pool.at(friends)->channel[0].throttle(), 0);
+    BOOST_CHECK_EQUAL(pool.at(friends)->guarantee[0].throttle(), 0);
+
+    for (int i = 2; i < libed2k::peer_class_pool::max_classes; ++i)
+        BOOST_CHECK_EQUAL(pool.new_peer_class("x"), i);
+    BOOST_CHECK_EQUAL(pool.new_peer_class("x"), -1);
+}
+
+BOOST_AUTO_TEST_CASE(test_peer_class_type_filter)
+{
+    libed2k::peer_class_type_filter f;
+    BOOST_CHECK_EQUAL(f.apply(libed2k::peer_class_type_filter::tcp_incoming, 0), 0u);
+
+    f.add(libed2k::peer_class_type_filter::lowid_callback, 3);
+    f.add(libed2k::peer_class_type_filter::lowid_callback, 5);
+    BOOST_CHECK_EQUAL(f.apply(libed2k::peer_class_type_filter::lowid_callback, 1), 0x29u);
+    BOOST_CHECK_EQUAL(f.apply(libed2k::peer_class_type_filter::tcp_outgoing, 1), 1u);
+
+    f.remove(libed2k::peer_class_type_filter::lowid_callback, 3);
+    BOOST_CHECK_EQUAL(f.apply(libed2k::peer_class_type_filter::lowid_callback, 0), 0x20u);
+    // unknown types leave the set alone
+    BOOST_CHECK_EQUAL(f.apply(-1, 7), 7u);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,56 @@
+#ifndef WIN32
+#define BOOST_TEST_DYN_LINK
+#endif
+
+#ifdef STAND_ALONE
+#   define BOOST_TEST_MODULE Main
+#endif
+
+#include <boost/test/unit_test.hpp>
+
+#include "libed2k/peer_connection.hpp"
+#include "libed2k/constants.hpp"
+
+BOOST_AUTO_TEST_SUITE(test_peer_connection)
+
+BOOST_AUTO_TEST_CASE(test_desired_queue_size)
+{
+    // no measurements yet - one request packet
+    BOOST_CHECK_EQUAL(libed2k::desired_queue_size(0, 0, 3, 32), 3);
+    BOOST_CHECK_EQUAL(libed2k::desired_queue_size(100000, 0, 3, 32), 3);
+    BOOST_CHECK_EQUAL(libed2k::desired_queue_size(0, 150, 1, 32), 3);
+    BOOST_CHECK_EQUAL(libed2k::desired_queue_size(0, 150, 8, 32), 8);
+
+    // 50 Mbit/s and 150 ms: 937500 bytes in flight, 4 blocks plus request packet
+    BOOST_CHECK_EQUAL(libed2k::desired_queue_size(6250000, 150, 3, 32), 7);
+
+    // clamped by settings
+    BOOST_CHECK_EQUAL(libed2k::desired_queue_size(100*1024*1024, 1000, 3, 32), 32);
+    BOOST_CHECK_EQUAL(libed2k::desired_queue_size(6250000, 150, 3, 5), 5);
+}
+
+BOOST_AUTO_TEST_CASE(test_desired_queue_size_long_link)
+{
+    // window limited download over 150 ms link of 50 Mbit/s: the peer can't send
+    // more than requested blocks in a round trip
+    const int link = 6250000;
+    const int rtt = 150;
+    const int fixed_rate = std::min<int>(link, 3 * libed2k::BLOCK_SIZE * 1000 / rtt);
+
+    int queue = 3;
+    int rate = 0;
+
+    for (int i = 0; i < 10; ++i)
+    {
+        rate = std::min<int>(link, queue * libed2k::BLOCK_SIZE * 1000 / rtt);
+        queue = libed2k::desired_queue_size(rate, rtt, 3, 32);
+    }
+
+    BOOST_CHECK_EQUAL(rate, link);
+    BOOST_CHECK(rate > fixed_rate);
+
+    // pipeline is refilled by three blocks, the rest must cover round trip
+    BOOST_CHECK((queue - 3) * libed2k::BLOCK_SIZE >= libed2k::size_type(link) * rtt / 1000);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
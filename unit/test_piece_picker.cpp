@@ -0,0 +1,138 @@
+#ifndef WIN32
+#define BOOST_TEST_DYN_LINK
+#endif
+
+#ifdef STAND_ALONE
+#   define BOOST_TEST_MODULE Main
+#endif
+
+#include <boost/test/unit_test.hpp>
+
+#include "libed2k/piece_picker.hpp"
+#include "libed2k/transfer.hpp"
+#include "libed2k/time.hpp"
+
+namespace
+{
+    void* const peer_a = reinterpret_cast<void*>(1);
+    void* const peer_b = reinterpret_cast<void*>(2);
+
+    // three pieces of two blocks, the last one of one block
+    void init(libed2k::piece_picker& p)
+    {
+        p.init(2, 1, 3);
+        BOOST_REQUIRE_EQUAL(p.blocks_in_piece(0), 2);
+        BOOST_REQUIRE_EQUAL(p.blocks_in_piece(2), 1);
+    }
+}
+
+BOOST_AUTO_TEST_SUITE(test_piece_picker)
+
+BOOST_AUTO_TEST_CASE(test_all_requested)
+{
+    using libed2k::piece_block;
+    using libed2k::piece_picker;
+
+    piece_picker p;
+    init(p);
+    BOOST_CHECK(!p.all_requested());
+
+    p.mark_as_downloading(piece_block(0, 0), peer_a, piece_picker::fast);
+    p.mark_as_downloading(piece_block(0, 1), peer_a, piece_picker::fast);
+    p.mark_as_downloading(piece_block(1, 0), peer_a, piece_picker::fast);
+    BOOST_CHECK(!p.all_requested());
+
+    // the filtered piece isn't wanted
+    p.set_piece_priority(2, 0);
+    BOOST_CHECK(!p.all_requested());
+    p.mark_as_downloading(piece_block(1, 1), peer_b, piece_picker::slow);
+    BOOST_CHECK(p.all_requested());
+
+    // a piece we have needs nothing
+    p.set_piece_priority(2, 1);
+    BOOST_CHECK(!p.all_requested());
+    p.we_have(2);
+    BOOST_CHECK(p.all_requested());
+
+    // a request given up isn't counted
+    p.abort_download(piece_block(1, 1), peer_b);
+    BOOST_CHECK(!p.all_requested());
+}
+
+BOOST_AUTO_TEST_CASE(test_end_game_cancel)
+{
+    using libed2k::piece_block;
+    using libed2k::piece_picker;
+
+    piece_picker p;
+    init(p);
+    const piece_block b(1, 0);
+
+    // end-game requests the block from a second peer
+    BOOST_CHECK(p.mark_as_downloading(b, peer_a, piece_picker::slow));
+    BOOST_CHECK(p.mark_as_downloading(b, peer_b, piece_picker::fast));
+    BOOST_CHECK_EQUAL(p.num_peers(b), 2);
+    BOOST_CHECK(!p.is_downloaded(b));
+
+    // the faster one delivers, the other request is cancelled
+    BOOST_CHECK(p.mark_as_writing(b, peer_b));
+    BOOST_CHECK(p.is_downloaded(b));
+    p.abort_download(b, peer_a);
+    BOOST_CHECK(p.is_downloaded(b));
+    BOOST_CHECK(!p.mark_as_downloading(b, peer_a, piece_picker::slow));
+
+    // the late copy is of no use once the block is written
+    p.mark_as_finished(b, peer_b);
+    BOOST_CHECK(p.is_finished(b));
+    BOOST_CHECK(!p.is_piece_finished(1));
+    p.mark_as_downloading(piece_block(1, 1), peer_a, piece_picker::slow);
+    p.mark_as_writing(piece_block(1, 1), peer_a);
+    BOOST_CHECK(p.is_piece_finished(1));
+}
+
+BOOST_AUTO_TEST_CASE(test_time_critical_order)
+{
+    libed2k::time_critical_pieces tc;
+    libed2k::ptime now = libed2k::time_now_hires();
+    BOOST_CHECK(tc.empty());
+
+    tc.set(5, now + libed2k::seconds(3));
+    tc.set(1, now + libed2k::seconds(1));
+    tc.set(7, now + libed2k::seconds(2));
+    // same deadline goes after the ones set before
+    tc.set(9, now + libed2k::seconds(1));
+
+    BOOST_REQUIRE_EQUAL(tc.pieces().size(), 4u);
+    BOOST_CHECK_EQUAL(tc.pieces()[0].piece, 1);
+    BOOST_CHECK_EQUAL(tc.pieces()[1].piece, 9);
+    BOOST_CHECK_EQUAL(tc.pieces()[2].piece, 7);
+    BOOST_CHECK_EQUAL(tc.pieces()[3].piece, 5);
+
+    // a new deadline moves the piece, it isn't added twice
+    tc.set(5, now);
+    BOOST_REQUIRE_EQUAL(tc.pieces().size(), 4u);
+    BOOST_CHECK_EQUAL(tc.pieces()[0].piece, 5);
+    BOOST_CHECK(tc.pieces()[0].deadline == now);
+}
+
+BOOST_AUTO_TEST_CASE(test_time_critical_remove)
+{
+    libed2k::time_critical_pieces tc;
+    libed2k::ptime now = libed2k::time_now_hires();
+
+    tc.set(1, now + libed2k::seconds(1));
+    tc.set(2, now + libed2k::seconds(2));
+    tc.set(3, now + libed2k::seconds(3));
+
+    BOOST_CHECK(tc.remove(2));
+    BOOST_CHECK(!tc.remove(2));
+    BOOST_CHECK(!tc.remove(4));
+    BOOST_REQUIRE_EQUAL(tc.pieces().size(), 2u);
+    BOOST_CHECK_EQUAL(tc.pieces()[0].piece, 1);
+    BOOST_CHECK_EQUAL(tc.pieces()[1].piece, 3);
+
+    tc.clear();
+    BOOST_CHECK(tc.empty());
+}
+
+BOOST_AUTO_TEST_SUITE_END()
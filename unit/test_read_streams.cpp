@@ -0,0 +1,137 @@
+#ifndef WIN32
+#define BOOST_TEST_DYN_LINK
+#endif
+
+#ifdef STAND_ALONE
+#   define BOOST_TEST_MODULE Main
+#endif
+
+#include <boost/test/unit_test.hpp>
+
+#include "libed2k/read_streams.hpp"
+
+namespace
+{
+    const int block = 100;
+    const int blocks_in_piece = 20;
+    const int window = 4;
+
+    struct reader
+    {
+        reader(libed2k::read_streams& s, boost::uint32_t id, void const* storage)
+            : streams(s), key(id, storage), start(-1), end(-1), hint(false) {}
+
+        bool read(int piece, int blk)
+        {
+            return streams.update(key, piece, blk * block, block, block
+                , blocks_in_piece, window, start, end, hint);
+        }
+
+        libed2k::read_streams& streams;
+        libed2k::read_streams::key_type key;
+        int start;
+        int end;
+        bool hint;
+    };
+
+    char storage_a;
+    char storage_b;
+}
+
+BOOST_AUTO_TEST_SUITE(test_read_streams)
+
+BOOST_AUTO_TEST_CASE(test_forward_reads_prefetch)
+{
+    libed2k::read_streams s;
+    reader r(s, 1, &storage_a);
+
+    // a single read isn't a stream yet
+    BOOST_CHECK(!r.read(0, 0));
+    BOOST_CHECK(r.read(0, 1));
+    BOOST_CHECK_EQUAL(r.start, 2);
+    BOOST_CHECK_EQUAL(r.end, 6);
+    BOOST_CHECK(r.hint);
+
+    // the window is refilled when half of it is consumed
+    BOOST_CHECK(!r.read(0, 2));
+    BOOST_CHECK(r.read(0, 3));
+    BOOST_CHECK_EQUAL(r.start, 6);
+    BOOST_CHECK_EQUAL(r.end, 8);
+    BOOST_CHECK(!r.hint);
+
+    // never past the end of the piece
+    for (int b = 4; b < 17; ++b) r.read(0, b);
+    BOOST_CHECK_EQUAL(r.end, blocks_in_piece);
+    BOOST_CHECK(!r.read(0, 17));
+    BOOST_CHECK(!r.read(0, 18));
+    BOOST_CHECK(!r.read(0, 19));
+}
+
+BOOST_AUTO_TEST_CASE(test_random_reads_dont_prefetch)
+{
+    libed2k::read_streams s;
+    reader r(s, 1, &storage_a);
+
+    BOOST_CHECK(!r.read(0, 0));
+    BOOST_CHECK(!r.read(0, 10));
+    BOOST_CHECK(!r.read(1, 11));
+    BOOST_CHECK(!r.read(1, 3));
+
+    // another part starts a new stream and hints the OS again
+    BOOST_CHECK(r.read(1, 4));
+    BOOST_CHECK_EQUAL(r.start, 5);
+    BOOST_CHECK(r.hint);
+}
+
+BOOST_AUTO_TEST_CASE(test_streams_are_separate)
+{
+    libed2k::read_streams s;
+    reader a(s, 1, &storage_a);
+    reader b(s, 2, &storage_a);
+    reader c(s, 1, &storage_b);
+
+    // interleaved reads of different peers and files
+    BOOST_CHECK(!a.read(0, 0));
+    BOOST_CHECK(!b.read(0, 8));
+    BOOST_CHECK(!c.read(0, 5));
+    BOOST_CHECK(a.read(0, 1));
+    BOOST_CHECK(b.read(0, 9));
+    BOOST_CHECK(c.read(0, 6));
+    BOOST_CHECK_EQUAL(s.size(), 3u);
+
+    // a freed storage takes its streams along
+    s.forget(&storage_a);
+    BOOST_CHECK_EQUAL(s.size(), 1u);
+    BOOST_CHECK(!a.read(0, 2));
+    BOOST_CHECK(!c.read(0, 7));
+    BOOST_CHECK(c.read(0, 8));
+    BOOST_CHECK_EQUAL(c.start, 11);
+}
+
+BOOST_AUTO_TEST_CASE(test_least_recently_used_is_dropped)
+{
+    libed2k::read_streams s;
+    reader first(s, 1, &storage_a);
+    BOOST_CHECK(!first.read(0, 0));
+
+    for (boost::uint32_t id = 2; id <= libed2k::read_streams::max_streams; ++id)
+    {
+        reader r(s, id, &storage_a);
+        r.read(0, 0);
+    }
+    BOOST_CHECK_EQUAL(s.size(), size_t(libed2k::read_streams::max_streams));
+
+    // the first stream was used last, another one goes for the new stream
+    BOOST_CHECK(first.read(0, 1));
+    reader late(s, 1000, &storage_a);
+    late.read(0, 0);
+    BOOST_CHECK_EQUAL(s.size(), size_t(libed2k::read_streams::max_streams));
+    BOOST_CHECK(!first.read(0, 2));
+    BOOST_CHECK(first.read(0, 3));
+
+    // the oldest one forgot its position
+    reader second(s, 2, &storage_a);
+    BOOST_CHECK(!second.read(0, 1));
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,103 @@
+#ifndef WIN32
+#define BOOST_TEST_DYN_LINK
+#endif
+
+#ifdef STAND_ALONE
+#   define BOOST_TEST_MODULE Main
+#endif
+
+#include <boost/test/unit_test.hpp>
+
+#include "libed2k/search_aggregator.hpp"
+#include "libed2k/ctag.hpp"
+
+namespace
+{
+    template<typename Size>
+    void set_file(libed2k::tag_list<Size>& tags, const std::string& name, boost::uint32_t size,
+                  boost::uint32_t sources, boost::uint32_t complete)
+    {
+        tags.add_tag(libed2k::make_string_tag(name, libed2k::FT_FILENAME, true));
+        tags.add_tag(libed2k::make_typed_tag(size, libed2k::FT_FILESIZE, true));
+        tags.add_tag(libed2k::make_typed_tag(sources, libed2k::FT_SOURCES, true));
+        tags.add_tag(libed2k::make_typed_tag(complete, libed2k::FT_COMPLETE_SOURCES, true));
+    }
+
+    libed2k::shared_file_entry server_file(const libed2k::md4_hash& h, const std::string& name,
+                                           boost::uint32_t sources, boost::uint32_t complete)
+    {
+        libed2k::shared_file_entry e(h, 0, 0);
+        set_file(e.m_list, name, 1000, sources, complete);
+        return e;
+    }
+
+    libed2k::kad_info_entry kad_file(const libed2k::md4_hash& h, const std::string& name,
+                                     boost::uint32_t sources, boost::uint32_t complete)
+    {
+        libed2k::kad_info_entry e;
+        e.hash = h;
+        set_file(e.tags, name, 1000, sources, complete);
+        return e;
+    }
+}
+
+BOOST_AUTO_TEST_SUITE(test_search_aggregator)
+
+BOOST_AUTO_TEST_CASE(test_merge_server_and_kad)
+{
+    libed2k::md4_hash h1 = libed2k::md4_hash::fromString("000102030405060708090A0B0C0D0E0F");
+    libed2k::md4_hash h2 = libed2k::md4_hash::fromString("1F1E1D1C1B1A19181716151413121110");
+    libed2k::md4_hash target = libed2k::md4_hash::fromString("20202020202020202020202020202020");
+
+    libed2k::search_aggregator sa;
+    sa.start(true, target);
+    BOOST_CHECK(sa.server_active());
+    BOOST_CHECK(sa.kad_target(target));
+    BOOST_CHECK(!sa.kad_target(h1));
+
+    std::vector<libed2k::search_result_entry> changed;
+    libed2k::shared_files_list page;
+    page.m_collection.push_back(server_file(h1, "a.avi", 10, 2));
+    page.m_collection.push_back(server_file(h2, "b.avi", 1, 0));
+    sa.add_server_results(page, true, changed);
+    BOOST_CHECK_EQUAL(changed.size(), 2u);
+    BOOST_CHECK(sa.more());
+    BOOST_CHECK_EQUAL(changed[0].size, 1000);
+    BOOST_CHECK_EQUAL(changed[0].origins, libed2k::search_result_entry::server);
+
+    // kad adds its sources and votes for the name
+    std::deque<libed2k::kad_info_entry> kad;
+    kad.push_back(kad_file(h1, "A.avi", 3, 1));
+    kad.push_back(kad_file(h1, "A.avi", 5, 1));
+    changed.clear();
+    sa.add_kad_results(kad, changed);
+    BOOST_CHECK_EQUAL(sa.size(), 2u);
+    BOOST_REQUIRE(!changed.empty());
+    const libed2k::search_result_entry& r = changed.back();
+    BOOST_CHECK(r.hash == h1);
+    BOOST_CHECK_EQUAL(r.sources, 15);
+    BOOST_CHECK_EQUAL(r.complete_sources, 3);
+    BOOST_CHECK_EQUAL(r.name, "A.avi");
+    BOOST_CHECK_EQUAL(r.names, 2);
+    BOOST_CHECK_EQUAL(r.origins, libed2k::search_result_entry::server | libed2k::search_result_entry::kad);
+
+    // the same answer again changes nothing
+    changed.clear();
+    sa.add_kad_results(kad, changed);
+    BOOST_CHECK(changed.empty());
+
+    // the next page of the server replaces its numbers
+    page.m_collection.clear();
+    page.m_collection.push_back(server_file(h2, "b.avi", 4, 0));
+    sa.add_server_results(page, false, changed);
+    BOOST_REQUIRE_EQUAL(changed.size(), 1u);
+    BOOST_CHECK_EQUAL(changed[0].sources, 4);
+    BOOST_CHECK(!sa.more());
+
+    sa.stop();
+    BOOST_CHECK_EQUAL(sa.size(), 0u);
+    BOOST_CHECK(!sa.server_active());
+    BOOST_CHECK(!sa.kad_target(target));
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -9,11 +9,22 @@
 #include <sstream>
 #include <locale.h>
 #include <boost/test/unit_test.hpp>
+#include <boost/lexical_cast.hpp>
 
 #include "libed2k/constants.hpp"
 #include "libed2k/log.hpp"
 #include "libed2k/alert.hpp"
 #include "libed2k/session_impl.hpp"
+#include "libed2k/global_source_finder.hpp"
+#include "libed2k/lowid_callbacks.hpp"
+#include "libed2k/kademlia/kad_packet_struct.hpp"
+#include "libed2k/connection_queue.hpp"
+#include "libed2k/time.hpp"
+#include "libed2k/session.hpp"
+#include "libed2k/alert_types.hpp"
+#include "libed2k/transfer.hpp"
+#include "libed2k/policy.hpp"
+#include "libed2k/peer.hpp"
 
 namespace libed2k{
 
@@ -45,4 +56,320 @@ BOOST_AUTO_TEST_CASE(test_lowid_logic)
     BOOST_CHECK_EQUAL(ses.callbacked_lowid(101), libed2k::md4_hash::terminal);
 }
 
+BOOST_AUTO_TEST_CASE(test_lowid_callbacks)
+{
+    using namespace libed2k;
+    lowid_callbacks cb;
+    ptime now = time_now_hires();
+    std::vector<client_id_type> resend;
+    std::vector<md4_hash> files;
+
+    // the second transfer joins the callback on the way
+    BOOST_CHECK(cb.request(101, md4_hash::emule, now));
+    BOOST_CHECK(!cb.request(101, md4_hash::terminal, now + seconds(1)));
+    BOOST_CHECK(!cb.request(101, md4_hash::terminal, now + seconds(1)));
+    BOOST_CHECK(cb.request(102, md4_hash::emule, now));
+    BOOST_CHECK_EQUAL(cb.sent(), 2);
+    BOOST_CHECK_EQUAL(cb.coalesced(), 1);
+
+    udp::endpoint buddy;
+    md4_hash buddy_hash;
+    md4_hash file;
+    BOOST_CHECK(!cb.buddy(102, buddy, buddy_hash, file));
+    cb.set_buddy(102, udp::endpoint(ip::address::from_string("10.0.0.1"), 4672), md4_hash::libed2k);
+    BOOST_REQUIRE(cb.buddy(102, buddy, buddy_hash, file));
+    BOOST_CHECK_EQUAL(buddy.port(), 4672);
+    BOOST_CHECK_EQUAL(buddy_hash, md4_hash::libed2k);
+    BOOST_CHECK_EQUAL(file, md4_hash::emule);
+
+    BOOST_REQUIRE(cb.answered(101, now + milliseconds(300), files));
+    BOOST_REQUIRE_EQUAL(files.size(), 2u);
+    BOOST_CHECK_EQUAL(files[0], md4_hash::emule);
+    BOOST_CHECK_EQUAL(files[1], md4_hash::terminal);
+    BOOST_CHECK(!cb.answered(101, now, files));
+    BOOST_CHECK_EQUAL(cb.average_latency(), 300);
+
+    // sent once more, then given up
+    cb.tick(now + seconds(10), seconds(30), 2, resend);
+    BOOST_CHECK(resend.empty());
+    cb.tick(now + seconds(30), seconds(30), 2, resend);
+    BOOST_REQUIRE_EQUAL(resend.size(), 1u);
+    BOOST_CHECK_EQUAL(resend[0], 102u);
+    cb.tick(now + seconds(59), seconds(30), 2, resend);
+    BOOST_CHECK_EQUAL(cb.size(), 1u);
+    cb.tick(now + seconds(60), seconds(30), 2, resend);
+    BOOST_CHECK_EQUAL(cb.size(), 0u);
+    BOOST_CHECK_EQUAL(cb.sent(), 3);
+    BOOST_CHECK_EQUAL(cb.succeeded(), 1);
+    BOOST_CHECK_EQUAL(cb.timed_out(), 1);
+
+    // <buddy 16><file 16><port 2>, both ids in kad order
+    buddy_callback_request req;
+    req.m_hBuddy = md4_hash::fromString("101112131415161718191A1B1C1D1E1F");
+    req.m_hFile = md4_hash::fromString("000102030405060708090A0B0C0D0E0F");
+    req.m_nPort = 4662;
+    udp_message msg = make_udp_message(req);
+    BOOST_CHECK_EQUAL(msg.first.m_protocol, OP_EMULEPROT);
+    BOOST_CHECK_EQUAL(int(msg.first.m_type), 0x94);
+    BOOST_REQUIRE_EQUAL(msg.second.size(), 34u);
+    BOOST_CHECK_EQUAL(msg.second[0], '\x13');
+    BOOST_CHECK_EQUAL(msg.second[3], '\x10');
+    BOOST_CHECK_EQUAL(msg.second[4], '\x17');
+    BOOST_CHECK_EQUAL(msg.second[16], '\x03');
+    BOOST_CHECK_EQUAL(msg.second[19], '\x00');
+    BOOST_CHECK_EQUAL(msg.second[20], '\x07');
+    BOOST_CHECK_EQUAL(msg.second[32], char(4662 & 0xff));
+}
+
+BOOST_AUTO_TEST_CASE(test_global_source_finder)
+{
+    using namespace libed2k;
+    std::vector<tcp::endpoint> servers;
+    servers.push_back(tcp::endpoint(ip::address::from_string("10.0.0.1"), 4661));
+    servers.push_back(tcp::endpoint(ip::address::from_string("10.0.0.2"), 4661));
+    global_source_finder finder;
+    finder.set_servers(servers);
+    BOOST_CHECK_EQUAL(finder.size(), 2u);
+
+    std::vector<get_file_sources> files(2);
+    files[0].m_hFile = md4_hash::emule;
+    files[0].m_file_size.nQuadPart = 100;
+    files[1].m_hFile = md4_hash::terminal;
+    files[1].m_file_size.nQuadPart = 200;
+
+    ptime now = time_now_hires();
+    udp::endpoint skip;
+    udp::endpoint server;
+    global_get_file_sources query;
+    BOOST_CHECK(finder.ready(now));
+
+    // both servers get the most important file first and spend their budget
+    BOOST_REQUIRE(finder.next_query(now, files, 1, seconds(60), minutes(20), skip, server, query));
+    BOOST_CHECK_EQUAL(server, udp::endpoint(ip::address::from_string("10.0.0.1"), 4665));
+    BOOST_REQUIRE_EQUAL(query.m_files.size(), 1u);
+    BOOST_CHECK_EQUAL(query.m_files[0].m_hFile, md4_hash::emule);
+    BOOST_REQUIRE(finder.next_query(now, files, 1, seconds(60), minutes(20), skip, server, query));
+    BOOST_CHECK_EQUAL(server, udp::endpoint(ip::address::from_string("10.0.0.2"), 4665));
+    BOOST_CHECK(!finder.ready(now));
+    BOOST_CHECK(!finder.next_query(now, files, 1, seconds(60), minutes(20), skip, server, query));
+
+    // first server answered and is asked for not asked file yet
+    BOOST_CHECK(finder.on_answer(udp::endpoint(ip::address::from_string("10.0.0.1"), 4665)));
+    BOOST_CHECK(!finder.on_answer(udp::endpoint(ip::address::from_string("10.0.0.3"), 4665)));
+    now += seconds(61);
+    BOOST_REQUIRE(finder.next_query(now, files, 10, seconds(60), minutes(20), skip, server, query));
+    BOOST_CHECK_EQUAL(server, udp::endpoint(ip::address::from_string("10.0.0.1"), 4665));
+    BOOST_REQUIRE_EQUAL(query.m_files.size(), 1u);
+    BOOST_CHECK_EQUAL(query.m_files[0].m_hFile, md4_hash::terminal);
+
+    // silent second server waits twice longer after the next query
+    BOOST_REQUIRE(finder.next_query(now, files, 10, seconds(60), minutes(20), skip, server, query));
+    BOOST_CHECK_EQUAL(server, udp::endpoint(ip::address::from_string("10.0.0.2"), 4665));
+    now += seconds(61);
+    BOOST_CHECK(!finder.next_query(now, files, 10, seconds(60), minutes(20), skip, server, query));
+    BOOST_CHECK_EQUAL(finder.queries(), 4);
+    BOOST_CHECK_EQUAL(finder.answers(), 1);
+}
+
+BOOST_AUTO_TEST_CASE(test_parse_global_sources)
+{
+    using namespace libed2k;
+    const char packet[] = {
+        '\xE3', '\x9B',
+        '\x31', '\xD6', '\xCF', '\xE0', '\xD1', '\x6A', '\xE9', '\x31', '\xB7', '\x3C', '\x59', '\xD7', '\xE0', '\xC0', '\x89', '\xC0',
+        '\x01', '\x0A', '\x00', '\x00', '\x01', '\x36', '\x12',
+        '\xE3', '\x9B',
+        '\x31', '\xD6', '\xCF', '\xE0', '\xD1', '\x6A', '\xE9', '\x31', '\xB7', '\x3C', '\x59', '\xD7', '\xE0', '\xC0', '\x89', '\xC1',
+        '\x00'
+    };
+
+    std::vector<found_file_sources> res;
+    BOOST_REQUIRE(parse_global_sources(packet, sizeof(packet), res));
+    BOOST_REQUIRE_EQUAL(res.size(), 2u);
+    BOOST_CHECK_EQUAL(res[0].m_hFile, md4_hash::fromString("31D6CFE0D16AE931B73C59D7E0C089C0"));
+    BOOST_REQUIRE_EQUAL(res[0].m_sources.m_collection.size(), 1u);
+    BOOST_CHECK_EQUAL(res[0].m_sources.m_collection[0].m_nPort, 0x1236);
+    BOOST_CHECK(res[1].m_sources.m_collection.empty());
+
+    // truncated source list
+    BOOST_CHECK(!parse_global_sources(packet, 20, res));
+    BOOST_CHECK(res.empty());
+}
+
+BOOST_AUTO_TEST_CASE(test_adapt_connect_rate)
+{
+    using libed2k::adapt_connect_rate;
+
+    // ramp up from startup while peers answer
+    int rate = 10;
+    for (int i = 0; i < 5; ++i) rate = adapt_connect_rate(rate, 0, 0, 0, 8, 100);
+    BOOST_CHECK_EQUAL(rate, 73);
+    BOOST_CHECK_EQUAL(adapt_connect_rate(rate, 20, 10, 5, 8, 100), 100);
+
+    // full half-open queue and silent peers slow it down, not below minimum
+    BOOST_CHECK_EQUAL(adapt_connect_rate(40, 20, 0, 0, 0, 100), 30);
+    BOOST_CHECK_EQUAL(adapt_connect_rate(40, 2, 3, 10, 8, 100), 30);
+    BOOST_CHECK_EQUAL(adapt_connect_rate(2, 0, 0, 10, 8, 100), 2);
+
+    // refused connections
+    BOOST_CHECK_EQUAL(adapt_connect_rate(40, 2, 10, 3, 8, 100), 41);
+}
+
+BOOST_AUTO_TEST_CASE(test_add_transfers)
+{
+    using namespace libed2k;
+
+    std::vector<add_transfer_params> params;
+    for (int n = 0; n < 3; ++n)
+    {
+        add_transfer_params p;
+        p.file_hash = md4_hash::fromString("31D6CFE0D16AE931B73C59D7E0C089C0");
+        p.file_hash[0] = n;
+        p.file_path = "test_add_transfers" + boost::lexical_cast<std::string>(n);
+        p.file_size = 2 * PIECE_SIZE;
+        p.piece_hashses.resize(2, md4_hash::fromString("000102030405060708090A0B0C0D0E0F"));
+        p.duplicate_is_error = true;
+        params.push_back(p);
+    }
+    params.push_back(params[0]);
+
+    session_settings settings;
+    settings.listen_port = 4742;
+    // only the first one starts, the others wait for its resume data check
+    settings.max_deferred_resume_checks = 1;
+
+    session ses(fingerprint(), "127.0.0.1", settings);
+    ses.set_alert_mask(alert::status_notification);
+    ses.add_transfers(params);
+
+    std::auto_ptr<alert> a;
+    added_transfers_alert* added = 0;
+    ptime deadline = time_now() + seconds(5);
+    while (!added && time_now() < deadline)
+    {
+        if (!ses.wait_for_alert(milliseconds(100))) continue;
+        a = ses.pop_alert();
+        added = dynamic_cast<added_transfers_alert*>(a.get());
+    }
+
+    BOOST_REQUIRE(added);
+    BOOST_REQUIRE_EQUAL(added->m_handles.size(), 4u);
+    BOOST_REQUIRE_EQUAL(added->m_errors.size(), 4u);
+    BOOST_CHECK(!added->m_handles[3].is_valid());
+    BOOST_CHECK_EQUAL(added->m_errors[3].value(), int(errors::duplicate_transfer));
+    BOOST_CHECK_EQUAL(ses.get_transfers().size(), 3u);
+
+    // started or not, none of them has any piece yet
+    for (int n = 0; n < 3; ++n)
+    {
+        const transfer_handle& h = added->m_handles[n];
+        BOOST_CHECK(!added->m_errors[n]);
+        BOOST_REQUIRE(h.is_valid());
+        BOOST_CHECK(h.hash() == params[n].file_hash);
+        BOOST_CHECK(!h.is_seed());
+        BOOST_CHECK(!h.is_finished());
+        BOOST_CHECK_EQUAL(h.status().num_pieces, 0);
+
+        std::vector<int> avail;
+        h.piece_availability(avail);
+        h.set_piece_priority(1, 0);
+        h.set_piece_deadline(0, 1000);
+        BOOST_CHECK_EQUAL(h.piece_priorities().size(), 2u);
+    }
+}
+
+BOOST_AUTO_TEST_CASE(test_resume_data_peers)
+{
+    using namespace libed2k;
+
+    session_settings settings;
+    settings.listen_port = 4743;
+    settings.max_failcount = 3;
+    settings.resume_data_peers = 2;
+    aux::session_impl ses(fingerprint(), "127.0.0.1", settings);
+    ses.set_alert_mask(alert::storage_notification);
+
+    add_transfer_params p;
+    p.file_hash = md4_hash::fromString("31D6CFE0D16AE931B73C59D7E0C089C0");
+    p.file_path = "test_resume_data_peers";
+    p.file_size = 2 * PIECE_SIZE;
+    p.piece_hashses.resize(2, md4_hash::fromString("000102030405060708090A0B0C0D0E0F"));
+
+    const tcp::endpoint ep1(ip::address::from_string("10.0.0.1"), 4661);
+    const tcp::endpoint ep2(ip::address::from_string("10.0.0.2"), 4662);
+    const tcp::endpoint ep3(ip::address::from_string("10.0.0.3"), 4663);
+    const tcp::endpoint ep4(ip::address::from_string("10.0.0.4"), 4664);
+    transfer_handle h;
+
+    {
+        boost::mutex::scoped_lock l(ses.m_mutex);
+        error_code ec;
+        h = ses.add_transfer(p, ec);
+        BOOST_REQUIRE(!ec);
+        boost::shared_ptr<transfer> t = ses.find_transfer(p.file_hash).lock();
+        BOOST_REQUIRE(t);
+
+        policy& pol = t->get_policy();
+        peer* p1 = pol.add_peer(ep1, peer_info::dht | peer_info::incoming, 0);
+        peer* p2 = pol.add_peer(ep2, peer_info::tracker, 0);
+        peer* p3 = pol.add_peer(ep3, peer_info::pex, 0);
+        peer* p4 = pol.add_peer(ep4, peer_info::tracker, 0);
+        BOOST_REQUIRE(p1 && p2 && p3 && p4);
+        p1->last_transferred = 100;
+        pol.set_failcount(p1, 1);
+        p2->last_transferred = 300;
+        // the best of them, but it failed too often
+        p4->last_transferred = 500;
+        pol.set_failcount(p4, 3);
+    }
+
+    h.save_resume_data();
+
+    std::auto_ptr<alert> a;
+    save_resume_data_alert* saved = 0;
+    ptime deadline = time_now_hires() + seconds(5);
+    while (!saved && time_now_hires() < deadline)
+    {
+        if (!ses.wait_for_alert(milliseconds(100))) continue;
+        boost::mutex::scoped_lock l(ses.m_mutex);
+        a = ses.pop_alert();
+        saved = dynamic_cast<save_resume_data_alert*>(a.get());
+    }
+
+    BOOST_REQUIRE(saved);
+    entry const* peers = saved->resume_data->find_key("peers");
+    BOOST_REQUIRE(peers);
+    BOOST_REQUIRE_EQUAL(peers->type(), entry::string_t);
+    // capped to the two most recent ones
+    BOOST_CHECK_EQUAL(peers->string().size(), 2u * 12u);
+
+    // load them into another transfer
+    p.file_hash[0] = 1;
+    p.file_path = "test_resume_data_peers1";
+
+    boost::mutex::scoped_lock l(ses.m_mutex);
+    error_code ec;
+    ses.add_transfer(p, ec);
+    BOOST_REQUIRE(!ec);
+    boost::shared_ptr<transfer> t = ses.find_transfer(p.file_hash).lock();
+    BOOST_REQUIRE(t);
+
+    policy& pol = t->get_policy();
+    BOOST_CHECK_EQUAL(pol.load_peers(peers->string().c_str(), int(peers->string().size())), 2);
+    BOOST_REQUIRE_EQUAL(pol.num_peers(), 2u);
+
+    // kept in address order
+    const peer* r1 = *pol.begin_peer();
+    const peer* r2 = *(pol.begin_peer() + 1);
+    BOOST_CHECK(r1->endpoint == ep1);
+    BOOST_CHECK_EQUAL(r1->source, unsigned(peer_info::dht | peer_info::resume_data));
+    BOOST_CHECK_EQUAL(r1->failcount, 1u);
+    BOOST_CHECK_EQUAL(r1->last_transferred, 100u);
+    BOOST_CHECK(r1->transferred);
+    BOOST_CHECK(r2->endpoint == ep2);
+    BOOST_CHECK_EQUAL(r2->source, unsigned(peer_info::tracker | peer_info::resume_data));
+    BOOST_CHECK_EQUAL(r2->failcount, 0u);
+    BOOST_CHECK_EQUAL(r2->last_transferred, 300u);
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,133 @@
+#ifndef WIN32
+#define BOOST_TEST_DYN_LINK
+#endif
+
+#ifdef STAND_ALONE
+#   define BOOST_TEST_MODULE Main
+#endif
+
+#include <algorithm>
+#include <set>
+#include <vector>
+#include <boost/test/unit_test.hpp>
+#include <boost/bind.hpp>
+#include <boost/ref.hpp>
+#include <boost/thread/thread.hpp>
+#include <boost/thread/barrier.hpp>
+
+#include "libed2k/slab_allocator.hpp"
+#include "libed2k/constants.hpp"
+
+BOOST_AUTO_TEST_SUITE(test_slab_allocator)
+
+BOOST_AUTO_TEST_CASE(test_slab_allocator_blocks)
+{
+    libed2k::slab_allocator pool(libed2k::BLOCK_SIZE, 4, 2);
+    std::vector<char*> blocks;
+
+    for (int i = 0; i < 10; ++i)
+    {
+        char* b = pool.allocate();
+        BOOST_REQUIRE(b);
+        // blocks must be usable for unbuffered disk IO
+        BOOST_CHECK_EQUAL(reinterpret_cast<size_t>(b) % libed2k::page_size(), 0u);
+        BOOST_CHECK(pool.is_from(b));
+        b[0] = 1;
+        b[libed2k::BLOCK_SIZE - 1] = 1;
+        blocks.push_back(b);
+    }
+
+    BOOST_CHECK_EQUAL(std::set<char*>(blocks.begin(), blocks.end()).size(), blocks.size());
+    BOOST_CHECK(!pool.is_from(blocks[0] + 1));
+
+    libed2k::slab_allocator_stats st = pool.stats();
+    BOOST_CHECK_EQUAL(st.in_use, 10);
+    BOOST_CHECK_EQUAL(st.allocations, 10);
+    BOOST_CHECK_EQUAL(st.slabs, 3);
+    BOOST_CHECK_EQUAL(st.reserved_bytes, 12 * libed2k::BLOCK_SIZE);
+
+    for (std::vector<char*>::iterator i = blocks.begin(); i != blocks.end(); ++i)
+        pool.free(*i);
+
+    // freed blocks are reused and empty slabs go back to the system
+    char* b = pool.allocate();
+    BOOST_CHECK(std::find(blocks.begin(), blocks.end(), b) != blocks.end());
+    pool.free(b);
+    pool.release_memory();
+    st = pool.stats();
+    BOOST_CHECK_EQUAL(st.in_use, 0);
+    BOOST_CHECK_EQUAL(st.slabs, 0);
+    BOOST_CHECK_EQUAL(st.reserved_bytes, 0);
+}
+
+BOOST_AUTO_TEST_CASE(test_slab_allocator_cache)
+{
+    libed2k::slab_allocator pool(100, 64, 8);
+    BOOST_CHECK_EQUAL(pool.object_size(), 112);
+
+    char* b = pool.allocate();
+    pool.free(b);
+
+    // the same thread gets its last freed object back without locking
+    BOOST_CHECK_EQUAL(pool.allocate(), b);
+    libed2k::slab_allocator_stats st = pool.stats();
+    BOOST_CHECK_EQUAL(st.allocations, 2);
+    BOOST_CHECK_EQUAL(st.cache_hits, 1);
+    BOOST_CHECK_EQUAL(st.refills, 1);
+    BOOST_CHECK_EQUAL(st.in_use, 1);
+    pool.free(b);
+}
+
+namespace
+{
+    void allocate_and_exit(libed2k::slab_allocator& pool, std::vector<char*>& out)
+    {
+        for (int i = 0; i < 3; ++i) out.push_back(pool.allocate());
+        pool.free(out.back());
+        out.pop_back();
+    }
+
+    void wait_and_exit(libed2k::slab_allocator* pool, boost::barrier* b)
+    {
+        pool->free(pool->allocate());
+        b->wait();
+        // the allocator is destroyed here, the cache goes with the thread
+        b->wait();
+    }
+}
+
+BOOST_AUTO_TEST_CASE(test_slab_allocator_thread_exit)
+{
+    libed2k::slab_allocator pool(100, 64, 8);
+    std::vector<char*> blocks;
+    boost::thread t(boost::bind(&allocate_and_exit, boost::ref(pool), boost::ref(blocks)));
+    t.join();
+
+    // the counters of the exited thread are kept
+    libed2k::slab_allocator_stats st = pool.stats();
+    BOOST_CHECK_EQUAL(st.allocations, 3);
+    BOOST_CHECK_EQUAL(st.in_use, 2);
+    BOOST_CHECK_EQUAL(st.slabs, 1);
+
+    // and its cached objects don't keep the slab
+    for (std::vector<char*>::iterator i = blocks.begin(); i != blocks.end(); ++i)
+        pool.free(*i);
+    pool.release_memory();
+    st = pool.stats();
+    BOOST_CHECK_EQUAL(st.in_use, 0);
+    BOOST_CHECK_EQUAL(st.slabs, 0);
+}
+
+BOOST_AUTO_TEST_CASE(test_slab_allocator_outlived_by_thread)
+{
+    libed2k::slab_allocator* pool = new libed2k::slab_allocator(100, 64, 8);
+    boost::barrier b(2);
+    boost::thread t(boost::bind(&wait_and_exit, pool, &b));
+    b.wait();
+    BOOST_CHECK_EQUAL(pool->stats().allocations, 1);
+    delete pool;
+    b.wait();
+    t.join();
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,88 @@
+#ifndef WIN32
+#define BOOST_TEST_DYN_LINK
+#endif
+
+#ifdef STAND_ALONE
+#   define BOOST_TEST_MODULE Main
+#endif
+
+#include <boost/test/unit_test.hpp>
+#include <boost/shared_ptr.hpp>
+
+#include "libed2k/source_request.hpp"
+
+namespace
+{
+    struct test_transfer
+    {
+        test_transfer(float n) : needed(n) {}
+        float sources_needed() const { return needed; }
+        float needed;
+    };
+
+    typedef boost::shared_ptr<test_transfer> transfer_ptr;
+}
+
+BOOST_AUTO_TEST_SUITE(test_source_request)
+
+BOOST_AUTO_TEST_CASE(test_source_request_backoff)
+{
+    using libed2k::seconds;
+    libed2k::source_request r;
+    libed2k::ptime now = libed2k::time_now_hires();
+    BOOST_CHECK(r.due(now));
+
+    // sources found before the first request don't matter
+    r.found();
+    r.schedule(10, 8, now);
+    BOOST_CHECK_EQUAL(r.backoff(), 1);
+    BOOST_CHECK(!r.due(now + seconds(9)));
+    BOOST_CHECK(r.due(now + seconds(10)));
+
+    // empty answers double the reask time up to the limit
+    const int expected[] = { 2, 4, 8, 8 };
+    for (int n = 0; n < 4; ++n)
+    {
+        now = r.next();
+        r.schedule(10, 8, now);
+        BOOST_CHECK_EQUAL(r.backoff(), expected[n]);
+        BOOST_CHECK(r.next() == now + seconds(10 * expected[n]));
+    }
+
+    // any new source starts over
+    r.found();
+    now = r.next();
+    r.schedule(10, 8, now);
+    BOOST_CHECK_EQUAL(r.backoff(), 1);
+    BOOST_CHECK(r.next() == now + seconds(10));
+
+    // no backoff at all
+    r.schedule(10, 0, now);
+    BOOST_CHECK_EQUAL(r.backoff(), 1);
+}
+
+BOOST_AUTO_TEST_CASE(test_source_request_batch)
+{
+    std::vector<transfer_ptr> candidates;
+    const float needed[] = { 0.2f, 0.9f, 0.5f, 1.f, 0.1f };
+    for (int n = 0; n < 5; ++n)
+        candidates.push_back(transfer_ptr(new test_transfer(needed[n])));
+
+    // the most source-starving ones go first
+    BOOST_REQUIRE_EQUAL(libed2k::source_request_batch(candidates, 3), 3u);
+    BOOST_CHECK_EQUAL(candidates.size(), 5u);
+    BOOST_CHECK_EQUAL(candidates[0]->needed, 1.f);
+    BOOST_CHECK_EQUAL(candidates[1]->needed, 0.9f);
+    BOOST_CHECK_EQUAL(candidates[2]->needed, 0.5f);
+
+    // never more than there are, never none
+    BOOST_CHECK_EQUAL(libed2k::source_request_batch(candidates, 15), 5u);
+    BOOST_CHECK_EQUAL(candidates[4]->needed, 0.1f);
+    BOOST_CHECK_EQUAL(libed2k::source_request_batch(candidates, 0), 1u);
+    BOOST_CHECK_EQUAL(candidates[0]->needed, 1.f);
+
+    std::vector<transfer_ptr> none;
+    BOOST_CHECK_EQUAL(libed2k::source_request_batch(none, 3), 0u);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,149 @@
+#ifndef WIN32
+#define BOOST_TEST_DYN_LINK
+#endif
+
+#ifdef STAND_ALONE
+#   define BOOST_TEST_MODULE Main
+#endif
+
+#include <set>
+#include <vector>
+
+#include <boost/test/unit_test.hpp>
+#include <boost/bind.hpp>
+#include <boost/intrusive_ptr.hpp>
+#include <boost/shared_ptr.hpp>
+
+#include "libed2k/constants.hpp"
+#include "libed2k/disk_io_thread.hpp"
+#include "libed2k/file_pool.hpp"
+#include "libed2k/filesystem.hpp"
+#include "libed2k/hasher.hpp"
+#include "libed2k/io_service.hpp"
+#include "libed2k/lazy_entry.hpp"
+#include "libed2k/storage.hpp"
+#include "libed2k/transfer_info.hpp"
+
+namespace
+{
+    using namespace libed2k;
+
+    const std::string dir = "test_sparse_files";
+    const std::string name = "sparse.dat";
+
+    // four pieces: two holes, a piece of data and a short hole at the end
+    const int data_piece = 2;
+    const size_type sparse_size = 3 * PIECE_SIZE + 1000;
+
+    void noop() {}
+
+    struct checker
+    {
+        checker(): ret(piece_manager::need_full_check), done(false) {}
+
+        void on_resume_checked(int r, disk_io_job const&)
+        {
+            ret = r;
+            done = true;
+        }
+
+        void on_checked(int r, disk_io_job const& j)
+        {
+            ret = r;
+            if (r == piece_manager::need_full_check)
+            {
+                slots.insert(j.piece);
+                if (j.offset >= 0) have.insert(j.offset);
+            }
+            else done = true;
+        }
+
+        int ret;
+        bool done;
+        std::set<int> slots;
+        std::set<int> have;
+    };
+
+    bool create_sparse_file(std::vector<md4_hash>& hashes)
+    {
+        error_code ec;
+        create_directory(dir, ec);
+        file f(combine_path(dir, name), file::read_write | file::sparse, ec);
+        if (ec || !f.set_size(sparse_size, ec)) return false;
+
+        std::vector<char> data(PIECE_SIZE);
+        for (size_t i = 0; i < data.size(); ++i) data[i] = char(i * 7 + 1);
+        file::iovec_t b = { &data[0], data.size() };
+        if (f.writev(data_piece * PIECE_SIZE, &b, 1, ec) != PIECE_SIZE) return false;
+
+        // hole pieces get the hash of zeros, so hashing one reports it as present
+        std::vector<char> zeros(PIECE_SIZE);
+        hashes.push_back(hasher(&zeros[0], PIECE_SIZE).final());
+        hashes.push_back(hasher(&zeros[0], PIECE_SIZE).final());
+        hashes.push_back(hasher(&data[0], PIECE_SIZE).final());
+        hashes.push_back(hasher(&zeros[0], int(sparse_size - 3 * PIECE_SIZE)).final());
+        return true;
+    }
+}
+
+BOOST_AUTO_TEST_CASE(test_sparse_end_finds_data)
+{
+    std::vector<md4_hash> hashes;
+    BOOST_REQUIRE(create_sparse_file(hashes));
+
+    error_code ec;
+    file f(combine_path(dir, name), file::read_only, ec);
+    BOOST_REQUIRE(!ec);
+
+    // the filesystem doesn't report holes, nothing to skip
+    if (f.sparse_end(0) == 0)
+    {
+        BOOST_TEST_MESSAGE("holes are not reported by the filesystem");
+        remove_all(dir, ec);
+        return;
+    }
+
+    BOOST_CHECK_EQUAL(f.sparse_end(0), data_piece * PIECE_SIZE);
+    BOOST_CHECK_EQUAL(f.sparse_end(PIECE_SIZE + 10), data_piece * PIECE_SIZE);
+    BOOST_CHECK_EQUAL(f.sparse_end(data_piece * PIECE_SIZE + 10), data_piece * PIECE_SIZE + 10);
+    // no data after the piece, the rest of the file is a hole
+    BOOST_CHECK_EQUAL(f.sparse_end(3 * PIECE_SIZE), sparse_size);
+    f.close();
+
+    io_service ios;
+    file_pool fp;
+    disk_io_thread disk(ios, &noop, fp);
+    boost::intrusive_ptr<transfer_info> info(new transfer_info(md4_hash::invalid, name, sparse_size, hashes));
+    boost::intrusive_ptr<piece_manager> pm(new piece_manager(boost::shared_ptr<int>(new int(0)), info, dir, fp
+        , disk, default_storage_constructor, storage_mode_sparse, std::vector<boost::uint8_t>(1, 1)));
+
+    // storage slots map to the slot of the next data byte
+    storage_interface* st = pm->get_storage_impl();
+    BOOST_CHECK_EQUAL(st->sparse_end(0), data_piece);
+    BOOST_CHECK_EQUAL(st->sparse_end(1), data_piece);
+    BOOST_CHECK_EQUAL(st->sparse_end(data_piece), data_piece);
+    BOOST_CHECK_EQUAL(st->sparse_end(3), info->num_pieces());
+
+    // the check skips the hole pieces and finds the data piece
+    checker c;
+    lazy_entry resume;
+    pm->async_check_fastresume(&resume, boost::bind(&checker::on_resume_checked, &c, _1, _2));
+    while (!c.done) ios.run_one();
+    BOOST_REQUIRE_EQUAL(c.ret, int(piece_manager::need_full_check));
+
+    c.done = false;
+    pm->async_check_files(boost::bind(&checker::on_checked, &c, _1, _2));
+    while (!c.done) ios.run_one();
+
+    BOOST_CHECK_EQUAL(c.ret, 0);
+    BOOST_CHECK_EQUAL(c.have.size(), 1U);
+    BOOST_CHECK(c.have.count(data_piece));
+    // the progress jumps from slot 0 over the hole to the data
+    BOOST_CHECK(c.slots.count(data_piece));
+    BOOST_CHECK(!c.slots.count(1));
+
+    disk.abort();
+    disk.join();
+    pm.reset();
+    remove_all(dir, ec);
+}